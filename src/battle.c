@@ -42,7 +42,7 @@
 #define FORMATION_RADIUS_FREE 10
 
 const double formation_position_defend[2] = {12.5, 12.5};
-const double formation_position_attack[NEIGHBORS_LIMIT][2] = {{25.0, 12.5}, {21.5, 3.5}, {12.5, 0.0}, {3.5, 3.5}, {0.0, 12.5}, {3.5, 21.5}, {12.5, 25.0}, {21.5, 21.5}};
+const double formation_position_attack[DIRECTIONS_COUNT][2] = {{25.0, 12.5}, {21.5, 3.5}, {12.5, 0.0}, {3.5, 3.5}, {0.0, 12.5}, {3.5, 21.5}, {12.5, 25.0}, {21.5, 21.5}};
 const double formation_position_garrison[2] = {12.5, 0};
 const double formation_position_assault[ASSAULT_LIMIT][2] = {{12.5, 20.0}, {0.0, 7.5}, {25.0, 7.5}, {3.5, 16.5}, {21.5, 16.5}};
 
@@ -144,7 +144,7 @@ static void battlefield_init_open(const struct game *restrict game, struct battl
 {
 	unsigned players_count = 0;
 	signed char locations[PLAYERS_LIMIT]; // startup locations of the players participating in the battle
-	signed char players[NEIGHBORS_LIMIT + 1]; // players occupying the startup locations
+	int players[DIRECTIONS_COUNT + 1]; // players occupying the startup locations
 
 	size_t i, j;
 
@@ -154,7 +154,8 @@ static void battlefield_init_open(const struct game *restrict game, struct battl
 	size_t reachable_count;
 
 	memset(locations, -1, sizeof(locations));
-	memset(players, -1, sizeof(players));
+	for(i = 0; i < DIRECTIONS_COUNT + 1; ++i)
+		players[i] = -1;
 
 	for(i = 0; i < battle->pawns_count; ++i)
 	{
@@ -173,13 +174,12 @@ static void battlefield_init_open(const struct game *restrict game, struct battl
 			startup = NEIGHBOR_SELF;
 			goto found;
 		}
-		else for(j = 0; j < NEIGHBORS_LIMIT; ++j)
+		else
 		{
-			if (troop->location != battle->region->neighbors[j]) continue;
-			startup = j;
-			goto found;
+			int direction = region_neighbor_direction(game, battle->region, troop->location);
+			assert(direction >= 0);
+			startup = direction;
 		}
-		assert(0);
 
 found:
 		// If possible, set startup position for the pawn.
@@ -202,19 +202,19 @@ found:
 	{
 		size_t locations_index = 0;
 
-		if (players_count > NEIGHBORS_LIMIT + 1)
+		if (players_count > DIRECTIONS_COUNT + 1)
 		{
 			// TODO handle pawns when no place is available
 			LOG_ERROR("no place for all players on the battlefield");
 		}
 
 		// Make sure no two startup locations are designated to the same player.
-		for(i = 0; i < NEIGHBORS_LIMIT; ++i)
+		for(i = 0; i < DIRECTIONS_COUNT; ++i)
 			if ((players[i] >= 0) && (locations[players[i]] != i))
 				players[i] = -1;
 
 		// Make sure each player has a designated startup location.
-		for(i = 0; i < PLAYERS_LIMIT; ++i)
+		for(i = 0; i < game->players_count; ++i)
 			if (locations[i] < 0)
 			{
 				while (players[locations_index] >= 0)
@@ -256,7 +256,7 @@ static void battlefield_init_assault(const struct game *restrict game, struct ba
 	const struct garrison_info *restrict garrison = garrison_info(battle->region);
 
 	size_t players_count = 0;
-	signed char players[PLAYERS_LIMIT];
+	int players[PLAYERS_LIMIT];
 
 	size_t i, j;
 
@@ -296,7 +296,8 @@ static void battlefield_init_assault(const struct game *restrict game, struct ba
 
 #undef OBSTACLE
 
-	memset(players, -1, sizeof(players));
+	for(i = 0; i < game->players_count; ++i)
+		players[i] = -1;
 
 	// Place the pawns on the battlefield.
 	for(i = 0; i < battle->pawns_count; ++i)
@@ -365,8 +366,11 @@ int battlefield_init(const struct game *restrict game, struct battle *restrict b
 		}
 	}
 
+	battle->players = malloc(game->players_count * sizeof(*battle->players));
+	if (!battle->players) return ERROR_MEMORY;
+
 	// Count the troops participating in the battle and only those satisfying certain conditions.
-	for(i = 0; i < PLAYERS_LIMIT; ++i) battle->players[i].pawns_count = 0;
+	for(i = 0; i < game->players_count; ++i) battle->players[i].pawns_count = 0;
 	for(troop = region->troops; troop; troop = troop->_next)
 	{
 		if ((battle_type == BATTLE_OPEN) && (troop->location == LOCATION_GARRISON)) continue; // garrison troops don't participate in open battle
@@ -387,8 +391,12 @@ int battlefield_init(const struct game *restrict game, struct battle *restrict b
 
 	// Allocate memory for the pawns array and the player-specific pawns arrays.
 	pawns = malloc(troops_count * sizeof(*pawns));
-	if (!pawns) return ERROR_MEMORY;
-	for(i = 0; i < PLAYERS_LIMIT; ++i)
+	if (!pawns)
+	{
+		free(battle->players);
+		return ERROR_MEMORY;
+	}
+	for(i = 0; i < game->players_count; ++i)
 	{
 		if (!battle->players[i].pawns_count)
 		{
@@ -402,6 +410,7 @@ int battlefield_init(const struct game *restrict game, struct battle *restrict b
 		{
 			while (i--) free(battle->players[i].pawns);
 			free(pawns);
+			free(battle->players);
 			return ERROR_MEMORY;
 		}
 		battle->players[i].state = PLAYER_ALIVE;
@@ -514,7 +523,7 @@ static void retreat(struct battle *restrict battle, unsigned char player)
 int battle_end(const struct game *restrict game, struct battle *restrict battle)
 {
 	int end = 1;
-	signed char winner = -1;
+	int winner = -1;
 
 	for(size_t i = 0; i < game->players_count; ++i)
 	{
@@ -554,5 +563,6 @@ void battlefield_term(const struct game *restrict game, struct battle *restrict
 	}
 	for(i = 0; i < game->players_count; ++i)
 		free(battle->players[i].pawns);
+	free(battle->players);
 	free(battle->pawns);
 }
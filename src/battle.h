@@ -30,8 +30,8 @@
 
 #define PATH_QUEUE_LIMIT 8
 
-#define NEIGHBOR_SELF NEIGHBORS_LIMIT
-#define NEIGHBOR_GARRISON NEIGHBORS_LIMIT
+#define NEIGHBOR_SELF DIRECTIONS_COUNT
+#define NEIGHBOR_GARRISON DIRECTIONS_COUNT
 
 enum battle_type {BATTLE_NONE, BATTLE_ASSAULT, BATTLE_OPEN, BATTLE_OPEN_REINFORCED};
 
@@ -74,7 +74,7 @@ struct battlefield
 	//enum {BLOCKAGE_NONE, BLOCKAGE_TERRAIN, BLOCKAGE_WALL, BLOCKAGE_GATE, BLOCKAGE_TOWER} blockage;
 	unsigned char blockage_location;
 
-	signed char owner; // for BLOCKAGE_GATE and BLOCKAGE_TOWER
+	unsigned char owner; // for BLOCKAGE_GATE and BLOCKAGE_TOWER
 	unsigned strength; // for BLOCKAGE_WALL, BLOCKAGE_GATE and BLOCKAGE_TOWER // TODO rename to health or store hurt instead (like for pawns)
 	const struct unit *unit; // for BLOCKAGE_WALL, BLOCKAGE_GATE and BLOCKAGE_TOWER
 	struct pawn *pawn; // during formation and for BLOCKAGE_TOWER TODO don't use this for formation?
@@ -99,13 +99,13 @@ struct battle
 		size_t pawns_count;
 		struct pawn **pawns;
 		enum {PLAYER_DEAD, PLAYER_ALIVE, PLAYER_RETREAT} state;
-	} players[PLAYERS_LIMIT];
+	} *players; // one entry for each player in the game
 
 	unsigned round;
 };
 
 extern const double formation_position_defend[2];
-extern const double formation_position_attack[NEIGHBORS_LIMIT][2];
+extern const double formation_position_attack[DIRECTIONS_COUNT][2];
 extern const double formation_position_garrison[2];
 extern const double formation_position_assault[ASSAULT_LIMIT][2];
 
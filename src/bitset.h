@@ -0,0 +1,80 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Fixed-size sets of small non-negative integers, stored as arrays of 64-bit words.
+// The size is chosen at allocation time so the sets can be sized from the loaded world.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BITSET_WORD_BITS 64
+
+// Number of words necessary to store a set with the given number of elements.
+#define BITSET_WORDS(count) (((count) + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS)
+
+static inline uint64_t *bitset_alloc(size_t count)
+{
+	return calloc(BITSET_WORDS(count) + !count, sizeof(uint64_t));
+}
+
+static inline void bitset_zero(uint64_t *restrict set, size_t count)
+{
+	memset(set, 0, BITSET_WORDS(count) * sizeof(*set));
+}
+
+static inline void bitset_copy(uint64_t *restrict dest, const uint64_t *restrict src, size_t count)
+{
+	memcpy(dest, src, BITSET_WORDS(count) * sizeof(*dest));
+}
+
+static inline void bitset_set(uint64_t *restrict set, size_t index)
+{
+	set[index / BITSET_WORD_BITS] |= (uint64_t)1 << (index % BITSET_WORD_BITS);
+}
+
+static inline bool bitset_test(const uint64_t *restrict set, size_t index)
+{
+	return (set[index / BITSET_WORD_BITS] >> (index % BITSET_WORD_BITS)) & 1;
+}
+
+static inline void bitset_or(uint64_t *restrict dest, const uint64_t *restrict src, size_t count)
+{
+	for(size_t i = 0; i < BITSET_WORDS(count); ++i)
+		dest[i] |= src[i];
+}
+
+static inline bool bitset_equal(const uint64_t *a, const uint64_t *b, size_t count)
+{
+	return !memcmp(a, b, BITSET_WORDS(count) * sizeof(*a));
+}
+
+// Returns whether the set contains more than one element.
+static inline bool bitset_multiple(const uint64_t *restrict set, size_t count)
+{
+	bool found = false;
+	for(size_t i = 0; i < BITSET_WORDS(count); ++i)
+	{
+		if (!set[i]) continue;
+		if (found || (set[i] & (set[i] - 1))) return true;
+		found = true;
+	}
+	return false;
+}
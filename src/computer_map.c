@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -26,6 +27,7 @@
 #include <string.h>
 
 #include "errors.h"
+#include "bitset.h"
 #include "log.h"
 #include "game.h"
 #include "draw.h"
@@ -114,13 +116,18 @@ struct region_info
 	struct troop_info troops_needed;
 
 	bool nearby; // whether the player can reach the region in one turn
+
+	struct
+	{
+		bool build, train;
+	} shortage; // whether the resources for the orders in the region are already counted as missing
 };
 
 struct context
 {
 	double importance_expected;
 	unsigned count_expected;
-	unsigned char regions_visible[REGIONS_LIMIT];
+	uint64_t *regions_visible; // bitset of regions
 };
 
 struct survivors
@@ -129,40 +136,86 @@ struct survivors
 	double region_garrison;
 };
 
-static void distances_compute(const struct game *restrict game, unsigned char regions_distances[static restrict REGIONS_LIMIT][REGIONS_LIMIT])
+#define DISTANCES_NONE SIZE_MAX
+
+// Distances (in number of borders crossed) from the regions where the player has troops to each region.
+// 0 means that the target region is unreachable (or is the source region).
+struct distances
+{
+	size_t *rows; // row of data for each region or DISTANCES_NONE
+	unsigned char *data;
+};
+
+static inline unsigned distance(const struct game *restrict game, const struct distances *restrict distances, size_t source, size_t target)
 {
-	size_t i, j, k;
+	return distances->data[distances->rows[source] * game->regions_count + target];
+}
+
+static void distances_term(struct distances *restrict distances)
+{
+	free(distances->rows);
+	free(distances->data);
+}
+
+// Computes the distances from each region with troops using breadth-first search.
+static int distances_compute(const struct game *restrict game, const struct array_troops *restrict troops, struct distances *restrict distances)
+{
+	size_t *queue;
+	size_t rows_count = 0;
+	size_t i, j;
+
+	distances->rows = malloc(game->regions_count * sizeof(*distances->rows));
+	queue = malloc(game->regions_count * sizeof(*queue));
+	if (!distances->rows || !queue)
+		goto error;
 
-	// Set distances between neighbors.
 	for(i = 0; i < game->regions_count; ++i)
+		distances->rows[i] = DISTANCES_NONE;
+	for(i = 0; i < troops->count; ++i)
 	{
-		for(j = 0; j < NEIGHBORS_LIMIT; ++j)
-		{
-			const struct region *restrict neighbor = game->regions[i].neighbors[j];
-			if (!neighbor)
-				continue;
-			regions_distances[i][neighbor->index] = 1;
-		}
+		size_t source = troops->data[i].region->index;
+		if (distances->rows[source] == DISTANCES_NONE)
+			distances->rows[source] = rows_count++;
 	}
 
-	// Find shortest distance between any pair of regions.
+	distances->data = calloc(rows_count * game->regions_count, sizeof(*distances->data));
+	if (!distances->data && rows_count)
+		goto error;
+
 	for(i = 0; i < game->regions_count; ++i)
 	{
-		for(j = 0; j < game->regions_count; ++j)
+		unsigned char *restrict row;
+		size_t queue_begin = 0, queue_end = 0;
+
+		if (distances->rows[i] == DISTANCES_NONE)
+			continue;
+		row = distances->data + distances->rows[i] * game->regions_count;
+
+		queue[queue_end++] = i;
+		while (queue_begin < queue_end)
 		{
-			if (i == j)
-				continue;
-			for(k = 0; k < game->regions_count; ++k)
+			const struct region *restrict region = game->regions + queue[queue_begin++];
+			unsigned region_distance = row[region->index];
+
+			for(j = region_neighbors_begin(game, region); j < region_neighbors_end(game, region); ++j)
 			{
-				unsigned distance;
-				if ((i == k) || (j == k))
+				size_t neighbor = game->neighbors[j];
+				if ((neighbor == i) || row[neighbor])
 					continue;
-				distance = regions_distances[j][i] + regions_distances[i][k];
-				if (!regions_distances[j][k] || (regions_distances[j][k] > distance))
-					regions_distances[j][k] = distance;
+				row[neighbor] = ((region_distance < UCHAR_MAX) ? region_distance + 1 : UCHAR_MAX);
+				queue[queue_end++] = neighbor;
 			}
 		}
 	}
+
+	free(queue);
+	return 0;
+
+error:
+	free(queue);
+	free(distances->rows);
+	distances->rows = 0;
+	return ERROR_MEMORY;
 }
 
 // TODO remove this function
@@ -388,13 +441,8 @@ error:
 }
 
 // Executes orders from the heap greedily until order priority becomes too low.
-static void computer_map_orders_execute(struct heap_orders *restrict orders, const struct game *restrict game, unsigned char player, struct resources *restrict income, struct resources *restrict resources_shortage)
+static void computer_map_orders_execute(struct heap_orders *restrict orders, const struct game *restrict game, unsigned char player, struct region_info *restrict regions_info, struct resources *restrict income, struct resources *restrict resources_shortage)
 {
-	struct
-	{
-		bool build, train;
-	} shortages[REGIONS_LIMIT] = {false};
-
 	// Perform map orders until all actions are complete or until the priority becomes too low.
 	// Skip orders for which there are not enough resources.
 
@@ -412,19 +460,19 @@ static void computer_map_orders_execute(struct heap_orders *restrict orders, con
 				continue;
 			if (!resource_enough(&game->players[player].treasury, &BUILDINGS[order->target.building].cost))
 			{
-				if (!shortages[order->region->index].build)
+				if (!regions_info[order->region->index].shortage.build)
 				{
 					resource_add(resources_shortage, &BUILDINGS[order->target.building].cost);
-					shortages[order->region->index].build = true;
+					regions_info[order->region->index].shortage.build = true;
 				}
 				break;
 			}
 			if (resources_adverse(income, &BUILDINGS[order->target.building].support))
 			{
-				if (!shortages[order->region->index].build)
+				if (!regions_info[order->region->index].shortage.build)
 				{
 					resource_add(resources_shortage, &BUILDINGS[order->target.building].support);
-					shortages[order->region->index].build = true;
+					regions_info[order->region->index].shortage.build = true;
 				}
 				break;
 			}
@@ -440,19 +488,19 @@ static void computer_map_orders_execute(struct heap_orders *restrict orders, con
 				continue;
 			if (!resource_enough(&game->players[player].treasury, &UNITS[order->target.unit].cost))
 			{
-				if (!shortages[order->region->index].train)
+				if (!regions_info[order->region->index].shortage.train)
 				{
 					resource_add(resources_shortage, &UNITS[order->target.unit].cost);
-					shortages[order->region->index].train = true;
+					regions_info[order->region->index].shortage.train = true;
 				}
 				break;
 			}
 			if (resources_adverse(income, &UNITS[order->target.unit].support))
 			{
-				if (!shortages[order->region->index].train)
+				if (!regions_info[order->region->index].shortage.train)
 				{
 					resource_add(resources_shortage, &UNITS[order->target.unit].support);
-					shortages[order->region->index].train = true;
+					regions_info[order->region->index].shortage.train = true;
 				}
 				break;
 			}
@@ -466,7 +514,7 @@ static void computer_map_orders_execute(struct heap_orders *restrict orders, con
 	}
 }
 
-static unsigned map_state_neighbors(const struct game *restrict game, struct region *restrict region, const struct troop *restrict troop, struct region *restrict neighbors[static 1 + NEIGHBORS_LIMIT])
+static unsigned map_state_neighbors(const struct game *restrict game, struct region *restrict region, const struct troop *restrict troop, struct region **restrict neighbors)
 {
 	unsigned neighbors_count = 0;
 
@@ -489,14 +537,14 @@ static unsigned map_state_neighbors(const struct game *restrict game, struct reg
 
 	// A troop can go to a neighboring region only if the owner of the troop also owns the current region.
 	if (troop->owner == region->owner)
-		for(size_t i = 0; i < NEIGHBORS_LIMIT; ++i)
-			if (region->neighbors[i] && (troop->move != region->neighbors[i]))
-				neighbors[neighbors_count++] = region->neighbors[i];
+		for(size_t i = region_neighbors_begin(game, region); i < region_neighbors_end(game, region); ++i)
+			if (troop->move != region_neighbor(game, i))
+				neighbors[neighbors_count++] = region_neighbor(game, i);
 
 	return neighbors_count;
 }
 
-static void map_state_set(const struct game *restrict game, struct troop *restrict troop_moved, struct region *restrict move, struct region_info regions_info[static restrict REGIONS_LIMIT])
+static void map_state_set(const struct game *restrict game, struct troop *restrict troop_moved, struct region *restrict move, struct region_info *restrict regions_info)
 {
 	size_t i;
 
@@ -608,7 +656,7 @@ static double rating_region(const struct game *restrict game, const struct regio
 	return rating;
 }
 
-static double map_state_rating(const struct game *restrict game, const struct array_troops *restrict troops, unsigned char player, const struct region_info regions_info[static restrict REGIONS_LIMIT], const struct troop_info *restrict troops_info, const unsigned char regions_visible[static restrict REGIONS_LIMIT], unsigned char regions_distances[static restrict REGIONS_LIMIT][REGIONS_LIMIT])
+static double map_state_rating(const struct game *restrict game, const struct array_troops *restrict troops, unsigned char player, const struct region_info *restrict regions_info, const struct troop_info *restrict troops_info, const struct distances *restrict distances, struct survivors *restrict survivors)
 {
 	double rating = 0.0, rating_max = 0.0;
 
@@ -621,7 +669,7 @@ static double map_state_rating(const struct game *restrict game, const struct ar
 
 	// TODO there seems to be a problem with the income logic
 
-	struct survivors survivors[REGIONS_LIMIT] = {0};
+	memset(survivors, 0, game->regions_count * sizeof(*survivors));
 
 	struct resources income = {0};
 
@@ -712,7 +760,7 @@ s += 0.5 * troop_importance * ((troop->move == LOCATION_GARRISON) ? survivors[re
 					troops_needed_region = regions_info[j].troops_needed.fast;
 				}
 
-				rating += (regions_info[region->index].importance * troops_needed_region) / ((regions_distances[region->index][j] + 1) * troops_needed * 2.0); // TODO this 2.0 is completely arbitrary
+				rating += (regions_info[region->index].importance * troops_needed_region) / ((distance(game, distances, region->index, j) + 1) * troops_needed * 2.0); // TODO this 2.0 is completely arbitrary
 /*m += (regions_info[region->index].importance * troops_needed_region) / ((regions_distances[region->index][j] + 1) * troops_needed * 2.0);
 if (troops_needed_region)
 	printf("%10.*s %16.*s # %f\n", (int)region->name_length, region->name, (int)troop->unit->name_length, troop->unit->name, (regions_info[region->index].importance * troops_needed_region) / ((regions_distances[region->index][j] + 1) * troops_needed * 2.0));*/
@@ -745,7 +793,7 @@ static int troops_find(const struct game *restrict game, struct array_troops *re
 }
 
 // Choose suitable commands for player's troops using simulated annealing.
-static int computer_map_move(const struct game *restrict game, unsigned char player, const unsigned char regions_visible[static restrict REGIONS_LIMIT], struct region_info *restrict regions_info, const struct troop_info *restrict troops_info, unsigned char regions_distances[static restrict REGIONS_LIMIT][REGIONS_LIMIT])
+static int computer_map_move(const struct game *restrict game, unsigned char player, struct region_info *restrict regions_info, const struct troop_info *restrict troops_info)
 {
 	double rating, rating_new;
 	double temperature = 1.0;
@@ -755,12 +803,16 @@ static int computer_map_move(const struct game *restrict game, unsigned char pla
 
 	struct region *move_backup;
 
-	struct region *neighbors[1 + NEIGHBORS_LIMIT];
+	struct region **neighbors = 0;
+	size_t neighbors_limit = 0;
 	unsigned neighbors_count;
 
 	size_t i, j;
 	int status;
 
+	struct distances distances = {0};
+	struct survivors *survivors = 0;
+
 	// Find player troops.
 	struct array_troops troops = {0};
 	status = troops_find(game, &troops, player);
@@ -768,7 +820,31 @@ static int computer_map_move(const struct game *restrict game, unsigned char pla
 
 	if (!troops.count) goto finally; // nothing to do here if the player has no troops
 
-	rating = map_state_rating(game, &troops, player, regions_info, troops_info, regions_visible, regions_distances);
+	// The buffers used for rating are allocated once and reused at each step.
+	status = distances_compute(game, &troops, &distances);
+	if (status < 0) goto finally;
+	survivors = malloc(game->regions_count * sizeof(*survivors));
+	if (!survivors)
+	{
+		status = ERROR_MEMORY;
+		goto finally;
+	}
+
+	// A troop can stay, go to the garrison or go to a neighboring region except the one it is already going to.
+	for(i = 0; i < troops.count; ++i)
+	{
+		region = troops.data[i].region;
+		if (region_neighbors_end(game, region) - region_neighbors_begin(game, region) > neighbors_limit)
+			neighbors_limit = region_neighbors_end(game, region) - region_neighbors_begin(game, region);
+	}
+	neighbors = malloc((1 + neighbors_limit) * sizeof(*neighbors));
+	if (!neighbors)
+	{
+		status = ERROR_MEMORY;
+		goto finally;
+	}
+
+	rating = map_state_rating(game, &troops, player, regions_info, troops_info, &distances, survivors);
 	for(unsigned step = 0; step < ANNEALING_STEPS; ++step)
 	{
 		i = random() % troops.count;
@@ -784,7 +860,7 @@ static int computer_map_move(const struct game *restrict game, unsigned char pla
 
 		// Calculate the rating of the new set of commands.
 		// Revert the new command if it is unacceptably worse than the current one.
-		rating_new = map_state_rating(game, &troops, player, regions_info, troops_info, regions_visible, regions_distances);
+		rating_new = map_state_rating(game, &troops, player, regions_info, troops_info, &distances, survivors);
 		if (state_wanted(rating, rating_new, temperature)) rating = rating_new;
 		else map_state_set(game, troop, move_backup, regions_info);
 
@@ -806,7 +882,7 @@ static int computer_map_move(const struct game *restrict game, unsigned char pla
 
 			// Calculate the rating of the new set of commands.
 			// Revert the new command if it is worse than the current one.
-			rating_new = map_state_rating(game, &troops, player, regions_info, troops_info, regions_visible, regions_distances);
+			rating_new = map_state_rating(game, &troops, player, regions_info, troops_info, &distances, survivors);
 			if (rating_new > rating) rating = rating_new;
 			else map_state_set(game, troop, move_backup, regions_info);
 		}
@@ -815,6 +891,9 @@ static int computer_map_move(const struct game *restrict game, unsigned char pla
 	status = 0;
 
 finally:
+	free(neighbors);
+	free(survivors);
+	distances_term(&distances);
 	array_troops_term(&troops);
 	return status;
 }
@@ -834,6 +913,12 @@ static struct region_info *regions_info_collect(const struct game *restrict game
 
 	struct region_info *regions_info = malloc(game->regions_count * sizeof(struct region_info));
 	if (!regions_info) return 0;
+	context->regions_visible = bitset_alloc(game->regions_count);
+	if (!context->regions_visible)
+	{
+		free(regions_info);
+		return 0;
+	}
 
 	// Calculate expected unit importance (used when the unit is unknown).
 	context->count_expected = 0;
@@ -861,26 +946,24 @@ static struct region_info *regions_info_collect(const struct game *restrict game
 			regions_info[i].garrisons_enemy += 1;
 
 		// Count neighboring regions that may pose danger.
-		for(j = 0; j < NEIGHBORS_LIMIT; ++j)
+		for(j = region_neighbors_begin(game, region); j < region_neighbors_end(game, region); ++j)
 		{
-			const struct region *restrict neighbor = region->neighbors[j];
-			if (!neighbor)
-				continue;
+			const struct region *restrict neighbor = region_neighbor(game, j);
 
 			if (!allies(game, neighbor->garrison.owner, player))
 				regions_info[i].garrisons_enemy += 1;
 
 			// TODO what if the garrison is controlled by a different player
-			if (!context->regions_visible[region->neighbors[j]->index])
+			if (!bitset_test(context->regions_visible, neighbor->index))
 				regions_info[i].neighbors_unknown += 1;
 			else if (game->players[neighbor->owner].type == Neutral)
 				regions_info[i].neighbors_neutral += 1;
-			else if (!allies(game, region->neighbors[j]->owner, player))
+			else if (!allies(game, neighbor->owner, player))
 				regions_info[i].neighbors_enemy += 1;
 			regions_info[i].neighbors += 1;
 		}
 
-		if (context->regions_visible[i])
+		if (bitset_test(context->regions_visible, i))
 		{
 			// TODO count enemy troops by class
 
@@ -943,11 +1026,9 @@ static struct region_info *regions_info_collect(const struct game *restrict game
 		if (regions_info[i].strength.self || regions_info[i].strength_garrison.self || (region->owner == player))
 			regions_info[i].nearby = true;
 
-		for(j = 0; j < NEIGHBORS_LIMIT; ++j)
+		for(j = region_neighbors_begin(game, region); j < region_neighbors_end(game, region); ++j)
 		{
-			const struct region *restrict neighbor = region->neighbors[j];
-			if (!neighbor)
-				continue;
+			const struct region *restrict neighbor = region_neighbor(game, j);
 
 			if (regions_info[i].strength.self || (regions_info[i].strength_garrison.self && (region->owner == player)))
 				regions_info[neighbor->index].nearby = true;
@@ -1248,12 +1329,6 @@ int computer_map(const struct game *restrict game, unsigned char player)
 	struct array_orders orders;
 	int status;
 
-	unsigned char regions_distances[REGIONS_LIMIT][REGIONS_LIMIT] = {0}; // TODO currently 0 means unreachable; fix this
-	assert(REGIONS_LIMIT <= 256); // TODO this should be a static assert
-
-	// Compute the distance between each pair of regions with the Floyd-Warshall algorithm.
-	distances_compute(game, regions_distances);
-
 	// Collect information about each region.
 	income_calculate(game, &income, player);
 	regions_info = regions_info_collect(game, player, &context);
@@ -1270,7 +1345,7 @@ int computer_map(const struct game *restrict game, unsigned char player)
 	}
 
 	// Move player troops.
-	status = computer_map_move(game, player, context.regions_visible, regions_info, &troops_info, regions_distances); // TODO pass income as an argument
+	status = computer_map_move(game, player, regions_info, &troops_info); // TODO pass income as an argument
 
 	// TODO support cancelling constructions and trainings
 	status = computer_map_orders_list(&orders, game, player, &context, regions_info, &troops_info, &income);
@@ -1292,7 +1367,7 @@ int computer_map(const struct game *restrict game, unsigned char player)
 	heap_orders_heapify(&orders_queue);
 
 	// Choose greedily which orders to execute.
-	computer_map_orders_execute(&orders_queue, game, player, &income, &resources_shortage);
+	computer_map_orders_execute(&orders_queue, game, player, regions_info, &income, &resources_shortage);
 	resource_add(&resources_shortage, &game->players[player].treasury);
 
 	// Adjust resource production.
@@ -1302,6 +1377,7 @@ int computer_map(const struct game *restrict game, unsigned char player)
 	array_orders_term(&orders);
 
 finally:
+	free(context.regions_visible);
 	free(regions_info);
 	return status;
 }
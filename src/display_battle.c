@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #define GL_GLEXT_PROTOTYPES
@@ -56,20 +57,33 @@ void if_set(struct battle *b)
 	battle = b;
 }
 
-static void if_battlefield(unsigned char player, const struct game *game, const struct battle *restrict battle, const unsigned char open[BATTLEFIELD_HEIGHT][BATTLEFIELD_WIDTH])
+// Battlefield background and obstacles. They are stored in a vertex buffer and displayed from there until the obstacles change.
+static struct
+{
+	struct sprites_buffer sprites;
+	const struct image *obstacles[BATTLEFIELD_HEIGHT][BATTLEFIELD_WIDTH];
+	_Bool cached;
+} battlefield_cache;
+
+static void if_battlefield_obstacles(const struct image *obstacles[BATTLEFIELD_HEIGHT][BATTLEFIELD_WIDTH])
 {
 	size_t x, y;
 
 	// Display battlefield background.
 	display_image(&image_terrain[0], BATTLE_X - 8, BATTLE_Y - 8, BATTLEFIELD_WIDTH * FIELD_SIZE + 16, BATTLEFIELD_HEIGHT * FIELD_SIZE + 16);
 
-	// Draw rectangle with current player's color.
-	fill_rectangle(CTRL_X, CTRL_Y, 256, 16, display_colors[Player + player]);
+	// Display battlefield obstacles.
+	for(y = 0; y < BATTLEFIELD_HEIGHT; ++y)
+		for(x = 0; x < BATTLEFIELD_WIDTH; ++x)
+			if (obstacles[y][x])
+				image_draw(obstacles[y][x], BATTLE_X + x * object_group[Battlefield].width, BATTLE_Y + y * object_group[Battlefield].height);
+}
 
-	// Draw the control section in gray.
-	fill_rectangle(CTRL_X, CTRL_Y + CTRL_MARGIN, CTRL_WIDTH, CTRL_HEIGHT - CTRL_MARGIN, display_colors[Gray]);
+static void if_battlefield(unsigned char player, const struct game *game, const struct battle *restrict battle, const unsigned char open[BATTLEFIELD_HEIGHT][BATTLEFIELD_WIDTH])
+{
+	const struct image *obstacles[BATTLEFIELD_HEIGHT][BATTLEFIELD_WIDTH] = {0};
+	size_t x, y;
 
-	// Display battlefield obstacles.
 	for(y = 0; y < BATTLEFIELD_HEIGHT; ++y)
 		for(x = 0; x < BATTLEFIELD_WIDTH; ++x)
 		{
@@ -77,28 +91,48 @@ static void if_battlefield(unsigned char player, const struct game *game, const
 
 			if (field->blockage && !open[y][x]) // TODO change this when there is an image for open gate
 			{
-				const struct image *image;
-
 				// TODO use separate images for palisade and fortress
 				// TODO support BLOCKAGE_TERRAIN
-				if (field->blockage == BLOCKAGE_WALL) image = &image_palisade[field->blockage_location];
+				if (field->blockage == BLOCKAGE_WALL) obstacles[y][x] = &image_palisade[field->blockage_location];
 				else
 				{
 					assert(field->blockage == BLOCKAGE_GATE);
 
 					if (field->blockage_location == (POSITION_LEFT | POSITION_RIGHT))
-						image = &image_palisade_gate[0];
+						obstacles[y][x] = &image_palisade_gate[0];
 					else // field->blockage_location == (POSITION_TOP | POSITION_BOTTOM)
-						image = &image_palisade_gate[1];
+						obstacles[y][x] = &image_palisade_gate[1];
 				}
-
-				image_draw(image, BATTLE_X + x * object_group[Battlefield].width, BATTLE_Y + y * object_group[Battlefield].height);
 			}
 		}
 
+	// Store the battlefield in the vertex buffer again when an obstacle is destroyed or a gate is displayed differently.
+	if (!battlefield_cache.cached || memcmp(battlefield_cache.obstacles, obstacles, sizeof(obstacles)))
+	{
+		sprites_buffer_begin(&battlefield_cache.sprites);
+		if_battlefield_obstacles(obstacles);
+		battlefield_cache.cached = (sprites_buffer_end(&battlefield_cache.sprites) == 0);
+		memcpy(battlefield_cache.obstacles, obstacles, sizeof(obstacles));
+	}
+
+	if (battlefield_cache.cached) sprites_buffer_draw(&battlefield_cache.sprites);
+	else if_battlefield_obstacles(obstacles);
+
+	// Draw rectangle with current player's color.
+	fill_rectangle(CTRL_X, CTRL_Y, 256, 16, display_colors[color_player(player)]);
+
+	// Draw the control section in gray.
+	fill_rectangle(CTRL_X, CTRL_Y + CTRL_MARGIN, CTRL_WIDTH, CTRL_HEIGHT - CTRL_MARGIN, display_colors[Gray]);
+
 	// TODO towers
 }
 
+void if_battlefield_term(void)
+{
+	sprites_buffer_term(&battlefield_cache.sprites);
+	battlefield_cache.cached = 0;
+}
+
 void if_animation_move(const void *argument, const struct game *game, double progress)
 {
 	const struct state_animation *state = argument;
@@ -121,7 +155,7 @@ void if_animation_move(const void *argument, const struct game *game, double pro
 		x = state->movements[p][step].x * (1 - progress) + state->movements[p][step + 1].x * progress;
 		y = state->movements[p][step].y * (1 - progress) + state->movements[p][step + 1].y * progress;
 
-		display_troop(pawn->troop->unit->index, BATTLEFIELD_X(x), BATTLEFIELD_Y(y), Player + pawn->troop->owner, 0, 0);
+		display_troop(pawn->troop->unit->index, BATTLEFIELD_X(x), BATTLEFIELD_Y(y), color_player(pawn->troop->owner), 0, 0);
 	}
 }
 
@@ -138,7 +172,7 @@ void if_animation_shoot(const void *argument, const struct game *game, double pr
 	{
 		struct pawn *pawn = battle->pawns + p;
 		if (!pawn->count) continue;
-		display_troop(pawn->troop->unit->index, BATTLEFIELD_X(pawn->position.x), BATTLEFIELD_Y(pawn->position.y), Player + pawn->troop->owner, 0, 0);
+		display_troop(pawn->troop->unit->index, BATTLEFIELD_X(pawn->position.x), BATTLEFIELD_Y(pawn->position.y), color_player(pawn->troop->owner), 0, 0);
 	}
 
 	// arrows
@@ -208,7 +242,7 @@ static void if_formation_players(const struct game *restrict game, const struct
 			else position = formation_position_attack[pawn->startup];
 		}
 
-		fill_circle(BATTLE_X + position[0] * object_group[Battlefield].width, BATTLE_Y + position[1] * object_group[Battlefield].height, PLAYER_INDICATOR_RADIUS, Player + pawn->troop->owner);
+		fill_circle(BATTLE_X + position[0] * object_group[Battlefield].width, BATTLE_Y + position[1] * object_group[Battlefield].height, PLAYER_INDICATOR_RADIUS, color_player(pawn->troop->owner));
 	}
 }
 
@@ -241,12 +275,12 @@ void if_formation(const void *argument, const struct game *game)
 
 			// Display the selected pawn in the control section.
 			fill_rectangle(CTRL_X, CTRL_Y + CTRL_MARGIN, FIELD_SIZE + MARGIN * 2, FIELD_SIZE + font12.size + MARGIN * 2, display_colors[Self]);
-			display_troop(troop->unit->index, CTRL_X + MARGIN, CTRL_Y + CTRL_MARGIN + MARGIN, Player + troop->owner, Black, pawns[i]->count);
+			display_troop(troop->unit->index, CTRL_X + MARGIN, CTRL_Y + CTRL_MARGIN + MARGIN, color_player(troop->owner), Black, pawns[i]->count);
 		}
 		else
 		{
 			// Display the pawn at its present location.
-			display_troop(troop->unit->index, BATTLEFIELD_X(pawns[i]->position.x), BATTLEFIELD_Y(pawns[i]->position.y), Player + state->player, 0, 0);
+			display_troop(troop->unit->index, BATTLEFIELD_X(pawns[i]->position.x), BATTLEFIELD_Y(pawns[i]->position.y), color_player(state->player), 0, 0);
 		}
 	}
 
@@ -400,7 +434,7 @@ void if_battle(const void *argument, const struct game *game)
 		else if (allies(game, state->player, pawn->troop->owner)) color = Ally;
 		else color = Enemy;
 		fill_rectangle(CTRL_X, CTRL_Y + CTRL_MARGIN, FIELD_SIZE + MARGIN * 2, FIELD_SIZE + font12.size + MARGIN * 2, display_colors[color]);
-		display_troop(pawn->troop->unit->index, CTRL_X + MARGIN, CTRL_Y + CTRL_MARGIN + MARGIN, Player + pawn->troop->owner, Black, pawn->count);
+		display_troop(pawn->troop->unit->index, CTRL_X + MARGIN, CTRL_Y + CTRL_MARGIN + MARGIN, color_player(pawn->troop->owner), Black, pawn->count);
 
 		show_health(pawn, CTRL_X, CTRL_Y + CTRL_MARGIN + FIELD_SIZE + font12.size + MARGIN * 2 + MARGIN);
 
@@ -24,3 +24,4 @@ void if_animation_move(const void *argument, const struct game *game, double pro
 void if_animation_shoot(const void *argument, const struct game *game, double progress);
 
 void if_set(struct battle *b);
+void if_battlefield_term(void);
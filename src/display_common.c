@@ -17,11 +17,15 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define GL_GLEXT_PROTOTYPES
 #include <GL/glx.h>
 
+#include "errors.h"
 #include "format.h"
 #include "game.h"
 #include "draw.h"
@@ -36,6 +40,9 @@
 
 #define S(s) (s), sizeof(s) - 1
 
+#define ATLAS_SIZE 1024
+
+
 struct image image_flag, image_flag_small;
 struct image image_selected, image_panel, image_construction, image_movement, image_assault, image_dismiss;
 struct image image_pawn_guard, image_pawn_fight, image_pawn_assault, image_pawn_shoot;
@@ -51,114 +58,123 @@ struct image image_buildings_gray[13]; // TODO the array must be big enough to h
 struct image image_palisade[16], image_palisade_gate[2], image_fortress[16], image_fortress_gate[2];
 struct image image_economy;
 
-void if_load_images(void)
+static struct atlas images_atlas; // all images displayed by the interface
+
+static struct mesh regions_mesh; // triangulated locations of the regions of the loaded world
+
+// Images of the regions with the colors of each region.
+static struct regions_cache
+{
+	double scale;
+	unsigned char (*colors)[4];
+	struct mesh_layer texture;
+	_Bool cached; // whether the regions are rendered in the texture
+	_Bool changed; // whether the colors changed since the regions were rendered
+} regions_caches[REGIONS_LAYERS] = {
+	[RegionsMap] = {.scale = 1.0},
+	[RegionsMinimap] = {.scale = 0.25},
+};
+
+// Image files loaded by if_load_images(). Units and buildings have variants derived from the same file.
+static const struct image_source images_files[] = {
+	{&image_selected, PREFIX_IMG "selected.png"},
+	{&image_flag, PREFIX_IMG "flag.png"},
+	{&image_flag_small, PREFIX_IMG "flag_small.png"},
+	{&image_panel, PREFIX_IMG "panel.png"},
+	{&image_construction, PREFIX_IMG "construction.png"},
+	{&image_movement, PREFIX_IMG "movement.png"},
+	{&image_assault, PREFIX_IMG "assault.png"},
+	{&image_dismiss, PREFIX_IMG "dismiss.png"},
+	{&image_pawn_guard, PREFIX_IMG "pawn_guard.png"},
+	{&image_pawn_fight, PREFIX_IMG "pawn_fight.png"},
+	{&image_pawn_assault, PREFIX_IMG "pawn_assault.png"},
+	{&image_pawn_shoot, PREFIX_IMG "pawn_shoot.png"},
+	{&image_shoot_right, PREFIX_IMG "shoot_right.png"},
+	{&image_shoot_up, PREFIX_IMG "shoot_up.png"},
+	{&image_shoot_left, PREFIX_IMG "shoot_left.png"},
+	{&image_shoot_down, PREFIX_IMG "shoot_down.png"},
+	{&image_garrisons[PALISADE], PREFIX_IMG "garrison_palisade.png"},
+	{&image_garrisons[FORTRESS], PREFIX_IMG "garrison_fortress.png"},
+	{&image_map_village, PREFIX_IMG "map_village.png"},
+	{&image_map_garrison[PALISADE], PREFIX_IMG "map_palisade.png"},
+	{&image_map_garrison[FORTRESS], PREFIX_IMG "map_fortress.png"},
+	{&image_scroll_left, PREFIX_IMG "scroll_left.png"},
+	{&image_scroll_right, PREFIX_IMG "scroll_right.png"},
+	{&image_gold, PREFIX_IMG "gold.png"},
+	{&image_food, PREFIX_IMG "food.png"},
+	{&image_wood, PREFIX_IMG "wood.png"},
+	{&image_stone, PREFIX_IMG "stone.png"},
+	{&image_iron, PREFIX_IMG "iron.png"},
+	{&image_time, PREFIX_IMG "time.png"},
+	{&image_units[UnitPeasant], PREFIX_IMG "peasant.png", &image_units_mask[UnitPeasant], image_mask},
+	{&image_units[UnitMilitia], PREFIX_IMG "militia.png", &image_units_mask[UnitMilitia], image_mask},
+	{&image_units[UnitPikeman], PREFIX_IMG "pikeman.png", &image_units_mask[UnitPikeman], image_mask},
+	{&image_units[UnitArcher], PREFIX_IMG "archer.png", &image_units_mask[UnitArcher], image_mask},
+	{&image_units[UnitLongbow], PREFIX_IMG "longbow.png", &image_units_mask[UnitLongbow], image_mask},
+	{&image_units[UnitLightCavalry], PREFIX_IMG "light_cavalry.png", &image_units_mask[UnitLightCavalry], image_mask},
+	{&image_units[UnitBatteringRam], PREFIX_IMG "battering_ram.png", &image_units_mask[UnitBatteringRam], image_mask},
+	{&image_buildings[0], PREFIX_IMG "farm.png", &image_buildings_gray[0], image_grayscale},
+	{&image_buildings[1], PREFIX_IMG "irrigation.png", &image_buildings_gray[1], image_grayscale},
+	{&image_buildings[2], PREFIX_IMG "sawmill.png", &image_buildings_gray[2], image_grayscale},
+	{&image_buildings[3], PREFIX_IMG "mine.png", &image_buildings_gray[3], image_grayscale},
+	{&image_buildings[4], PREFIX_IMG "bloomery.png", &image_buildings_gray[4], image_grayscale},
+	{&image_buildings[5], PREFIX_IMG "barracks.png", &image_buildings_gray[5], image_grayscale},
+	{&image_buildings[6], PREFIX_IMG "archery_range.png", &image_buildings_gray[6], image_grayscale},
+	{&image_buildings[7], PREFIX_IMG "stables.png", &image_buildings_gray[7], image_grayscale},
+	{&image_buildings[8], PREFIX_IMG "watch_tower.png", &image_buildings_gray[8], image_grayscale},
+	{&image_buildings[9], PREFIX_IMG "palisade.png", &image_buildings_gray[9], image_grayscale},
+	{&image_buildings[10], PREFIX_IMG "fortress.png", &image_buildings_gray[10], image_grayscale},
+	{&image_buildings[11], PREFIX_IMG "workshop.png", &image_buildings_gray[11], image_grayscale},
+	{&image_buildings[12], PREFIX_IMG "forge.png", &image_buildings_gray[12], image_grayscale},
+	{&image_terrain[0], PREFIX_IMG "terrain_grass.png"},
+	{&image_palisade_gate[0], PREFIX_IMG "palisade_gate0.png"},
+	{&image_fortress_gate[0], PREFIX_IMG "fortress_gate0.png"},
+	{&image_palisade_gate[1], PREFIX_IMG "palisade_gate1.png"},
+	{&image_fortress_gate[1], PREFIX_IMG "fortress_gate1.png"},
+	{&image_economy, PREFIX_IMG "economy.png"},
+};
+
+// If cache is not NULL, it specifies a file for caching the decoded images.
+int if_load_images(const char *restrict cache)
 {
-	image_load_png(&image_selected, PREFIX_IMG "selected.png", 0);
-	image_load_png(&image_flag, PREFIX_IMG "flag.png", 0);
-	image_load_png(&image_flag_small, PREFIX_IMG "flag_small.png", 0);
-	image_load_png(&image_panel, PREFIX_IMG "panel.png", 0);
-	image_load_png(&image_construction, PREFIX_IMG "construction.png", 0);
-	image_load_png(&image_movement, PREFIX_IMG "movement.png", 0);
-	image_load_png(&image_assault, PREFIX_IMG "assault.png", 0);
-	image_load_png(&image_dismiss, PREFIX_IMG "dismiss.png", 0);
-
-	image_load_png(&image_pawn_guard, PREFIX_IMG "pawn_guard.png", 0);
-	image_load_png(&image_pawn_fight, PREFIX_IMG "pawn_fight.png", 0);
-	image_load_png(&image_pawn_assault, PREFIX_IMG "pawn_assault.png", 0);
-	image_load_png(&image_pawn_shoot, PREFIX_IMG "pawn_shoot.png", 0);
-
-	image_load_png(&image_shoot_right, PREFIX_IMG "shoot_right.png", 0);
-	image_load_png(&image_shoot_up, PREFIX_IMG "shoot_up.png", 0);
-	image_load_png(&image_shoot_left, PREFIX_IMG "shoot_left.png", 0);
-	image_load_png(&image_shoot_down, PREFIX_IMG "shoot_down.png", 0);
-
-	image_load_png(&image_garrisons[PALISADE], PREFIX_IMG "garrison_palisade.png", 0);
-	image_load_png(&image_garrisons[FORTRESS], PREFIX_IMG "garrison_fortress.png", 0);
-
-	image_load_png(&image_map_village, PREFIX_IMG "map_village.png", 0);
-	image_load_png(&image_map_garrison[PALISADE], PREFIX_IMG "map_palisade.png", 0);
-	image_load_png(&image_map_garrison[FORTRESS], PREFIX_IMG "map_fortress.png", 0);
-
-	image_load_png(&image_scroll_left, PREFIX_IMG "scroll_left.png", 0);
-	image_load_png(&image_scroll_right, PREFIX_IMG "scroll_right.png", 0);
-
-	image_load_png(&image_gold, PREFIX_IMG "gold.png", 0);
-	image_load_png(&image_food, PREFIX_IMG "food.png", 0);
-	image_load_png(&image_wood, PREFIX_IMG "wood.png", 0);
-	image_load_png(&image_stone, PREFIX_IMG "stone.png", 0);
-	image_load_png(&image_iron, PREFIX_IMG "iron.png", 0);
-	image_load_png(&image_time, PREFIX_IMG "time.png", 0);
-
-	image_load_png(&image_units[UnitPeasant], PREFIX_IMG "peasant.png", 0);
-	image_load_png(&image_units[UnitMilitia], PREFIX_IMG "militia.png", 0);
-	image_load_png(&image_units[UnitPikeman], PREFIX_IMG "pikeman.png", 0);
-	image_load_png(&image_units[UnitArcher], PREFIX_IMG "archer.png", 0);
-	image_load_png(&image_units[UnitLongbow], PREFIX_IMG "longbow.png", 0);
-	image_load_png(&image_units[UnitLightCavalry], PREFIX_IMG "light_cavalry.png", 0);
-	image_load_png(&image_units[UnitBatteringRam], PREFIX_IMG "battering_ram.png", 0);
-
-	image_load_png(&image_units_mask[UnitPeasant], PREFIX_IMG "peasant.png", image_mask);
-	image_load_png(&image_units_mask[UnitMilitia], PREFIX_IMG "militia.png", image_mask);
-	image_load_png(&image_units_mask[UnitPikeman], PREFIX_IMG "pikeman.png", image_mask);
-	image_load_png(&image_units_mask[UnitArcher], PREFIX_IMG "archer.png", image_mask);
-	image_load_png(&image_units_mask[UnitLongbow], PREFIX_IMG "longbow.png", image_mask);
-	image_load_png(&image_units_mask[UnitLightCavalry], PREFIX_IMG "light_cavalry.png", image_mask);
-	image_load_png(&image_units_mask[UnitBatteringRam], PREFIX_IMG "battering_ram.png", image_mask);
-
-	image_load_png(&image_buildings[0], PREFIX_IMG "farm.png", 0);
-	image_load_png(&image_buildings[1], PREFIX_IMG "irrigation.png", 0);
-	image_load_png(&image_buildings[2], PREFIX_IMG "sawmill.png", 0);
-	image_load_png(&image_buildings[3], PREFIX_IMG "mine.png", 0);
-	image_load_png(&image_buildings[4], PREFIX_IMG "bloomery.png", 0);
-	image_load_png(&image_buildings[5], PREFIX_IMG "barracks.png", 0);
-	image_load_png(&image_buildings[6], PREFIX_IMG "archery_range.png", 0);
-	image_load_png(&image_buildings[7], PREFIX_IMG "stables.png", 0);
-	image_load_png(&image_buildings[8], PREFIX_IMG "watch_tower.png", 0);
-	image_load_png(&image_buildings[9], PREFIX_IMG "palisade.png", 0);
-	image_load_png(&image_buildings[10], PREFIX_IMG "fortress.png", 0);
-	image_load_png(&image_buildings[11], PREFIX_IMG "workshop.png", 0);
-	image_load_png(&image_buildings[12], PREFIX_IMG "forge.png", 0);
-
-	image_load_png(&image_buildings_gray[0], PREFIX_IMG "farm.png", image_grayscale);
-	image_load_png(&image_buildings_gray[1], PREFIX_IMG "irrigation.png", image_grayscale);
-	image_load_png(&image_buildings_gray[2], PREFIX_IMG "sawmill.png", image_grayscale);
-	image_load_png(&image_buildings_gray[3], PREFIX_IMG "mine.png", image_grayscale);
-	image_load_png(&image_buildings_gray[4], PREFIX_IMG "bloomery.png", image_grayscale);
-	image_load_png(&image_buildings_gray[5], PREFIX_IMG "barracks.png", image_grayscale);
-	image_load_png(&image_buildings_gray[6], PREFIX_IMG "archery_range.png", image_grayscale);
-	image_load_png(&image_buildings_gray[7], PREFIX_IMG "stables.png", image_grayscale);
-	image_load_png(&image_buildings_gray[8], PREFIX_IMG "watch_tower.png", image_grayscale);
-	image_load_png(&image_buildings_gray[9], PREFIX_IMG "palisade.png", image_grayscale);
-	image_load_png(&image_buildings_gray[10], PREFIX_IMG "fortress.png", image_grayscale);
-	image_load_png(&image_buildings_gray[11], PREFIX_IMG "workshop.png", image_grayscale);
-	image_load_png(&image_buildings_gray[12], PREFIX_IMG "forge.png", image_grayscale);
-
-	image_load_png(&image_terrain[0], PREFIX_IMG "terrain_grass.png", 0);
-
-	// Load battlefield images.
-	size_t i;
-	for(i = 1; i < 16; ++i) // TODO fix this
+	// Battlefield images with numbered file names.
+	char filenames[2][16][64]; // TODO make sure this is enough
+
+	struct image_source sources[sizeof(images_files) / sizeof(*images_files) + 2 * 15];
+	size_t count = sizeof(images_files) / sizeof(*images_files);
+
+	int status;
+
+	status = atlas_init(&images_atlas, ATLAS_SIZE, ATLAS_SIZE);
+	if (status < 0) return status;
+
+	memcpy(sources, images_files, sizeof(images_files));
+	for(size_t i = 1; i < 16; ++i) // TODO fix this
 	{
-		char buffer[64], *end; // TODO make sure this is enough
+		char *end;
 
-		end = format_bytes(buffer, S(PREFIX_IMG "palisade"));
+		end = format_bytes(filenames[0][i], S(PREFIX_IMG "palisade"));
 		end = format_uint(end, i, 10);
 		end = format_bytes(end, S(".png"));
 		*end = 0;
-		image_load_png(&image_palisade[i], buffer, 0);
+		sources[count++] = (struct image_source){&image_palisade[i], filenames[0][i]};
 
-		end = format_bytes(buffer, S(PREFIX_IMG "fortress"));
+		end = format_bytes(filenames[1][i], S(PREFIX_IMG "fortress"));
 		end = format_uint(end, i, 10);
 		end = format_bytes(end, S(".png"));
 		*end = 0;
-		image_load_png(&image_fortress[i], buffer, 0);
+		sources[count++] = (struct image_source){&image_fortress[i], filenames[1][i]};
 	}
-	image_load_png(&image_palisade_gate[0], PREFIX_IMG "palisade_gate0.png", 0);
-	image_load_png(&image_fortress_gate[0], PREFIX_IMG "fortress_gate0.png", 0);
-	image_load_png(&image_palisade_gate[1], PREFIX_IMG "palisade_gate1.png", 0);
-	image_load_png(&image_fortress_gate[1], PREFIX_IMG "fortress_gate1.png", 0);
 
-	image_load_png(&image_economy, PREFIX_IMG "economy.png", 0);
+	images_load_atlas(&images_atlas, sources, count, cache);
+
+	atlas_upload(&images_atlas);
+	return 0;
+}
+
+void if_unload_images(void)
+{
+	atlas_term(&images_atlas);
 }
 
 void display_troop(size_t unit, unsigned x, unsigned y, enum color player, enum color text, unsigned count)
@@ -174,31 +190,112 @@ void display_troop(size_t unit, unsigned x, unsigned y, enum color player, enum
 	}
 }
 
-void display_minimap(const struct game *restrict game, unsigned x, unsigned y)
+// Triangulates the locations of the regions. Must be called after a world is loaded.
+int if_regions_init(const struct game *restrict game)
 {
-	size_t i;
+	const struct polygon **polygons;
+	int right = 0, bottom = 0;
+	int status;
 
-	// Fill each region with the color of its owner.
-	for(i = 0; i < game->regions_count; ++i)
+	polygons = malloc((game->regions_count ? game->regions_count : 1) * sizeof(*polygons));
+	if (!polygons) return ERROR_MEMORY;
+	for(size_t i = 0; i < game->regions_count; ++i)
+	{
+		polygons[i] = game->regions[i].location;
+		for(size_t j = 0; j < polygons[i]->vertices_count; ++j)
+		{
+			if (polygons[i]->points[j].x > right) right = polygons[i]->points[j].x;
+			if (polygons[i]->points[j].y > bottom) bottom = polygons[i]->points[j].y;
+		}
+	}
+
+	status = mesh_init(&regions_mesh, polygons, game->regions_count);
+	free(polygons);
+	if (status < 0) return status;
+
+	for(size_t i = 0; i < REGIONS_LAYERS; ++i)
 	{
-		const struct region *restrict region = game->regions + i;
-		fill_polygon(region->location, x, y, display_colors[Player + region->owner], 0.25);
+		struct regions_cache *restrict cache = regions_caches + i;
+
+		cache->colors = calloc(game->regions_count ? game->regions_count : 1, sizeof(*cache->colors));
+		if (!cache->colors)
+		{
+			if_regions_term();
+			return ERROR_MEMORY;
+		}
+
+		// Display the mesh directly if it can not be rendered in a texture.
+		// Leave space for the outlines at the right and bottom edge.
+		cache->cached = (mesh_layer_init(&cache->texture, ceil(right * cache->scale) + 2, ceil(bottom * cache->scale) + 2) == 0);
+		cache->changed = 1;
 	}
 
-	// Draw region borders.
-	for(i = 0; i < game->regions_count; ++i)
-		draw_polygon(game->regions[i].location, x, y, display_colors[Black], 0.25);
+	return 0;
+}
+
+void if_regions_term(void)
+{
+	for(size_t i = 0; i < REGIONS_LAYERS; ++i)
+	{
+		mesh_layer_term(&regions_caches[i].texture);
+		free(regions_caches[i].colors);
+		regions_caches[i].colors = 0;
+	}
+	mesh_term(&regions_mesh);
+}
+
+void if_regions_color(enum regions_layer layer, size_t region, const unsigned char color[static 4])
+{
+	unsigned char *restrict current = regions_caches[layer].colors[region];
+	if (memcmp(current, color, 4))
+	{
+		memcpy(current, color, 4);
+		regions_caches[layer].changed = 1;
+	}
+}
+
+// Displays the regions with the colors set by if_regions_color() and their borders.
+// The regions are rendered again only if their colors changed since they were last displayed.
+void if_regions_display(enum regions_layer layer, int x, int y)
+{
+	struct regions_cache *restrict cache = regions_caches + layer;
+
+	if (cache->changed || !cache->cached)
+	{
+		for(size_t i = 0; i < regions_mesh.polygons_count; ++i)
+			mesh_color(&regions_mesh, i, cache->colors[i]);
+		cache->changed = 0;
+
+		if (!cache->cached)
+		{
+			mesh_fill(&regions_mesh, x, y, cache->scale);
+			mesh_outline(&regions_mesh, x, y, display_colors[Black], cache->scale);
+			return;
+		}
+
+		mesh_layer_render(&cache->texture, &regions_mesh, cache->scale, display_colors[Black]);
+	}
+
+	mesh_layer_display(&cache->texture, x, y);
+}
+
+void display_minimap(const struct game *restrict game, unsigned x, unsigned y)
+{
+	// Fill each region with the color of its owner.
+	for(size_t i = 0; i < game->regions_count; ++i)
+		if_regions_color(RegionsMinimap, i, display_colors[color_player(game->regions[i].owner)]);
+	if_regions_display(RegionsMinimap, x, y);
 }
 
 void show_flag(unsigned x, unsigned y, unsigned player)
 {
-	fill_rectangle(x + 4, y + 4, 24, 12, display_colors[Player + player]);
+	fill_rectangle(x + 4, y + 4, 24, 12, display_colors[color_player(player)]);
 	image_draw(&image_flag, x, y);
 }
 
 void show_flag_small(unsigned x, unsigned y, unsigned player)
 {
-	fill_rectangle(x + 2, y + 2, 12, 6, display_colors[Player + player]);
+	fill_rectangle(x + 2, y + 2, 12, 6, display_colors[color_player(player)]);
 	image_draw(&image_flag_small, x, y);
 }
 
@@ -25,6 +25,7 @@
 #define PLAYERS_Y 32
 #define PLAYERS_INDICATOR_SIZE 32
 #define PLAYERS_PADDING 8
+#define PLAYERS_VISIBLE 16 /* players after that are not listed in the menu */
 
 #define WORLDS_X 32
 #define WORLDS_Y 56
@@ -33,6 +34,7 @@
 #define MAP_HEIGHT 768
 #define MAP_X 256
 #define MAP_Y 0
+#define MAP_SCROLL 64 /* distance by which the map is scrolled with the arrow keys */
 
 #define ECONOMY_X 226
 #define ECONOMY_Y 10
@@ -142,7 +144,7 @@ static const struct object_group
 } object_group[] = {
 	[Worlds] = OBJECT_GROUP(24, 1, WORLDS_X, WORLDS_Y, 240, 20, 0),
 	[WorldTabs] = OBJECT_GROUP(1, 3, TABS_X, TABS_Y, 80, 24, 0),
-	[Players] = OBJECT_GROUP(PLAYERS_LIMIT, 1, PLAYERS_X, PLAYERS_Y, 160, PLAYERS_INDICATOR_SIZE, PLAYERS_PADDING),
+	[Players] = OBJECT_GROUP(PLAYERS_VISIBLE, 1, PLAYERS_X, PLAYERS_Y, 160, PLAYERS_INDICATOR_SIZE, PLAYERS_PADDING),
 	[Building] = OBJECT_GROUP(3, 5, PANEL_X + 1, PANEL_Y + 400, 48, 48, 1),
 	[Train] = OBJECT_GROUP(1, 7, PANEL_X + 1, PANEL_Y + 340, 32, 32, 1),
 	[Dismiss] = OBJECT_GROUP(1, TRAIN_QUEUE, PANEL_X + 81, PANEL_Y + 300, 32, 32, 1),
@@ -173,9 +175,17 @@ static inline int if_index(enum object object, struct point position)
 	return (object_group[object].columns * (position.y / height_padded) + (position.x / width_padded));
 }
 
-void if_load_images(void);
+int if_load_images(const char *restrict cache);
+void if_unload_images(void);
 
 void display_troop(size_t unit, unsigned x, unsigned y, enum color player, enum color text, unsigned count);
+enum regions_layer {RegionsMap, RegionsMinimap, REGIONS_LAYERS};
+
+int if_regions_init(const struct game *restrict game);
+void if_regions_term(void);
+void if_regions_color(enum regions_layer layer, size_t region, const unsigned char color[static 4]);
+void if_regions_display(enum regions_layer layer, int x, int y);
+
 void display_minimap(const struct game *restrict game, unsigned x, unsigned y);
 
 void show_flag(unsigned x, unsigned y, unsigned player);
@@ -17,6 +17,7 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -24,6 +25,8 @@
 #include <GL/glx.h>
 #include <GL/glext.h>
 
+#include "bitset.h"
+#include "errors.h"
 #include "format.h"
 #include "game.h"
 #include "draw.h"
@@ -51,81 +54,77 @@
 #define TROOPS_BAR_WIDTH 4
 #define TROOPS_BAR_HEIGHT 48
 
-// TODO compatibility with OpenGL 2.1 (necessary in MacOS X)
-#define glGenFramebuffers(...) glGenFramebuffersEXT(__VA_ARGS__)
-#define glGenRenderbuffers(...) glGenRenderbuffersEXT(__VA_ARGS__)
-#define glBindFramebuffer(...) glBindFramebufferEXT(__VA_ARGS__)
-#define glBindRenderbuffer(...) glBindRenderbufferEXT(__VA_ARGS__)
-#define glRenderbufferStorage(...) glRenderbufferStorageEXT(__VA_ARGS__)
-#define glFramebufferRenderbuffer(...) glFramebufferRenderbufferEXT(__VA_ARGS__)
-
 #define ARROW_LENGTH 50
 
-static GLuint map_framebuffer;
-
-static GLuint map_renderbuffer;
-
 static uint8_t *format_sint(uint8_t *buffer, int64_t number)
 {
 	if (number > 0) *buffer++ = '+';
 	return format_int(buffer, number, 10);
 }
 
-void if_storage_init(const struct game *game, int width, int height)
-{
-	size_t i;
-
-	unsigned regions_count = game->regions_count;
-	// assert(game->regions_count < 65536);
-
-	glGenRenderbuffers(1, &map_renderbuffer);
-	glGenFramebuffers(1, &map_framebuffer);
+// The map displays the part of the world with size width x height, starting from a position called camera.
+static const struct game *storage_game;
+static struct regions_grid storage_grid;
+static unsigned storage_width, storage_height;
+static uint32_t *storage_visible; // regions intersecting the displayed part of the world
 
-	glBindRenderbuffer(GL_RENDERBUFFER, map_renderbuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, map_framebuffer);
-
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, width, height);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, map_renderbuffer);
-
-	glViewport(0, 0, width, height);
-
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0, width, 0, height, 0, 1);
+// Initializes region input recognition and visibility queries.
+int if_storage_init(const struct game *game, int width, int height)
+{
+	int status;
 
-	// TODO why is this necessary
-	//glBindRenderbuffer(GL_RENDERBUFFER, 0);
-	//glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	//glBindFramebuffer(GL_FRAMEBUFFER, map_framebuffer);
+	storage_game = game;
+	storage_width = width;
+	storage_height = height;
 
-	glClear(GL_COLOR_BUFFER_BIT);
+	storage_visible = malloc((game->regions_count ? game->regions_count : 1) * sizeof(*storage_visible));
+	if (!storage_visible) return ERROR_MEMORY;
 
-	for(i = 0; i < regions_count; ++i)
+	status = regions_grid_init(&storage_grid, game);
+	if (status < 0)
 	{
-		unsigned char color[4] = {255, i / 256, i % 256, 255};
-		fill_polygon(game->regions[i].location, 0, 0, color, 1.0);
+		free(storage_visible);
+		storage_visible = 0;
 	}
-
-	glFlush();
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return status;
 }
 
-int if_storage_get(unsigned x, unsigned y)
+// Returns the index of the region displayed at (x, y) or -1 if there is no such region.
+int if_storage_get(struct point camera, unsigned x, unsigned y)
 {
-	GLubyte pixel[3];
+	if ((x >= storage_width) || (y >= storage_height)) return -1;
+	return regions_grid_find(&storage_grid, storage_game, camera.x + (int)x, camera.y + (int)y);
+}
 
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, map_framebuffer);
-	glReadPixels(x, y, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, pixel);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+// Moves the camera to (x, y) without letting it go further than necessary to display the whole world.
+void if_storage_view(struct point *restrict camera, int x, int y)
+{
+	// Keep the original position of worlds that fit on the map.
+	int left = ((storage_grid.world.left < 0) ? storage_grid.world.left : 0);
+	int top = ((storage_grid.world.top < 0) ? storage_grid.world.top : 0);
+	int right = storage_grid.world.right + 1 - (int)storage_width;
+	int bottom = storage_grid.world.bottom + 1 - (int)storage_height;
+
+	if (x > right) x = right;
+	if (x < left) x = left;
+	if (y > bottom) y = bottom;
+	if (y < top) y = top;
+
+	*camera = (struct point){x, y};
+}
 
-	if (!pixel[0]) return -1;
-	return pixel[1] * 256 + pixel[2];
+// Finds which regions intersect the part of the world displayed on the map. Returns the number of regions in storage_visible.
+static size_t storage_query(struct point camera)
+{
+	struct bounds view = {camera.x, camera.x + (int)storage_width - 1, camera.y, camera.y + (int)storage_height - 1};
+	return regions_grid_query(&storage_grid, view, storage_visible);
 }
 
 void if_storage_term(void)
 {
-	glDeleteRenderbuffers(1, &map_renderbuffer);
-	glDeleteFramebuffers(1, &map_framebuffer);
+	regions_grid_term(&storage_grid);
+	free(storage_visible);
+	storage_visible = 0;
 }
 
 static void show_progress(unsigned current, unsigned total, unsigned x, unsigned y, unsigned width, unsigned height)
@@ -137,6 +136,7 @@ static void show_progress(unsigned current, unsigned total, unsigned x, unsigned
 		double progress = (double)current / total;
 		double angle = progress * 2 * M_PI;
 
+		sprites_flush();
 		glColor4ubv(display_colors[Progress]);
 
 		glBegin(GL_POLYGON);
@@ -317,7 +317,7 @@ static void if_map_troops(unsigned x, unsigned y, unsigned count_self, unsigned
 	}
 }
 
-static void display_troop_destination(struct point p0, struct point p1)
+static void display_troop_destination(struct point p0, struct point p1, struct point camera)
 {
 	// Take the points p0 and p1 as endpoints of the diagonal of the square and find the endpoints of the other diagonal.
 	// http://stackoverflow.com/questions/27829304/calculate-bisector-segment-coordinates
@@ -335,7 +335,9 @@ static void display_troop_destination(struct point p0, struct point p1)
 	struct point from = {xm + dx, ym - dy};
 	struct point to = {xm - dx, ym + dy};
 
-	display_arrow(from, to, MAP_X, MAP_Y, Self); // TODO change color
+	display_clip(MAP_X, MAP_Y, MAP_WIDTH, MAP_HEIGHT);
+	display_arrow(from, to, MAP_X - camera.x, MAP_Y - camera.y, Self); // TODO change color
+	display_clip_reset();
 }
 
 static void display_economy_resource(struct point position, unsigned workers, unsigned workers_unused, const struct image *restrict image, int resource)
@@ -441,7 +443,7 @@ static void if_map_region(const struct region *region, const struct state_map *s
 							struct point p0, p1;
 							if (polygons_border(region->location, troop->move->location, &p0, &p1)) // TODO this is slow; don't do it every time
 							{
-								display_troop_destination(p0, p1);
+								display_troop_destination(p0, p1, state->camera);
 							}
 							else
 							{
@@ -483,7 +485,7 @@ static void if_map_region(const struct region *region, const struct state_map *s
 				{
 					struct point position = if_position(object, x - offset);
 					fill_rectangle(position.x, position.y, object_group[object].width, object_group[object].height, display_colors[Black]);
-					display_troop(troop->unit->index, position.x, position.y, Player + troop->owner, color_text, troop->count);
+					display_troop(troop->unit->index, position.x, position.y, color_player(troop->owner), color_text, troop->count);
 					if (image_action) image_draw(image_action, position.x, position.y); // draw action indicator for the troop
 					if (troop == state->troop) draw_rectangle(position.x - 1, position.y - 1, object_group[object].width + 2, object_group[object].height + 2, display_colors[White]);
 				}
@@ -513,7 +515,7 @@ static void if_map_region(const struct region *region, const struct state_map *s
 
 						struct point position = if_position(TroopGarrison, i);
 						fill_rectangle(position.x, position.y, object_group[TroopGarrison].width, object_group[TroopGarrison].height, display_colors[Black]);
-						display_troop(troop->unit->index, position.x, position.y, Player + troop->owner, Black, troop->count);
+						display_troop(troop->unit->index, position.x, position.y, color_player(troop->owner), Black, troop->count);
 						if (troop == state->troop) draw_rectangle(position.x - 1, position.y - 1, object_group[TroopGarrison].width + 2, object_group[TroopGarrison].height + 2, display_colors[White]);
 
 						i += 1;
@@ -648,13 +650,17 @@ void if_map(const void *argument, const struct game *game)
 {
 	const struct state_map *state = argument;
 
-	size_t i;
+	size_t i, j;
+
+	// Position of the world origin on the screen.
+	int map_x = MAP_X - state->camera.x, map_y = MAP_Y - state->camera.y;
+	size_t visible_count;
 
 	// Display current player's color.
 	// TODO use darker color in the center
-	draw_rectangle(PANEL_X - 4, PANEL_Y - 4, PANEL_WIDTH + 8, PANEL_HEIGHT + 8, display_colors[Player + state->player]);
-	draw_rectangle(PANEL_X - 3, PANEL_Y - 3, PANEL_WIDTH + 6, PANEL_HEIGHT + 6, display_colors[Player + state->player]);
-	draw_rectangle(PANEL_X - 2, PANEL_Y - 2, PANEL_WIDTH + 4, PANEL_HEIGHT + 4, display_colors[Player + state->player]);
+	draw_rectangle(PANEL_X - 4, PANEL_Y - 4, PANEL_WIDTH + 8, PANEL_HEIGHT + 8, display_colors[color_player(state->player)]);
+	draw_rectangle(PANEL_X - 3, PANEL_Y - 3, PANEL_WIDTH + 6, PANEL_HEIGHT + 6, display_colors[color_player(state->player)]);
+	draw_rectangle(PANEL_X - 2, PANEL_Y - 2, PANEL_WIDTH + 4, PANEL_HEIGHT + 4, display_colors[color_player(state->player)]);
 
 	// Display panel background pattern.
 	display_image(&image_panel, PANEL_X, PANEL_Y, PANEL_WIDTH, PANEL_HEIGHT);
@@ -670,31 +676,26 @@ void if_map(const void *argument, const struct game *game)
 
 	// Map
 
-	struct resources income = {0};
 	const struct troop *troop;
 
-	// TODO place income logic at a single place (now it's here and in main.c)
-
+	// Fill each region with the color of its owner (or the color indicating unexplored).
 	for(i = 0; i < game->regions_count; ++i)
 	{
-		const struct region *restrict region = game->regions + i;
-
-		// Fill each region with the color of its owner (or the color indicating unexplored).
-		enum color color = (state->regions_visible[i] ? (Player + region->owner) : Unexplored);
-		fill_polygon(region->location, MAP_X, MAP_Y, display_colors[color], 1.0);
-
-		// Remember income and expenses.
-		if (region->owner == state->player) region_production(region, &income);
-		region_income(region, state->player, &income);
+		enum color color = (bitset_test(state->regions_visible, i) ? color_player(game->regions[i].owner) : Unexplored);
+		if_regions_color(RegionsMap, i, display_colors[color]);
 	}
 
-	// Draw region borders.
-	for(i = 0; i < game->regions_count; ++i)
-		draw_polygon(game->regions[i].location, MAP_X, MAP_Y, display_colors[Black], 1.0);
+	display_clip(MAP_X, MAP_Y, MAP_WIDTH, MAP_HEIGHT);
 
-	for(i = 0; i < game->regions_count; ++i)
+	// Draw the regions and their borders.
+	if_regions_display(RegionsMap, map_x, map_y);
+
+	// Only the regions intersecting the displayed part of the world need to be drawn.
+	visible_count = storage_query(state->camera);
+	for(j = 0; j < visible_count; ++j)
 	{
-		if (!state->regions_visible[i]) continue;
+		i = storage_visible[j];
+		if (!bitset_test(state->regions_visible, i)) continue;
 
 		const struct region *region = game->regions + i;
 
@@ -705,10 +706,10 @@ void if_map(const void *argument, const struct game *game)
 		if (garrison)
 		{
 			const struct image *restrict image = &image_map_garrison[garrison->index];
-			unsigned location_x = MAP_X + region->location_garrison.x - image->width / 2;
-			unsigned location_y = MAP_Y + region->location_garrison.y - image->height / 2;
+			unsigned location_x = map_x + region->location_garrison.x - image->width / 2;
+			unsigned location_y = map_y + region->location_garrison.y - image->height / 2;
 			display_image(image, location_x, location_y, image->width, image->height);
-			if (game->players[region->garrison.owner].type != Neutral) show_flag_small(MAP_X + region->location_garrison.x, location_y - image_flag_small.height + 10, region->garrison.owner);
+			if (game->players[region->garrison.owner].type != Neutral) show_flag_small(map_x + region->location_garrison.x, location_y - image_flag_small.height + 10, region->garrison.owner);
 
 			if (allies(game, region->owner, state->player) || allies(game, region->garrison.owner, state->player))
 			{
@@ -731,8 +732,8 @@ void if_map(const void *argument, const struct game *game)
 		// Display village image.
 		// TODO fix this; it requires bigger regions and grass as background
 		// unsigned x, y;
-		/*x = MAP_X + region->center.x - image_map_village.width;
-		y = MAP_Y + region->center.y - image_map_village.height;
+		/*x = map_x + region->center.x - image_map_village.width;
+		y = map_y + region->center.y - image_map_village.height;
 		display_image(&image_map_village, x, y, image_map_village.width, image_map_village.height);*/
 		// TODO padding between village image and troops bar
 
@@ -749,9 +750,11 @@ void if_map(const void *argument, const struct game *game)
 			else if (allies(game, troop->owner, state->player)) count_allies += troop->count;
 			else count_enemies += troop->count;
 		}
-		if_map_troops(MAP_X + region->center.x, MAP_Y + region->center.y, count_self, count_allies, count_enemies);
+		if_map_troops(map_x + region->center.x, map_y + region->center.y, count_self, count_allies, count_enemies);
 	}
 
+	display_clip_reset();
+
 	if (state->region >= 0)
 	{
 		const struct region *region = game->regions + state->region;
@@ -759,16 +762,16 @@ void if_map(const void *argument, const struct game *game)
 		// Show the name of the selected region.
 		draw_string(region->name, region->name_length, PANEL_X + image_flag.width + MARGIN, PANEL_Y + (image_flag.height - font12.size) / 2, &font12, Black);
 
-		if (state->regions_visible[state->region]) if_map_region(region, state, game);
+		if (bitset_test(state->regions_visible, state->region)) if_map_region(region, state, game);
 	}
 
 	// treasury
 	struct resources *treasury = &game->players[state->player].treasury;
-	show_resource(&image_gold, treasury->gold, income.gold, PANEL_X, RESOURCE_GOLD);
-	show_resource(&image_food, treasury->food, income.food, PANEL_X, RESOURCE_FOOD);
-	show_resource(&image_wood, treasury->wood, income.wood, PANEL_X, RESOURCE_WOOD);
-	show_resource(&image_stone, treasury->stone, income.stone, PANEL_X, RESOURCE_STONE);
-	show_resource(&image_iron, treasury->iron, income.iron, PANEL_X, RESOURCE_IRON);
+	show_resource(&image_gold, treasury->gold, state->income.gold, PANEL_X, RESOURCE_GOLD);
+	show_resource(&image_food, treasury->food, state->income.food, PANEL_X, RESOURCE_FOOD);
+	show_resource(&image_wood, treasury->wood, state->income.wood, PANEL_X, RESOURCE_WOOD);
+	show_resource(&image_stone, treasury->stone, state->income.stone, PANEL_X, RESOURCE_STONE);
+	show_resource(&image_iron, treasury->iron, state->income.iron, PANEL_X, RESOURCE_IRON);
 
 	show_button(S("Ready"), BUTTON_READY_X, BUTTON_READY_Y);
 	show_button(S("Menu"), BUTTON_MENU_X, BUTTON_MENU_Y);
@@ -17,9 +17,10 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-void if_storage_init(const struct game *game, int width, int height);
+int if_storage_init(const struct game *game, int width, int height);
 void if_storage_term(void);
 
-int if_storage_get(unsigned x, unsigned y);
+int if_storage_get(struct point camera, unsigned x, unsigned y);
+void if_storage_view(struct point *restrict camera, int x, int y);
 
 void if_map(const void *argument, const struct game *game);
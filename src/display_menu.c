@@ -96,7 +96,7 @@ void if_load(const void *argument, const struct game *game)
 
 	if (state->loaded)
 	{
-		for(i = 0; i < game->players_count; ++i)
+		for(i = 0; (i < game->players_count) && (i < PLAYERS_VISIBLE); ++i)
 		{
 			if (i == PLAYER_NEUTRAL) continue;
 
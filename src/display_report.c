@@ -106,12 +106,12 @@ void if_report_battle(const void *argument, const struct game *game)
 				position_after[owner] = REPORT_AFTER_X;
 			}
 
-			display_troop(pawn->troop->unit->index, position_before[owner], offset[owner], Player + owner, White, pawn->troop->count);
+			display_troop(pawn->troop->unit->index, position_before[owner], offset[owner], color_player(owner), White, pawn->troop->count);
 			position_before[owner] += MARGIN_X;
 
 			if (pawn->count)
 			{
-				display_troop(pawn->troop->unit->index, position_after[owner], offset[owner], Player + owner, White, pawn->count);
+				display_troop(pawn->troop->unit->index, position_after[owner], offset[owner], color_player(owner), White, pawn->count);
 				position_after[owner] += MARGIN_X;
 			}
 		}
@@ -225,7 +225,7 @@ void if_report_invasion(const void *argument, const struct game *game)
 	{
 		if ((troop->move == LOCATION_GARRISON) && (troop->owner == state->region->garrison.owner))
 		{
-			display_troop(troop->unit->index, x, REPORT_Y + MARGIN_Y, Player + troop->owner, White, troop->count);
+			display_troop(troop->unit->index, x, REPORT_Y + MARGIN_Y, color_player(troop->owner), White, troop->count);
 			x += MARGIN_X;
 		}
 	}
@@ -17,8 +17,11 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdlib.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
 
 #define GL_GLEXT_PROTOTYPES
 #include <GL/glx.h>
@@ -27,6 +30,7 @@
 #include <xcb/xcb.h>
 
 #include "draw.h"
+#include "errors.h"
 
 #define BACK_RADIUS 2 /* width of the back of the arrow */
 #define FRONT_RADIUS 2 /* radius of the front of the arrow (behind the head) */
@@ -35,6 +39,8 @@
 
 #define SEPARATOR_LENGTH 32
 
+#define SPRITES_LIMIT 1024
+
 extern Display *display;
 
 struct polygon_draw
@@ -46,6 +52,26 @@ struct polygon_draw
 
 extern struct font font;
 
+// Vertices of the textured rectangles waiting to be displayed.
+static struct sprite_vertex
+{
+	GLfloat x, y;
+	GLfloat s, t;
+	GLubyte color[4];
+} sprites[SPRITES_LIMIT * 4];
+static size_t sprites_count;
+static GLuint sprites_texture;
+
+// Rectangles stored for a vertex buffer instead of being displayed.
+static struct
+{
+	struct sprites_buffer *buffer;
+	struct sprite_vertex *vertices;
+	size_t count, size;
+	size_t runs_size;
+	int status;
+} recording;
+
 const unsigned char display_colors[][4] = {
 	[White] = {255, 255, 255, 255},
 	[Gray] = {128, 128, 128, 255},
@@ -125,6 +151,7 @@ void fill_circle(unsigned x, unsigned y, unsigned radius, enum color color)
 {
 	unsigned steps = radius * 4, step;
 
+	sprites_flush();
 	glColor4ubv(display_colors[color]);
 	glBegin(GL_POLYGON);
 	for(step = 0; step < steps; ++step)
@@ -135,22 +162,18 @@ void fill_circle(unsigned x, unsigned y, unsigned radius, enum color color)
 	glEnd();
 }
 
+// Rectangles are accumulated with the textured rectangles (as rectangles without a texture).
 void fill_rectangle(unsigned x, unsigned y, unsigned width, unsigned height, const unsigned char color[4])
 {
-	glColor4ubv(color);
-
-	glBegin(GL_QUADS);
-	glVertex2i(x + width, y + height);
-	glVertex2i(x + width, y);
-	glVertex2i(x, y);
-	glVertex2i(x, y + height);
-	glEnd();
+	static const GLfloat coords[4] = {0};
+	sprite_draw(0, coords, x, y, width, height, color);
 }
 
 void draw_rectangle(unsigned x, unsigned y, unsigned width, unsigned height, const unsigned char color[4])
 {
 	// http://stackoverflow.com/questions/10040961/opengl-pixel-perfect-2d-drawing
 
+	sprites_flush();
 	glColor4ubv(color);
 
 	glBegin(GL_LINE_LOOP);
@@ -165,6 +188,7 @@ void draw_polygon(const struct polygon *restrict polygon, int offset_x, int offs
 {
 	size_t i;
 
+	sprites_flush();
 	glColor4ubv(color);
 
 	glBegin(GL_LINE_STRIP);
@@ -173,18 +197,19 @@ void draw_polygon(const struct polygon *restrict polygon, int offset_x, int offs
 	glEnd();
 }
 
-// Display a region as a polygon, using ear clipping.
-void fill_polygon(const struct polygon *restrict polygon, int offset_x, int offset_y, const unsigned char color[static 4], double scale)
+// Triangulates a polygon, using ear clipping. Stores the vertices of each triangle in triangles.
+// triangles must have space for 3 * (polygon->vertices_count - 2) points. Returns the number of points stored.
+ssize_t polygon_triangulate(const struct polygon *restrict polygon, struct point *restrict triangles)
 {
 	// assert(polygon->vertices_count > 2);
 
 	size_t vertices_left = polygon->vertices_count;
+	size_t count = 0;
 	size_t i;
 
 	// Initialize cyclic linked list with the polygon's vertices.
 	struct polygon_draw *draw = malloc(vertices_left * sizeof(*draw));
-	if (!draw)
-		return; // TODO
+	if (!draw) return ERROR_MEMORY;
 	draw[0].point = polygon->points;
 	draw[0].prev = draw + vertices_left - 1;
 	for(i = 1; i < vertices_left; ++i)
@@ -203,8 +228,6 @@ void fill_polygon(const struct polygon *restrict polygon, int offset_x, int offs
 		vertex = vertex->next;
 	} while (vertex != draw);
 
-	glColor4ubv(color);
-
 	while (vertices_left > 3)
 	{
 		// find a triangle to draw
@@ -222,11 +245,9 @@ void fill_polygon(const struct polygon *restrict polygon, int offset_x, int offs
 			continue;
 		}
 
-		glBegin(GL_POLYGON);
-		glVertex2f(offset_x + (unsigned)(vertex->prev->point->x * scale + 0.5), offset_y + (unsigned)(vertex->prev->point->y * scale + 0.5));
-		glVertex2f(offset_x + (unsigned)(vertex->point->x * scale + 0.5), offset_y + (unsigned)(vertex->point->y * scale + 0.5));
-		glVertex2f(offset_x + (unsigned)(vertex->next->point->x * scale + 0.5), offset_y + (unsigned)(vertex->next->point->y * scale + 0.5));
-		glEnd();
+		triangles[count++] = *vertex->prev->point;
+		triangles[count++] = *vertex->point;
+		triangles[count++] = *vertex->next->point;
 
 		// clip the triangle from the polygon
 		vertices_left -= 1;
@@ -239,13 +260,459 @@ void fill_polygon(const struct polygon *restrict polygon, int offset_x, int offs
 		vertex->class = is_ear(vertex->prev, vertex, vertex->next);
 	}
 
-	glBegin(GL_POLYGON);
-	glVertex2f(offset_x + (unsigned)(vertex->prev->point->x * scale + 0.5), offset_y + (unsigned)(vertex->prev->point->y * scale + 0.5));
-	glVertex2f(offset_x + (unsigned)(vertex->point->x * scale + 0.5), offset_y + (unsigned)(vertex->point->y * scale + 0.5));
-	glVertex2f(offset_x + (unsigned)(vertex->next->point->x * scale + 0.5), offset_y + (unsigned)(vertex->next->point->y * scale + 0.5));
-	glEnd();
+	triangles[count++] = *vertex->prev->point;
+	triangles[count++] = *vertex->point;
+	triangles[count++] = *vertex->next->point;
 
 	free(draw);
+	return count;
+}
+
+// Display a region as a polygon. Polygons which are displayed repeatedly should be stored in a mesh instead.
+void fill_polygon(const struct polygon *restrict polygon, int offset_x, int offset_y, const unsigned char color[static 4], double scale)
+{
+	struct point *triangles;
+	ssize_t count, i;
+
+	triangles = malloc(3 * (polygon->vertices_count - 2) * sizeof(*triangles));
+	if (!triangles)
+		return; // TODO
+	count = polygon_triangulate(polygon, triangles);
+
+	sprites_flush();
+	glColor4ubv(color);
+
+	glBegin(GL_TRIANGLES);
+	for(i = 0; i < count; ++i)
+		glVertex2f(offset_x + (unsigned)(triangles[i].x * scale + 0.5), offset_y + (unsigned)(triangles[i].y * scale + 0.5));
+	glEnd();
+
+	free(triangles);
+}
+
+// Triangulates the polygons and stores the result in buffer objects.
+int mesh_init(struct mesh *restrict mesh, const struct polygon *const *restrict polygons, size_t polygons_count)
+{
+	struct point *vertices = 0;
+	size_t triangles_limit = 0, outline_count = 0;
+	size_t i;
+
+	*mesh = (struct mesh){.polygons_count = polygons_count};
+
+	for(i = 0; i < polygons_count; ++i)
+	{
+		triangles_limit += 3 * (polygons[i]->vertices_count - 2);
+		outline_count += polygons[i]->vertices_count;
+	}
+
+	mesh->offsets = malloc((polygons_count + 1) * sizeof(*mesh->offsets));
+	mesh->outline_first = malloc((polygons_count ? polygons_count : 1) * sizeof(*mesh->outline_first));
+	mesh->outline_count = malloc((polygons_count ? polygons_count : 1) * sizeof(*mesh->outline_count));
+	vertices = malloc((triangles_limit + outline_count + 1) * sizeof(*vertices));
+	if (!mesh->offsets || !mesh->outline_first || !mesh->outline_count || !vertices) goto error;
+
+	// The triangles of all polygons are followed by the outlines of all polygons.
+	mesh->offsets[0] = 0;
+	for(i = 0; i < polygons_count; ++i)
+	{
+		ssize_t count = polygon_triangulate(polygons[i], vertices + mesh->offsets[i]);
+		if (count < 0) goto error;
+		mesh->offsets[i + 1] = mesh->offsets[i] + count;
+	}
+	mesh->triangles_count = mesh->offsets[polygons_count];
+	outline_count = mesh->triangles_count;
+	for(i = 0; i < polygons_count; ++i)
+	{
+		memcpy(vertices + outline_count, polygons[i]->points, polygons[i]->vertices_count * sizeof(*vertices));
+		mesh->outline_first[i] = outline_count;
+		mesh->outline_count[i] = polygons[i]->vertices_count;
+		outline_count += polygons[i]->vertices_count;
+	}
+
+	mesh->colors = calloc(mesh->triangles_count ? mesh->triangles_count : 1, sizeof(*mesh->colors));
+	if (!mesh->colors) goto error;
+
+	glGenBuffers(2, mesh->buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, outline_count * sizeof(*vertices), vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[1]);
+	glBufferData(GL_ARRAY_BUFFER, mesh->triangles_count * sizeof(*mesh->colors), mesh->colors, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	free(vertices);
+	return 0;
+
+error:
+	free(vertices);
+	mesh_term(mesh);
+	return ERROR_MEMORY;
+}
+
+// Sets the color of a polygon. The change is uploaded when the mesh is displayed.
+void mesh_color(struct mesh *restrict mesh, size_t polygon, const unsigned char color[static 4])
+{
+	size_t i;
+
+	if ((mesh->offsets[polygon] == mesh->offsets[polygon + 1]) || !memcmp(mesh->colors[mesh->offsets[polygon]], color, 4))
+		return;
+
+	for(i = mesh->offsets[polygon]; i < mesh->offsets[polygon + 1]; ++i)
+		memcpy(mesh->colors[i], color, 4);
+	mesh->colors_changed = 1;
+}
+
+// Displays all polygons of the mesh with a single draw call.
+void mesh_fill(struct mesh *restrict mesh, int offset_x, int offset_y, double scale)
+{
+	sprites_flush();
+
+	if (mesh->colors_changed)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[1]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, mesh->triangles_count * sizeof(*mesh->colors), mesh->colors);
+		mesh->colors_changed = 0;
+	}
+
+	glPushMatrix();
+	glTranslatef(offset_x, offset_y, 0);
+	glScaled(scale, scale, 1);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[0]);
+	glVertexPointer(2, GL_INT, 0, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[1]);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, 0);
+
+	glDrawArrays(GL_TRIANGLES, 0, mesh->triangles_count);
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glPopMatrix();
+}
+
+// Displays the outlines of all polygons of the mesh with a single draw call.
+void mesh_outline(const struct mesh *restrict mesh, int offset_x, int offset_y, const unsigned char color[static 4], double scale)
+{
+	sprites_flush();
+	glColor4ubv(color);
+
+	glPushMatrix();
+	glTranslatef(offset_x, offset_y, 0);
+	glScaled(scale, scale, 1);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[0]);
+	glVertexPointer(2, GL_INT, 0, 0);
+
+	glMultiDrawArrays(GL_LINE_STRIP, mesh->outline_first, mesh->outline_count, mesh->polygons_count);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glPopMatrix();
+}
+
+void mesh_term(struct mesh *restrict mesh)
+{
+	if (mesh->buffers[0])
+		glDeleteBuffers(2, mesh->buffers);
+	free(mesh->colors);
+	free(mesh->outline_count);
+	free(mesh->outline_first);
+	free(mesh->offsets);
+	*mesh = (struct mesh){0};
+}
+
+// Prepares a texture in which meshes can be rendered. Returns ERROR_UNSUPPORTED if the texture can not be used for rendering.
+int mesh_layer_init(struct mesh_layer *restrict layer, unsigned width, unsigned height)
+{
+	GLint size_max, framebuffer;
+	GLenum status;
+
+	*layer = (struct mesh_layer){.width = width, .height = height};
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size_max);
+	if ((width > (unsigned)size_max) || (height > (unsigned)size_max))
+		return ERROR_UNSUPPORTED;
+
+	glGenTextures(1, &layer->texture);
+	glBindTexture(GL_TEXTURE_2D, layer->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &framebuffer);
+	glGenFramebuffersEXT(1, &layer->framebuffer);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, layer->framebuffer);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, layer->texture, 0);
+	status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+	{
+		mesh_layer_term(layer);
+		return ERROR_UNSUPPORTED;
+	}
+
+	return 0;
+}
+
+// Renders the mesh in the texture of the layer. The outlines are not rendered if outline is NULL.
+void mesh_layer_render(struct mesh_layer *restrict layer, struct mesh *restrict mesh, double scale, const unsigned char *restrict outline)
+{
+	GLint framebuffer;
+
+	sprites_flush();
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &framebuffer);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, layer->framebuffer);
+	glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT | GL_SCISSOR_BIT);
+
+	glDisable(GL_SCISSOR_TEST);
+	glViewport(0, 0, layer->width, layer->height);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, layer->width, layer->height, 0, 0, 1);
+	glMatrixMode(GL_MODELVIEW);
+
+	// Store the colors in the texture as they are so that displaying the texture has the same result as displaying the mesh.
+	glDisable(GL_BLEND);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	mesh_fill(mesh, 0, 0, scale);
+	if (outline) mesh_outline(mesh, 0, 0, outline, scale);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+
+	glPopAttrib();
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+}
+
+void mesh_layer_display(const struct mesh_layer *restrict layer, int x, int y)
+{
+	static const GLfloat coords[4] = {0, 0, 1, 1};
+	sprite_draw(layer->texture, coords, x, y, layer->width, layer->height, display_colors[White]);
+}
+
+void mesh_layer_term(struct mesh_layer *restrict layer)
+{
+	if (layer->framebuffer)
+		glDeleteFramebuffersEXT(1, &layer->framebuffer);
+	if (layer->texture)
+		glDeleteTextures(1, &layer->texture);
+	*layer = (struct mesh_layer){0};
+}
+
+// Adds a rectangle displaying the part of the texture specified by coords (left, bottom, right, top).
+void sprite_draw(GLuint texture, const GLfloat coords[static 4], GLfloat x, GLfloat y, GLfloat width, GLfloat height, const unsigned char color[static 4])
+{
+	struct sprite_vertex *vertex;
+
+	if ((texture != sprites_texture) || (sprites_count == SPRITES_LIMIT * 4))
+	{
+		sprites_flush();
+		sprites_texture = texture;
+	}
+
+	vertex = sprites + sprites_count;
+	vertex[0] = (struct sprite_vertex){x + width, y + height, coords[2], coords[1], {color[0], color[1], color[2], color[3]}};
+	vertex[1] = (struct sprite_vertex){x, y + height, coords[0], coords[1], {color[0], color[1], color[2], color[3]}};
+	vertex[2] = (struct sprite_vertex){x, y, coords[0], coords[3], {color[0], color[1], color[2], color[3]}};
+	vertex[3] = (struct sprite_vertex){x + width, y, coords[2], coords[3], {color[0], color[1], color[2], color[3]}};
+	sprites_count += 4;
+}
+
+static void sprites_arrays(const GLvoid *position, const GLvoid *coords, const GLvoid *color)
+{
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(struct sprite_vertex), position);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(struct sprite_vertex), coords);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(struct sprite_vertex), color);
+}
+
+static void sprites_arrays_reset(void)
+{
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// Rectangles with texture 0 are displayed without a texture.
+static void sprites_display(GLuint texture, GLint start, GLsizei count)
+{
+	if (texture)
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glEnable(GL_TEXTURE_2D);
+	}
+
+	glDrawArrays(GL_QUADS, start, count);
+
+	if (texture)
+		glDisable(GL_TEXTURE_2D);
+}
+
+// Appends the accumulated rectangles to the recording.
+static void sprites_record(void)
+{
+	struct sprites_buffer *restrict buffer = recording.buffer;
+
+	if (recording.status < 0)
+		return;
+
+	if (recording.count + sprites_count > recording.size)
+	{
+		size_t size = (recording.size ? recording.size * 2 : SPRITES_LIMIT * 4);
+		struct sprite_vertex *vertices;
+
+		while (size < recording.count + sprites_count)
+			size *= 2;
+		vertices = realloc(recording.vertices, size * sizeof(*vertices));
+		if (!vertices)
+		{
+			recording.status = ERROR_MEMORY;
+			return;
+		}
+		recording.vertices = vertices;
+		recording.size = size;
+	}
+	memcpy(recording.vertices + recording.count, sprites, sprites_count * sizeof(*sprites));
+
+	// Rectangles with the same texture as the previous ones are displayed together.
+	if (buffer->runs_count && (buffer->runs[buffer->runs_count - 1].texture == sprites_texture))
+	{
+		buffer->runs[buffer->runs_count - 1].count += sprites_count;
+	}
+	else
+	{
+		if (buffer->runs_count == recording.runs_size)
+		{
+			size_t size = (recording.runs_size ? recording.runs_size * 2 : 8);
+			struct sprites_run *runs = realloc(buffer->runs, size * sizeof(*runs));
+			if (!runs)
+			{
+				recording.status = ERROR_MEMORY;
+				return;
+			}
+			buffer->runs = runs;
+			recording.runs_size = size;
+		}
+		buffer->runs[buffer->runs_count++] = (struct sprites_run){sprites_texture, recording.count, sprites_count};
+	}
+
+	recording.count += sprites_count;
+}
+
+// Displays the accumulated rectangles.
+void sprites_flush(void)
+{
+	if (!sprites_count)
+		return;
+
+	if (recording.buffer)
+	{
+		sprites_record();
+		sprites_count = 0;
+		return;
+	}
+
+	sprites_arrays(&sprites[0].x, &sprites[0].s, sprites[0].color);
+	sprites_display(sprites_texture, 0, sprites_count);
+	sprites_arrays_reset();
+
+	sprites_count = 0;
+}
+
+void display_clip(int x, int y, unsigned width, unsigned height)
+{
+	GLint viewport[4];
+
+	sprites_flush();
+
+	// The window coordinates used by glScissor() start from the bottom.
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glScissor(x, viewport[3] - (y + (int)height), width, height);
+	glEnable(GL_SCISSOR_TEST);
+}
+
+void display_clip_reset(void)
+{
+	sprites_flush();
+	glDisable(GL_SCISSOR_TEST);
+}
+
+// Starts storing the textured rectangles in the buffer instead of displaying them.
+// Anything else drawn before sprites_buffer_end() is displayed immediately.
+void sprites_buffer_begin(struct sprites_buffer *restrict buffer)
+{
+	sprites_flush();
+
+	buffer->runs_count = 0;
+	recording.buffer = buffer;
+	recording.count = 0;
+	recording.runs_size = 0;
+	recording.status = 0;
+}
+
+// Stores the recorded rectangles in the vertex buffer. On error, the buffer is empty.
+int sprites_buffer_end(struct sprites_buffer *restrict buffer)
+{
+	int status;
+
+	sprites_flush();
+	recording.buffer = 0;
+
+	status = recording.status;
+	if (status < 0)
+	{
+		buffer->runs_count = 0;
+	}
+	else
+	{
+		if (!buffer->buffer)
+			glGenBuffers(1, &buffer->buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer->buffer);
+		glBufferData(GL_ARRAY_BUFFER, recording.count * sizeof(*recording.vertices), recording.vertices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	free(recording.vertices);
+	recording.vertices = 0;
+	recording.size = 0;
+
+	return status;
+}
+
+void sprites_buffer_draw(const struct sprites_buffer *restrict buffer)
+{
+	if (!buffer->runs_count)
+		return;
+
+	sprites_flush();
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer->buffer);
+	sprites_arrays((const GLvoid *)offsetof(struct sprite_vertex, x), (const GLvoid *)offsetof(struct sprite_vertex, s), (const GLvoid *)offsetof(struct sprite_vertex, color));
+	for(size_t i = 0; i < buffer->runs_count; ++i)
+		sprites_display(buffer->runs[i].texture, buffer->runs[i].start, buffer->runs[i].count);
+	sprites_arrays_reset();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void sprites_buffer_term(struct sprites_buffer *restrict buffer)
+{
+	if (buffer->buffer)
+		glDeleteBuffers(1, &buffer->buffer);
+	free(buffer->runs);
+	*buffer = (struct sprites_buffer){0};
 }
 
 // TODO rewrite this?
@@ -261,6 +728,7 @@ void display_arrow(struct point from, struct point to, int offset_x, int offset_
 	hx = to.x - HEAD_LENGTH * angle_x;
 	hy = to.y - HEAD_LENGTH * angle_y;
 
+	sprites_flush();
 	glColor4ubv(display_colors[color]);
 
 	glBegin(GL_POLYGON);
@@ -291,6 +759,7 @@ void display_separator(struct point a, struct point b, enum color color)
 	b.x = xm - dx;
 	b.y = ym + dy;
 
+	sprites_flush();
 	glColor4ubv(display_colors[color]);
 	glBegin(GL_LINES);
 	glVertex2f(a.x, a.y);
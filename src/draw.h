@@ -29,6 +29,12 @@ struct point
 	int x, y;
 };
 
+// Rectangle. The right and bottom edges are inclusive.
+struct bounds
+{
+	int left, right, top, bottom;
+};
+
 struct polygon
 {
 	size_t vertices_count;
@@ -38,6 +44,14 @@ struct polygon
 enum color {White, Gray, Black, Error, Unexplored, Progress, Select, Self, Ally, Enemy, PathReachable, PathUnreachable, Hover, FieldReachable, Player};
 extern const unsigned char display_colors[][4];
 
+#define PLAYER_COLORS 16
+
+// Colors are reused when there are more players than colors. The neutral player 0 has a color of its own.
+static inline enum color color_player(unsigned player)
+{
+	return Player + (player ? (player - 1) % (PLAYER_COLORS - 1) + 1 : 0);
+}
+
 static inline int point_eq(struct point a, struct point b)
 {
 	return ((a.x == b.x) && (a.y == b.y));
@@ -51,5 +65,65 @@ void fill_rectangle(unsigned x, unsigned y, unsigned width, unsigned height, con
 void draw_polygon(const struct polygon *restrict polygon, int offset_x, int offset_y, const unsigned char color[static 4], double scale);
 void fill_polygon(const struct polygon *restrict polygon, int offset_x, int offset_y, const unsigned char color[static 4], double scale);
 
+// Polygons triangulated once and stored in buffer objects. Each polygon has a color of its own.
+struct mesh
+{
+	GLuint buffers[2]; // vertices, colors
+	size_t polygons_count;
+	size_t triangles_count; // number of vertices in the triangles of all polygons
+	size_t *offsets; // index of the first triangle vertex of each polygon (polygons_count + 1 items)
+	GLint *outline_first;
+	GLsizei *outline_count;
+	unsigned char (*colors)[4]; // color of each triangle vertex
+	_Bool colors_changed;
+};
+
+ssize_t polygon_triangulate(const struct polygon *restrict polygon, struct point *restrict triangles);
+
+int mesh_init(struct mesh *restrict mesh, const struct polygon *const *restrict polygons, size_t polygons_count);
+void mesh_color(struct mesh *restrict mesh, size_t polygon, const unsigned char color[static 4]);
+void mesh_fill(struct mesh *restrict mesh, int offset_x, int offset_y, double scale);
+void mesh_outline(const struct mesh *restrict mesh, int offset_x, int offset_y, const unsigned char color[static 4], double scale);
+void mesh_term(struct mesh *restrict mesh);
+
+// Texture in which a mesh is rendered. Displaying the texture is cheaper than displaying the mesh.
+struct mesh_layer
+{
+	GLuint framebuffer, texture;
+	unsigned width, height;
+};
+
+int mesh_layer_init(struct mesh_layer *restrict layer, unsigned width, unsigned height);
+void mesh_layer_render(struct mesh_layer *restrict layer, struct mesh *restrict mesh, double scale, const unsigned char *restrict outline);
+void mesh_layer_display(const struct mesh_layer *restrict layer, int x, int y);
+void mesh_layer_term(struct mesh_layer *restrict layer);
+
+// Textured rectangles are accumulated and displayed together with a single draw call per texture.
+// The accumulated rectangles are displayed before anything else is drawn. Rectangles with texture 0 are filled with the color.
+void sprite_draw(GLuint texture, const GLfloat coords[static 4], GLfloat x, GLfloat y, GLfloat width, GLfloat height, const unsigned char color[static 4]);
+void sprites_flush(void);
+
+// Restricts drawing to a rectangle of the window until display_clip_reset() is called.
+void display_clip(int x, int y, unsigned width, unsigned height);
+void display_clip_reset(void);
+
+// Textured rectangles stored in a vertex buffer so that they can be displayed repeatedly without being sent again.
+struct sprites_buffer
+{
+	GLuint buffer;
+	size_t runs_count;
+	struct sprites_run
+	{
+		GLuint texture;
+		GLint start;
+		GLsizei count;
+	} *runs; // consecutive rectangles with the same texture
+};
+
+void sprites_buffer_begin(struct sprites_buffer *restrict buffer);
+int sprites_buffer_end(struct sprites_buffer *restrict buffer);
+void sprites_buffer_draw(const struct sprites_buffer *restrict buffer);
+void sprites_buffer_term(struct sprites_buffer *restrict buffer);
+
 void display_arrow(struct point from, struct point to, int offset_x, int offset_y, enum color color);
 void display_separator(struct point a, struct point b, enum color color);
@@ -86,13 +86,11 @@ struct vertex
 #define array_type struct vertex
 #include "generic/array.g"
 
-static GLuint map_framebuffer;
-static GLuint map_renderbuffer;
-
 struct state
 {
 	// TOOL_REGIONS
 	unsigned char *colors;
+	struct regions_grid grid;
 	ssize_t region_index;
 	char name[NAME_LIMIT];
 	size_t name_size;
@@ -109,115 +107,25 @@ static struct image image_garrison, image_village;
 static struct image image_garrison_gray, image_village_gray;
 
 /* < Interface storage */
-// TODO put this in a separate file
-
-static void if_storage_init(unsigned width, unsigned height)
-{
-	glGenRenderbuffers(1, &map_renderbuffer);
-	glGenFramebuffers(1, &map_framebuffer);
-
-	glBindRenderbuffer(GL_RENDERBUFFER, map_renderbuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, map_framebuffer);
-
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, width, height);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, map_renderbuffer);
-
-	glViewport(0, 0, width, height);
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0, width, 0, height, 0, 1);
+#define POINT_RADIUS 6 /* points can be selected from this distance */
 
-	glClear(GL_COLOR_BUFFER_BIT);
-
-	glFlush();
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-static void colored_rectangle(unsigned x, unsigned y, unsigned width, unsigned height, const unsigned char color[4])
+// Returns the index of the object at the given position or -1 if there is no object there.
+// The objects are regions or points, depending on the tool. When points overlap, the last one is found.
+static int if_storage_get(const struct game *restrict game, const struct state *restrict state, unsigned x, unsigned y)
 {
-	glColor4ubv(color);
+	size_t i;
 
-	glBegin(GL_QUADS);
-	glVertex2i(x + width, y + height);
-	glVertex2i(x + width, y);
-	glVertex2i(x, y);
-	glVertex2i(x, y + height);
-	glEnd();
-}
+	if (editor_tool == TOOL_REGIONS)
+		return regions_grid_find(&state->grid, game, x, y);
 
-static void if_index_color(unsigned char color[4], int index)
-{
-	if (index < 0)
-	{
-		color[0] = 0;
-		color[1] = 0;
-		color[2] = 0;
-	}
-	else
+	for(i = state->points.count; i; --i)
 	{
-		color[0] = 255;
-		color[1] = index / 256;
-		color[2] = index % 256;
+		const struct point *restrict point = &state->points.data[i - 1].point;
+		if ((abs(point->x - (int)x) <= POINT_RADIUS) && (abs(point->y - (int)y) <= POINT_RADIUS))
+			return i - 1;
 	}
-	color[3] = 255;
-}
-
-static void if_switch_buffer(void)
-{
-	glBindFramebuffer(GL_FRAMEBUFFER, map_framebuffer);
-
-	glViewport(0, 0, image_world.width, image_world.height);
-
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0, image_world.width, 0, image_world.height, 0, 1);
-}
-
-static void if_switch_screen(void)
-{
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0, WINDOW_WIDTH, WINDOW_HEIGHT, 0, 0, 1);
-}
-
-static void if_storage_region(const struct polygon *restrict location, int index)
-{
-	unsigned char color[4];
-	if_index_color(color, index);
-	fill_polygon(location, 0, 0, color, 1.0);
-}
-
-static void if_storage_point(unsigned x, unsigned y, int index)
-{
-	unsigned char color[4];
-	if_switch_buffer();
-	if_index_color(color, index);
-	colored_rectangle(x - 6, y - 6, 13, 13, color);
-	glFlush();
-	if_switch_screen();
-}
-
-static int if_storage_get(unsigned x, unsigned y)
-{
-	GLubyte pixel[3];
-
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, map_framebuffer);
-	glReadPixels(x, y, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, pixel);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-
-	if (!pixel[0]) return -1;
-	return pixel[1] * 256 + pixel[2];
-}
-
-static void if_storage_term(void)
-{
-	glDeleteRenderbuffers(1, &map_renderbuffer);
-	glDeleteFramebuffers(1, &map_framebuffer);
+	return -1;
 }
 
 /* Interface storage > */
@@ -232,11 +140,10 @@ static int regions_color_try(const struct game *restrict game, unsigned char *co
 	if (region_index == game->regions_count) return 0;
 
 	// Find which colors are already used by the neighbors of the region.
-	for(i = 0; i < NEIGHBORS_LIMIT; ++i)
+	for(i = region_neighbors_begin(game, region); i < region_neighbors_end(game, region); ++i)
 	{
-		const struct region *restrict neighbor = region->neighbors[i];
+		const struct region *restrict neighbor = region_neighbor(game, i);
 
-		if (!neighbor) continue; // no such neighbor
 		if (neighbor->index >= region_index) continue; // not colored yet
 
 		used[colors[neighbor->index]] = 1;
@@ -278,8 +185,6 @@ static void region_init(struct game *restrict game, struct region *restrict regi
 	regions_created_count += 1;
 
 	region->index = game->regions_count;
-	for(i = 0; i < NEIGHBORS_LIMIT; ++i)
-		region->neighbors[i] = 0;
 
 	region->location = malloc(offsetof(struct polygon, points) + points_count * sizeof(struct point));
 	if (!region->location) abort();
@@ -308,8 +213,6 @@ static void region_init(struct game *restrict game, struct region *restrict regi
 
 static void tool_regions_init(struct game *restrict game, struct state *restrict state)
 {
-	size_t i;
-
 	editor_tool = TOOL_REGIONS;
 
 	state->region_index = -1;
@@ -318,13 +221,7 @@ static void tool_regions_init(struct game *restrict game, struct state *restrict
 	state->name_position = 0;
 	state->object = OBJECT_GARRISON;
 
-	if_switch_buffer();
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	for(i = 0; i < game->regions_count; ++i)
-		if_storage_region(game->regions[i].location, i);
-	glFlush();
-
-	if_switch_screen();
+	if (regions_grid_init(&state->grid, game) < 0) abort();
 
 	state->colors = regions_colors(game);
 	if (!state->colors) abort();
@@ -332,6 +229,7 @@ static void tool_regions_init(struct game *restrict game, struct state *restrict
 
 static void tool_regions_term(struct game *restrict game, struct state *restrict state)
 {
+	regions_grid_term(&state->grid);
 	free(state->colors);
 }
 
@@ -341,9 +239,6 @@ static void tool_points_init(const struct game *restrict game, struct state *res
 
 	editor_tool = TOOL_POINTS;
 
-	if_switch_buffer();
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
 	state->points = (struct array_vertex){0};
 	for(i = 0; i < game->regions_count; ++i)
 	{
@@ -356,17 +251,7 @@ static void tool_points_init(const struct game *restrict game, struct state *res
 
 		for(j = 0; j < location->vertices_count; ++j)
 		{
-			unsigned x = location->points[j].x;
-			unsigned y = location->points[j].y;
-
-			int index = if_storage_get(x, y);
-			if (index >= 0) // there is an existing point at this location
-			{
-				x = points[index].point.x;
-				y = points[index].point.y;
-			}
-
-			if_storage_point(x, y, state->points.count);
+			int index = if_storage_get(game, state, location->points[j].x, location->points[j].y);
 
 			points[state->points.count].point = location->points[j];
 			points[state->points.count].previous = index;
@@ -374,47 +259,51 @@ static void tool_points_init(const struct game *restrict game, struct state *res
 			state->points.count += 1;
 		}
 	}
-	glFlush();
-
-	if_switch_screen();
 
 	state->index_start = state->points.count;
 }
 
-static void add_neighbor(struct region *restrict region, struct region *restrict neighbor)
+static void add_neighbor(struct region_link **restrict links, size_t *restrict links_count, size_t *restrict degrees, size_t region, size_t neighbor)
 {
-	size_t i;
-	for(i = 0; i < NEIGHBORS_LIMIT; ++i)
-		if (!region->neighbors[i])
-		{
-			region->neighbors[i] = neighbor;
-			return;
-		}
+	// Grow the array when its size reaches a power of 2.
+	if (!(*links_count & (*links_count - 1)))
+	{
+		void *buffer = realloc(*links, (*links_count ? *links_count * 2 : 1) * sizeof(**links));
+		if (!buffer) abort();
+		*links = buffer;
+	}
 
-	LOG_ERROR("Region %u has more than %u neighbors.", (unsigned)region->index, (unsigned)NEIGHBORS_LIMIT);
+	// Directions are assigned in order, starting over after all are used.
+	(*links)[*links_count] = (struct region_link){.region = region, .neighbor = neighbor, .direction = degrees[region] % DIRECTIONS_COUNT};
+	*links_count += 1;
+	degrees[region] += 1;
 }
 
 static void neighbors_generate(struct game *restrict game)
 {
+	struct region_link *links = 0;
+	size_t links_count = 0;
+	size_t *degrees;
 	size_t i, j;
 
-	for(i = 0; i < game->regions_count; ++i)
-		for(j = 0; j < NEIGHBORS_LIMIT; ++j)
-			game->regions[i].neighbors[j] = 0;
+	degrees = calloc(game->regions_count ? game->regions_count : 1, sizeof(*degrees));
+	if (!degrees) abort();
 
 	// Determine the neighbors of each region.
 	for(i = 1; i < game->regions_count; ++i)
 		for(j = 0; j < i; ++j)
 		{
-			struct region *restrict region = game->regions + j;
-			struct region *restrict neighbor = game->regions + i;
-
-			if (polygons_border(region->location, neighbor->location, 0, 0))
+			if (polygons_border(game->regions[j].location, game->regions[i].location, 0, 0))
 			{
-				add_neighbor(region, neighbor);
-				add_neighbor(neighbor, region);
+				add_neighbor(&links, &links_count, degrees, j, i);
+				add_neighbor(&links, &links_count, degrees, i, j);
 			}
 		}
+
+	if (neighbors_init(game, links, links_count) < 0) abort();
+
+	free(degrees);
+	free(links);
 }
 
 static void tool_points_term(struct game *restrict game, struct state *restrict state)
@@ -432,7 +321,7 @@ static void tool_points_term(struct game *restrict game, struct state *restrict
 
 		game->regions_count += 1;
 
-		// Re-generate neighbors since the pointers are not valid after the realloc and the new region has no neighbors set.
+		// Re-generate neighbors since the new region has no neighbors set.
 		neighbors_generate(game);
 	}
 
@@ -458,7 +347,7 @@ static int input_region(int code, unsigned x, unsigned y, uint16_t modifiers, co
 
 			if ((x >= MAP_WIDTH) || (y >= MAP_HEIGHT)) return INPUT_IGNORE;
 
-			index = if_storage_get(x, y);
+			index = if_storage_get(game, state, x, y);
 			if (index == state->region_index) return INPUT_IGNORE;
 			if (index < 0)
 			{
@@ -534,9 +423,15 @@ static int input_region(int code, unsigned x, unsigned y, uint16_t modifiers, co
 			// Remove selected region.
 			game_mutable->regions_count -= 1;
 			if (state->region_index != game_mutable->regions_count)
+			{
 				memcpy(game_mutable->regions + state->region_index, game_mutable->regions + game_mutable->regions_count, sizeof(*game_mutable->regions));
+				game_mutable->regions[state->region_index].index = state->region_index;
+			}
 
 			neighbors_generate(game_mutable);
+
+			regions_grid_term(&state->grid);
+			if (regions_grid_init(&state->grid, game_mutable) < 0) abort();
 		}
 		else
 		{
@@ -614,16 +509,9 @@ static int input_point(int code, unsigned x, unsigned y, uint16_t modifiers, con
 		return INPUT_FINISH;
 
 	case XK_Delete:
-		{
-			struct vertex v;
-
-			if (state->points.count <= state->index_start)
-				return INPUT_IGNORE;
-
-			v = state->points.data[state->points.count - 1];
-			if_storage_point(v.point.x, v.point.y, v.previous);
-			state->points.count -= 1;
-		}
+		if (state->points.count <= state->index_start)
+			return INPUT_IGNORE;
+		state->points.count -= 1;
 		return 0;
 
 	case EVENT_MOUSE_LEFT:
@@ -632,7 +520,7 @@ static int input_point(int code, unsigned x, unsigned y, uint16_t modifiers, con
 
 			if ((x >= MAP_WIDTH) || (y >= MAP_HEIGHT)) return INPUT_IGNORE;
 
-			index = if_storage_get(x, y);
+			index = if_storage_get(game, state, x, y);
 			if (index > (int)state->index_start) // this point is already added to the current region
 				return INPUT_IGNORE;
 
@@ -653,7 +541,6 @@ static int input_point(int code, unsigned x, unsigned y, uint16_t modifiers, con
 				y = state->points.data[index].point.y;
 			}
 
-			if_storage_point(x, y, state->points.count);
 			if (array_vertex_expand(&state->points, state->points.count + 1) < 0)
 				abort();
 			state->points.data[state->points.count++] = (struct vertex){x, y, index, game->regions_count};
@@ -667,14 +554,10 @@ static int input_point(int code, unsigned x, unsigned y, uint16_t modifiers, con
 
 			if ((x >= MAP_WIDTH) || (y >= MAP_HEIGHT)) return INPUT_IGNORE;
 
-			index = if_storage_get(x, y);
+			index = if_storage_get(game, state, x, y);
 			if (index < 0) return INPUT_IGNORE;
 			if (index < (int)state->index_start) return INPUT_IGNORE;
 
-			x = state->points.data[index].point.x;
-			y = state->points.data[index].point.y;
-			if_storage_point(x, y, state->points.data[index].previous);
-
 			state->points.count -= 1;
 			for(i = index; i < state->points.count; ++i)
 				state->points.data[i] = state->points.data[i + 1];
@@ -767,6 +650,7 @@ static void if_regions(const void *restrict argument, const struct game *restric
 		break;
 	}
 
+	sprites_flush();
 	glFlush();
 }
 
@@ -793,6 +677,7 @@ static void if_points(const void *argument, const struct game *game)
 		const struct vertex *restrict points = state->points.data;
 		size_t region_first = 0;
 
+		sprites_flush();
 		glColor3ub(0, 0, 0);
 		for(i = 1; 1; ++i)
 		{
@@ -827,6 +712,7 @@ static void if_points(const void *argument, const struct game *game)
 
 	show_button(S("Regions tool"), BUTTON_REGIONS_X, BUTTON_REGIONS_Y);
 
+	sprites_flush();
 	glFlush();
 }
 
@@ -910,6 +796,16 @@ static int world_init(struct game *restrict game)
 		return ERROR_MEMORY;
 	}
 
+	game->neighbors_offsets = 0;
+	game->neighbors = 0;
+	game->neighbors_directions = 0;
+	if (neighbors_init(game, 0, 0) < 0)
+	{
+		free(game->regions);
+		free(game->players);
+		return ERROR_MEMORY;
+	}
+
 	return 0;
 }
 
@@ -926,7 +822,6 @@ int main(int argc, char *argv[])
 	}
 
 	write(1, S("WARNING: Vertices in a region must be listed counterclockwise.\n"));
-	write(1, S("WARNING: Each region can have up to " LOG_STRING(NEIGHBORS_LIMIT) " neighbors.\n"));
 
 	if_init();
 
@@ -936,8 +831,6 @@ int main(int argc, char *argv[])
 	image_load_png(&image_village, PREFIX_IMG "map_village.png", 0);
 	image_load_png(&image_village_gray, PREFIX_IMG "map_village.png", image_grayscale);
 
-	if_storage_init(image_world.width, image_world.height);
-
 	if_display();
 
 	if (argc > 2) status = world_load(argv[2], &game);
@@ -977,7 +870,6 @@ int main(int argc, char *argv[])
 	world_unload(&game);
 	write(1, S("world written to " WORLD_TEMP "\n"));
 
-	if_storage_term();
 	image_unload(&image_world);
 	if_term();
 
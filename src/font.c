@@ -29,6 +29,8 @@
 #define TYPEFACE "/usr/share/fonts/dejavu/DejaVuSans-Bold.ttf"
 #define FONT_DPI 72
 
+#define FONT_ATLAS_WIDTH 512
+
 // TODO improve return error codes
 // TODO cleanup on error
 
@@ -43,30 +45,72 @@ static inline unsigned topower2(unsigned number)
 	return result;
 }
 
-static int bitmap_texture(FT_Bitmap *restrict bitmap, GLuint *restrict texture)
+// Stores the bitmaps of all glyphs of the font in a single texture.
+// The glyphs are placed in rows of fixed width. The height of the texture is as small as possible.
+static int font_atlas(struct font *restrict font, FT_BitmapGlyph *restrict glyphs)
 {
-	unsigned width = topower2(bitmap->width);
-	unsigned rows = topower2(bitmap->rows);
+	unsigned x = 0, y = 0, row_height = 0;
+	unsigned height;
+	GLubyte *buffer;
+	size_t i;
+
+	// Find where each glyph will be stored. Leave a transparent pixel around each glyph.
+	for(i = 0; i < GLYPHS_COUNT; ++i)
+	{
+		const FT_Bitmap *restrict bitmap = &glyphs[i]->bitmap;
+
+		if (bitmap->width + 1 > FONT_ATLAS_WIDTH)
+			return ERROR_UNSUPPORTED;
+		if (x + bitmap->width + 1 > FONT_ATLAS_WIDTH)
+		{
+			x = 0;
+			y += row_height;
+			row_height = 0;
+		}
+
+		font->glyphs[i].x = x + 1;
+		font->glyphs[i].y = y + 1;
+
+		x += bitmap->width + 1;
+		if (bitmap->rows + 1 > row_height)
+			row_height = bitmap->rows + 1;
+	}
+	height = topower2(y + row_height + 1);
 
-	GLubyte *buffer = malloc(rows * width * 2 * sizeof(*buffer));
+	buffer = malloc(FONT_ATLAS_WIDTH * height * 2 * sizeof(*buffer));
 	if (!buffer)
 		return ERROR_MEMORY;
 
-	for(size_t y = 0; y < rows; y++) {
-		for(size_t x = 0; x < width; x++) {
-			size_t index = 2 * (y * width + x);
-			buffer[index] = 0xff;
-			if ((x < bitmap->width) && (y < bitmap->rows))
-				buffer[index + 1] = bitmap->buffer[bitmap->width * y + x];
-			else
-				buffer[index + 1] = 0;
-		}
+	// Use white with the glyph bitmap as alpha so that text is displayed in the current color.
+	for(i = 0; i < FONT_ATLAS_WIDTH * height; ++i)
+	{
+		buffer[i * 2] = 0xff;
+		buffer[i * 2 + 1] = 0;
+	}
+	for(i = 0; i < GLYPHS_COUNT; ++i)
+	{
+		const FT_Bitmap *restrict bitmap = &glyphs[i]->bitmap;
+		struct glyph *restrict glyph = font->glyphs + i;
+
+		for(size_t row = 0; row < bitmap->rows; ++row)
+			for(size_t column = 0; column < bitmap->width; ++column)
+				buffer[((glyph->y + row) * FONT_ATLAS_WIDTH + glyph->x + column) * 2 + 1] = bitmap->buffer[bitmap->pitch * row + column];
+
+		glyph->left = glyphs[i]->left;
+		glyph->top = glyphs[i]->top;
+		glyph->width = bitmap->width;
+		glyph->height = bitmap->rows;
+		glyph->coords[0] = (GLfloat)glyph->x / FONT_ATLAS_WIDTH;
+		glyph->coords[1] = (GLfloat)(glyph->y + glyph->height) / height;
+		glyph->coords[2] = (GLfloat)(glyph->x + glyph->width) / FONT_ATLAS_WIDTH;
+		glyph->coords[3] = (GLfloat)glyph->y / height;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, *texture);
+	glGenTextures(1, &font->texture);
+	glBindTexture(GL_TEXTURE_2D, font->texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, rows, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, buffer);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, FONT_ATLAS_WIDTH, height, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, buffer);
 
 	free(buffer);
 
@@ -75,75 +119,49 @@ static int bitmap_texture(FT_Bitmap *restrict bitmap, GLuint *restrict texture)
 
 static int font_load(FT_Library *restrict library, struct font *restrict font, unsigned size)
 {
-	const size_t count = sizeof(font->textures) / sizeof(*font->textures);
+	FT_BitmapGlyph glyphs[GLYPHS_COUNT];
+	size_t count;
+	int status = ERROR_MEMORY;
 
 	FT_Face face;
 	if (FT_New_Face(*library, TYPEFACE, 0, &face))
 		return ERROR_MISSING;
 	if (FT_Set_Char_Size(face, size * 64, size * 64, FONT_DPI, FONT_DPI))
+	{
+		FT_Done_Face(face);
 		return ERROR_INPUT;
+	}
 
-	font->base = glGenLists(count);
-	glGenTextures(count, font->textures);
 	font->size = size;
 
-	for(size_t i = 0; i < count; ++i)
+	for(count = 0; count < GLYPHS_COUNT; ++count)
 	{
-		if (FT_Load_Glyph(face, FT_Get_Char_Index(face, i), FT_LOAD_DEFAULT))
-			return ERROR_MEMORY;
+		if (FT_Load_Glyph(face, FT_Get_Char_Index(face, count), FT_LOAD_DEFAULT))
+			goto finally;
 
 		FT_Glyph glyph;
 		if (FT_Get_Glyph(face->glyph, &glyph))
-			return ERROR_MEMORY;
+			goto finally;
 
 		if (FT_Glyph_To_Bitmap(&glyph, ft_render_mode_normal, 0, 1))
-			return ERROR_MEMORY;
-
-		FT_BitmapGlyph glyph_bitmap = (FT_BitmapGlyph)glyph;
-		if (bitmap_texture(&glyph_bitmap->bitmap, font->textures + i) < 0)
-			return ERROR_MEMORY;
-
-		// Calculate glyph size relative to texture size.
-		double x = (double)glyph_bitmap->bitmap.width / topower2(glyph_bitmap->bitmap.width);
-		double y = (double)glyph_bitmap->bitmap.rows / topower2(glyph_bitmap->bitmap.rows);
-
-		// Create display list for the glyph.
-		glNewList(font->base + i, GL_COMPILE);
 		{
-			glPushMatrix();
-
-			glTranslatef(glyph_bitmap->left, size - glyph_bitmap->top, 0);
-			glBindTexture(GL_TEXTURE_2D, font->textures[i]);
-
-			glBegin(GL_QUADS);
-
-			glTexCoord2d(0, 0);
-			glVertex2f(0, 0);
-
-			glTexCoord2d(0, y);
-			glVertex2f(0, glyph_bitmap->bitmap.rows);
-
-			glTexCoord2d(x, y);
-			glVertex2f(glyph_bitmap->bitmap.width, glyph_bitmap->bitmap.rows);
-
-			glTexCoord2d(x, 0);
-			glVertex2f(glyph_bitmap->bitmap.width, 0);
-
-			glEnd();
-
-			glPopMatrix();
-
-			glTranslatef(face->glyph->advance.x / 64, 0, 0);
+			FT_Done_Glyph(glyph);
+			goto finally;
 		}
-		glEndList();
+		glyphs[count] = (FT_BitmapGlyph)glyph;
 
-		font->advance[i].x = face->glyph->advance.x / 64;
-		font->advance[i].y = face->glyph->advance.y / 64;
+		font->advance[count].x = face->glyph->advance.x / 64;
+		font->advance[count].y = face->glyph->advance.y / 64;
 	}
 
+	status = font_atlas(font, glyphs);
+
+finally:
+	while (count--)
+		FT_Done_Glyph((FT_Glyph)glyphs[count]);
 	FT_Done_Face(face);
 
-	return 0;
+	return status;
 }
 
 int font_init(void)
@@ -168,9 +186,7 @@ int font_init(void)
 
 static inline void font_unload(struct font *restrict font)
 {
-	const size_t count = sizeof(font->textures) / sizeof(*font->textures);
-	glDeleteLists(font->base, count);
-	glDeleteTextures(count, font->textures);
+	glDeleteTextures(1, &font->texture);
 }
 
 void font_term(void)
@@ -185,7 +201,10 @@ struct box string_box(const char *string, size_t length, struct font *restrict f
 	struct box box = {0, font->size};
 	while (length--)
 	{
-		struct advance advance = font->advance[(size_t)string[length]];
+		unsigned char character = string[length];
+		if (character >= GLYPHS_COUNT) continue; // no glyph for this character
+
+		struct advance advance = font->advance[character];
 		box.width += advance.x;
 		if (advance.y > box.height)
 			box.height = advance.y;
@@ -199,6 +218,7 @@ void draw_cursor(const char *string, size_t length, unsigned x, unsigned y, stru
 
 	struct box box = string_box(string, length, font);
 
+	sprites_flush();
 	glColor4ubv(display_colors[color]);
 
 	glBegin(GL_LINES);
@@ -209,19 +229,18 @@ void draw_cursor(const char *string, size_t length, unsigned x, unsigned y, stru
 
 unsigned draw_string(const char *string, size_t length, unsigned x, unsigned y, struct font *restrict font, enum color color)
 {
-	glEnable(GL_TEXTURE_2D);
-
-	glPushMatrix();
-	glLoadIdentity();
-	glTranslatef(x, y, 0);
+	unsigned start = x;
 
-	glListBase(font->base);
-	glColor4ubv(display_colors[color]);
-	glCallLists(length, GL_UNSIGNED_BYTE, string);
-
-	glPopMatrix();
+	for(size_t i = 0; i < length; ++i)
+	{
+		unsigned char character = string[i];
+		if (character >= GLYPHS_COUNT) continue; // no glyph for this character
 
-	glDisable(GL_TEXTURE_2D);
+		const struct glyph *restrict glyph = font->glyphs + character;
+		if (glyph->width)
+			sprite_draw(font->texture, glyph->coords, (int)x + glyph->left, (int)(y + font->size) - glyph->top, glyph->width, glyph->height, display_colors[color]);
+		x += font->advance[character].x;
+	}
 
-	return string_box(string, length, font).width;
+	return x - start;
 }
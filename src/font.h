@@ -26,8 +26,15 @@ struct box
 
 struct font
 {
-	GLuint textures[GLYPHS_COUNT];
-	GLuint base;
+	GLuint texture; // bitmaps of all glyphs
+
+	struct glyph
+	{
+		unsigned x, y; // position in the texture
+		unsigned width, height;
+		int left, top; // position relative to the pen
+		GLfloat coords[4]; // texture coordinates of the left, bottom, right and top edges
+	} glyphs[GLYPHS_COUNT];
 
 	struct advance
 	{
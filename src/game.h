@@ -17,8 +17,8 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#define PLAYERS_LIMIT 16
-#define NEIGHBORS_LIMIT 8
+#define PLAYERS_LIMIT 256 /* player and alliance indices are stored in unsigned char */
+#define DIRECTIONS_COUNT 8 /* directions from which a region can be entered on the battlefield */
 
 #define TRAIN_QUEUE 4
 
@@ -66,13 +66,19 @@ struct game
 	struct region *regions;
 	size_t regions_count;
 
+	// Neighbors of each region, initialized by neighbors_init().
+	uint32_t *neighbors_offsets;
+	uint32_t *neighbors;
+	unsigned char *neighbors_directions;
+
 	unsigned turn; // TODO implement this
 
-	size_t players_local[PLAYERS_LIMIT];
+	size_t *players_local;
 	size_t players_local_count;
 
+	// Bitsets of players, allocated by players_init().
 	pthread_mutex_t mutex_input; // used for accessing input_ready while handling individual players
-	uint32_t input_ready, input_all;
+	uint64_t *input_ready, *input_all, *input_processed;
 };
 
 struct unit
@@ -109,3 +115,13 @@ static inline int allies(const struct game *game, unsigned player0, unsigned pla
 {
 	return (game->players[player0].alliance == game->players[player1].alliance);
 }
+
+// Returns the number of entries necessary for a table indexed by alliance.
+static inline size_t alliances_count(const struct game *game)
+{
+	size_t count = 0;
+	for(size_t i = 0; i < game->players_count; ++i)
+		if (game->players[i].alliance >= count)
+			count = game->players[i].alliance + 1;
+	return count;
+}
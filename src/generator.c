@@ -0,0 +1,687 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "log.h"
+#include "game.h"
+#include "draw.h"
+#include "map.h"
+#include "world.h"
+
+// Generates random worlds of arbitrary size. The same seed always generates the same world.
+// Regions are the Voronoi cells of randomly placed sites. Regions sharing a long enough border are neighbors.
+
+#define S(s) (s), sizeof(s) - 1
+
+#define WIDTH_DEFAULT 768 /* MAP_WIDTH */
+#define HEIGHT_DEFAULT 768 /* MAP_HEIGHT */
+
+#define SITE_ATTEMPTS 32
+
+#define BORDER_MIN 0.2 /* minimum length of the border between neighbors (relative to the grid cell) */
+#define NEUTRAL_CHANCE 20 /* percent of the regions not owned by any player */
+#define BUILDING_CHANCE 25 /* percent of the buildings built in a region */
+
+struct parameters
+{
+	unsigned long seed;
+	size_t regions_count;
+	size_t players_count; // not counting the neutral player
+	size_t troops_count;
+	unsigned width, height;
+};
+
+struct site
+{
+	double x, y;
+};
+
+struct vertex
+{
+	double x, y;
+	ssize_t border; // index of the site on the other side of the edge starting at this vertex; -1 for the edge of the map
+};
+
+// Sites are grouped in a grid of square cells to limit the sites compared to one another.
+struct grid
+{
+	double size;
+	size_t columns, rows;
+	ssize_t *first; // first site in each grid cell
+	ssize_t *next; // next site in the same grid cell
+};
+
+struct border
+{
+	size_t regions[2];
+	double length;
+};
+
+static uint64_t random_state;
+
+static void random_seed(unsigned long seed)
+{
+	random_state = seed ^ 0x9e3779b97f4a7c15;
+	if (!random_state) random_state = 1;
+}
+
+// xorshift64*
+static uint32_t random_next(void)
+{
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (random_state * 2685821657736338717ull) >> 32;
+}
+
+static inline unsigned random_range(unsigned limit)
+{
+	return random_next() % limit;
+}
+
+static inline double random_real(double limit)
+{
+	return random_next() * (limit / 4294967296.0);
+}
+
+static inline double distance2(double x0, double y0, double x1, double y1)
+{
+	return (x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0);
+}
+
+static inline size_t grid_cell(const struct grid *restrict grid, size_t column, size_t row)
+{
+	return row * grid->columns + column;
+}
+
+static inline size_t grid_column(const struct grid *restrict grid, double x)
+{
+	size_t column = x / grid->size;
+	return ((column < grid->columns) ? column : grid->columns - 1);
+}
+
+static inline size_t grid_row(const struct grid *restrict grid, double y)
+{
+	size_t row = y / grid->size;
+	return ((row < grid->rows) ? row : grid->rows - 1);
+}
+
+// Places the sites randomly, trying to keep a minimum distance between them.
+static void sites_place(struct site *restrict sites, struct grid *restrict grid, const struct parameters *restrict parameters)
+{
+	double distance_min = grid->size / 2;
+	size_t i;
+
+	for(i = 0; i < grid->columns * grid->rows; ++i)
+		grid->first[i] = -1;
+
+	for(i = 0; i < parameters->regions_count; ++i)
+	{
+		struct site site;
+		size_t column, row;
+		size_t attempt;
+
+		for(attempt = 0; attempt < SITE_ATTEMPTS; ++attempt)
+		{
+			size_t x, y;
+
+			site.x = random_real(parameters->width);
+			site.y = random_real(parameters->height);
+			column = grid_column(grid, site.x);
+			row = grid_row(grid, site.y);
+
+			// The minimum distance is less than the size of a grid cell so only adjacent grid cells need to be checked.
+			for(y = (row ? row - 1 : 0); (y <= row + 1) && (y < grid->rows); ++y)
+				for(x = (column ? column - 1 : 0); (x <= column + 1) && (x < grid->columns); ++x)
+					for(ssize_t other = grid->first[grid_cell(grid, x, y)]; other >= 0; other = grid->next[other])
+						if (distance2(site.x, site.y, sites[other].x, sites[other].y) < distance_min * distance_min)
+							goto retry;
+			break;
+retry:
+			;
+		}
+
+		sites[i] = site;
+		grid->next[i] = grid->first[grid_cell(grid, column, row)];
+		grid->first[grid_cell(grid, column, row)] = i;
+	}
+}
+
+// Keeps the part of the polygon which is closer to site than to the other site.
+static size_t cell_clip(const struct vertex *restrict polygon, size_t count, struct vertex *restrict result, struct site site, struct site other, ssize_t other_index)
+{
+	// Keep the points p for which (p - middle) . (other - site) <= 0.
+	double dx = other.x - site.x, dy = other.y - site.y;
+	double mx = (site.x + other.x) / 2, my = (site.y + other.y) / 2;
+	size_t i, result_count = 0;
+
+	for(i = 0; i < count; ++i)
+	{
+		const struct vertex *current = polygon + i, *next = polygon + (i + 1) % count;
+		double current_side = (current->x - mx) * dx + (current->y - my) * dy;
+		double next_side = (next->x - mx) * dx + (next->y - my) * dy;
+		double t;
+
+		if (current_side <= 0)
+		{
+			result[result_count++] = *current;
+			if (next_side <= 0) continue;
+
+			// The edge leaves the cell. The border with the other site starts here.
+			t = current_side / (current_side - next_side);
+			result[result_count++] = (struct vertex){current->x + t * (next->x - current->x), current->y + t * (next->y - current->y), other_index};
+		}
+		else if (next_side <= 0)
+		{
+			// The edge enters the cell.
+			t = current_side / (current_side - next_side);
+			result[result_count++] = (struct vertex){current->x + t * (next->x - current->x), current->y + t * (next->y - current->y), current->border};
+		}
+	}
+
+	return result_count;
+}
+
+// Finds the Voronoi cell of a site. Returns the number of vertices of the cell and stores them in cell.
+static size_t cell_find(const struct site *restrict sites, const struct grid *restrict grid, size_t index, const struct parameters *restrict parameters, struct vertex *restrict cell, struct vertex *restrict buffer)
+{
+	struct site site = sites[index];
+	size_t column = grid_column(grid, site.x), row = grid_row(grid, site.y);
+	size_t count = 4;
+	size_t ring, i;
+
+	// Start with the whole map. The vertices are listed counterclockwise (on screen).
+	cell[0] = (struct vertex){0, 0, -1};
+	cell[1] = (struct vertex){0, parameters->height, -1};
+	cell[2] = (struct vertex){parameters->width, parameters->height, -1};
+	cell[3] = (struct vertex){parameters->width, 0, -1};
+
+	// Clip the cell with the sites in rings of grid cells around the site.
+	// Stop when the remaining sites are too far to affect the cell.
+	for(ring = 0; (ring < grid->columns) || (ring < grid->rows); ++ring)
+	{
+		double radius2 = 0;
+		size_t x, y;
+
+		for(i = 0; i < count; ++i)
+		{
+			double d = distance2(site.x, site.y, cell[i].x, cell[i].y);
+			if (d > radius2) radius2 = d;
+		}
+		if (ring && ((ring - 1) * grid->size) * ((ring - 1) * grid->size) >= 4 * radius2)
+			break;
+
+		for(y = ((row >= ring) ? row - ring : 0); (y <= row + ring) && (y < grid->rows); ++y)
+			for(x = ((column >= ring) ? column - ring : 0); (x <= column + ring) && (x < grid->columns); ++x)
+			{
+				if ((x + ring != column) && (x != column + ring) && (y + ring != row) && (y != row + ring))
+					continue; // the grid cell is not in the ring
+
+				for(ssize_t other = grid->first[grid_cell(grid, x, y)]; other >= 0; other = grid->next[other])
+				{
+					if (other == index) continue;
+					count = cell_clip(cell, count, buffer, site, sites[other], other);
+					memcpy(cell, buffer, count * sizeof(*cell));
+				}
+			}
+	}
+
+	return count;
+}
+
+static int border_compare(const void *a, const void *b)
+{
+	const struct border *left = a, *right = b;
+	return (left->length < right->length) - (left->length > right->length);
+}
+
+// Returns the direction (0 to 7) in which the neighbor is located.
+static unsigned direction(struct site site, struct site neighbor)
+{
+	long sector = lround(atan2(neighbor.y - site.y, neighbor.x - site.x) / (M_PI / 4));
+	return (sector + DIRECTIONS_COUNT) % DIRECTIONS_COUNT;
+}
+
+// Finds an unused direction, as close as possible to the preferred direction. Uses the preferred direction if all are used.
+static unsigned direction_free(unsigned char *restrict used, unsigned preferred)
+{
+	for(unsigned i = 0; i < DIRECTIONS_COUNT; ++i)
+	{
+		unsigned offset = (i + 1) / 2;
+		unsigned direction = ((i % 2) ? preferred + offset : preferred + DIRECTIONS_COUNT - offset) % DIRECTIONS_COUNT;
+		if (!(*used & (1 << direction)))
+		{
+			*used |= (1 << direction);
+			return direction;
+		}
+	}
+	return preferred;
+}
+
+// Regions get directions for their neighbors in the order of decreasing border length.
+static int neighbors_connect(struct game *restrict game, const struct site *restrict sites, struct border *restrict borders, size_t borders_count)
+{
+	struct region_link *links;
+	unsigned char *used; // bitmask of the directions used by each region
+	size_t i;
+	int status = ERROR_MEMORY;
+
+	links = malloc((borders_count ? borders_count * 2 : 1) * sizeof(*links));
+	used = calloc(game->regions_count, sizeof(*used));
+	if (!links || !used) goto finally;
+
+	qsort(borders, borders_count, sizeof(*borders), border_compare);
+	for(i = 0; i < borders_count; ++i)
+	{
+		size_t a = borders[i].regions[0], b = borders[i].regions[1];
+		links[i * 2] = (struct region_link){.region = a, .neighbor = b, .direction = direction_free(used + a, direction(sites[a], sites[b]))};
+		links[i * 2 + 1] = (struct region_link){.region = b, .neighbor = a, .direction = direction_free(used + b, direction(sites[b], sites[a]))};
+	}
+
+	status = neighbors_init(game, links, borders_count * 2);
+
+finally:
+	free(used);
+	free(links);
+	return status;
+}
+
+static void region_name(struct region *restrict region, size_t regions_count, const char *const syllables[static 16])
+{
+	size_t length = 2, limit = 16 * 16;
+	size_t index = region->index;
+
+	// Each index is encoded with the same number of syllables so that all names are different.
+	while (limit < regions_count)
+	{
+		length += 1;
+		limit *= 16;
+	}
+
+	region->name_length = 0;
+	while (length--)
+	{
+		const char *syllable = syllables[index % 16];
+		size_t size = strlen(syllable);
+		memcpy(region->name + region->name_length, syllable, size);
+		region->name_length += size;
+		index /= 16;
+	}
+	region->name[0] = region->name[0] - 'a' + 'A';
+}
+
+// Converts the Voronoi cell to the location of the region.
+static int region_locate(struct region *restrict region, const struct vertex *restrict cell, size_t count)
+{
+	struct polygon *location;
+	double area = 0, x = 0, y = 0;
+	size_t i, top = 0;
+
+	location = malloc(offsetof(struct polygon, points) + count * sizeof(struct point));
+	if (!location) return ERROR_MEMORY;
+	location->vertices_count = 0;
+	for(i = 0; i < count; ++i)
+	{
+		struct point point = {lround(cell[i].x), lround(cell[i].y)};
+		const struct point *last = location->points + location->vertices_count - 1;
+
+		if (location->vertices_count && (point.x == last->x) && (point.y == last->y))
+			continue;
+		location->points[location->vertices_count++] = point;
+	}
+	if ((location->vertices_count > 1) && !memcmp(location->points, location->points + location->vertices_count - 1, sizeof(struct point)))
+		location->vertices_count -= 1;
+	region->location = location;
+	if (location->vertices_count < 3)
+		return ERROR_INPUT; // region too small
+
+	// Place the troops at the centroid of the cell and the garrison between the centroid and the top of the cell.
+	// The cell is convex so both points are inside it.
+	for(i = 0; i < count; ++i)
+	{
+		const struct vertex *current = cell + i, *next = cell + (i + 1) % count;
+		double cross = current->x * next->y - next->x * current->y;
+		area += cross;
+		x += (current->x + next->x) * cross;
+		y += (current->y + next->y) * cross;
+		if (cell[i].y < cell[top].y) top = i;
+	}
+	x /= 3 * area;
+	y /= 3 * area;
+	region->center = (struct point){lround(x), lround(y)};
+	region->location_garrison = (struct point){lround((x + cell[top].x) / 2), lround((y + cell[top].y) / 2)};
+
+	return 0;
+}
+
+static const struct unit *unit_random(const struct region *restrict region)
+{
+	const struct unit *available[UNITS_COUNT];
+	size_t count = 0;
+
+	for(size_t i = 0; i < UNITS_COUNT; ++i)
+		if (region_unit_available(region, UNITS[i]))
+			available[count++] = UNITS + i;
+	return available[random_range(count)]; // peasants are always available
+}
+
+// Assigns the regions to players. Each player gets a capital and the regions closest to it.
+static int regions_own(struct game *restrict game, const struct site *restrict sites)
+{
+	size_t *queue;
+	size_t queue_begin = 0, queue_end = 0;
+	size_t i, j;
+
+	queue = malloc(game->regions_count * sizeof(*queue));
+	if (!queue) return ERROR_MEMORY;
+
+	for(i = 0; i < game->regions_count; ++i)
+		game->regions[i].owner = PLAYER_NEUTRAL;
+
+	// Spread the capitals by choosing each one as far as possible from the previous ones.
+	for(size_t player = 1; player < game->players_count; ++player)
+	{
+		size_t capital = 0;
+		double farthest = -1;
+
+		if (player == 1) capital = random_range(game->regions_count);
+		else for(i = 0; i < game->regions_count; ++i)
+		{
+			double closest = INFINITY;
+			if (game->regions[i].owner != PLAYER_NEUTRAL) continue;
+			for(j = 0; j < queue_end; ++j)
+			{
+				double d = distance2(sites[i].x, sites[i].y, sites[queue[j]].x, sites[queue[j]].y);
+				if (d < closest) closest = d;
+			}
+			if (closest > farthest)
+			{
+				farthest = closest;
+				capital = i;
+			}
+		}
+
+		game->regions[capital].owner = player;
+		game->regions[capital].built |= (1 << BuildingPalisade);
+		queue[queue_end++] = capital;
+	}
+
+	// Expand the territory of each player in breadth-first order.
+	while (queue_begin < queue_end)
+	{
+		const struct region *region = game->regions + queue[queue_begin++];
+		for(j = region_neighbors_begin(game, region); j < region_neighbors_end(game, region); ++j)
+		{
+			struct region *neighbor = region_neighbor(game, j);
+			if (neighbor->owner != PLAYER_NEUTRAL) continue;
+			neighbor->owner = region->owner;
+			queue[queue_end++] = neighbor->index;
+		}
+	}
+
+	// Leave some regions to the neutral player.
+	for(i = game->players_count - 1; i < queue_end; ++i)
+		if (random_range(100) < NEUTRAL_CHANCE)
+			game->regions[queue[i]].owner = PLAYER_NEUTRAL;
+
+	free(queue);
+	return 0;
+}
+
+static int regions_populate(struct game *restrict game, size_t troops_count)
+{
+	size_t i, j;
+
+	for(i = 0; i < game->regions_count; ++i)
+	{
+		struct region *restrict region = game->regions + i;
+		const struct garrison_info *restrict garrison;
+
+		region->population = 2000 + random_range(18000);
+
+		for(j = 0; j < BUILDINGS_COUNT; ++j)
+			if (region_building_available(region, BUILDINGS + j) && (random_range(100) < BUILDING_CHANCE))
+				region->built |= (1 << j);
+
+		region->garrison.owner = region->owner;
+		if (garrison = garrison_info(region))
+		{
+			unsigned count = random_range(garrison->troops + 1);
+			while (count--)
+			{
+				const struct unit *unit = unit_random(region);
+				if (troop_spawn(LOCATION_GARRISON, &region->troops, unit, unit->troops_count, region->owner) < 0)
+					return ERROR_MEMORY;
+			}
+		}
+	}
+
+	// Troops outside of garrisons are located in regions of their owner.
+	for(i = 0; i < troops_count; ++i)
+	{
+		struct region *restrict region = game->regions + random_range(game->regions_count);
+		const struct unit *unit = unit_random(region);
+		if (troop_spawn(region, &region->troops, unit, unit->troops_count, region->owner) < 0)
+			return ERROR_MEMORY;
+	}
+
+	return 0;
+}
+
+static int world_generate(struct game *restrict game, const struct parameters *restrict parameters)
+{
+	static const char *syllables[16] = {"ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "dra", "gor", "len", "mar", "tho", "bel", "zan", "qui"};
+	const char *shuffled[16];
+
+	struct site *sites = 0;
+	struct grid grid = {0};
+	struct vertex *cell = 0, *buffer = 0;
+	struct border *borders = 0;
+	size_t borders_count = 0, borders_capacity = 0;
+	size_t i, j;
+	int status = ERROR_MEMORY;
+
+	random_seed(parameters->seed);
+
+	game->players_count = parameters->players_count + 1;
+	game->players = calloc(game->players_count, sizeof(*game->players));
+	game->regions_count = parameters->regions_count;
+	game->regions = calloc(game->regions_count, sizeof(*game->regions));
+	game->turn = 0;
+	game->neighbors_offsets = 0;
+	game->neighbors = 0;
+	game->neighbors_directions = 0;
+	if (!game->players || !game->regions) goto finally;
+
+	for(i = 0; i < game->players_count; ++i)
+	{
+		struct player *restrict player = game->players + i;
+		player->type = (i ? Computer : Neutral);
+		player->alliance = i;
+		if (i)
+		{
+			player->name_length = sprintf(player->name, "Player %u", (unsigned)i);
+			player->treasury = (struct resources){.gold = 100, .food = 60, .wood = 60, .stone = 30};
+		}
+	}
+
+	grid.size = sqrt((double)parameters->width * parameters->height / parameters->regions_count);
+	grid.columns = parameters->width / grid.size + 1;
+	grid.rows = parameters->height / grid.size + 1;
+	grid.first = malloc(grid.columns * grid.rows * sizeof(*grid.first));
+	grid.next = malloc(parameters->regions_count * sizeof(*grid.next));
+	sites = malloc(parameters->regions_count * sizeof(*sites));
+	cell = malloc((parameters->regions_count + 4) * sizeof(*cell)); // a cell has at most one edge for each other site and the map
+	buffer = malloc((parameters->regions_count + 4) * sizeof(*buffer));
+	if (!grid.first || !grid.next || !sites || !cell || !buffer) goto finally;
+
+	sites_place(sites, &grid, parameters);
+
+	memcpy(shuffled, syllables, sizeof(syllables));
+	for(i = 16; i > 1; --i)
+	{
+		const char *swap;
+		j = random_range(i);
+		swap = shuffled[i - 1];
+		shuffled[i - 1] = shuffled[j];
+		shuffled[j] = swap;
+	}
+
+	for(i = 0; i < game->regions_count; ++i)
+	{
+		struct region *restrict region = game->regions + i;
+		size_t count;
+
+		region->index = i;
+		region_name(region, game->regions_count, shuffled);
+		region->construct = -1;
+		region->workers.food = 40;
+
+		count = cell_find(sites, &grid, i, parameters, cell, buffer);
+		status = region_locate(region, cell, count);
+		if (status < 0)
+		{
+			LOG_ERROR("Region %u is too small.", (unsigned)i);
+			goto finally;
+		}
+		status = ERROR_MEMORY;
+
+		// Remember the borders with the regions following this one.
+		for(j = 0; j < count; ++j)
+		{
+			const struct vertex *current = cell + j, *next = cell + (j + 1) % count;
+			double length;
+
+			if (current->border <= (ssize_t)i) continue;
+			length = sqrt(distance2(current->x, current->y, next->x, next->y));
+			if (length < BORDER_MIN * grid.size) continue;
+
+			if (borders_count == borders_capacity)
+			{
+				size_t capacity = (borders_capacity ? borders_capacity * 2 : 64);
+				struct border *resized = realloc(borders, capacity * sizeof(*borders));
+				if (!resized) goto finally;
+				borders = resized;
+				borders_capacity = capacity;
+			}
+			borders[borders_count++] = (struct border){{i, current->border}, length};
+		}
+	}
+
+	status = neighbors_connect(game, sites, borders, borders_count);
+	if (status < 0) goto finally;
+
+	status = regions_own(game, sites);
+	if (status < 0) goto finally;
+
+	status = regions_populate(game, parameters->troops_count);
+
+finally:
+	free(borders);
+	free(buffer);
+	free(cell);
+	free(sites);
+	free(grid.next);
+	free(grid.first);
+	return status;
+}
+
+static void world_free(struct game *restrict game)
+{
+	if (game->regions)
+		for(size_t i = 0; i < game->regions_count; ++i)
+			while (game->regions[i].troops)
+				troop_remove(&game->regions[i].troops, game->regions[i].troops);
+	world_unload(game);
+}
+
+int main(int argc, char *argv[])
+{
+	struct game game;
+	struct parameters parameters = {
+		.seed = 1,
+		.regions_count = 64,
+		.players_count = 4,
+		.troops_count = 64,
+		.width = WIDTH_DEFAULT,
+		.height = HEIGHT_DEFAULT,
+	};
+	int option;
+	int status;
+
+	while ((option = getopt(argc, argv, "s:r:p:t:w:h:")) >= 0)
+	{
+		switch (option)
+		{
+		case 's':
+			parameters.seed = strtoul(optarg, 0, 10);
+			break;
+		case 'r':
+			parameters.regions_count = strtoul(optarg, 0, 10);
+			break;
+		case 'p':
+			parameters.players_count = strtoul(optarg, 0, 10);
+			break;
+		case 't':
+			parameters.troops_count = strtoul(optarg, 0, 10);
+			break;
+		case 'w':
+			parameters.width = strtoul(optarg, 0, 10);
+			break;
+		case 'h':
+			parameters.height = strtoul(optarg, 0, 10);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind + 1 != argc)
+		goto usage;
+
+	if (!parameters.regions_count || (parameters.regions_count > REGIONS_LIMIT))
+	{
+		LOG_ERROR("The number of regions must be between 1 and %u.", (unsigned)REGIONS_LIMIT);
+		return ERROR_INPUT;
+	}
+	if (!parameters.players_count || (parameters.players_count >= PLAYERS_LIMIT) || (parameters.players_count > parameters.regions_count))
+	{
+		LOG_ERROR("The number of players must be between 1 and %u and must not exceed the number of regions.", (unsigned)PLAYERS_LIMIT - 1);
+		return ERROR_INPUT;
+	}
+	if (!parameters.width || !parameters.height)
+		goto usage;
+
+	status = world_generate(&game, &parameters);
+	if (!status) status = world_save(&game, argv[optind]);
+	world_free(&game);
+	if (status < 0) LOG_ERROR("Cannot generate world (%d).", status);
+	return status;
+
+usage:
+	write(2, S("Usage: generator [-s seed] [-r regions] [-p players] [-t troops] [-w width] [-h height] <world>\n"));
+	return ERROR_INPUT;
+}
@@ -0,0 +1,252 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+
+// The hashmap is expanded when it is more than 7/8 full.
+#define HASHMAP_OPEN_LOAD(slots_count) ((slots_count) - (slots_count) / 8)
+
+// Hashes the key 8 bytes at a time.
+static uint32_t hashmap_open_hash(const unsigned char *restrict data, size_t size)
+{
+	const uint64_t multiplier = 0x9e3779b97f4a7c15;
+	uint64_t result = size * multiplier;
+	uint64_t word;
+
+	for(; size >= sizeof(word); data += sizeof(word), size -= sizeof(word))
+	{
+		memcpy(&word, data, sizeof(word));
+		result = (result ^ word) * multiplier;
+		result ^= result >> 32;
+	}
+	if (size)
+	{
+		word = 0;
+		memcpy(&word, data, size);
+		result = (result ^ word) * multiplier;
+		result ^= result >> 32;
+	}
+
+	// Mix the high bits into the low bits because the slot index is taken from the low bits.
+	result ^= result >> 29;
+	result *= 0xbf58476d1ce4e5b9;
+	result ^= result >> 32;
+
+	return ((uint32_t)result | !(uint32_t)result); // 0 is reserved for empty slots
+}
+
+// Returns the distance of the entry from its preferred slot.
+static inline size_t hashmap_open_distance(const struct hashmap_open *restrict hashmap, uint32_t hash, size_t index)
+{
+	return (index - hash) & (hashmap->slots_count - 1);
+}
+
+static inline int hashmap_open_key_eq(const struct hashmap_open_entry *restrict entry, const unsigned char *restrict key_data, size_t key_size, uint32_t hash)
+{
+	return ((entry->hash == hash) && (entry->key_size == key_size) && !memcmp(hashmap_open_key(entry), key_data, key_size));
+}
+
+int hashmap_open_init(struct hashmap_open *hashmap, size_t slots_count)
+{
+	size_t i;
+
+	hashmap->count = 0;
+	hashmap->slots_count = slots_count;
+	hashmap->slots = malloc(slots_count * sizeof(*hashmap->slots));
+	if (!hashmap->slots) return ERROR_MEMORY;
+
+	for(i = 0; i < slots_count; ++i)
+		hashmap->slots[i].hash = 0;
+
+	return 0;
+}
+
+// Returns the index of the slot with the specified key or slots_count if the key is missing.
+static size_t hashmap_open_find(const struct hashmap_open *restrict hashmap, const unsigned char *restrict key_data, size_t key_size, uint32_t hash)
+{
+	size_t mask = hashmap->slots_count - 1;
+	size_t index = hash & mask;
+	size_t distance;
+
+	// Entries are ordered by distance so the search can stop at the first entry closer to its preferred slot.
+	for(distance = 0; hashmap->slots[index].hash; ++distance)
+	{
+		const struct hashmap_open_entry *restrict entry = hashmap->slots + index;
+		if (hashmap_open_distance(hashmap, entry->hash, index) < distance) break;
+		if (hashmap_open_key_eq(entry, key_data, key_size, hash)) return index;
+		index = (index + 1) & mask;
+	}
+
+	return hashmap->slots_count; // missing
+}
+
+hashmap_type *hashmap_open_get(const struct hashmap_open *restrict hashmap, const unsigned char *restrict key_data, size_t key_size)
+{
+	size_t index = hashmap_open_find(hashmap, key_data, key_size, hashmap_open_hash(key_data, key_size));
+	if (index == hashmap->slots_count) return 0; // missing
+	return &hashmap->slots[index].value;
+}
+
+// Places the entry in the slot array. Returns the slot where the entry is stored.
+// Assumes the key is not in the hashmap and there is a free slot.
+static struct hashmap_open_entry *hashmap_open_place(struct hashmap_open *restrict hashmap, struct hashmap_open_entry entry)
+{
+	size_t mask = hashmap->slots_count - 1;
+	size_t index = entry.hash & mask;
+	size_t distance = 0;
+	struct hashmap_open_entry *result = 0;
+
+	while (hashmap->slots[index].hash)
+	{
+		struct hashmap_open_entry *restrict slot = hashmap->slots + index;
+		size_t slot_distance = hashmap_open_distance(hashmap, slot->hash, index);
+
+		// Take the slot of an entry closer to its preferred slot and continue placing that entry.
+		if (slot_distance < distance)
+		{
+			struct hashmap_open_entry swap = *slot;
+			*slot = entry;
+			entry = swap;
+			distance = slot_distance;
+			if (!result) result = slot;
+		}
+
+		index = (index + 1) & mask;
+		distance += 1;
+	}
+
+	hashmap->slots[index] = entry;
+	return (result ? result : hashmap->slots + index);
+}
+
+static int hashmap_open_expand(struct hashmap_open *hashmap)
+{
+	struct hashmap_open_entry *slots = hashmap->slots;
+	size_t slots_count = hashmap->slots_count;
+	size_t count = hashmap->count;
+	size_t i;
+
+	if (hashmap_open_init(hashmap, slots_count * 2) < 0)
+	{
+		hashmap->count = count;
+		hashmap->slots_count = slots_count;
+		hashmap->slots = slots;
+		return ERROR_MEMORY;
+	}
+	hashmap->count = count;
+
+	for(i = 0; i < slots_count; ++i)
+		if (slots[i].hash)
+			hashmap_open_place(hashmap, slots[i]);
+
+	free(slots);
+	return 0;
+}
+
+hashmap_type *hashmap_open_insert(struct hashmap_open *restrict hashmap, const unsigned char *restrict key_data, size_t key_size, hashmap_type value)
+{
+	uint32_t hash = hashmap_open_hash(key_data, key_size);
+	struct hashmap_open_entry entry;
+	size_t index;
+
+	// Look for an entry with the specified key in the hashmap.
+	index = hashmap_open_find(hashmap, key_data, key_size, hash);
+	if (index < hashmap->slots_count)
+		return &hashmap->slots[index].value; // the specified key exists in the hashmap
+
+	// Enlarge the hashmap if the probe sequences would become too long.
+	if (hashmap->count >= HASHMAP_OPEN_LOAD(hashmap->slots_count))
+		if (hashmap_open_expand(hashmap) < 0)
+			return 0;
+
+	entry.hash = hash;
+	entry.key_size = key_size;
+	entry.value = value;
+	if (key_size <= HASHMAP_OPEN_INLINE)
+	{
+		memcpy(entry.key.data, key_data, key_size);
+	}
+	else
+	{
+		entry.key.pointer = malloc(key_size);
+		if (!entry.key.pointer) return 0;
+		memcpy(entry.key.pointer, key_data, key_size);
+	}
+
+	hashmap->count += 1;
+	return &hashmap_open_place(hashmap, entry)->value;
+}
+
+int hashmap_open_remove(struct hashmap_open *restrict hashmap, const unsigned char *restrict key_data, size_t key_size, hashmap_type *value_old)
+{
+	size_t mask = hashmap->slots_count - 1;
+	size_t index, next;
+
+	index = hashmap_open_find(hashmap, key_data, key_size, hashmap_open_hash(key_data, key_size));
+	if (index == hashmap->slots_count) return ERROR_MISSING;
+
+	if (value_old) *value_old = hashmap->slots[index].value;
+	if (hashmap->slots[index].key_size > HASHMAP_OPEN_INLINE)
+		free(hashmap->slots[index].key.pointer);
+
+	// Shift back the following entries until an empty slot or an entry in its preferred slot.
+	for(next = (index + 1) & mask; hashmap->slots[next].hash && hashmap_open_distance(hashmap, hashmap->slots[next].hash, next); next = (next + 1) & mask)
+	{
+		hashmap->slots[index] = hashmap->slots[next];
+		index = next;
+	}
+	hashmap->slots[index].hash = 0;
+	hashmap->count -= 1;
+
+	return 0;
+}
+
+// Returns the first used slot starting from index.
+static struct hashmap_open_entry *hashmap_open_iterate(const struct hashmap_open *restrict hashmap, struct hashmap_open_iterator *restrict iterator, size_t index)
+{
+	for(; index < hashmap->slots_count; ++index)
+		if (hashmap->slots[index].hash)
+		{
+			iterator->index = index;
+			return hashmap->slots + index;
+		}
+	return 0; // no more entries
+}
+
+struct hashmap_open_entry *hashmap_open_first(const struct hashmap_open *restrict hashmap, struct hashmap_open_iterator *restrict iterator)
+{
+	return hashmap_open_iterate(hashmap, iterator, 0);
+}
+
+struct hashmap_open_entry *hashmap_open_next(const struct hashmap_open *restrict hashmap, struct hashmap_open_iterator *restrict iterator)
+{
+	return hashmap_open_iterate(hashmap, iterator, iterator->index + 1);
+}
+
+void hashmap_open_term(struct hashmap_open *hashmap)
+{
+	size_t i;
+	for(i = 0; i < hashmap->slots_count; ++i)
+		if (hashmap->slots[i].hash && (hashmap->slots[i].key_size > HASHMAP_OPEN_INLINE))
+			free(hashmap->slots[i].key.pointer);
+	free(hashmap->slots);
+}
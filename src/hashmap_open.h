@@ -0,0 +1,67 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Open addressing hashmap with Robin Hood probing.
+// Entries are stored directly in the slot array. Keys up to HASHMAP_OPEN_INLINE bytes are stored in the slot.
+// Inserting or removing an entry may move other entries so pointers returned by the functions are only valid until the hashmap is modified.
+
+#if !defined(hashmap_type)
+# define hashmap_type void *
+#endif
+
+#define HASHMAP_OPEN_INLINE 16
+
+struct hashmap_open
+{
+	size_t count;
+	size_t slots_count;
+	struct hashmap_open_entry
+	{
+		uint32_t hash; // 0 for empty slots
+		uint32_t key_size;
+		union
+		{
+			unsigned char data[HASHMAP_OPEN_INLINE];
+			unsigned char *pointer;
+		} key;
+		hashmap_type value;
+	} *slots;
+};
+
+struct hashmap_open_iterator
+{
+	size_t index;
+};
+
+static inline const unsigned char *hashmap_open_key(const struct hashmap_open_entry *restrict entry)
+{
+	return ((entry->key_size <= HASHMAP_OPEN_INLINE) ? entry->key.data : entry->key.pointer);
+}
+
+int hashmap_open_init(struct hashmap_open *hashmap, size_t slots_count);
+
+hashmap_type *hashmap_open_get(const struct hashmap_open *restrict hashmap, const unsigned char *restrict key_data, size_t key_size);
+
+hashmap_type *hashmap_open_insert(struct hashmap_open *restrict hashmap, const unsigned char *restrict key_data, size_t key_size, hashmap_type value);
+int hashmap_open_remove(struct hashmap_open *restrict hashmap, const unsigned char *restrict key_data, size_t key_size, hashmap_type *value_old);
+
+struct hashmap_open_entry *hashmap_open_first(const struct hashmap_open *restrict hashmap, struct hashmap_open_iterator *restrict iterator);
+struct hashmap_open_entry *hashmap_open_next(const struct hashmap_open *restrict hashmap, struct hashmap_open_iterator *restrict iterator);
+
+void hashmap_open_term(struct hashmap_open *hashmap);
@@ -19,7 +19,11 @@
 
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -28,11 +32,31 @@
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 
+#include "errors.h"
+#include "draw.h"
 #include "image.h"
 
 #define MAGIC_NUMBER_SIZE 8
 
-int image_load_png(struct image *restrict image, const char *restrict filename, void (*modify)(const struct image *restrict, png_byte **))
+// Images are decoded in parallel by this many threads at most.
+#define IMAGES_WORKERS_LIMIT 8
+
+struct images_worker
+{
+	struct image_source *sources;
+	size_t start, end; // range of sources decoded by the worker
+};
+
+// Returns the size of a row of pixels in bytes. glTexImage2d requires rows to be 4-byte aligned.
+static inline size_t image_rowbytes(unsigned width, unsigned channels)
+{
+	size_t rowbytes = width * channels;
+	return rowbytes + 3 - ((rowbytes - 1) % 4);
+}
+
+// Reads a PNG file and stores its pixels in *rows, starting from the bottom row.
+// The pixels are followed by pointers to each row. The caller must free the buffer with free(*rows).
+static int image_decode(struct image *restrict image, const char *restrict filename, void (*modify)(const struct image *restrict, png_byte **), png_byte ***rows_result, GLint *restrict format_result)
 {
 	int img;
 	struct stat info;
@@ -147,18 +171,456 @@ int image_load_png(struct image *restrict image, const char *restrict filename,
 	if (modify)
 		modify(image, rows);
 
-	// Generate the OpenGL texture object.
+	*rows_result = rows;
+	*format_result = format;
+	return 0;
+}
+
+// Generates a texture of its own for the image.
+static void image_texture(struct image *restrict image, GLint format, const png_byte *restrict image_data)
+{
 	glGenTextures(1, &image->texture);
 	glBindTexture(GL_TEXTURE_2D, image->texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, format, image->width, image->height, 0, format, GL_UNSIGNED_BYTE, image_data);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+	image->coords[0] = 0;
+	image->coords[1] = 0;
+	image->coords[2] = 1;
+	image->coords[3] = 1;
+}
+
+int image_load_png(struct image *restrict image, const char *restrict filename, void (*modify)(const struct image *restrict, png_byte **))
+{
+	png_byte **rows;
+	GLint format;
+
+	if (image_decode(image, filename, modify, &rows, &format) < 0)
+		return -1;
+	image_texture(image, format, (png_byte *)(rows + image->height));
+	free(rows);
+
+	return 0;
+}
+
+int atlas_init(struct atlas *restrict atlas, unsigned width, unsigned height)
+{
+	atlas->pixels = calloc((size_t)width * height, 4);
+	if (!atlas->pixels)
+		return ERROR_MEMORY;
+
+	glGenTextures(1, &atlas->texture);
+	atlas->width = width;
+	atlas->height = height;
+	atlas->x = 0;
+	atlas->y = 0;
+	atlas->row_height = 0;
+
+	return 0;
+}
+
+// Stores the decoded image in the atlas and frees the rows. An image that doesn't fit in the atlas gets a texture of its own.
+static void atlas_insert(struct atlas *restrict atlas, struct image *restrict image, GLint format, png_byte **rows)
+{
+	const png_byte *image_data = (png_byte *)(rows + image->height);
+	unsigned channels = ((format == GL_RGBA) ? 4 : 3);
+	size_t rowbytes = image_rowbytes(image->width, channels);
+
+	// Start a new row of images if there is no space left in the current one.
+	if (atlas->x + image->width > atlas->width)
+	{
+		atlas->x = 0;
+		atlas->y += atlas->row_height;
+		atlas->row_height = 0;
+	}
+	if ((atlas->x + image->width > atlas->width) || (atlas->y + image->height > atlas->height))
+	{
+		image_texture(image, format, image_data);
+		free(rows);
+		return;
+	}
+
+	for(size_t y = 0; y < image->height; ++y)
+	{
+		const png_byte *restrict from = image_data + y * rowbytes;
+		unsigned char *restrict to = atlas->pixels + ((atlas->y + y) * atlas->width + atlas->x) * 4;
+		for(size_t x = 0; x < image->width; ++x)
+		{
+			to[x * 4] = from[x * channels];
+			to[x * 4 + 1] = from[x * channels + 1];
+			to[x * 4 + 2] = from[x * channels + 2];
+			to[x * 4 + 3] = ((channels == 4) ? from[x * channels + 3] : 255);
+		}
+	}
 	free(rows);
 
+	image->texture = atlas->texture;
+	image->coords[0] = (GLfloat)atlas->x / atlas->width;
+	image->coords[1] = (GLfloat)atlas->y / atlas->height;
+	image->coords[2] = (GLfloat)(atlas->x + image->width) / atlas->width;
+	image->coords[3] = (GLfloat)(atlas->y + image->height) / atlas->height;
+
+	// Leave a transparent pixel between the images.
+	atlas->x += image->width + 1;
+	if (image->height + 1 > atlas->row_height)
+		atlas->row_height = image->height + 1;
+}
+
+// Decodes the image of the source and prepares its variant from a copy of the pixels.
+static void image_source_decode(struct image_source *restrict source)
+{
+	size_t size, rowbytes;
+	png_byte *image_data;
+
+	source->rows = 0;
+	source->rows_variant = 0;
+
+	source->status = image_decode(source->image, source->filename, 0, &source->rows, &source->format);
+	if (source->status < 0)
+		return;
+	if (!source->variant)
+		return;
+
+	*source->variant = *source->image;
+	rowbytes = image_rowbytes(source->image->width, ((source->format == GL_RGBA) ? 4 : 3));
+	size = source->image->height * rowbytes;
+
+	source->rows_variant = malloc(source->image->height * sizeof(png_byte *) + size);
+	if (!source->rows_variant)
+	{
+		free(source->rows);
+		source->status = ERROR_MEMORY;
+		return;
+	}
+	image_data = (png_byte *)(source->rows_variant + source->image->height);
+	memcpy(image_data, source->rows + source->image->height, size);
+	for(size_t i = 0; i < source->image->height; i++)
+		source->rows_variant[source->image->height - 1 - i] = image_data + i * rowbytes;
+
+	source->modify(source->variant, source->rows_variant);
+}
+
+static void *images_worker_main(void *argument)
+{
+	struct images_worker *restrict worker = argument;
+
+	for(size_t i = worker->start; i < worker->end; ++i)
+		image_source_decode(worker->sources + i);
+
+	return 0;
+}
+
+// The cache file stores the pixels of the atlas and the position of each image in it.
+// It is valid as long as the image files and the program are not modified.
+// Rebuilding the program invalidates the cache, so changes to the atlas layout or to the functions deriving variants are always detected.
+
+#define ATLAS_CACHE_MAGIC "levatlas"
+#define ATLAS_CACHE_VERSION 2
+
+#define TEMP_SUFFIX ".XXXXXX"
+
+struct atlas_cache_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t x, y, row_height;
+	uint32_t count;
+	uint64_t filenames; // hash of the names of the image files and the functions deriving their variants
+	int64_t program_sec, program_nsec, program_size; // modification time and size of the program
+};
+
+struct atlas_cache_image
+{
+	uint32_t width, height;
+	GLfloat coords[4];
+};
+
+struct atlas_cache_entry
+{
+	int64_t modified_sec, modified_nsec, size;
+	struct atlas_cache_image image, variant;
+};
+
+// Identifies the function deriving a variant. Each function has a number of its own.
+static unsigned atlas_cache_modify(void (*modify)(const struct image *restrict, png_byte **))
+{
+	if (!modify) return 0;
+	if (modify == image_grayscale) return 1;
+	if (modify == image_mask) return 2;
+	return 3;
+}
+
+static uint64_t atlas_cache_filenames(const struct image_source *restrict sources, size_t count)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for(size_t i = 0; i < count; ++i)
+	{
+		for(const unsigned char *c = sources[i].filename; *c; ++c)
+			hash = (hash ^ *c) * 0x100000001b3;
+		hash = (hash ^ (sources[i].variant ? atlas_cache_modify(sources[i].modify) : 0)) * 0x100000001b3;
+	}
+	return hash;
+}
+
+// Fills the header and the file information of the entries.
+static int atlas_cache_prepare(const struct atlas *restrict atlas, const struct image_source *restrict sources, size_t count, struct atlas_cache_header *restrict header, struct atlas_cache_entry *restrict entries)
+{
+	struct stat program;
+
+	if (stat("/proc/self/exe", &program) < 0)
+		return ERROR_MISSING;
+
+	*header = (struct atlas_cache_header){
+		.version = ATLAS_CACHE_VERSION,
+		.width = atlas->width,
+		.height = atlas->height,
+		.x = atlas->x,
+		.y = atlas->y,
+		.row_height = atlas->row_height,
+		.count = count,
+		.filenames = atlas_cache_filenames(sources, count),
+		.program_sec = program.st_mtim.tv_sec,
+		.program_nsec = program.st_mtim.tv_nsec,
+		.program_size = program.st_size,
+	};
+	memcpy(header->magic, ATLAS_CACHE_MAGIC, sizeof(header->magic));
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		struct stat info;
+		if (stat(sources[i].filename, &info) < 0)
+			return ERROR_MISSING;
+		entries[i] = (struct atlas_cache_entry){
+			.modified_sec = info.st_mtim.tv_sec,
+			.modified_nsec = info.st_mtim.tv_nsec,
+			.size = info.st_size,
+		};
+	}
+
 	return 0;
 }
 
+static void atlas_cache_image_set(struct image *restrict image, const struct atlas *restrict atlas, const struct atlas_cache_image *restrict cached)
+{
+	image->texture = atlas->texture;
+	image->width = cached->width;
+	image->height = cached->height;
+	memcpy(image->coords, cached->coords, sizeof(image->coords));
+}
+
+// Loads the images from the cache if the cache is valid.
+static int atlas_cache_load(struct atlas *restrict atlas, struct image_source *restrict sources, size_t count, const char *restrict cache)
+{
+	struct atlas_cache_header header, header_cached;
+	struct atlas_cache_entry *entries, *entries_cached;
+	FILE *file;
+	int status;
+
+	entries = malloc(count * 2 * sizeof(*entries));
+	if (!entries)
+		return ERROR_MEMORY;
+	entries_cached = entries + count;
+
+	status = atlas_cache_prepare(atlas, sources, count, &header, entries);
+	if (status < 0)
+		goto finally;
+
+	status = ERROR_MISSING;
+	file = fopen(cache, "rb");
+	if (!file)
+		goto finally;
+
+	if ((fread(&header_cached, sizeof(header_cached), 1, file) != 1) || memcmp(header_cached.magic, header.magic, sizeof(header.magic)) || (header_cached.version != header.version))
+		goto close;
+	if ((header_cached.width != header.width) || (header_cached.height != header.height) || (header_cached.count != header.count) || (header_cached.filenames != header.filenames))
+		goto close;
+	if ((header_cached.program_sec != header.program_sec) || (header_cached.program_nsec != header.program_nsec) || (header_cached.program_size != header.program_size))
+		goto close;
+	if (fread(entries_cached, sizeof(*entries_cached), count, file) != count)
+		goto close;
+	for(size_t i = 0; i < count; ++i)
+	{
+		if ((entries_cached[i].modified_sec != entries[i].modified_sec) || (entries_cached[i].modified_nsec != entries[i].modified_nsec) || (entries_cached[i].size != entries[i].size))
+			goto close;
+	}
+	if (fread(atlas->pixels, (size_t)atlas->width * atlas->height * 4, 1, file) != 1)
+		goto close;
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		atlas_cache_image_set(sources[i].image, atlas, &entries_cached[i].image);
+		if (sources[i].variant)
+			atlas_cache_image_set(sources[i].variant, atlas, &entries_cached[i].variant);
+	}
+	atlas->x = header_cached.x;
+	atlas->y = header_cached.y;
+	atlas->row_height = header_cached.row_height;
+
+	status = 0;
+
+close:
+	fclose(file);
+finally:
+	free(entries);
+	return status;
+}
+
+static void atlas_cache_image_get(struct atlas_cache_image *restrict cached, const struct image *restrict image)
+{
+	cached->width = image->width;
+	cached->height = image->height;
+	memcpy(cached->coords, image->coords, sizeof(cached->coords));
+}
+
+// Stores the images in the cache. The cache is not written if there are images outside of the atlas.
+static void atlas_cache_store(const struct atlas *restrict atlas, const struct image_source *restrict sources, size_t count, const char *restrict cache)
+{
+	struct atlas_cache_header header;
+	struct atlas_cache_entry *entries;
+	size_t cache_size;
+	char *temp = 0;
+	int fd;
+	FILE *file;
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		if (sources[i].image->texture != atlas->texture)
+			return;
+		if (sources[i].variant && (sources[i].variant->texture != atlas->texture))
+			return;
+	}
+
+	entries = malloc(count * sizeof(*entries));
+	if (!entries)
+		return;
+
+	if (atlas_cache_prepare(atlas, sources, count, &header, entries) < 0)
+		goto finally;
+	for(size_t i = 0; i < count; ++i)
+	{
+		atlas_cache_image_get(&entries[i].image, sources[i].image);
+		if (sources[i].variant)
+			atlas_cache_image_get(&entries[i].variant, sources[i].variant);
+	}
+
+	// Write the cache to a temporary file and then replace the old cache with it.
+	// This way the cache is never read while partially written.
+	cache_size = strlen(cache);
+	temp = malloc(cache_size + sizeof(TEMP_SUFFIX));
+	if (!temp)
+		goto finally;
+	memcpy(temp, cache, cache_size);
+	memcpy(temp + cache_size, TEMP_SUFFIX, sizeof(TEMP_SUFFIX));
+
+	fd = mkstemp(temp);
+	if (fd < 0)
+		goto finally;
+	fchmod(fd, 0644);
+	file = fdopen(fd, "wb");
+	if (!file)
+	{
+		close(fd);
+		goto error;
+	}
+
+	if ((fwrite(&header, sizeof(header), 1, file) != 1) || (fwrite(entries, sizeof(*entries), count, file) != count) || (fwrite(atlas->pixels, (size_t)atlas->width * atlas->height * 4, 1, file) != 1))
+	{
+		fclose(file);
+		goto error;
+	}
+	if (fclose(file) || (rename(temp, cache) < 0))
+		goto error;
+
+	goto finally;
+
+error:
+	unlink(temp);
+finally:
+	free(temp);
+	free(entries);
+}
+
+// Decodes the images of the sources in parallel and stores them in the atlas, in the order of the sources.
+// Each image file is decoded once, even when it has a variant. Images that can not be loaded are left empty.
+// If cache is not NULL, the atlas is loaded from the cache file when the image files have not changed since it was written.
+void images_load_atlas(struct atlas *restrict atlas, struct image_source *restrict sources, size_t count, const char *restrict cache)
+{
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t workers_count = ((processors > 0) ? processors : 1);
+	struct images_worker workers[IMAGES_WORKERS_LIMIT];
+	pthread_t threads[IMAGES_WORKERS_LIMIT];
+	_Bool started[IMAGES_WORKERS_LIMIT];
+	size_t start = 0;
+
+	if (cache && !atlas_cache_load(atlas, sources, count, cache))
+		return;
+
+	if (workers_count > IMAGES_WORKERS_LIMIT)
+		workers_count = IMAGES_WORKERS_LIMIT;
+	if (workers_count > count)
+		workers_count = count;
+
+	for(size_t i = 0; i < workers_count; ++i)
+	{
+		workers[i].sources = sources;
+		workers[i].start = start;
+		start += count / workers_count + (i < count % workers_count);
+		workers[i].end = start;
+	}
+
+	// The current thread acts as the first worker.
+	for(size_t i = 1; i < workers_count; ++i)
+		started[i] = !pthread_create(threads + i, 0, images_worker_main, workers + i);
+	if (workers_count)
+		images_worker_main(workers);
+	for(size_t i = 1; i < workers_count; ++i)
+	{
+		if (started[i]) pthread_join(threads[i], 0);
+		else images_worker_main(workers + i); // the thread could not be created
+	}
+
+	// The atlas is filled in a single thread so that the placement of the images doesn't depend on thread scheduling.
+	for(size_t i = 0; i < count; ++i)
+	{
+		struct image_source *restrict source = sources + i;
+
+		if (source->status < 0)
+		{
+			*source->image = (struct image){0};
+			if (source->variant) *source->variant = (struct image){0};
+			continue;
+		}
+
+		atlas_insert(atlas, source->image, source->format, source->rows);
+		if (source->variant)
+			atlas_insert(atlas, source->variant, source->format, source->rows_variant);
+	}
+
+	if (cache)
+		atlas_cache_store(atlas, sources, count, cache);
+}
+
+// Stores the images loaded in the atlas in its texture.
+void atlas_upload(struct atlas *restrict atlas)
+{
+	glBindTexture(GL_TEXTURE_2D, atlas->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas->width, atlas->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas->pixels);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	free(atlas->pixels);
+	atlas->pixels = 0;
+}
+
+void atlas_term(struct atlas *restrict atlas)
+{
+	free(atlas->pixels);
+	glDeleteTextures(1, &atlas->texture);
+}
+
 void image_grayscale(const struct image *restrict image, png_byte **rows)
 {
 	for(size_t y = 0; y < image->height; ++y)
@@ -193,79 +655,38 @@ void image_mask(const struct image *restrict image, png_byte **rows)
 
 void image_draw(const struct image *restrict image, unsigned x, unsigned y)
 {
-//	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glColor4ub(255, 255, 255, 255); // TODO why is this necessary
-	glBindTexture(GL_TEXTURE_2D, image->texture);
-
-	glEnable(GL_TEXTURE_2D);
-	glBegin(GL_QUADS);
-
-	glTexCoord2d(1, 0);
-	glVertex2f(x + image->width, y + image->height);
-
-	glTexCoord2d(0, 0);
-	glVertex2f(x, y + image->height);
-
-	glTexCoord2d(0, 1);
-	glVertex2f(x, y);
-
-	glTexCoord2d(1, 1);
-	glVertex2f(x + image->width, y);
-
-	glEnd();
-	glDisable(GL_TEXTURE_2D);
+	sprite_draw(image->texture, image->coords, x, y, image->width, image->height, display_colors[White]);
 }
 
+// Displays the image tinted with the given color.
 void image_draw_mask(const struct image *restrict image, unsigned x, unsigned y, const unsigned char color[static 4])
 {
-//	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-	glColor4ub(color[0], color[1], color[2], color[3]);
-	glBindTexture(GL_TEXTURE_2D, image->texture);
-
-	glEnable(GL_TEXTURE_2D);
-	glBegin(GL_QUADS);
-
-	glTexCoord2d(1, 0);
-	glVertex2f(x + image->width, y + image->height);
-
-	glTexCoord2d(0, 0);
-	glVertex2f(x, y + image->height);
-
-	glTexCoord2d(0, 1);
-	glVertex2f(x, y);
-
-	glTexCoord2d(1, 1);
-	glVertex2f(x + image->width, y);
-
-	glEnd();
-	glDisable(GL_TEXTURE_2D);
+	sprite_draw(image->texture, image->coords, x, y, image->width, image->height, color);
 }
 
+// Fills the rectangle by repeating the image a whole number of times in each direction.
 void display_image(const struct image *restrict image, unsigned x, unsigned y, unsigned width, unsigned height)
 {
-//	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glColor4ub(255, 255, 255, 255); // TODO why is this necessary
-	glBindTexture(GL_TEXTURE_2D, image->texture);
-
-	glEnable(GL_TEXTURE_2D);
-	glBegin(GL_QUADS);
-
-	glTexCoord2d(width / image->width, 0);
-	glVertex2f(x + width, y + height);
-
-	glTexCoord2d(0, 0);
-	glVertex2f(x, y + height);
-
-	glTexCoord2d(0, height / image->height);
-	glVertex2f(x, y);
-
-	glTexCoord2d(width / image->width, height / image->height);
-	glVertex2f(x + width, y);
-
-	glEnd();
-	glDisable(GL_TEXTURE_2D);
+	unsigned columns, rows;
+	GLfloat tile_width, tile_height;
+
+	if (!image->width || !image->height)
+		return;
+
+	// The image is stretched to fill the rectangle when its size is not a multiple of the image size.
+	columns = width / image->width;
+	if (!columns) columns = 1;
+	rows = height / image->height;
+	if (!rows) rows = 1;
+	tile_width = (GLfloat)width / columns;
+	tile_height = (GLfloat)height / rows;
+
+	for(unsigned row = 0; row < rows; ++row)
+		for(unsigned column = 0; column < columns; ++column)
+			sprite_draw(image->texture, image->coords, x + column * tile_width, y + row * tile_height, tile_width, tile_height, display_colors[White]);
 }
 
+// The images loaded in an atlas are released by atlas_term().
 void image_unload(struct image *restrict image)
 {
 	glDeleteTextures(1, &image->texture);
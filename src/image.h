@@ -21,11 +21,40 @@ struct image
 {
 	GLuint texture;
 	uint32_t width, height;
+	GLfloat coords[4]; // texture coordinates of the left, bottom, right and top edges of the image
+};
+
+// Texture storing multiple images. Images are placed in rows, starting from the bottom left.
+struct atlas
+{
+	GLuint texture;
+	unsigned width, height;
+	unsigned x, y, row_height; // position of the next image and height of the current row
+	unsigned char *pixels; // RGBA pixels until the atlas is uploaded
 };
 
 #include <png.h>
 int image_load_png(struct image *restrict image, const char *restrict filename, void (*modify)(const struct image *restrict, png_byte **));
 
+// Image file to load in an atlas. If variant is not NULL, it is loaded from the same file and its pixels are changed by modify.
+struct image_source
+{
+	struct image *image;
+	const char *filename;
+	struct image *variant;
+	void (*modify)(const struct image *restrict, png_byte **);
+
+	// Used internally while loading.
+	png_byte **rows, **rows_variant;
+	GLint format;
+	int status;
+};
+
+int atlas_init(struct atlas *restrict atlas, unsigned width, unsigned height);
+void images_load_atlas(struct atlas *restrict atlas, struct image_source *restrict sources, size_t count, const char *restrict cache);
+void atlas_upload(struct atlas *restrict atlas);
+void atlas_term(struct atlas *restrict atlas);
+
 void image_grayscale(const struct image *restrict image, png_byte **rows);
 void image_mask(const struct image *restrict image, png_byte **rows);
 
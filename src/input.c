@@ -17,10 +17,10 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <poll.h>
+#include <stdbool.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <time.h>
-#include <unistd.h>
 
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
@@ -30,6 +30,9 @@
 #include "game.h"
 #include "input.h"
 #include "interface.h"
+#include "log.h"
+
+#define FRAME_DURATION 16667 /* time between two frames in microseconds (60 frames per second) */
 
 extern xcb_connection_t *connection;
 extern KeySym *keymap;
@@ -69,10 +72,48 @@ int input_terminate(int code, unsigned x, unsigned y, uint16_t modifiers, const
 	return INPUT_TERMINATE;
 }
 
+struct frame_timing frame_timing;
+
+// Returns the value of a monotonic clock in microseconds.
+static long long time_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// Returns the CPU time used by the calling thread in microseconds.
+static long long time_cpu(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// Adds the statistics of an animation to frame_timing.
+static void frame_timing_add(const struct frame_timing *restrict timing)
+{
+	if (timing->missed)
+		LOG_DEBUG("animation frames: %lu, missed: %lu, frame CPU time average: %lld us, max: %lld us", timing->frames, timing->missed, timing->time_total / (long long)timing->frames, timing->time_max);
+
+	frame_timing.frames += timing->frames;
+	frame_timing.missed += timing->missed;
+	frame_timing.time_total += timing->time_total;
+	if (timing->time_max > frame_timing.time_max)
+		frame_timing.time_max = timing->time_max;
+}
+
+// Waits until there is an event in the queue or until timeout microseconds pass. Returns whether there is an event.
+static int event_wait(long long timeout)
+{
+	struct pollfd wait = {.fd = xcb_get_file_descriptor(connection), .events = POLLIN};
+	return (poll(&wait, 1, (timeout + 999) / 1000) > 0);
+}
+
 // ERROR_CANCEL - user-specified termination
 int input_local(const struct area *restrict areas, size_t areas_count, void (*display)(const void *, const struct game *), const struct game *restrict game, void *state)
 {
-	xcb_generic_event_t *event;
+	xcb_generic_event_t *event, *next = 0;
 	xcb_button_release_event_t *mouse;
 	xcb_key_press_event_t *keyboard;
 	xcb_motion_notify_event_t *motion;
@@ -86,17 +127,42 @@ int input_local(const struct area *restrict areas, size_t areas_count, void (*di
 	size_t index;
 	int status;
 
+	// The display is updated after all queued events are handled and at most once per frame.
+	bool changed = false; // whether there are changes that are not displayed
+	long long displayed; // when the last frame was displayed
+
 	// Ignore all the queued events.
 	while (event = xcb_poll_for_event(connection))
 		free(event);
 
 	input_display(display, game, state);
+	displayed = time_now();
 
 	while (1)
 	{
 wait:
-		event = xcb_wait_for_event(connection);
-		if (!event) return ERROR_MEMORY;
+		if (next)
+		{
+			event = next;
+			next = 0;
+		}
+		else if (!(event = xcb_poll_for_event(connection)))
+		{
+			if (changed)
+			{
+				// Events that arrive before the next frame may bring more changes.
+				long long timeout = displayed + FRAME_DURATION - time_now();
+				if ((timeout > 0) && event_wait(timeout))
+					continue;
+
+				input_display(display, game, state);
+				displayed = time_now();
+				changed = false;
+			}
+
+			event = xcb_wait_for_event(connection);
+			if (!event) return ERROR_MEMORY;
+		}
 
 		switch (event->response_type & ~0x80)
 		{
@@ -111,13 +177,24 @@ wait:
 		case XCB_KEY_PRESS:
 			keyboard = (xcb_key_press_event_t *)event;
 			code = keymap[(keyboard->detail - keycode_min) * keysyms_per_keycode];
-			if (is_modifier(code)) continue;
+			if (is_modifier(code))
+			{
+				free(event);
+				continue;
+			}
 			x = keyboard->event_x;
 			y = keyboard->event_y;
 			modifiers = keyboard->state;
 			break;
 
 		case XCB_MOTION_NOTIFY:
+			// Only the last of several consecutive motion events needs handling.
+			while ((next = xcb_poll_for_event(connection)) && ((next->response_type & ~0x80) == XCB_MOTION_NOTIFY))
+			{
+				free(event);
+				event = next;
+			}
+
 			motion = (xcb_motion_notify_event_t *)event;
 			code = EVENT_MOTION;
 			x = motion->event_x;
@@ -126,7 +203,7 @@ wait:
 			break;
 
 		case XCB_EXPOSE:
-			input_display(display, game, state);
+			changed = true;
 		default:
 			free(event);
 			continue;
@@ -146,16 +223,18 @@ wait:
 				case INPUT_TERMINATE:
 					status = ERROR_CANCEL;
 				default: // runtime error
+					free(next);
 					return status;
 
 				case INPUT_FINISH:
+					free(next);
 					return 0;
 
 				case INPUT_NOTME:
 					continue;
 
 				case 0:
-					input_display(display, game, state);
+					changed = true;
 				case INPUT_IGNORE:
 					goto wait;
 				}
@@ -164,15 +243,8 @@ wait:
 	}
 }
 
-static double timer_progress(const struct timeval *restrict start, double duration)
-{
-	struct timeval now;
-	unsigned long time_difference;
-	gettimeofday(&now, 0);
-	time_difference = (now.tv_sec * 1000000 + now.tv_usec - start->tv_sec * 1000000 - start->tv_usec);
-	return time_difference / (duration * 1000000.0);
-}
-
+// Displays an animation with the given duration (in seconds). Frames are displayed at fixed intervals.
+// The progress passed to display is proportional to the time when the frame is due.
 int input_timer(void (*display)(const void *, const struct game *, double), const struct game *restrict game, double duration, void *state)
 {
 	xcb_generic_event_t *event;
@@ -182,44 +254,67 @@ int input_timer(void (*display)(const void *, const struct game *, double), cons
 
 	int code = 0; // TODO this is oversimplification
 
-	struct timeval start; // start time of the animation
+	long long start, now; // start time of the animation and current time
+	long long length = duration * 1000000;
+	unsigned long frame = 0;
+	struct frame_timing timing = {0}; // statistics of this animation
 
 	// Ignore all the queued events.
 	while (event = xcb_poll_for_event(connection))
 		free(event);
 
-	gettimeofday(&start, 0);
+	start = time_now();
 
-	do
+	while ((long long)frame * FRAME_DURATION < length)
 	{
-		double progress = timer_progress(&start, duration);
-		if (progress > 1.0)
-			break;
+		long long deadline = start + (frame + 1) * FRAME_DURATION; // when the next frame is due
+		long long elapsed;
 
-		input_display_timer(display, game, progress, state);
+		elapsed = time_cpu();
+		input_display_timer(display, game, (double)frame * FRAME_DURATION / length, state);
+		elapsed = time_cpu() - elapsed;
 
-		event = xcb_poll_for_event(connection);
-		if (!event)
-		{
-			usleep(10000);
-			continue;
-		}
+		timing.frames += 1;
+		timing.time_total += elapsed;
+		if (elapsed > timing.time_max)
+			timing.time_max = elapsed;
 
-		switch (event->response_type & ~0x80)
+		// Handle the events that arrive before the next frame is due.
+		while (1)
 		{
-		case XCB_EXPOSE:
-		default:
+			event = xcb_poll_for_event(connection);
+			if (!event)
+			{
+				now = time_now();
+				if (now >= deadline) break;
+				if (!event_wait(deadline - now)) break;
+				continue;
+			}
+
+			if ((event->response_type & ~0x80) == XCB_KEY_PRESS)
+			{
+				keyboard = (xcb_key_press_event_t *)event;
+				code = keymap[(keyboard->detail - keycode_min) * keysyms_per_keycode];
+			}
 			free(event);
-			continue;
 
-		case XCB_KEY_PRESS:
-			keyboard = (xcb_key_press_event_t *)event;
-			code = keymap[(keyboard->detail - keycode_min) * keysyms_per_keycode];
-			break;
+			if (code == XK_Escape)
+			{
+				frame_timing_add(&timing);
+				return 0;
+			}
 		}
 
-		free(event);
-	} while (code != XK_Escape);
+		// Skip the frames that are already late.
+		frame += 1;
+		if (now >= deadline + FRAME_DURATION)
+		{
+			unsigned long skip = (now - start) / FRAME_DURATION - frame;
+			frame += skip;
+			timing.missed += skip;
+		}
+	}
 
+	frame_timing_add(&timing);
 	return 0;
 }
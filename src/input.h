@@ -42,5 +42,14 @@ struct area
 int input_finish(int code, unsigned x, unsigned y, uint16_t modifiers, const struct game *restrict game, void *argument);
 int input_terminate(int code, unsigned x, unsigned y, uint16_t modifiers, const struct game *restrict game, void *argument);
 
+// Statistics for the frames of all animations displayed by input_timer().
+struct frame_timing
+{
+	unsigned long frames; // number of frames displayed
+	unsigned long missed; // number of frames skipped because the previous one was late
+	long long time_total, time_max; // CPU time spent displaying frames in microseconds
+};
+extern struct frame_timing frame_timing;
+
 int input_local(const struct area *restrict areas, size_t areas_count, void (*display)(const void *, const struct game *), const struct game *restrict game, void *state);
 int input_timer(void (*display)(const void *, const struct game *, double), const struct game *restrict game, double duration, void *state);
@@ -25,6 +25,7 @@
 #include <X11/keysym.h>
 
 #include "errors.h"
+#include "bitset.h"
 #include "game.h"
 #include "draw.h"
 #include "map.h"
@@ -90,6 +91,18 @@ static struct context context;
 static struct region_info *regions_info;*/
 /////////////////////
 
+// Calculates the income of the player. Must be called when troop movement or workers change.
+static void state_income_set(const struct game *restrict game, struct state_map *restrict state)
+{
+	state->income = (struct resources){0};
+	for(size_t i = 0; i < game->regions_count; ++i)
+	{
+		const struct region *restrict region = game->regions + i;
+		if (region->owner == state->player) region_production(region, &state->income);
+		region_income(region, state->player, &state->income);
+	}
+}
+
 static void state_economy_set(struct state_map *restrict state, const struct region *restrict region)
 {
 	state->region_income = (struct resources){0};
@@ -143,6 +156,19 @@ static int input_turn(int code, unsigned x, unsigned y, uint16_t modifiers, cons
 
 	case 'n':
 		return INPUT_FINISH;
+
+	case XK_Left:
+		if_storage_view(&state->camera, state->camera.x - MAP_SCROLL, state->camera.y);
+		return 0;
+	case XK_Right:
+		if_storage_view(&state->camera, state->camera.x + MAP_SCROLL, state->camera.y);
+		return 0;
+	case XK_Up:
+		if_storage_view(&state->camera, state->camera.x, state->camera.y - MAP_SCROLL);
+		return 0;
+	case XK_Down:
+		if_storage_view(&state->camera, state->camera.x, state->camera.y + MAP_SCROLL);
+		return 0;
 	}
 }
 
@@ -160,7 +186,7 @@ static int input_region(int code, unsigned x, unsigned y, uint16_t modifiers, co
 	if (code >= 0) return INPUT_NOTME;
 
 	// Get the clicked region.
-	int region_index = if_storage_get(x, y);
+	int region_index = if_storage_get(state->camera, x, y);
 
 	if (code == EVENT_MOUSE_LEFT)
 	{
@@ -210,17 +236,14 @@ static int input_region(int code, unsigned x, unsigned y, uint16_t modifiers, co
 		struct region *region = game->regions + state->region;
 		struct troop *troop;
 
-		unsigned index;
 		struct region *destination = game->regions + region_index;
 		if (destination == region) goto valid;
 
 		// A troop can only go to a neighboring region and only if it's not sieged in the garrison.
 		if (!allies(game, state->player, region->owner))
 			return INPUT_IGNORE;
-		for(index = 0; index < NEIGHBORS_LIMIT; ++index)
-			if (destination == region->neighbors[index])
-				goto valid;
-		return INPUT_IGNORE;
+		if (region_neighbor_direction(game, region, destination) < 0)
+			return INPUT_IGNORE;
 
 valid:
 		if (state->troop)
@@ -244,6 +267,7 @@ valid:
 				troop->move = destination;
 			}
 		}
+		state_income_set(game, state);
 
 //printf("rating=%f\n", rate(game, state->player, regions_info, &context));
 		return 0;
@@ -516,6 +540,7 @@ static int input_troop(int code, unsigned x, unsigned y, uint16_t modifiers, con
 		{
 			state->troop->move = region;
 			state->troop = 0;
+			state_income_set(game, state);
 //printf("rating=%f\n", rate(game, state->player, regions_info, &context));
 		}
 		else return INPUT_IGNORE;
@@ -593,6 +618,7 @@ static int input_garrison(int code, unsigned x, unsigned y, uint16_t modifiers,
 		{
 			state->troop->move = LOCATION_GARRISON;
 		}
+		state_income_set(game, state);
 //printf("rating=%f\n", rate(game, state->player, regions_info, &context));
 	}
 	else return INPUT_IGNORE;
@@ -658,6 +684,7 @@ static int input_workers(int code, unsigned x, unsigned y, uint16_t modifiers, c
 		{
 			*resources[index] += 1;
 			state_economy_set(state, region);
+			state_income_set(game, state);
 			return 0;
 		}
 	}
@@ -667,6 +694,7 @@ static int input_workers(int code, unsigned x, unsigned y, uint16_t modifiers, c
 		{
 			*resources[index] -= 1;
 			state_economy_set(state, region);
+			state_income_set(game, state);
 			return 0;
 		}
 	}
@@ -773,17 +801,32 @@ int input_map(const struct game *restrict game, unsigned char player)
 	};
 
 	struct state_map state;
+	int status;
 
 	state.player = player;
 
+	// Center the map on the first region of the player.
+	state.camera = (struct point){0, 0};
+	for(size_t i = 0; i < game->regions_count; ++i)
+		if (game->regions[i].owner == player)
+		{
+			struct point center = game->regions[i].center;
+			if_storage_view(&state.camera, center.x - MAP_WIDTH / 2, center.y - MAP_HEIGHT / 2);
+			break;
+		}
+
 	state.region = REGION_NONE;
 	state.troop = 0;
 
 	state.hover_object = HOVER_NONE;
 
+	state.regions_visible = bitset_alloc(game->regions_count);
+	if (!state.regions_visible)
+		return ERROR_MEMORY;
 	map_visible(game, player, state.regions_visible);
 
 	state.economy = 0;
+	state_income_set(game, &state);
 
 	// If playing in hotseat mode, announce which player will be playing.
 	if (game->players_local_count >= 2)
@@ -800,5 +843,7 @@ int input_map(const struct game *restrict game, unsigned char player)
 //regions_info = regions_info_collect(game, player, &context);
 //printf("rating=%f\n", rate(game, state.player, regions_info, &context));
 
-	return input_local(areas, sizeof(areas) / sizeof(*areas), if_map, game, &state);
+	status = input_local(areas, sizeof(areas) / sizeof(*areas), if_map, game, &state);
+	free(state.regions_visible);
+	return status;
 }
@@ -23,6 +23,8 @@ struct state_map
 {
 	unsigned char player; // current player
 
+	struct point camera; // world coordinates displayed at the top left corner of the map
+
 	ssize_t region; // index of the selected region
 	struct troop *troop; // selected troop
 
@@ -39,7 +41,9 @@ struct state_map
 	unsigned self_offset, other_offset;
 	unsigned self_count, other_count;
 
-	unsigned char regions_visible[REGIONS_LIMIT];
+	uint64_t *regions_visible; // bitset of the regions visible to the player
+
+	struct resources income; // income of the player
 
 	int economy; // whether to display region economy
 	struct resources region_income;
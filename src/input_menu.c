@@ -412,11 +412,19 @@ retry:
 		state.world_index = -1;
 	}
 
+	status = if_regions_init(game);
+	if (status < 0)
+	{
+		world_unload(game);
+		goto finally;
+	}
+
 	state.loaded = 1;
 
 	status = input_local(areas_setup, sizeof(areas_setup) / sizeof(*areas_setup), if_load, game, &state);
 	if (status == ERROR_CANCEL)
 	{
+		if_regions_term();
 		world_unload(game);
 		goto retry;
 	}
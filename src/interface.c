@@ -200,6 +200,7 @@ void input_display(void (*if_display)(const void *, const struct game *), const
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	if_display(state, game);
+	sprites_flush();
 	glFlush();
 	glFinish();
 }
@@ -208,6 +209,7 @@ void input_display_timer(void (*if_display)(const void *, const struct game *, d
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	if_display(state, game, progress);
+	sprites_flush();
 	glFlush();
 	glFinish();
 }
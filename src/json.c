@@ -26,12 +26,13 @@ SOFTWARE.
 
 #include <assert.h>
 #include <arpa/inet.h>
-#include <ctype.h>
-#include <float.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <locale.h>
+#include <unistd.h>
 
 #include "format.h"
 #include "json.h"
@@ -42,169 +43,6 @@ enum {ARRAY_SIZE_DEFAULT = 16};
 // Parses extended JSON format.
 // Extensions: null as a separate type, floating point as a separate type, string as root node
 
-/* Determine the integer type use to parse non-floating point numbers */
-typedef long long JSON_int_t;
-#define JSON_PARSER_INTEGER_SSCANF_TOKEN "%lld"
-#define JSON_PARSER_INTEGER_SPRINTF_TOKEN "%lld"
-
-typedef enum 
-{
-    JSON_E_NONE = 0,
-    JSON_E_INVALID_CHAR,
-    JSON_E_INVALID_KEYWORD,
-    JSON_E_INVALID_ESCAPE_SEQUENCE,
-    JSON_E_INVALID_UNICODE_SEQUENCE,
-    JSON_E_INVALID_NUMBER,
-    JSON_E_NESTING_DEPTH_REACHED,
-    JSON_E_UNBALANCED_COLLECTION,
-    JSON_E_EXPECTED_KEY,
-    JSON_E_EXPECTED_COLON,
-    JSON_E_OUT_OF_MEMORY
-} JSON_error;
-
-typedef enum 
-{
-    JSON_T_NONE = 0,
-    JSON_T_ARRAY_BEGIN,
-    JSON_T_ARRAY_END,
-    JSON_T_OBJECT_BEGIN,
-    JSON_T_OBJECT_END,
-    JSON_T_INTEGER,
-    JSON_T_FLOAT,
-    JSON_T_NULL,
-    JSON_T_TRUE,
-    JSON_T_FALSE,
-    JSON_T_STRING,
-    JSON_T_KEY,
-    JSON_T_MAX
-} JSON_type;
-
-typedef struct JSON_value_struct {
-    union {
-        JSON_int_t integer_value;
-        
-        double float_value;
-        
-        struct {
-            const char* value;
-            size_t length;
-        } str;
-    } vu;
-} JSON_value;
-
-typedef struct JSON_parser_struct* JSON_parser;
-
-/*! \brief JSON parser callback 
-
-    \param ctx The pointer passed to new_JSON_parser.
-    \param type An element of JSON_type but not JSON_T_NONE.    
-    \param value A representation of the parsed value. This parameter is NULL for
-        JSON_T_ARRAY_BEGIN, JSON_T_ARRAY_END, JSON_T_OBJECT_BEGIN, JSON_T_OBJECT_END,
-        JSON_T_NULL, JSON_T_TRUE, and JSON_T_FALSE. String values are always returned
-        as zero-terminated C strings.
-
-    \return Non-zero if parsing should continue, else zero.
-*/    
-typedef int (*JSON_parser_callback)(void* ctx, int type, const struct JSON_value_struct* value);
-
-
-/**
-   A typedef for allocator functions semantically compatible with malloc().
-*/
-typedef void* (*JSON_malloc_t)(size_t n);
-/**
-   A typedef for deallocator functions semantically compatible with free().
-*/
-typedef void (*JSON_free_t)(void* mem);
-
-/*! \brief Create a JSON parser object 
-
-    \param config. Used to configure the parser. Set to NULL to use
-        the default configuration. See init_JSON_config.  Its contents are
-        copied by this function, so it need not outlive the returned
-        object.
-    
-    \return The parser object, which is owned by the caller and must eventually
-    be freed by calling delete_JSON_parser().
-*/
-JSON_parser new_JSON_parser(JSON_parser_callback callback, void *ctx);
-
-/*! \brief Destroy a previously created JSON parser object. */
-void delete_JSON_parser(JSON_parser jc);
-
-/*! \brief Parse a character.
-
-    \return Non-zero, if all characters passed to this function are part of are valid JSON.
-*/
-int JSON_parser_char(JSON_parser jc, int next_char);
-
-/*! \brief Finalize parsing.
-
-    Call this method once after all input characters have been consumed.
-    
-    \return Non-zero, if all parsed characters are valid JSON, zero otherwise.
-*/
-int JSON_parser_done(JSON_parser jc);
-
-/*! \brief Determine if a given string is valid JSON white space 
-
-    \return Non-zero if the string is valid, zero otherwise.
-*/
-int JSON_parser_is_legal_white_space_string(const char* s);
-
-/*! \brief Gets the last error that occurred during the use of JSON_parser.
-
-    \return A value from the JSON_error enum.
-*/
-int JSON_parser_get_last_error(JSON_parser jc);
-
-/*! \brief Re-sets the parser to prepare it for another parse run.
-
-    \return True (non-zero) on success, 0 on error (e.g. !jc).
-*/
-int JSON_parser_reset(JSON_parser jc);
-
-#define __   -1	 /* the universal error code */
-
-/* values chosen so that the object size is approx equal to one page (4K) */
-#ifndef JSON_PARSER_STACK_SIZE
-#   define JSON_PARSER_STACK_SIZE 128
-#endif
-
-#ifndef JSON_PARSER_PARSE_BUFFER_SIZE
-#   define JSON_PARSER_PARSE_BUFFER_SIZE 3500
-#endif
-
-typedef void* (*JSON_debug_malloc_t)(size_t bytes, const char* reason);
-
-#ifdef JSON_PARSER_DEBUG_MALLOC
-#   define JSON_parser_malloc(func, bytes, reason) ((JSON_debug_malloc_t)func)(bytes, reason)
-#else
-#   define JSON_parser_malloc(func, bytes, reason) func(bytes)
-#endif
-
-typedef unsigned short UTF16;
-
-struct JSON_parser_struct {
-	JSON_parser_callback callback;
-	void* ctx;
-	signed char state, before_comment_state, type, escaped, comment, allow_comments, handle_floats_manually, error;
-	char decimal_point;
-	UTF16 utf16_high_surrogate;
-	int current_char;
-	int depth;
-	int top;
-	int stack_capacity;
-	signed char* stack;
-	char* parse_buffer;
-	size_t parse_buffer_capacity;
-	size_t parse_buffer_count;
-	signed char static_stack[JSON_PARSER_STACK_SIZE];
-	char static_parse_buffer[JSON_PARSER_PARSE_BUFFER_SIZE];
-	JSON_malloc_t malloc;
-	JSON_free_t free;
-};
-
 struct json_context
 {
 	union json *root;
@@ -213,1007 +51,455 @@ struct json_context
 	size_t count;
 };
 
-#define COUNTOF(x) (sizeof(x)/sizeof(x[0])) 
+/* < JSON scanner */
 
-/*
-	Characters are mapped into these character classes. This allows for
-	a significant reduction in the size of the state transition table.
-*/
+// The scanner finds the end of whitespace, string bodies and numbers in bulk and reports each token to a callback.
+// String values are passed directly from the input unless they contain escape sequences.
 
-enum classes {
-	C_SPACE,  /* space */
-	C_WHITE,  /* other whitespace */
-	C_LCURB,  /* {  */
-	C_RCURB,  /* } */
-	C_LSQRB,  /* [ */
-	C_RSQRB,  /* ] */
-	C_COLON,  /* : */
-	C_COMMA,  /* , */
-	C_QUOTE,  /* " */
-	C_BACKS,  /* \ */
-	C_SLASH,  /* / */
-	C_PLUS,   /* + */
-	C_MINUS,  /* - */
-	C_POINT,  /* . */
-	C_ZERO ,  /* 0 */
-	C_DIGIT,  /* 123456789 */
-	C_LOW_A,  /* a */
-	C_LOW_B,  /* b */
-	C_LOW_C,  /* c */
-	C_LOW_D,  /* d */
-	C_LOW_E,  /* e */
-	C_LOW_F,  /* f */
-	C_LOW_L,  /* l */
-	C_LOW_N,  /* n */
-	C_LOW_R,  /* r */
-	C_LOW_S,  /* s */
-	C_LOW_T,  /* t */
-	C_LOW_U,  /* u */
-	C_ABCDF,  /* ABCDF */
-	C_E,	  /* E */
-	C_ETC,	/* everything else */
-	C_STAR,   /* * */   
-	NR_CLASSES
-};
+#define JSON_WORD_ONES (~(uint64_t)0 / 255)
+#define JSON_WORD_HIGHS (JSON_WORD_ONES * 0x80)
 
-static const signed char ascii_class[128] = {
-/*
-	This array maps the 128 ASCII characters into character classes.
-	The remaining Unicode characters should be mapped to C_ETC.
-	Non-whitespace control characters are errors.
-*/
-	__,	  __,	  __,	  __,	  __,	  __,	  __,	  __,
-	__,	  C_WHITE, C_WHITE, __,	  __,	  C_WHITE, __,	  __,
-	__,	  __,	  __,	  __,	  __,	  __,	  __,	  __,
-	__,	  __,	  __,	  __,	  __,	  __,	  __,	  __,
-
-	C_SPACE, C_ETC,   C_QUOTE, C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,
-	C_ETC,   C_ETC,   C_STAR,   C_PLUS,  C_COMMA, C_MINUS, C_POINT, C_SLASH,
-	C_ZERO,  C_DIGIT, C_DIGIT, C_DIGIT, C_DIGIT, C_DIGIT, C_DIGIT, C_DIGIT,
-	C_DIGIT, C_DIGIT, C_COLON, C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,
-
-	C_ETC,   C_ABCDF, C_ABCDF, C_ABCDF, C_ABCDF, C_E,	 C_ABCDF, C_ETC,
-	C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,
-	C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_ETC,
-	C_ETC,   C_ETC,   C_ETC,   C_LSQRB, C_BACKS, C_RSQRB, C_ETC,   C_ETC,
-
-	C_ETC,   C_LOW_A, C_LOW_B, C_LOW_C, C_LOW_D, C_LOW_E, C_LOW_F, C_ETC,
-	C_ETC,   C_ETC,   C_ETC,   C_ETC,   C_LOW_L, C_ETC,   C_LOW_N, C_ETC,
-	C_ETC,   C_ETC,   C_LOW_R, C_LOW_S, C_LOW_T, C_LOW_U, C_ETC,   C_ETC,
-	C_ETC,   C_ETC,   C_ETC,   C_LCURB, C_ETC,   C_RCURB, C_ETC,   C_ETC
-};
+// Whether any byte of the word is zero.
+#define word_haszero(word) (((word) - JSON_WORD_ONES) & ~(word) & JSON_WORD_HIGHS)
 
+// Whether any byte of the word is less than limit (limit <= 128).
+#define word_hasless(word, limit) (((word) - JSON_WORD_ONES * (limit)) & ~(word) & JSON_WORD_HIGHS)
 
-/*
-	The state codes.
-*/
-enum states {
-	GO,  /* start	*/
-	OK,  /* ok	   */
-	OB,  /* object   */
-	KE,  /* key	  */
-	CO,  /* colon	*/
-	VA,  /* value	*/
-	AR,  /* array	*/
-	ST,  /* string   */
-	ES,  /* escape   */
-	U1,  /* u1	   */
-	U2,  /* u2	   */
-	U3,  /* u3	   */
-	U4,  /* u4	   */
-	MI,  /* minus	*/
-	ZE,  /* zero	 */
-	IT,  /* integer  */
-	FR,  /* fraction */
-	E1,  /* e		*/
-	E2,  /* ex	   */
-	E3,  /* exp	  */
-	T1,  /* tr	   */
-	T2,  /* tru	  */
-	T3,  /* true	 */
-	F1,  /* fa	   */
-	F2,  /* fal	  */
-	F3,  /* fals	 */
-	F4,  /* false	*/
-	N1,  /* nu	   */
-	N2,  /* nul	  */
-	N3,  /* null	 */
-	C1,  /* /		*/
-	C2,  /* / *	 */
-	C3,  /* *		*/
-	FX,  /* *.* *eE* */
-	D1,  /* second UTF-16 character decoding started by \ */
-	D2,  /* second UTF-16 character proceeded by u */
-	NR_STATES
-};
+enum {JSON_SCAN_ARRAY = 1, JSON_SCAN_OBJECT};
 
-enum actions
+struct json_scanner
 {
-	CB = -10, /* comment begin */
-	CE = -11, /* comment end */
-	FA = -12, /* false */
-	TR = -13, /* false */
-	NU = -14, /* null */
-	DE = -15, /* double detected by exponent e E */
-	DF = -16, /* double detected by fraction . */
-	SB = -17, /* string begin */
-	MX = -18, /* integer detected by minus */
-	ZX = -19, /* integer detected by zero */
-	IX = -20, /* integer detected by 1-9 */
-	EX = -21, /* next char is escaped */
-	UC = -22  /* Unicode character read */
-};
-
-///*start  GO*/ {GO,GO,-6,__,-5,__,__,__,__,__,CB,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-static const signed char state_transition_table[NR_STATES][NR_CLASSES] = {
-/*
-	The state transition table takes the current state and the current symbol,
-	and returns either a new state or an action. An action is represented as a
-	negative number. A JSON text is accepted if at the end of the text the
-	state is OK and if the mode is MODE_DONE.
-
-				 white									  1-9								   ABCDF  etc
-			 space |  {  }  [  ]  :  ,  "  \  /  +  -  .  0  |  a  b  c  d  e  f  l  n  r  s  t  u  |  E  |  * */
-/*start  GO*/ {GO,GO,-6,__,-5,__,__,__,SB,__,CB,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*ok	 OK*/ {OK,OK,__,-8,__,-7,__,-3,__,__,CB,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*object OB*/ {OB,OB,__,-9,__,__,__,__,SB,__,CB,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*key	 KE*/ {KE,KE,__,__,__,__,__,__,SB,__,CB,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*colon  CO*/ {CO,CO,__,__,__,__,-2,__,__,__,CB,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*value  VA*/ {VA,VA,-6,__,-5,__,__,__,SB,__,CB,__,MX,__,ZX,IX,__,__,__,__,__,FA,__,NU,__,__,TR,__,__,__,__,__},
-/*array  AR*/ {AR,AR,-6,__,-5,-7,__,__,SB,__,CB,__,MX,__,ZX,IX,__,__,__,__,__,FA,__,NU,__,__,TR,__,__,__,__,__},
-/*string ST*/ {ST,__,ST,ST,ST,ST,ST,ST,-4,EX,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST,ST},
-/*escape ES*/ {__,__,__,__,__,__,__,__,ST,ST,ST,__,__,__,__,__,__,ST,__,__,__,ST,__,ST,ST,__,ST,U1,__,__,__,__},
-/*u1	 U1*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,U2,U2,U2,U2,U2,U2,U2,U2,__,__,__,__,__,__,U2,U2,__,__},
-/*u2	 U2*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,U3,U3,U3,U3,U3,U3,U3,U3,__,__,__,__,__,__,U3,U3,__,__},
-/*u3	 U3*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,U4,U4,U4,U4,U4,U4,U4,U4,__,__,__,__,__,__,U4,U4,__,__},
-/*u4	 U4*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,UC,UC,UC,UC,UC,UC,UC,UC,__,__,__,__,__,__,UC,UC,__,__},
-/*minus  MI*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,ZE,IT,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*zero   ZE*/ {OK,OK,__,-8,__,-7,__,-3,__,__,CB,__,__,DF,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*int	 IT*/ {OK,OK,__,-8,__,-7,__,-3,__,__,CB,__,__,DF,IT,IT,__,__,__,__,DE,__,__,__,__,__,__,__,__,DE,__,__},
-/*frac   FR*/ {OK,OK,__,-8,__,-7,__,-3,__,__,CB,__,__,__,FR,FR,__,__,__,__,E1,__,__,__,__,__,__,__,__,E1,__,__},
-/*e	     E1*/ {__,__,__,__,__,__,__,__,__,__,__,E2,E2,__,E3,E3,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*ex	 E2*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,E3,E3,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*exp	 E3*/ {OK,OK,__,-8,__,-7,__,-3,__,__,__,__,__,__,E3,E3,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*tr	 T1*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,T2,__,__,__,__,__,__,__},
-/*tru	 T2*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,T3,__,__,__,__},
-/*true   T3*/ {__,__,__,__,__,__,__,__,__,__,CB,__,__,__,__,__,__,__,__,__,OK,__,__,__,__,__,__,__,__,__,__,__},
-/*fa	 F1*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,F2,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*fal	 F2*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,F3,__,__,__,__,__,__,__,__,__},
-/*fals   F3*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,F4,__,__,__,__,__,__},
-/*false  F4*/ {__,__,__,__,__,__,__,__,__,__,CB,__,__,__,__,__,__,__,__,__,OK,__,__,__,__,__,__,__,__,__,__,__},
-/*nu	 N1*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,N2,__,__,__,__},
-/*nul	 N2*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,N3,__,__,__,__,__,__,__,__,__},
-/*null   N3*/ {__,__,__,__,__,__,__,__,__,__,CB,__,__,__,__,__,__,__,__,__,__,__,OK,__,__,__,__,__,__,__,__,__},
-/*/	     C1*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,C2},
-/*/*	 C2*/ {C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C3},
-/**	     C3*/ {C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,CE,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C2,C3},
-/*_.	 FX*/ {OK,OK,__,-8,__,-7,__,-3,__,__,__,__,__,__,FR,FR,__,__,__,__,E1,__,__,__,__,__,__,__,__,E1,__,__},
-/*\	     D1*/ {__,__,__,__,__,__,__,__,__,D2,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__},
-/*\	     D2*/ {__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,__,U1,__,__,__,__},
-};
+	const unsigned char *data;
+	size_t size;
+	size_t position;
 
+	JSON_parser_callback callback;
+	void *context;
 
-/*
-	These modes can be pushed on the stack.
-*/
-enum modes {
-	MODE_ARRAY = 1, 
-	MODE_DONE = 2,  
-	MODE_KEY = 3,   
-	MODE_OBJECT = 4
+	// Buffer for strings with escape sequences and for floating point numbers.
+	char *buffer;
+	size_t buffer_size, buffer_capacity;
 };
 
-static void set_error(JSON_parser jc)
-{
-	switch (jc->state) {
-		case GO:
-			switch (jc->current_char) {
-			case '{': case '}': case '[': case ']': 
-				jc->error = JSON_E_UNBALANCED_COLLECTION;
-				break;
-			default:
-				jc->error = JSON_E_INVALID_CHAR;
-				break;	
-			}
-			break;
-		case OB:
-			jc->error = JSON_E_EXPECTED_KEY;
-			break;
-		case AR:
-			jc->error = JSON_E_UNBALANCED_COLLECTION;
-			break;
-		case CO:
-			jc->error = JSON_E_EXPECTED_COLON;
-			break;
-		case KE:
-			jc->error = JSON_E_EXPECTED_KEY;
-			break;
-		/* \uXXXX\uYYYY */
-		case U1: case U2: case U3: case U4: case D1: case D2:
-			jc->error = JSON_E_INVALID_UNICODE_SEQUENCE;
-			break;
-		/* true, false, null */
-		case T1: case T2: case T3: case F1: case F2: case F3: case F4: case N1: case N2: case N3:
-			jc->error = JSON_E_INVALID_KEYWORD;
-			break;
-		/* minus, integer, fraction, exponent */
-		case MI: case ZE: case IT: case FR: case E1: case E2: case E3:
-			jc->error = JSON_E_INVALID_NUMBER;
-			break;
-		default:
-			jc->error = JSON_E_INVALID_CHAR;
-			break;
-	}
-}
-
-static int
-push(JSON_parser jc, int mode)
+static int scan_buffer_push(struct json_scanner *restrict scanner, const unsigned char *restrict data, size_t size)
 {
-/*
-	Push a mode onto the stack. Return false if there is overflow.
-*/
-	assert(jc->top <= jc->stack_capacity);
-	
-	if (jc->depth < 0) {
-		if (jc->top == jc->stack_capacity) {
-			const size_t bytes_to_copy = jc->stack_capacity * sizeof(jc->stack[0]);
-			const size_t new_capacity = jc->stack_capacity * 2;
-			const size_t bytes_to_allocate = new_capacity * sizeof(jc->stack[0]);
-			void* mem = JSON_parser_malloc(jc->malloc, bytes_to_allocate, "stack");
-			if (!mem) {
-				jc->error = JSON_E_OUT_OF_MEMORY;
-				return false;
-			}
-			jc->stack_capacity = (int)new_capacity;
-			memcpy(mem, jc->stack, bytes_to_copy);
-			if (jc->stack != &jc->static_stack[0]) {
-				jc->free(jc->stack);
-			}
-			jc->stack = (signed char*)mem;
-		}
-	} else {
-		if (jc->top == jc->depth) {
-			jc->error = JSON_E_NESTING_DEPTH_REACHED;
-			return false;
-		}
+	if (scanner->buffer_size + size + 1 > scanner->buffer_capacity)
+	{
+		size_t capacity = (scanner->buffer_capacity ? scanner->buffer_capacity : ARRAY_SIZE_DEFAULT);
+		char *buffer;
+
+		while (capacity < scanner->buffer_size + size + 1)
+			capacity *= 2;
+		buffer = realloc(scanner->buffer, capacity);
+		if (!buffer) return 0;
+		scanner->buffer = buffer;
+		scanner->buffer_capacity = capacity;
 	}
-	jc->stack[++jc->top] = (signed char)mode;
-	return true;
+	memcpy(scanner->buffer + scanner->buffer_size, data, size);
+	scanner->buffer_size += size;
+	scanner->buffer[scanner->buffer_size] = 0;
+	return 1;
 }
 
-
-static int
-pop(JSON_parser jc, int mode)
+// Skips whitespace and comments. Returns whether the input is valid.
+static int scan_space(struct json_scanner *restrict scanner)
 {
-/*
-	Pop the stack, assuring that the current mode matches the expectation.
-	Return false if there is underflow or if the modes mismatch.
-*/
-	if (jc->top < 0 || jc->stack[jc->top] != mode) {
-		return false;
-	}
-	jc->top -= 1;
-	return true;
-}
-
-
-#define parse_buffer_clear(jc) \
-	do {\
-		jc->parse_buffer_count = 0;\
-		jc->parse_buffer[0] = 0;\
-	} while (0)
-	
-#define parse_buffer_pop_back_char(jc)\
-	do {\
-		assert(jc->parse_buffer_count >= 1);\
-		--jc->parse_buffer_count;\
-		jc->parse_buffer[jc->parse_buffer_count] = 0;\
-	} while (0)	
+	const unsigned char *restrict data = scanner->data;
+	size_t position = scanner->position;
 
+	while (1)
+	{
+		while ((position < scanner->size) && ((data[position] == ' ') || (data[position] == '\t') || (data[position] == '\n') || (data[position] == '\r')))
+			position += 1;
 
+		// Skip comment.
+		if ((position + 1 < scanner->size) && (data[position] == '/') && (data[position + 1] == '*'))
+		{
+			const unsigned char *end;
 
-void delete_JSON_parser(JSON_parser jc)
-{
-	if (jc) {
-		if (jc->stack != &jc->static_stack[0]) {
-			jc->free((void*)jc->stack);
-		}
-		if (jc->parse_buffer != &jc->static_parse_buffer[0]) {
-			jc->free((void*)jc->parse_buffer);
+			position += 2;
+			do
+			{
+				end = memchr(data + position, '*', scanner->size - position);
+				if (!end) return 0;
+				position = end - data + 1;
+			} while ((position == scanner->size) || (data[position] != '/'));
+			position += 1;
 		}
-		jc->free((void*)jc);
-	 }   
+		else break;
+	}
+
+	scanner->position = position;
+	return 1;
 }
 
-int JSON_parser_reset(JSON_parser jc)
+static int scan_hex(const unsigned char *restrict data, unsigned *restrict result)
 {
-	if (NULL == jc) {
-		return false;
-	}
-	
-	jc->state = GO;
-	jc->top = -1;
-
-	/* parser has been used previously? */
-	if (NULL == jc->parse_buffer) {
-	
-		/* Do we want non-bound stack? */
-		if (jc->depth > 0) {
-			jc->stack_capacity = jc->depth;
-			if (jc->depth <= (int)COUNTOF(jc->static_stack)) {
-				jc->stack = &jc->static_stack[0];
-			} else {
-				const size_t bytes_to_alloc = jc->stack_capacity * sizeof(jc->stack[0]);
-				jc->stack = (signed char*)JSON_parser_malloc(jc->malloc, bytes_to_alloc, "stack");
-				if (jc->stack == NULL) {
-					return false;
-				}
-			}
-		} else {
-			jc->stack_capacity = (int)COUNTOF(jc->static_stack);
-			jc->depth = -1;
-			jc->stack = &jc->static_stack[0];
-		}
-		
-		/* set up the parse buffer */
-		jc->parse_buffer = &jc->static_parse_buffer[0];
-		jc->parse_buffer_capacity = COUNTOF(jc->static_parse_buffer);
+	unsigned value = 0;
+	for(size_t i = 0; i < 4; ++i)
+	{
+		value <<= 4;
+		if ((data[i] >= '0') && (data[i] <= '9')) value |= data[i] - '0';
+		else if ((data[i] >= 'a') && (data[i] <= 'f')) value |= data[i] - 'a' + 10;
+		else if ((data[i] >= 'A') && (data[i] <= 'F')) value |= data[i] - 'A' + 10;
+		else return 0;
 	}
-	
-	/* set parser to start */
-	push(jc, MODE_DONE);
-	parse_buffer_clear(jc);
-	
-	return true;
+	*result = value;
+	return 1;
 }
 
-JSON_parser new_JSON_parser(JSON_parser_callback callback, void *ctx)
+// Decodes \u escape sequence (the input starts after \u). Returns the number of bytes read or 0 on error.
+static size_t scan_unicode(struct json_scanner *restrict scanner, const unsigned char *restrict data, size_t size)
 {
-/*
-	new_JSON_parser starts the checking process by constructing a JSON_parser
-	object. It takes a depth parameter that restricts the level of maximum
-	nesting.
+	unsigned char utf8[4];
+	unsigned code, low;
+	size_t length;
 
-	To continue the process, call JSON_parser_char for each character in the
-	JSON text, and then call JSON_parser_done to obtain the final result.
-	These functions are fully reentrant.
-*/
+	if ((size < 4) || !scan_hex(data, &code)) return 0;
+	length = 4;
 
-	JSON_parser jc;
-
-	jc = JSON_parser_malloc(malloc, sizeof(*jc), "parser");	
-	if (0 == jc) return 0;
-	
-	/* configure the parser */
-	memset(jc, 0, sizeof(*jc));
-	jc->malloc = malloc;
-	jc->free = free;
-	jc->callback = callback;
-	jc->ctx = ctx;
-	jc->allow_comments = true;
-	jc->handle_floats_manually = false;
-	jc->decimal_point = *localeconv()->decimal_point;
-	jc->depth = JSON_DEPTH_MAX;
-	
-	/* reset the parser */
-	if (!JSON_parser_reset(jc)) {
-		jc->free(jc);
-		return 0;
+	if ((code & 0xfc00) == 0xd800) // high surrogate
+	{
+		if ((size < 10) || (data[4] != '\\') || (data[5] != 'u') || !scan_hex(data + 6, &low)) return 0;
+		if ((low & 0xfc00) != 0xdc00) return 0;
+		code = (((code & 0x3ff) << 10) | (low & 0x3ff)) + 0x10000;
+		length = 10;
 	}
-	
-	return jc;
-}
+	else if ((code & 0xfc00) == 0xdc00) return 0; // low surrogate without high surrogate
 
-static int parse_buffer_grow(JSON_parser jc)
-{
-	const size_t bytes_to_copy = jc->parse_buffer_count * sizeof(jc->parse_buffer[0]);
-	const size_t new_capacity = jc->parse_buffer_capacity * 2;
-	const size_t bytes_to_allocate = new_capacity * sizeof(jc->parse_buffer[0]);
-	void* mem = JSON_parser_malloc(jc->malloc, bytes_to_allocate, "parse buffer");
-	
-	if (mem == NULL) {
-		jc->error = JSON_E_OUT_OF_MEMORY;
-		return false;
+	if (code < 0x80)
+	{
+		utf8[0] = code;
+		return (scan_buffer_push(scanner, utf8, 1) ? length : 0);
 	}
-	
-	assert(new_capacity > 0);
-	memcpy(mem, jc->parse_buffer, bytes_to_copy);
-	
-	if (jc->parse_buffer != &jc->static_parse_buffer[0]) {
-		jc->free(jc->parse_buffer);
+	else if (code < 0x800)
+	{
+		utf8[0] = 0xc0 | (code >> 6);
+		utf8[1] = 0x80 | (code & 0x3f);
+		return (scan_buffer_push(scanner, utf8, 2) ? length : 0);
 	}
-	
-	jc->parse_buffer = (char*)mem;
-	jc->parse_buffer_capacity = new_capacity;
-	
-	return true;
-}
-
-static int parse_buffer_reserve_for(JSON_parser jc, unsigned chars)
-{
-	while (jc->parse_buffer_count + chars + 1 > jc->parse_buffer_capacity) {
-		if (!parse_buffer_grow(jc)) {
-			assert(jc->error == JSON_E_OUT_OF_MEMORY);
-			return false;
-		}
+	else if (code < 0x10000)
+	{
+		utf8[0] = 0xe0 | (code >> 12);
+		utf8[1] = 0x80 | ((code >> 6) & 0x3f);
+		utf8[2] = 0x80 | (code & 0x3f);
+		return (scan_buffer_push(scanner, utf8, 3) ? length : 0);
+	}
+	else
+	{
+		utf8[0] = 0xf0 | (code >> 18);
+		utf8[1] = 0x80 | ((code >> 12) & 0x3f);
+		utf8[2] = 0x80 | ((code >> 6) & 0x3f);
+		utf8[3] = 0x80 | (code & 0x3f);
+		return (scan_buffer_push(scanner, utf8, 4) ? length : 0);
 	}
-	
-	return true;
 }
 
-#define parse_buffer_has_space_for(jc, count) \
-	(jc->parse_buffer_count + (count) + 1 <= jc->parse_buffer_capacity)
-
-#define parse_buffer_push_back_char(jc, c)\
-	do {\
-		assert(parse_buffer_has_space_for(jc, 1)); \
-		jc->parse_buffer[jc->parse_buffer_count++] = c;\
-		jc->parse_buffer[jc->parse_buffer_count]   = 0;\
-	} while (0)
-
-#define assert_is_non_container_type(jc) \
-	assert( \
-		jc->type == JSON_T_NULL || \
-		jc->type == JSON_T_FALSE || \
-		jc->type == JSON_T_TRUE || \
-		jc->type == JSON_T_FLOAT || \
-		jc->type == JSON_T_INTEGER || \
-		jc->type == JSON_T_STRING)
-	
-
-static int parse_parse_buffer(JSON_parser jc)
+// Returns the number of bytes in the input before the first quote, backslash or control character.
+static size_t scan_string_plain(const unsigned char *restrict data, size_t size)
 {
-	if (jc->callback) {
-		JSON_value value, *arg = NULL;
-		
-		if (jc->type != JSON_T_NONE) {
-			assert_is_non_container_type(jc);
-		
-			switch(jc->type) {
-				case JSON_T_FLOAT:
-					arg = &value;
-					if (jc->handle_floats_manually) {
-						value.vu.str.value = jc->parse_buffer;
-						value.vu.str.length = jc->parse_buffer_count;
-					} else { 
-						/* not checking with end pointer b/c there may be trailing ws */
-						value.vu.float_value = strtod(jc->parse_buffer, NULL);
-					}
-					break;
-				case JSON_T_INTEGER:
-					arg = &value;
-					sscanf(jc->parse_buffer, JSON_PARSER_INTEGER_SSCANF_TOKEN, &value.vu.integer_value);
-					break;
-				case JSON_T_STRING:
-					arg = &value;
-					value.vu.str.value = jc->parse_buffer;
-					value.vu.str.length = jc->parse_buffer_count;
-					break;
-			}
-			
-			if (!(*jc->callback)(jc->ctx, jc->type, arg)) {
-				return false;
-			}
-		}
+	const uint64_t quotes = JSON_WORD_ONES * '"';
+	const uint64_t backslashes = JSON_WORD_ONES * '\\';
+	size_t length = 0;
+
+	// Skip 8 bytes at a time while none of them is special.
+	while (length + sizeof(uint64_t) <= size)
+	{
+		uint64_t word;
+		memcpy(&word, data + length, sizeof(word));
+		if (word_haszero(word ^ quotes) | word_haszero(word ^ backslashes) | word_hasless(word, 0x20))
+			break;
+		length += sizeof(word);
 	}
-	
-	parse_buffer_clear(jc);
-	
-	return true;
-}
 
-#define IS_HIGH_SURROGATE(uc) (((uc) & 0xFC00) == 0xD800)
-#define IS_LOW_SURROGATE(uc)  (((uc) & 0xFC00) == 0xDC00)
-#define DECODE_SURROGATE_PAIR(hi,lo) ((((hi) & 0x3FF) << 10) + ((lo) & 0x3FF) + 0x10000)
-static const unsigned char utf8_lead_bits[4] = { 0x00, 0xC0, 0xE0, 0xF0 };
+	while ((length < size) && (data[length] != '"') && (data[length] != '\\') && (data[length] >= 0x20))
+		length += 1;
 
-static int decode_unicode_char(JSON_parser jc)
+	return length;
+}
+
+// Scans a string starting after the opening quote. On success, value contains the decoded string.
+static int scan_string(struct json_scanner *restrict scanner, JSON_value *restrict value)
 {
-	int i;
-	unsigned uc = 0;
-	char* p;
-	int trail_bytes;
-	
-	assert(jc->parse_buffer_count >= 6);
-	
-	p = &jc->parse_buffer[jc->parse_buffer_count - 4];
-	
-	for (i = 12; i >= 0; i -= 4, ++p) {
-		unsigned x = *p;
-		
-		if (x >= 'a') {
-			x -= ('a' - 10);
-		} else if (x >= 'A') {
-			x -= ('A' - 10);
-		} else {
-			x &= ~0x30u;
-		}
-		
-		assert(x < 16);
-		
-		uc |= x << i;
-	}
-	
-	/* clear UTF-16 char from buffer */
-	jc->parse_buffer_count -= 6;
-	jc->parse_buffer[jc->parse_buffer_count] = 0;
-	
-	/* attempt decoding ... */
-	if (jc->utf16_high_surrogate) {
-		if (IS_LOW_SURROGATE(uc)) {
-			uc = DECODE_SURROGATE_PAIR(jc->utf16_high_surrogate, uc);
-			trail_bytes = 3;
-			jc->utf16_high_surrogate = 0;
-		} else {
-			/* high surrogate without a following low surrogate */
-			return false;
-		}
-	} else {
-		if (uc < 0x80) {
-			trail_bytes = 0;
-		} else if (uc < 0x800) {
-			trail_bytes = 1;
-		} else if (IS_HIGH_SURROGATE(uc)) {
-			/* save the high surrogate and wait for the low surrogate */
-			jc->utf16_high_surrogate = (UTF16)uc;
-			return true;
-		} else if (IS_LOW_SURROGATE(uc)) {
-			/* low surrogate without a preceding high surrogate */
-			return false;
-		} else {
-			trail_bytes = 2;
-		}
-	}
-	
-	jc->parse_buffer[jc->parse_buffer_count++] = (char) ((uc >> (trail_bytes * 6)) | utf8_lead_bits[trail_bytes]);
-	
-	for (i = trail_bytes * 6 - 6; i >= 0; i -= 6) {
-		jc->parse_buffer[jc->parse_buffer_count++] = (char) (((uc >> i) & 0x3F) | 0x80);
+	const unsigned char *restrict data = scanner->data;
+	size_t start = scanner->position;
+	size_t position = start + scan_string_plain(data + start, scanner->size - start);
+
+	if (position == scanner->size) return 0;
+	if (data[position] == '"')
+	{
+		// The string has no escape sequences so there is no need to copy it.
+		value->vu.str.value = (const char *)data + start;
+		value->vu.str.length = position - start;
+		scanner->position = position + 1;
+		return 1;
 	}
 
-	jc->parse_buffer[jc->parse_buffer_count] = 0;
-	
-	return true;
-}
+	scanner->buffer_size = 0;
+	while (1)
+	{
+		if (!scan_buffer_push(scanner, data + start, position - start)) return 0;
 
-static int add_escaped_char_to_parse_buffer(JSON_parser jc, int next_char)
-{
-	assert(parse_buffer_has_space_for(jc, 1));
-	
-	jc->escaped = 0;
-	/* remove the backslash */
-	parse_buffer_pop_back_char(jc);
-	switch(next_char) {
-		case 'b':
-			parse_buffer_push_back_char(jc, '\b');
-			break;
-		case 'f':
-			parse_buffer_push_back_char(jc, '\f');
-			break;
-		case 'n':
-			parse_buffer_push_back_char(jc, '\n');
-			break;
-		case 'r':
-			parse_buffer_push_back_char(jc, '\r');
-			break;
-		case 't':
-			parse_buffer_push_back_char(jc, '\t');
-			break;
-		case '"':
-			parse_buffer_push_back_char(jc, '"');
-			break;
-		case '\\':
-			parse_buffer_push_back_char(jc, '\\');
-			break;
-		case '/':
-			parse_buffer_push_back_char(jc, '/');
+		if ((position == scanner->size) || (data[position] < 0x20)) return 0;
+		if (data[position] == '"') break;
+
+		// Decode escape sequence.
+		position += 1;
+		if (position == scanner->size) return 0;
+		switch (data[position++])
+		{
+			unsigned char c;
+			size_t length;
+
+		case '"': c = '"'; goto escaped;
+		case '\\': c = '\\'; goto escaped;
+		case '/': c = '/'; goto escaped;
+		case 'b': c = '\b'; goto escaped;
+		case 'f': c = '\f'; goto escaped;
+		case 'n': c = '\n'; goto escaped;
+		case 'r': c = '\r'; goto escaped;
+		case 't': c = '\t'; goto escaped;
+		escaped:
+			if (!scan_buffer_push(scanner, &c, 1)) return 0;
 			break;
+
 		case 'u':
-			parse_buffer_push_back_char(jc, '\\');
-			parse_buffer_push_back_char(jc, 'u');
+			length = scan_unicode(scanner, data + position, scanner->size - position);
+			if (!length) return 0;
+			position += length;
 			break;
+
 		default:
-			return false;
+			return 0;
+		}
+
+		start = position;
+		position += scan_string_plain(data + position, scanner->size - position);
 	}
 
-	return true;
+	value->vu.str.value = scanner->buffer;
+	value->vu.str.length = scanner->buffer_size;
+	scanner->position = position + 1;
+	return 1;
+}
+
+static inline size_t scan_digits(const unsigned char *restrict data, size_t size, size_t position)
+{
+	while ((position < size) && (data[position] >= '0') && (data[position] <= '9'))
+		position += 1;
+	return position;
 }
 
-static int add_char_to_parse_buffer(JSON_parser jc, int next_char, int next_class)
+// Scans a number and reports it as integer or floating point.
+static int scan_number(struct json_scanner *restrict scanner)
 {
-	if (!parse_buffer_reserve_for(jc, 1)) {
-		assert(JSON_E_OUT_OF_MEMORY == jc->error);
-		return false;
+	const unsigned char *restrict data = scanner->data;
+	size_t start = scanner->position, position = start, digits;
+	int integer = 1;
+	JSON_value value;
+
+	if (data[position] == '-') position += 1;
+	digits = position;
+	if ((position < scanner->size) && (data[position] == '0')) position += 1;
+	else position = scan_digits(data, scanner->size, position);
+	if (position == digits) return 0;
+	digits = position - digits;
+
+	if ((position < scanner->size) && (data[position] == '.'))
+	{
+		position = scan_digits(data, scanner->size, position + 1);
+		integer = 0;
 	}
-	
-	if (jc->escaped) {
-		if (!add_escaped_char_to_parse_buffer(jc, next_char)) {
-			jc->error = JSON_E_INVALID_ESCAPE_SEQUENCE;
-			return false; 
-		}
-	} else if (!jc->comment) {
-		if ((jc->type != JSON_T_NONE) | !((next_class == C_SPACE) | (next_class == C_WHITE)) /* non-white-space */) {
-			parse_buffer_push_back_char(jc, (char)next_char);
+	if ((position < scanner->size) && ((data[position] == 'e') || (data[position] == 'E')))
+	{
+		size_t exponent;
+
+		position += 1;
+		if ((position < scanner->size) && ((data[position] == '+') || (data[position] == '-'))) position += 1;
+		exponent = position;
+		position = scan_digits(data, scanner->size, position);
+		if (position == exponent) return 0;
+		integer = 0;
+	}
+
+	// A number is always followed by a delimiter.
+	if (position == scanner->size) return 0;
+	switch (data[position])
+	{
+	case ' ': case '\t': case '\n': case '\r': case ',': case ']': case '}': case '/':
+		break;
+	default:
+		return 0;
+	}
+	scanner->position = position;
+
+	if (integer)
+	{
+		if (digits < 19) // the value fits in long long
+		{
+			size_t i = start + (data[start] == '-');
+			value.vu.integer_value = 0;
+			for(; i < position; ++i)
+				value.vu.integer_value = value.vu.integer_value * 10 + (data[i] - '0');
+			if (data[start] == '-')
+				value.vu.integer_value = -value.vu.integer_value;
 		}
+		else value.vu.integer_value = strtoll((const char *)data + start, 0, 10);
+		return scanner->callback(scanner->context, JSON_T_INTEGER, &value);
 	}
-	
-	return true;
-}
+	else
+	{
+		char *point;
 
-#define assert_type_isnt_string_null_or_bool(jc) \
-	assert(jc->type != JSON_T_FALSE); \
-	assert(jc->type != JSON_T_TRUE); \
-	assert(jc->type != JSON_T_NULL); \
-	assert(jc->type != JSON_T_STRING)
+		scanner->buffer_size = 0;
+		if (!scan_buffer_push(scanner, data + start, position - start)) return 0;
 
+		// strtod() expects the decimal point of the current locale.
+		if (point = strchr(scanner->buffer, '.'))
+			*point = *localeconv()->decimal_point;
 
-int
-JSON_parser_char(JSON_parser jc, int next_char)
+		value.vu.float_value = strtod(scanner->buffer, 0);
+		return scanner->callback(scanner->context, JSON_T_FLOAT, &value);
+	}
+}
+
+static int scan_keyword(struct json_scanner *restrict scanner, const char *restrict keyword, size_t size, int type)
 {
-/*
-	After calling new_JSON_parser, call this function for each character (or
-	partial character) in your JSON text. It can accept UTF-8, UTF-16, or
-	UTF-32. It returns true if things are looking ok so far. If it rejects the
-	text, it returns false.
-*/
-	int next_class, next_state;
+	if ((scanner->size - scanner->position < size) || memcmp(scanner->data + scanner->position, keyword, size))
+		return 0;
+	scanner->position += size;
+	return scanner->callback(scanner->context, type, 0);
+}
 
-/*
-	Store the current char for error handling
-*/	
-	jc->current_char = next_char;
-	
-/*
-	Determine the character's class.
-*/
-	if (next_char < 0) {
-		jc->error = JSON_E_INVALID_CHAR;
-		return false;
-	}
-	if (next_char >= 128) {
-		next_class = C_ETC;
-	} else {
-		next_class = ascii_class[next_char];
-		if (next_class <= __) {
-			set_error(jc);
-			return false;
-		}
-	}
-	
-	if (!add_char_to_parse_buffer(jc, next_char, next_class)) {
-		return false;
+// Parses JSON text and reports each token to the callback.
+// The root node must be an object, an array or a string. Empty input is valid and reports no tokens.
+// Returns whether the text was parsed successfully.
+int json_scan(const unsigned char *restrict data, size_t size, JSON_parser_callback callback, void *context)
+{
+	struct json_scanner scanner = {.data = data, .size = size, .callback = callback, .context = context};
+	unsigned char stack[JSON_DEPTH_MAX];
+	size_t depth = 0;
+	JSON_value value;
+
+	if (!scan_space(&scanner)) goto error;
+	if (scanner.position == size) goto finally;
+
+	// Only objects, arrays and strings are allowed as root node.
+	switch (data[scanner.position])
+	{
+	case '{':
+	case '[':
+	case '"':
+		break;
+	default:
+		goto error;
 	}
-	
-/*
-	Get the next state from the state transition table.
-*/
-	next_state = state_transition_table[jc->state][next_class];
-	if (next_state >= 0) {
-/*
-	Change the state.
-*/
-		jc->state = (signed char)next_state;
-	} else {
-/*
-	Or perform one of the actions.
-*/
-		switch (next_state) {
-/* Unicode character */		
-		case UC:
-			if(!decode_unicode_char(jc)) {
-				jc->error = JSON_E_INVALID_UNICODE_SEQUENCE;
-				return false;
-			}
-			/* check if we need to read a second UTF-16 char */
-			if (jc->utf16_high_surrogate) {
-				jc->state = D1;
-			} else {
-				jc->state = ST;
-			}
-			break;
-/* escaped char */
-		case EX:
-			jc->escaped = 1;
-			jc->state = ES;
-			break;
-/* integer detected by minus */
-		case MX:
-			jc->type = JSON_T_INTEGER;
-			jc->state = MI;
-			break;  
-/* integer detected by zero */			
-		case ZX:
-			jc->type = JSON_T_INTEGER;
-			jc->state = ZE;
-			break;  
-/* integer detected by 1-9 */			
-		case IX:
-			jc->type = JSON_T_INTEGER;
-			jc->state = IT;
-			break;  
-			
-/* floating point number detected by exponent*/
-		case DE:
-			assert_type_isnt_string_null_or_bool(jc);
-			jc->type = JSON_T_FLOAT;
-			jc->state = E1;
-			break;   
-		
-/* floating point number detected by fraction */
-		case DF:
-			assert_type_isnt_string_null_or_bool(jc);
-			if (!jc->handle_floats_manually) {
-/*
-	Some versions of strtod (which underlies sscanf) don't support converting 
-	C-locale formated floating point values.
-*/		   
-				assert(jc->parse_buffer[jc->parse_buffer_count-1] == '.');
-				jc->parse_buffer[jc->parse_buffer_count-1] = jc->decimal_point;
-			}			
-			jc->type = JSON_T_FLOAT;
-			jc->state = FX;
-			break;   
-/* string begin " */
-		case SB:
-			parse_buffer_clear(jc);
-			assert(jc->type == JSON_T_NONE);
-			jc->type = JSON_T_STRING;
-			jc->state = ST;
-			break;		
-		
-/* n */
-		case NU:
-			assert(jc->type == JSON_T_NONE);
-			jc->type = JSON_T_NULL;
-			jc->state = N1;
-			break;		
-/* f */
-		case FA:
-			assert(jc->type == JSON_T_NONE);
-			jc->type = JSON_T_FALSE;
-			jc->state = F1;
-			break;		
-/* t */
-		case TR:
-			assert(jc->type == JSON_T_NONE);
-			jc->type = JSON_T_TRUE;
-			jc->state = T1;
-			break;		
-		
-/* closing comment */
-		case CE:
-			jc->comment = 0;
-			assert(jc->parse_buffer_count == 0);
-			assert(jc->type == JSON_T_NONE);
-			jc->state = jc->before_comment_state;
-			break;		
-		
-/* opening comment  */
-		case CB:
-			if (!jc->allow_comments) {
-				return false;
-			}
-			parse_buffer_pop_back_char(jc);
-			if (!parse_parse_buffer(jc)) {
-				return false;
-			}
-			assert(jc->parse_buffer_count == 0);
-			assert(jc->type != JSON_T_STRING);
-			switch (jc->stack[jc->top]) {
-			case MODE_ARRAY:
-			case MODE_OBJECT:   
-				switch(jc->state) {
-				case VA:
-				case AR:
-					jc->before_comment_state = jc->state;
-					break;
-				default:
-					jc->before_comment_state = OK;
-					break;
-				}
-				break;
-			default:
-				jc->before_comment_state = jc->state;
-				break;
-			}
-			jc->type = JSON_T_NONE;
-			jc->state = C1;
-			jc->comment = 1;
-			break;
-/* empty } */
-		case -9:		
-			parse_buffer_clear(jc);
-			if (jc->callback && !(*jc->callback)(jc->ctx, JSON_T_OBJECT_END, NULL)) {
-				return false;
-			}
-			if (!pop(jc, MODE_KEY)) {
-				return false;
-			}
-			jc->state = OK;
-			break;
 
-/* } */ case -8:
-			parse_buffer_pop_back_char(jc);
-			if (!parse_parse_buffer(jc)) {
-				return false;
-			}
-			if (jc->callback && !(*jc->callback)(jc->ctx, JSON_T_OBJECT_END, NULL)) {
-				return false;
-			}
-			if (!pop(jc, MODE_OBJECT)) {
-				jc->error = JSON_E_UNBALANCED_COLLECTION;
-				return false;
-			}
-			jc->type = JSON_T_NONE;
-			jc->state = OK;
-			break;
+	while (1)
+	{
+		// Parse a value.
+		if (scanner.position == size) goto error;
+		switch (data[scanner.position])
+		{
+		case '{':
+			if (depth == JSON_DEPTH_MAX) goto error;
+			scanner.position += 1;
+			if (!callback(context, JSON_T_OBJECT_BEGIN, 0)) goto error;
+			stack[depth++] = JSON_SCAN_OBJECT;
+
+			if (!scan_space(&scanner) || (scanner.position == size)) goto error;
+			if (data[scanner.position] == '}')
+				goto close;
+			goto key;
+
+		case '[':
+			if (depth == JSON_DEPTH_MAX) goto error;
+			scanner.position += 1;
+			if (!callback(context, JSON_T_ARRAY_BEGIN, 0)) goto error;
+			stack[depth++] = JSON_SCAN_ARRAY;
+
+			if (!scan_space(&scanner) || (scanner.position == size)) goto error;
+			if (data[scanner.position] == ']')
+				goto close;
+			continue;
 
-/* ] */ case -7:
-			parse_buffer_pop_back_char(jc);
-			if (!parse_parse_buffer(jc)) {
-				return false;
-			}
-			if (jc->callback && !(*jc->callback)(jc->ctx, JSON_T_ARRAY_END, NULL)) {
-				return false;
-			}
-			if (!pop(jc, MODE_ARRAY)) {
-				jc->error = JSON_E_UNBALANCED_COLLECTION;
-				return false;
-			}
-			
-			jc->type = JSON_T_NONE;
-			jc->state = OK;
+		case '"':
+			scanner.position += 1;
+			if (!scan_string(&scanner, &value)) goto error;
+			if (!callback(context, JSON_T_STRING, &value)) goto error;
 			break;
 
-/* { */ case -6:
-			parse_buffer_pop_back_char(jc);
-			if (jc->callback && !(*jc->callback)(jc->ctx, JSON_T_OBJECT_BEGIN, NULL)) {
-				return false;
-			}
-			if (!push(jc, MODE_KEY)) {
-				return false;
-			}
-			assert(jc->type == JSON_T_NONE);
-			jc->state = OB;
+		case '-': case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+			if (!scan_number(&scanner)) goto error;
 			break;
 
-/* [ */ case -5:
-			parse_buffer_pop_back_char(jc);
-			if (jc->callback && !(*jc->callback)(jc->ctx, JSON_T_ARRAY_BEGIN, NULL)) {
-				return false;
-			}
-			if (!push(jc, MODE_ARRAY)) {
-				return false;
-			}
-			assert(jc->type == JSON_T_NONE);
-			jc->state = AR;
+		case 't':
+			if (!scan_keyword(&scanner, "true", 4, JSON_T_TRUE)) goto error;
 			break;
-
-/* string end " */ case -4:
-			parse_buffer_pop_back_char(jc);
-			switch (jc->stack[jc->top]) {
-			case MODE_KEY:
-				assert(jc->type == JSON_T_STRING);
-				jc->type = JSON_T_NONE;
-				jc->state = CO;
-				
-				if (jc->callback) {
-					JSON_value value;
-					value.vu.str.value = jc->parse_buffer;
-					value.vu.str.length = jc->parse_buffer_count;
-					if (!(*jc->callback)(jc->ctx, JSON_T_KEY, &value)) {
-						return false;
-					}
-				}
-				parse_buffer_clear(jc);
-				break;
-			case MODE_ARRAY:
-			case MODE_OBJECT:
-			case MODE_DONE: // martinkunev
-				assert(jc->type == JSON_T_STRING);
-				if (!parse_parse_buffer(jc)) {
-					return false;
-				}
-				jc->type = JSON_T_NONE;
-				jc->state = OK;
-				break;
-			default:
-				return false;
-			}
+		case 'f':
+			if (!scan_keyword(&scanner, "false", 5, JSON_T_FALSE)) goto error;
 			break;
-
-/* , */ case -3:
-			parse_buffer_pop_back_char(jc);
-			if (!parse_parse_buffer(jc)) {
-				return false;
-			}
-			switch (jc->stack[jc->top]) {
-			case MODE_OBJECT:
-/*
-	A comma causes a flip from object mode to key mode.
-*/
-				if (!pop(jc, MODE_OBJECT) || !push(jc, MODE_KEY)) {
-					return false;
-				}
-				assert(jc->type != JSON_T_STRING);
-				jc->type = JSON_T_NONE;
-				jc->state = KE;
-				break;
-			case MODE_ARRAY:
-				assert(jc->type != JSON_T_STRING);
-				jc->type = JSON_T_NONE;
-				jc->state = VA;
-				break;
-			default:
-				return false;
-			}
+		case 'n':
+			if (!scan_keyword(&scanner, "null", 4, JSON_T_NULL)) goto error;
 			break;
 
-/* : */ case -2:
-/*
-	A colon causes a flip from key mode to object mode.
-*/
-			parse_buffer_pop_back_char(jc);
-			if (!pop(jc, MODE_KEY) || !push(jc, MODE_OBJECT)) {
-				return false;
-			}
-			assert(jc->type == JSON_T_NONE);
-			jc->state = VA;
-			break;
-/*
-	Bad action.
-*/
 		default:
-			set_error(jc);
-			return false;
+			goto error;
 		}
-	}
-	return true;
-}
-
-int
-JSON_parser_done(JSON_parser jc)
-{
-	if ((jc->state == OK || jc->state == GO) && pop(jc, MODE_DONE))
-	{
-		return true;
-	}
 
-	jc->error = JSON_E_UNBALANCED_COLLECTION;
-	return false;
-}
+		// Parse what follows the value.
+		while (1)
+		{
+			if (!scan_space(&scanner)) goto error;
+			if (!depth)
+			{
+				if (scanner.position < size) goto error; // data after the root node
+				goto finally;
+			}
+			if (scanner.position == size) goto error;
 
+			if (data[scanner.position] == ',')
+			{
+				scanner.position += 1;
+				if (!scan_space(&scanner)) goto error;
+				if (stack[depth - 1] == JSON_SCAN_OBJECT) goto key;
+				break; // array item follows
+			}
 
-int JSON_parser_is_legal_white_space_string(const char* s)
-{
-	int c, char_class;
-	
-	if (s == NULL) {
-		return false;
-	}
-	
-	for (; *s; ++s) {   
-		c = *s;
-		
-		if (c < 0 || c >= 128) {
-			return false;
-		}
-		
-		char_class = ascii_class[c];
-		
-		if (char_class != C_SPACE && char_class != C_WHITE) {
-			return false;
+close:
+			if (data[scanner.position] == ((stack[depth - 1] == JSON_SCAN_OBJECT) ? '}' : ']'))
+			{
+				scanner.position += 1;
+				if (!callback(context, ((stack[depth - 1] == JSON_SCAN_OBJECT) ? JSON_T_OBJECT_END : JSON_T_ARRAY_END), 0)) goto error;
+				depth -= 1;
+				continue;
+			}
+			goto error;
 		}
+		continue;
+
+key:
+		// Parse object key and the colon after it.
+		if ((scanner.position == size) || (data[scanner.position] != '"')) goto error;
+		scanner.position += 1;
+		if (!scan_string(&scanner, &value)) goto error;
+		if (!callback(context, JSON_T_KEY, &value)) goto error;
+		if (!scan_space(&scanner) || (scanner.position == size) || (data[scanner.position] != ':')) goto error;
+		scanner.position += 1;
+		if (!scan_space(&scanner)) goto error;
 	}
-	
-	return true;
-}
 
-int JSON_parser_get_last_error(JSON_parser jc)
-{
-	return jc->error;
+finally:
+	free(scanner.buffer);
+	return 1;
+
+error:
+	free(scanner.buffer);
+	return 0;
 }
 
+/* JSON scanner > */
+
 static int token_add(void *restrict context, int type, const JSON_value *value)
 {
 	struct json_context *stack = (struct json_context *)context;
@@ -1315,30 +601,14 @@ void json_free(union json *restrict json)
 union json *json_parse(const unsigned char *data, size_t size)
 {
 	struct json_context context = {.count = 0};
-	struct JSON_parser_struct *jc;
-	size_t i;
-
-	unsigned line;
-
-	jc = new_JSON_parser(&token_add, &context); // TODO: memory error
 
-	line = 1;
-	for(i = 0; i < size; ++i)
+	if (!json_scan(data, size, &token_add, &context)) // TODO: memory or parse error
 	{
-		if (!JSON_parser_char(jc, data[i])) // TODO: memory or parse error
-			goto error;
-		if (data[i] == '\n') line += 1;
+		json_free(context.root);
+		return 0;
 	}
-	if (!JSON_parser_done(jc)) goto error; // TODO: parse error
-
-	delete_JSON_parser(jc);
 
 	return context.root;
-
-error:
-	delete_JSON_parser(jc);
-	json_free(context.root);
-	return 0;
 }
 
 // Returns the position of the Most Significant Bit set in a byte.
@@ -1706,3 +976,179 @@ union json *json_clone(const union json *json)
 		}
 	}
 }
+
+/* < JSON writer */
+
+// Writes data to the file directly.
+static void writer_output(struct json_writer *restrict writer, const unsigned char *restrict data, size_t size)
+{
+	while (size && !writer->status)
+	{
+		ssize_t written = write(writer->file, data, size);
+		if (written < 0)
+		{
+			if (errno != EINTR) writer->status = ERROR_WRITE;
+			continue;
+		}
+		data += written;
+		size -= written;
+	}
+}
+
+// Returns where to write size bytes (size must not exceed the buffer size).
+static unsigned char *writer_reserve(struct json_writer *restrict writer, size_t size)
+{
+	if (writer->size + size > sizeof(writer->buffer))
+	{
+		writer_output(writer, writer->buffer, writer->size);
+		writer->size = 0;
+	}
+	return writer->buffer + writer->size;
+}
+
+// Writes a token which consists of at most size bytes and may need a separator.
+#define writer_token(writer, size) writer_token_start((writer), (size) + 1)
+
+static unsigned char *writer_token_start(struct json_writer *restrict writer, size_t size)
+{
+	unsigned char *position = writer_reserve(writer, size);
+	if (writer->separator) *position++ = ',';
+	return position;
+}
+
+static void writer_token_end(struct json_writer *restrict writer, unsigned char *restrict position, _Bool separator)
+{
+	writer->size = position - writer->buffer;
+	writer->separator = separator;
+}
+
+void json_writer_init(struct json_writer *restrict writer, int file)
+{
+	writer->file = file;
+	writer->status = 0;
+	writer->separator = false;
+	writer->size = 0;
+}
+
+int json_writer_flush(struct json_writer *restrict writer)
+{
+	writer_output(writer, writer->buffer, writer->size);
+	writer->size = 0;
+	return writer->status;
+}
+
+void json_write_object_begin(struct json_writer *restrict writer)
+{
+	unsigned char *position = writer_token(writer, 1);
+	*position++ = '{';
+	writer_token_end(writer, position, false);
+}
+
+void json_write_object_end(struct json_writer *restrict writer)
+{
+	unsigned char *position = writer_reserve(writer, 1);
+	*position++ = '}';
+	writer_token_end(writer, position, true);
+}
+
+void json_write_array_begin(struct json_writer *restrict writer)
+{
+	unsigned char *position = writer_token(writer, 1);
+	*position++ = '[';
+	writer_token_end(writer, position, false);
+}
+
+void json_write_array_end(struct json_writer *restrict writer)
+{
+	unsigned char *position = writer_reserve(writer, 1);
+	*position++ = ']';
+	writer_token_end(writer, position, true);
+}
+
+// Writes a quoted string followed by suffix (if suffix is not 0).
+static void writer_string(struct json_writer *restrict writer, const unsigned char *restrict data, size_t size, unsigned char suffix)
+{
+	ssize_t length = json_string_size(data, size);
+	size_t total;
+	unsigned char *position;
+
+	if (length < 0)
+	{
+		writer->status = ERROR_INPUT;
+		return;
+	}
+
+	total = 1 + 1 + length + 1 + 1; // ,"data":
+	if (total <= sizeof(writer->buffer))
+	{
+		position = writer_token_start(writer, total);
+		*position++ = '"';
+		position = json_string_dump(position, data, size);
+		*position++ = '"';
+		if (suffix) *position++ = suffix;
+		writer_token_end(writer, position, !suffix);
+	}
+	else
+	{
+		// The string does not fit in the buffer so write it separately.
+		unsigned char *buffer = malloc(total);
+		if (!buffer)
+		{
+			writer->status = ERROR_MEMORY;
+			return;
+		}
+
+		position = buffer;
+		if (writer->separator) *position++ = ',';
+		*position++ = '"';
+		position = json_string_dump(position, data, size);
+		*position++ = '"';
+		if (suffix) *position++ = suffix;
+
+		json_writer_flush(writer);
+		writer_output(writer, buffer, position - buffer);
+		writer->separator = !suffix;
+		free(buffer);
+	}
+}
+
+void json_write_key(struct json_writer *restrict writer, const unsigned char *restrict key_data, size_t key_size)
+{
+	writer_string(writer, key_data, key_size, ':');
+}
+
+void json_write_null(struct json_writer *restrict writer)
+{
+	unsigned char *position = writer_token(writer, 4);
+	position = format_bytes(position, "null", 4);
+	writer_token_end(writer, position, true);
+}
+
+void json_write_boolean(struct json_writer *restrict writer, bool value)
+{
+	unsigned char *position = writer_token(writer, 5);
+	position = (value ? format_bytes(position, "true", 4) : format_bytes(position, "false", 5));
+	writer_token_end(writer, position, true);
+}
+
+void json_write_integer(struct json_writer *restrict writer, long long value)
+{
+	unsigned char *position = writer_token(writer, format_int_length(value, 10));
+	position = format_int(position, value, 10);
+	writer_token_end(writer, position, true);
+}
+
+void json_write_real(struct json_writer *restrict writer, double value)
+{
+	int length = snprintf(0, 0, "%g", value); // TODO use format_ here
+	unsigned char *position = writer_token(writer, length + 1);
+	position += sprintf(position, "%g", value);
+	writer_token_end(writer, position, true);
+}
+
+void json_write_string(struct json_writer *restrict writer, const char *restrict data, size_t size)
+{
+	writer_string(writer, data, size, 0);
+}
+
+/* JSON writer > */
@@ -70,6 +70,47 @@ union json *json_array_insert(union json *restrict container, union json *restri
 union json *json_object_insert(union json *restrict container, const unsigned char *restrict key_data, size_t key_size, union json *restrict value);
 
 union json *json_parse(const unsigned char *data, size_t size);
+
+// Tokens reported by json_scan().
+typedef enum
+{
+	JSON_T_NONE = 0,
+	JSON_T_ARRAY_BEGIN,
+	JSON_T_ARRAY_END,
+	JSON_T_OBJECT_BEGIN,
+	JSON_T_OBJECT_END,
+	JSON_T_INTEGER,
+	JSON_T_FLOAT,
+	JSON_T_NULL,
+	JSON_T_TRUE,
+	JSON_T_FALSE,
+	JSON_T_STRING,
+	JSON_T_KEY,
+	JSON_T_MAX
+} JSON_type;
+
+typedef struct JSON_value_struct
+{
+	union
+	{
+		long long integer_value;
+		double float_value;
+		struct
+		{
+			const char *value;
+			size_t length;
+		} str;
+	} vu;
+} JSON_value;
+
+// Called by json_scan() for each token. type is an element of JSON_type other than JSON_T_NONE.
+// value is NULL for JSON_T_ARRAY_BEGIN, JSON_T_ARRAY_END, JSON_T_OBJECT_BEGIN, JSON_T_OBJECT_END, JSON_T_NULL, JSON_T_TRUE and JSON_T_FALSE.
+// String values are not zero-terminated and are only valid until the callback returns.
+// Returns non-zero if parsing should continue, else zero.
+typedef int (*JSON_parser_callback)(void *ctx, int type, const JSON_value *value);
+
+int json_scan(const unsigned char *restrict data, size_t size, JSON_parser_callback callback, void *context);
+
 union json *json_clone(const union json *json);
 
 ssize_t json_string_size(const char *restrict data, size_t size);
@@ -79,3 +120,31 @@ char *json_string_dump(unsigned char *restrict dest, const unsigned char *restri
 char *json_dump(char *restrict result, const union json *restrict json);
 
 void json_free(union json *restrict json);
+
+enum {JSON_WRITER_BUFFER = 4096};
+
+// Writes JSON to a file as it is generated, using a fixed-size buffer.
+// The first error stops the writing and is reported by json_writer_flush().
+struct json_writer
+{
+	int file;
+	int status;
+	_Bool separator; // whether a comma is necessary before the next item
+	size_t size;
+	unsigned char buffer[JSON_WRITER_BUFFER];
+};
+
+void json_writer_init(struct json_writer *restrict writer, int file);
+int json_writer_flush(struct json_writer *restrict writer);
+
+void json_write_object_begin(struct json_writer *restrict writer);
+void json_write_object_end(struct json_writer *restrict writer);
+void json_write_array_begin(struct json_writer *restrict writer);
+void json_write_array_end(struct json_writer *restrict writer);
+void json_write_key(struct json_writer *restrict writer, const unsigned char *restrict key_data, size_t key_size);
+
+void json_write_null(struct json_writer *restrict writer);
+void json_write_boolean(struct json_writer *restrict writer, bool value);
+void json_write_integer(struct json_writer *restrict writer, long long value);
+void json_write_real(struct json_writer *restrict writer, double value);
+void json_write_string(struct json_writer *restrict writer, const char *restrict data, size_t size);
@@ -23,10 +23,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "base.h"
 #include "errors.h"
+#include "bitset.h"
 #include "game.h"
 #include "draw.h"
 #include "resources.h"
@@ -39,12 +42,13 @@
 #include "input_menu.h"
 #include "input_battle.h"
 #include "input_report.h"
-#include "computer_battle.h"
 #include "interface.h"
 #include "display_common.h"
 #include "display_map.h"
+#include "display_battle.h"
 #include "menu.h"
 #include "players.h"
+#include "turn.h"
 
 #define S(s) s, sizeof(s) - 1
 
@@ -76,10 +80,28 @@ static int play_battle(struct game *restrict game, struct region *restrict regio
 
 	unsigned players_local = 0;
 
+	// Obstacles are indexed by alliance and graphs are indexed by player.
+	size_t alliances = alliances_count(game);
+	const struct obstacles **obstacles;
+	struct adjacency_list **graph;
+
 	int status;
 
+	obstacles = malloc(alliances * sizeof(*obstacles));
+	graph = malloc(game->players_count * sizeof(*graph));
+	if (!obstacles || !graph)
+	{
+		free(obstacles);
+		free(graph);
+		return ERROR_MEMORY;
+	}
+
 	if (battlefield_init(game, &battle, region, battle_type) < 0)
+	{
+		free(obstacles);
+		free(graph);
 		return -1;
+	}
 
 	if (game->players_local_count >= 2)
 	{
@@ -97,6 +119,8 @@ static int play_battle(struct game *restrict game, struct region *restrict regio
 	if (!movements)
 	{
 		battlefield_term(game, &battle);
+		free(obstacles);
+		free(graph);
 		return ERROR_MEMORY;
 	}
 
@@ -112,20 +136,18 @@ static int play_battle(struct game *restrict game, struct region *restrict regio
 
 	while ((winner = battle_end(game, &battle)) < 0)
 	{
-		const struct obstacles *obstacles[PLAYERS_LIMIT] = {0};
-		struct adjacency_list *graph[PLAYERS_LIMIT] = {0};
-
 		unsigned step;
 		size_t i;
 
 		unsigned char alliance_neutral = game->players[PLAYER_NEUTRAL].alliance;
 
+		memset(obstacles, 0, alliances * sizeof(*obstacles));
+		memset(graph, 0, game->players_count * sizeof(*graph));
+
 		// TODO if there are no local players, resolve the battle automatically
 
 		obstacles[alliance_neutral] = path_obstacles_alloc(game, &battle, PLAYER_NEUTRAL);
 		if (!obstacles[alliance_neutral]) abort();
-		graph[alliance_neutral] = visibility_graph_build(&battle, obstacles[alliance_neutral], 2); // 2 vertices for origin and target
-		if (!graph[alliance_neutral]) abort();
 
 		battlefield_index_build(&battle);
 
@@ -182,11 +204,10 @@ static int play_battle(struct game *restrict game, struct region *restrict regio
 		combat_melee(game, &battle);
 		if (battlefield_clean(game, &battle)) round_activity_last = battle.round;
 
-		for(i = 0; i < PLAYERS_LIMIT; ++i)
-		{
+		for(i = 0; i < alliances; ++i)
 			free((void *)obstacles[i]); // TODO fix this cast
+		for(i = 0; i < game->players_count; ++i)
 			visibility_graph_free(graph[i]);
-		}
 
 		// Cancel the battle if nothing is killed/destroyed for a certain number of rounds.
 		if ((battle.round - round_activity_last) >= ((battle_type == BATTLE_ASSAULT) ? ROUNDS_STALE_LIMIT_ASSAULT : ROUNDS_STALE_LIMIT_OPEN))
@@ -213,21 +234,31 @@ static int play_battle(struct game *restrict game, struct region *restrict regio
 	input_report_battle(game, &battle);
 
 finally:
+	if_battlefield_term();
 	free(movements);
 	battlefield_term(game, &battle);
+	free(obstacles);
+	free(graph);
 	return winner;
 }
 
 // Returns whether there is a winner. On error, returns error code.
 static int play(struct game *restrict game)
 {
-	unsigned char player;
+	size_t player;
 	struct region *region;
-	struct troop *troop, *next;
+	struct troop *troop;
+
+	struct turn turn;
 
 	size_t index;
 
-	uint16_t alliances; // this limits the alliance numbers to the number of bits
+	// Tables sized from the world. They are allocated once and reused each turn.
+	size_t alliances_size = alliances_count(game);
+	struct resources *expenses;
+	unsigned char *alive;
+	struct turn_battle *battle_info;
+	uint64_t *alliances, *alliances_assault, *alliances_open;
 
 	int status;
 
@@ -235,15 +266,30 @@ static int play(struct game *restrict game)
 	if (status < 0)
 		return status;
 
+	status = turn_init(&turn, game);
+	if (status < 0)
+	{
+		players_term(game);
+		return status;
+	}
+
+	expenses = malloc(game->players_count * sizeof(*expenses));
+	alive = malloc(game->players_count * sizeof(*alive));
+	battle_info = malloc(game->regions_count * sizeof(*battle_info));
+	alliances = bitset_alloc(alliances_size);
+	alliances_assault = bitset_alloc(alliances_size);
+	alliances_open = bitset_alloc(alliances_size);
+	if (!expenses || !alive || !battle_info || !alliances || !alliances_assault || !alliances_open)
+	{
+		status = ERROR_MEMORY;
+		goto finally;
+	}
+
 	do
 	{
-		struct resources expenses[PLAYERS_LIMIT] = {0};
-		unsigned char alive[PLAYERS_LIMIT] = {0};
-		struct
-		{
-			enum battle_type type;
-			unsigned char winner;
-		} battle_info[REGIONS_LIMIT] = {0};
+		memset(expenses, 0, game->players_count * sizeof(*expenses));
+		memset(alive, 0, game->players_count * sizeof(*alive));
+		memset(battle_info, 0, game->regions_count * sizeof(*battle_info));
 
 		// Ask each player to perform map actions.
 		status = players_map(game);
@@ -251,114 +297,39 @@ static int play(struct game *restrict game)
 			goto finally;
 
 		// Perform region-specific actions.
-		for(index = 0; index < game->regions_count; ++index)
-		{
-			struct resources expense;
-
-			region = game->regions + index;
-
-			// TODO improve the code below
-
-			for(troop = region->troops; troop; troop = next)
-			{
-				next = troop->_next;
-				if (troop->dismiss)
-				{
-					troop_detach(&region->troops, troop);
-					free(troop);
-				}
-			}
-
-			// Calculate region expenses.
-			if (region->owner == region->garrison.owner)
-			{
-				// Troops expenses are covered by current region.
-				for(troop = region->troops; troop; troop = troop->_next)
-				{
-					if (troop->move == LOCATION_GARRISON)
-						continue;
-
-					if (troop->move->owner != region->owner)
-						resource_multiply(&expense, &troop->unit->support, 2 * troop->count);
-					else
-						resource_multiply(&expense, &troop->unit->support, troop->count);
-					resource_add(expenses + troop->owner, &expense);
-				}
-			}
-			else
-			{
-				// Troops expenses are covered by another region. Double expenses.
-				for(troop = region->troops; troop; troop = troop->_next)
-				{
-					if ((troop->move == LOCATION_GARRISON) && (troop->owner == region->garrison.owner))
-						continue; // sieged troop
-
-					resource_multiply(&expense, &troop->unit->support, 2 * troop->count);
-					resource_add(expenses + troop->owner, &expense);
-				}
-			}
-			expenses[region->owner].gold -= 10 * sqrt(region->population / 1000.0); // region governing
-			for(size_t i = 0; i < BUILDINGS_COUNT; ++i)
-				if (region->built & (1 << i))
-					resource_add(expenses + region->owner, &BUILDINGS[i].support);
-
-			region_orders_process(region);
-
-			// Move troops in and out of garrison and put them in their target regions.
-			// New troop locations will be set after all battles have concluded.
-			for(troop = region->troops; troop; troop = next)
-			{
-				next = troop->_next;
-				if (troop->move == troop->location) continue;
-
-				if (troop->move == LOCATION_GARRISON)
-				{
-					// Move troop to the garrison unless it prepares for assault.
-					if (troop->owner == region->garrison.owner)
-						troop->location = LOCATION_GARRISON;
-				}
-				else
-				{
-					if (troop->location == LOCATION_GARRISON) troop->location = region;
-
-					if (troop->move != troop->location)
-					{
-						// Put the troop in the specified region.
-						troop_detach(&region->troops, troop);
-						troop_attach(&troop->move->troops, troop);
-					}
-				}
-			}
-		}
+		turn_regions_prepare(&turn, expenses);
 
 		// Settle conflicts by battles.
 		for(index = 0; index < game->regions_count; ++index)
 		{
-			uint32_t alliances_assault = 0, alliances_open = 0, alliances;
 			int manual_assault = 0, manual_open = 0;
 
 			int status;
 
 			region = game->regions + index;
 
+			bitset_zero(alliances_assault, alliances_size);
+			bitset_zero(alliances_open, alliances_size);
+
 			// Collect information about the troops in each region.
 			for(troop = region->troops; troop; troop = troop->_next)
 			{
 				if (troop->move == LOCATION_GARRISON)
 				{
-					alliances_assault |= (1 << game->players[troop->owner].alliance);
+					bitset_set(alliances_assault, game->players[troop->owner].alliance);
 					if (game->players[troop->owner].type == Local) manual_assault = 1;
 				}
 				else
 				{
-					alliances_open |= (1 << game->players[troop->owner].alliance);
+					bitset_set(alliances_open, game->players[troop->owner].alliance);
 					if (game->players[troop->owner].type == Local) manual_open = 1;
 				}
 			}
 
 			// Check if the owner of the garrison has troops in the garrison and wants to reinforce the defense.
-			alliances = alliances_open | alliances_assault;
-			if ((alliances & (alliances - 1)) && (alliances_assault & (1 << game->players[region->garrison.owner].alliance)))
+			bitset_copy(alliances, alliances_open, alliances_size);
+			bitset_or(alliances, alliances_assault, alliances_size);
+			if (bitset_multiple(alliances, alliances_size) && bitset_test(alliances_assault, game->players[region->garrison.owner].alliance))
 			{
 				region->garrison.reinforce = false;
 				status = players_invasion(game, region);
@@ -368,95 +339,53 @@ static int play(struct game *restrict game)
 				if (region->garrison.reinforce)
 				{
 					if (game->players[region->garrison.owner].type == Local) manual_open = 1;
-					alliances_open |= (1 << game->players[region->garrison.owner].alliance);
+					bitset_set(alliances_open, game->players[region->garrison.owner].alliance);
 					battle_info[index].type = BATTLE_OPEN_REINFORCED;
 				}
 			}
 
 			// Start open battle if troops of two different alliances occupy the region.
 			// If there is no open battle and there are troops preparing for assault, start assault battle.
-			if (alliances_open & (alliances_open - 1))
+			if (bitset_multiple(alliances_open, alliances_size))
 			{
 				if (!battle_info[index].type)
 					battle_info[index].type = BATTLE_OPEN;
-
-				status = (manual_open ? play_battle(game, region, battle_info[index].type) : calculate_battle(game, region, 0));
-				if (status < 0) goto finally;
-
-				battle_info[index].winner = status;
+				battle_info[index].manual = manual_open;
 			}
-			else if (alliances_assault & (alliances_assault - 1))
+			else if (bitset_multiple(alliances_assault, alliances_size))
 			{
 				battle_info[index].type = BATTLE_ASSAULT;
-
-				status = (manual_assault ? play_battle(game, region, battle_info[index].type) : calculate_battle(game, region, 1));
-				if (status < 0) goto finally;
-
-				battle_info[index].winner = status;
+				battle_info[index].manual = manual_assault;
 			}
 			else battle_info[index].type = BATTLE_NONE;
 		}
 
-		// Perform post-battle cleanup actions.
+		// Battles without local players are calculated in the background while local players play their battles.
+		turn_battles_start(&turn, battle_info);
 		for(index = 0; index < game->regions_count; ++index)
 		{
-			unsigned region_owner_old;
-
-			region = game->regions + index;
-			region_owner_old = region->owner;
-
-			if (battle_info[index].type)
-				region_battle_cleanup(game, region, (battle_info[index].type == BATTLE_ASSAULT), battle_info[index].winner);
-
-			region_turn_process(game, region);
-
-			// Cancel all constructions and trainings if region owner changed.
-			if (region->owner != region_owner_old)
-				region_orders_cancel(region);
-
-			// Each player controlling a region or a garrison is alive.
-			alive[region->owner] = 1;
-			alive[region->garrison.owner] = 1;
-		}
-
-		// Adjust troop locations and calculate region income.
-		for(index = 0; index < game->regions_count; ++index)
-		{
-			region = game->regions + index;
+			if (!battle_info[index].type || !battle_info[index].manual)
+				continue;
 
-			for(troop = region->troops; troop; troop = next)
+			status = play_battle(game, game->regions + index, battle_info[index].type);
+			if (status < 0)
 			{
-				next = troop->_next;
-
-				if (troop->location == LOCATION_GARRISON) continue;
-
-				// Update troop location.
-				// Return retreating troops to their previous location.
-				if (troop->move == region) troop->location = region;
-				else
-				{
-					troop_detach(&region->troops, troop);
-					if (allies(game, troop->owner, troop->location->owner))
-						troop_attach(&troop->location->troops, troop);
-					else
-						free(troop); // the troop has no region to return to; kill it
-				}
+				turn_battles_wait(&turn);
+				goto finally;
 			}
 
-			// Add region income to the owner's treasury if the garrison is not under siege.
-			if (region->owner == region->garrison.owner)
-			{
-				struct resources income = {0};
-				region_production(region, &income);
-				resource_add(&game->players[region->owner].treasury, &income);
-			}
+			battle_info[index].winner = status;
 		}
+		turn_battles_wait(&turn);
 
-		for(index = 0; index < game->regions_count; ++index)
-			region_troops_merge(game->regions + index);
+		// Perform post-battle cleanup actions.
+		turn_regions_cleanup(&turn, battle_info, alive);
+
+		// Adjust troop locations and calculate region income.
+		turn_regions_settle(&turn);
 
 		// Perform player-specific actions.
-		alliances = 0;
+		bitset_zero(alliances, alliances_size);
 		game->players_local_count = 0;
 		for(player = 0; player < game->players_count; ++player)
 		{
@@ -475,7 +404,7 @@ static int play(struct game *restrict game)
 			}
 
 			// Mark the alliance of each alive player as alive.
-			alliances |= (1 << game->players[player].alliance);
+			bitset_set(alliances, game->players[player].alliance);
 
 			// Adjust player treasury for the income and expenses.
 			resource_spend(&game->players[player].treasury, expenses + player);
@@ -483,16 +412,25 @@ static int play(struct game *restrict game)
 
 		game->turn += 1;
 
+		menu_autosave(game); // the game continues if autosave fails
+
 		if (!game->players_local_count) // no more human-controlled players
 		{
 			status = 0;
 			goto finally;
 		}
-	} while (1 || (alliances & (alliances - 1))); // while there is more than 1 alliance
+	} while (1 || bitset_multiple(alliances, alliances_size)); // while there is more than 1 alliance
 
-	status = alliances;
+	status = 1;
 
 finally:
+	free(expenses);
+	free(alive);
+	free(battle_info);
+	free(alliances);
+	free(alliances_assault);
+	free(alliances_open);
+	turn_term(&turn);
 	players_term(game);
 	return status;
 }
@@ -500,6 +438,7 @@ finally:
 int main(int argc, char *argv[])
 {
 	struct game game;
+	struct bytes *images_cache;
 	int status;
 
 	status = sigaction(SIGPIPE, &(struct sigaction){.sa_handler = SIG_IGN}, 0);
@@ -507,13 +446,16 @@ int main(int argc, char *argv[])
 
 	srandom(time(0));
 
-	assert(PLAYERS_LIMIT <= 16); // TODO this should be compile-time assert
-
 	menu_init();
 
 	if (if_init() < 0)
 		return 1;
-	if_load_images();
+	// Cache the decoded images in the game directory created by menu_init().
+	images_cache = menu_game_file(S("images.cache"));
+	status = if_load_images(images_cache ? (const char *)images_cache->data : 0);
+	free(images_cache);
+	if (status < 0)
+		return 1;
 
 	if_display();
 
@@ -523,19 +465,28 @@ int main(int argc, char *argv[])
 		if (status < 0) return -1; // TODO
 
 		// Initialize region input recognition.
-		if_storage_init(&game, MAP_WIDTH, MAP_HEIGHT);
+		status = if_storage_init(&game, MAP_WIDTH, MAP_HEIGHT);
+		if (status < 0)
+		{
+			if_regions_term();
+			world_unload(&game);
+			return status;
+		}
 		if_display();
 
 		status = play(&game);
 		if (status >= 0) input_report_map(&game);
 
 		if_storage_term();
+		if_regions_term();
+		menu_autosave_wait();
 		world_unload(&game);
 
 		if (status == ERROR_CANCEL) continue;
 		else if (status < 0) return status;
 	}
 
+	if_unload_images();
 	if_term();
 
 	menu_term();
@@ -17,13 +17,16 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "bitset.h"
 #include "draw.h"
+#include "errors.h"
 #include "game.h"
 #include "resources.h"
 #include "map.h"
@@ -150,10 +153,10 @@ void region_production(const struct region *restrict region, struct resources *r
 }
 
 // Chooses new region owner from the troops in the given alliance.
-static unsigned region_owner_choose(const struct game *restrict game, struct region *restrict region, size_t troops_count, unsigned alliance)
+static unsigned region_owner_choose(const struct game *restrict game, struct region *restrict region, size_t troops_count, unsigned alliance, unsigned short random_state[static 3])
 {
 	struct troop *troop;
-	unsigned char owner_troop = random() % troops_count;
+	unsigned char owner_troop = nrand48(random_state) % troops_count;
 
 	for(troop = region->troops; troop; troop = troop->_next)
 	{
@@ -189,7 +192,8 @@ void region_battle_cleanup(const struct game *restrict game, struct region *rest
 	}
 }
 
-void region_turn_process(const struct game *restrict game, struct region *restrict region)
+// The random choices are made with the random number generator state random_state (as used by nrand48()).
+void region_turn_process(const struct game *restrict game, struct region *restrict region, unsigned short random_state[static 3])
 {
 	// Region can change ownership if:
 	// * it is conquered by enemy troops
@@ -227,7 +231,7 @@ void region_turn_process(const struct game *restrict game, struct region *restri
 		if (invaders_alliance == game->players[region->garrison.owner].alliance)
 			region->owner = region->garrison.owner;
 		else
-			region->owner = region_owner_choose(game, region, invaders_count, invaders_alliance);
+			region->owner = region_owner_choose(game, region, invaders_count, invaders_alliance, random_state);
 	}
 	else if (!region_guarded && !allies(game, region->owner, region->garrison.owner))
 		region->owner = region->garrison.owner;
@@ -294,6 +298,205 @@ int polygons_border(const struct polygon *restrict a, const struct polygon *rest
 	return 0;
 }
 
+// Returns whether the center of the pixel (x, y) is inside the polygon.
+static int polygon_contains(const struct polygon *restrict polygon, int x, int y)
+{
+	// Count how many times a ray from the point in the positive x direction crosses the polygon.
+	// The coordinates are doubled so that the pixel center has integer coordinates. The pixel center
+	// is never at the same height as a vertex and is inside exactly one of two polygons sharing an edge.
+	long long px = 2 * (long long)x + 1, py = 2 * (long long)y + 1;
+	int inside = 0;
+	size_t i, j;
+
+	for(i = 0, j = polygon->vertices_count - 1; i < polygon->vertices_count; j = i++)
+	{
+		long long ax = 2 * (long long)polygon->points[j].x, ay = 2 * (long long)polygon->points[j].y;
+		long long bx = 2 * (long long)polygon->points[i].x, by = 2 * (long long)polygon->points[i].y;
+		long long cross;
+
+		if ((ay > py) == (by > py)) continue; // the edge is not at the height of the point
+
+		// Check whether the edge crosses the ray (whether the point is to the left of the edge).
+		cross = (bx - ax) * (py - ay) - (px - ax) * (by - ay);
+		if ((by > ay) ? (cross > 0) : (cross < 0))
+			inside = !inside;
+	}
+
+	return inside;
+}
+
+// Divides the area of the map into square cells and remembers which regions may contain points in each cell.
+int regions_grid_init(struct regions_grid *restrict grid, const struct game *restrict game)
+{
+	struct bounds world = {INT_MAX, INT_MIN, INT_MAX, INT_MIN};
+	size_t cells_count;
+	size_t i, j;
+
+	*grid = (struct regions_grid){.cell_size = 1};
+
+	grid->bounds = malloc((game->regions_count ? game->regions_count : 1) * sizeof(*grid->bounds));
+	if (!grid->bounds) return ERROR_MEMORY;
+
+	for(i = 0; i < game->regions_count; ++i)
+	{
+		const struct polygon *restrict location = game->regions[i].location;
+		struct bounds *restrict bounds = grid->bounds + i;
+
+		*bounds = (struct bounds){INT_MAX, INT_MIN, INT_MAX, INT_MIN};
+		for(j = 0; j < location->vertices_count; ++j)
+		{
+			if (location->points[j].x < bounds->left) bounds->left = location->points[j].x;
+			if (location->points[j].x > bounds->right) bounds->right = location->points[j].x;
+			if (location->points[j].y < bounds->top) bounds->top = location->points[j].y;
+			if (location->points[j].y > bounds->bottom) bounds->bottom = location->points[j].y;
+		}
+
+		if (bounds->left < world.left) world.left = bounds->left;
+		if (bounds->right > world.right) world.right = bounds->right;
+		if (bounds->top < world.top) world.top = bounds->top;
+		if (bounds->bottom > world.bottom) world.bottom = bounds->bottom;
+	}
+
+	if (game->regions_count)
+	{
+		// Choose cell size so that there is about one region per cell.
+		double area = ((double)world.right - world.left + 1) * ((double)world.bottom - world.top + 1);
+		grid->cell_size = (unsigned)ceil(sqrt(area / game->regions_count));
+		grid->world = world;
+		grid->columns = ((size_t)world.right - world.left) / grid->cell_size + 1;
+		grid->rows = ((size_t)world.bottom - world.top) / grid->cell_size + 1;
+	}
+	cells_count = grid->columns * grid->rows;
+
+	grid->offsets = calloc(cells_count + 1, sizeof(*grid->offsets));
+	if (!grid->offsets)
+	{
+		free(grid->bounds);
+		return ERROR_MEMORY;
+	}
+
+	// Each region is a candidate for the cells intersecting its bounding box.
+	// Count the candidates of each cell, then store the candidates in order of region index.
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		for(i = 0; i < game->regions_count; ++i)
+		{
+			const struct bounds *restrict bounds = grid->bounds + i;
+			size_t column, row;
+
+			for(row = ((size_t)bounds->top - world.top) / grid->cell_size; row <= ((size_t)bounds->bottom - world.top) / grid->cell_size; ++row)
+				for(column = ((size_t)bounds->left - world.left) / grid->cell_size; column <= ((size_t)bounds->right - world.left) / grid->cell_size; ++column)
+				{
+					size_t cell = row * grid->columns + column;
+					if (pass) grid->regions[grid->offsets[cell]++] = i;
+					else grid->offsets[cell + 1] += 1;
+				}
+		}
+
+		if (pass)
+		{
+			// Each offset was moved to the beginning of the next cell. Shift the offsets back.
+			for(i = cells_count; i; --i)
+				grid->offsets[i] = grid->offsets[i - 1];
+			grid->offsets[0] = 0;
+		}
+		else
+		{
+			for(i = 0; i < cells_count; ++i)
+				grid->offsets[i + 1] += grid->offsets[i];
+			grid->regions = malloc((grid->offsets[cells_count] ? grid->offsets[cells_count] : 1) * sizeof(*grid->regions));
+			if (!grid->regions)
+			{
+				free(grid->offsets);
+				free(grid->bounds);
+				return ERROR_MEMORY;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Returns the index of the region containing the pixel (x, y) or -1 if there is no such region.
+int regions_grid_find(const struct regions_grid *restrict grid, const struct game *restrict game, int x, int y)
+{
+	size_t column, row, cell, i;
+
+	if ((x < grid->world.left) || (y < grid->world.top)) return -1;
+	column = ((size_t)x - grid->world.left) / grid->cell_size;
+	row = ((size_t)y - grid->world.top) / grid->cell_size;
+	if ((column >= grid->columns) || (row >= grid->rows)) return -1;
+	cell = row * grid->columns + column;
+
+	// When regions overlap, the region with the largest index is found.
+	for(i = grid->offsets[cell + 1]; i > grid->offsets[cell]; --i)
+		if (polygon_contains(game->regions[grid->regions[i - 1]].location, x, y))
+			return grid->regions[i - 1];
+	return -1;
+}
+
+static int index_compare(const void *a, const void *b)
+{
+	uint32_t first = *(const uint32_t *)a, second = *(const uint32_t *)b;
+	return (first > second) - (first < second);
+}
+
+// Stores in result the indices of the regions whose bounding box intersects view, in increasing order.
+// result must have space for all regions. Returns the number of indices stored.
+size_t regions_grid_query(const struct regions_grid *restrict grid, struct bounds view, uint32_t *restrict result)
+{
+	size_t column_first, column_last, row_first, row_last;
+	size_t column, row, i;
+	size_t count = 0;
+
+	if (!grid->columns) return 0;
+
+	if ((view.right < grid->world.left) || (view.left > grid->world.right) || (view.bottom < grid->world.top) || (view.top > grid->world.bottom))
+		return 0;
+	if (view.left < grid->world.left) view.left = grid->world.left;
+	if (view.right > grid->world.right) view.right = grid->world.right;
+	if (view.top < grid->world.top) view.top = grid->world.top;
+	if (view.bottom > grid->world.bottom) view.bottom = grid->world.bottom;
+
+	column_first = ((size_t)view.left - grid->world.left) / grid->cell_size;
+	column_last = ((size_t)view.right - grid->world.left) / grid->cell_size;
+	row_first = ((size_t)view.top - grid->world.top) / grid->cell_size;
+	row_last = ((size_t)view.bottom - grid->world.top) / grid->cell_size;
+
+	for(row = row_first; row <= row_last; ++row)
+		for(column = column_first; column <= column_last; ++column)
+		{
+			size_t cell = row * grid->columns + column;
+			for(i = grid->offsets[cell]; i < grid->offsets[cell + 1]; ++i)
+			{
+				uint32_t region = grid->regions[i];
+				const struct bounds *restrict bounds = grid->bounds + region;
+				size_t region_column, region_row;
+
+				if ((bounds->right < view.left) || (bounds->left > view.right) || (bounds->bottom < view.top) || (bounds->top > view.bottom))
+					continue;
+
+				// A region is a candidate for several cells. Report it only for the first of them that is examined.
+				region_column = ((size_t)bounds->left - grid->world.left) / grid->cell_size;
+				region_row = ((size_t)bounds->top - grid->world.top) / grid->cell_size;
+				if ((column != ((region_column > column_first) ? region_column : column_first)) || (row != ((region_row > row_first) ? region_row : row_first)))
+					continue;
+
+				result[count++] = region;
+			}
+		}
+
+	qsort(result, count, sizeof(*result), index_compare);
+	return count;
+}
+
+void regions_grid_term(struct regions_grid *restrict grid)
+{
+	free(grid->regions);
+	free(grid->offsets);
+	free(grid->bounds);
+}
+
 void region_orders_process(struct region *restrict region)
 {
 	// Update training time and check if there are trained units.
@@ -325,10 +528,76 @@ void region_orders_cancel(struct region *restrict region)
 	region->train_progress = 0;
 }
 
+// Stores the neighbors of each region in arrays indexed by neighbor position.
+// The links of each region keep their relative order.
+int neighbors_init(struct game *restrict game, const struct region_link *restrict links, size_t links_count)
+{
+	uint32_t *offsets, *neighbors;
+	unsigned char *directions;
+	size_t i;
+
+	if (links_count > UINT32_MAX) return ERROR_INPUT;
+
+	offsets = calloc(game->regions_count + 1, sizeof(*offsets));
+	neighbors = malloc((links_count ? links_count : 1) * sizeof(*neighbors));
+	directions = malloc(links_count ? links_count : 1);
+	if (!offsets || !neighbors || !directions)
+	{
+		free(offsets);
+		free(neighbors);
+		free(directions);
+		return ERROR_MEMORY;
+	}
+
+	// Count the neighbors of each region and find where the neighbors of each region end.
+	for(i = 0; i < links_count; ++i)
+		offsets[links[i].region + 1] += 1;
+	for(i = 0; i < game->regions_count; ++i)
+		offsets[i + 1] += offsets[i];
+
+	// Use the offsets as insertion positions. Afterwards each offset is shifted by one region.
+	for(i = 0; i < links_count; ++i)
+	{
+		uint32_t position = offsets[links[i].region]++;
+		neighbors[position] = links[i].neighbor;
+		directions[position] = links[i].direction;
+	}
+	for(i = game->regions_count; i; --i)
+		offsets[i] = offsets[i - 1];
+	offsets[0] = 0;
+
+	neighbors_term(game);
+	game->neighbors_offsets = offsets;
+	game->neighbors = neighbors;
+	game->neighbors_directions = directions;
+
+	return 0;
+}
+
+void neighbors_term(struct game *restrict game)
+{
+	free(game->neighbors_offsets);
+	free(game->neighbors);
+	free(game->neighbors_directions);
+	game->neighbors_offsets = 0;
+	game->neighbors = 0;
+	game->neighbors_directions = 0;
+}
+
+// Returns the direction in which neighbor is located or -1 if the regions are not neighbors.
+int region_neighbor_direction(const struct game *restrict game, const struct region *restrict region, const struct region *restrict neighbor)
+{
+	for(size_t i = region_neighbors_begin(game, region); i < region_neighbors_end(game, region); ++i)
+		if (game->neighbors[i] == neighbor->index)
+			return game->neighbors_directions[i];
+	return -1;
+}
+
 // Determine which regions are visible for the current player.
-void map_visible(const struct game *restrict game, unsigned char player, unsigned char visible[REGIONS_LIMIT])
+// visible is a bitset with an element for each region.
+void map_visible(const struct game *restrict game, unsigned char player, uint64_t *restrict visible)
 {
-	memset(visible, 0, REGIONS_LIMIT);
+	bitset_zero(visible, game->regions_count);
 
 	for(size_t i = 0; i < game->regions_count; ++i)
 	{
@@ -336,19 +605,16 @@ void map_visible(const struct game *restrict game, unsigned char player, unsigne
 
 		if (allies(game, player, region->owner))
 		{
-			visible[i] = 1;
+			bitset_set(visible, i);
 
 			// Make the neighboring regions visible when a watch tower is built.
 			if (region_built(region, BuildingWatchTower))
 			{
-				for(size_t j = 0; j < NEIGHBORS_LIMIT; ++j)
-				{
-					struct region *neighbor = region->neighbors[j];
-					if (neighbor) visible[neighbor->index] = 1;
-				}
+				for(size_t j = region_neighbors_begin(game, region); j < region_neighbors_end(game, region); ++j)
+					bitset_set(visible, game->neighbors[j]);
 			}
 		}
-		else if (allies(game, player, region->garrison.owner)) visible[i] = 1;
+		else if (allies(game, player, region->garrison.owner)) bitset_set(visible, i);
 	}
 }
 
@@ -17,7 +17,7 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#define REGIONS_LIMIT 256
+#define REGIONS_LIMIT 16777215
 
 #define PLAYER_NEUTRAL 0 /* player 0 is hard-coded as neutral */
 
@@ -65,7 +65,6 @@ struct region
 	size_t name_length;
 
 	size_t index;
-	struct region *neighbors[NEIGHBORS_LIMIT];
 	struct polygon *location;
 	struct point location_garrison, center;
 
@@ -162,14 +161,57 @@ void region_income(const struct region *restrict region, unsigned char player, s
 void region_production(const struct region* restrict region, struct resources *restrict income);
 
 void region_battle_cleanup(const struct game *restrict game, struct region *restrict region, int assault, unsigned winner_alliance);
-void region_turn_process(const struct game *restrict game, struct region *restrict region);
+void region_turn_process(const struct game *restrict game, struct region *restrict region, unsigned short random_state[static 3]);
+
+// Index for finding which region contains a given point and which regions intersect a given rectangle.
+struct regions_grid
+{
+	struct bounds world; // bounding box of all regions
+	struct bounds *bounds; // bounding box of each region
+	unsigned cell_size;
+	size_t columns, rows;
+	size_t *offsets; // candidates of cell i are regions[offsets[i]] to regions[offsets[i + 1] - 1]
+	uint32_t *regions;
+};
+
+int regions_grid_init(struct regions_grid *restrict grid, const struct game *restrict game);
+int regions_grid_find(const struct regions_grid *restrict grid, const struct game *restrict game, int x, int y);
+size_t regions_grid_query(const struct regions_grid *restrict grid, struct bounds view, uint32_t *restrict result);
+void regions_grid_term(struct regions_grid *restrict grid);
 
 void region_orders_process(struct region *restrict region);
 void region_orders_cancel(struct region *restrict region);
 
+// Neighbor relation between two regions. direction specifies where the neighbor is located.
+struct region_link
+{
+	size_t region, neighbor;
+	unsigned char direction;
+};
+
+int neighbors_init(struct game *restrict game, const struct region_link *restrict links, size_t links_count);
+void neighbors_term(struct game *restrict game);
+
+// The neighbors of each region are stored contiguously in game->neighbors and are iterated by position:
+// for(i = region_neighbors_begin(game, region); i < region_neighbors_end(game, region); ++i)
+static inline size_t region_neighbors_begin(const struct game *restrict game, const struct region *restrict region)
+{
+	return game->neighbors_offsets[region->index];
+}
+static inline size_t region_neighbors_end(const struct game *restrict game, const struct region *restrict region)
+{
+	return game->neighbors_offsets[region->index + 1];
+}
+static inline struct region *region_neighbor(const struct game *restrict game, size_t position)
+{
+	return game->regions + game->neighbors[position];
+}
+
+int region_neighbor_direction(const struct game *restrict game, const struct region *restrict region, const struct region *restrict neighbor);
+
 int polygons_border(const struct polygon *restrict a, const struct polygon *restrict b, struct point *restrict first, struct point *restrict second);
 
-void map_visible(const struct game *restrict game, unsigned char player, unsigned char visible[REGIONS_LIMIT]);
+void map_visible(const struct game *restrict game, unsigned char player, uint64_t *restrict visible);
 
 int region_garrison_full(const struct region *restrict region, const struct garrison_info *restrict garrison);
 void region_troops_merge(struct region *restrict region);
@@ -31,6 +31,10 @@
 #include "base.h"
 #include "format.h"
 #include "game.h"
+#include "log.h"
+#include "draw.h"
+#include "map.h"
+#include "snapshot.h"
 #include "world.h"
 #include "menu.h"
 
@@ -39,7 +43,20 @@
 #define DIRECTORY_WORLDS "/.conquest_of_levidon/worlds/"
 #define DIRECTORY_SAVE "/.conquest_of_levidon/save/"
 
+#define AUTOSAVE_NAME "autosave"
+
 static struct bytes *directories[DIRECTORIES_COUNT];
+static struct bytes *directory_game; // set by menu_init()
+
+// State of the background autosave thread.
+static struct
+{
+	pthread_mutex_t mutex;
+	pthread_t thread;
+	int started, finished;
+	const struct snapshot *snapshot;
+	struct bytes *filepath;
+} autosave = {.mutex = PTHREAD_MUTEX_INITIALIZER};
 
 static struct bytes *path_cat(const unsigned char *restrict prefix, size_t prefix_size, const unsigned char *restrict suffix, size_t suffix_size)
 {
@@ -55,6 +72,13 @@ static struct bytes *path_cat(const unsigned char *restrict prefix, size_t prefi
 	return path;
 }
 
+// Returns the path of a file in the game directory or NULL on error (including when menu_init() failed).
+struct bytes *menu_game_file(const unsigned char *restrict filename, size_t filename_size)
+{
+	if (!directory_game) return 0;
+	return path_cat(directory_game->data, directory_game->size, filename, filename_size);
+}
+
 int menu_init(void)
 {
 	const char *home;
@@ -75,14 +99,18 @@ int menu_init(void)
 		free(game_home);
 		return ERROR_ACCESS;
 	}
-	free(game_home);
 
 	directories[0] = path_cat(PREFIX, sizeof(PREFIX) - 1, DIRECTORY_SHARED, sizeof(DIRECTORY_SHARED) - 1);
-	if (!directories[0]) return ERROR_MEMORY;
+	if (!directories[0])
+	{
+		free(game_home);
+		return ERROR_MEMORY;
+	}
 
 	directories[1] = path_cat(home, home_size, DIRECTORY_WORLDS, sizeof(DIRECTORY_WORLDS) - 1);
 	if (!directories[1])
 	{
+		free(game_home);
 		free(directories[0]);
 		return ERROR_MEMORY;
 	}
@@ -90,11 +118,14 @@ int menu_init(void)
 	directories[2] = path_cat(home, home_size, DIRECTORY_SAVE, sizeof(DIRECTORY_SAVE) - 1);
 	if (!directories[2])
 	{
+		free(game_home);
 		free(directories[0]);
 		free(directories[1]);
 		return ERROR_MEMORY;
 	}
 
+	directory_game = game_home;
+
 	return 0;
 }
 
@@ -103,6 +134,8 @@ void menu_term(void)
 	free(directories[0]);
 	free(directories[1]);
 	free(directories[2]);
+	free(directory_game);
+	directory_game = 0;
 }
 
 // Returns a list of NUL-terminated paths to the world files.
@@ -236,3 +269,71 @@ int menu_save(size_t index, const unsigned char *restrict filename, size_t filen
 
 	return status;
 }
+
+static void *autosave_main(void *argument)
+{
+	if (world_save_binary(autosave.snapshot, autosave.filepath->data) < 0)
+		LOG_WARNING("Autosave failed");
+
+	pthread_mutex_lock(&autosave.mutex);
+	autosave.finished = 1;
+	pthread_mutex_unlock(&autosave.mutex);
+
+	return 0;
+}
+
+static void autosave_finish(void)
+{
+	pthread_join(autosave.thread, 0);
+	snapshot_free(autosave.snapshot);
+	free(autosave.filepath);
+	autosave.started = 0;
+}
+
+// Saves the game in the background. The state of the game is captured before returning.
+// If the previous autosave is still in progress, the game is not saved.
+int menu_autosave(const struct game *restrict game)
+{
+	int finished;
+
+	if (autosave.started)
+	{
+		pthread_mutex_lock(&autosave.mutex);
+		finished = autosave.finished;
+		pthread_mutex_unlock(&autosave.mutex);
+
+		if (!finished)
+			return 0;
+		autosave_finish();
+	}
+
+	autosave.filepath = path_cat(directories[2]->data, directories[2]->size, AUTOSAVE_NAME, sizeof(AUTOSAVE_NAME) - 1);
+	if (!autosave.filepath)
+		return ERROR_MEMORY;
+
+	autosave.snapshot = snapshot_create(game);
+	if (!autosave.snapshot)
+	{
+		free(autosave.filepath);
+		return ERROR_MEMORY;
+	}
+
+	autosave.finished = 0;
+	if (pthread_create(&autosave.thread, 0, autosave_main, 0))
+	{
+		snapshot_free(autosave.snapshot);
+		free(autosave.filepath);
+		return ERROR_MEMORY;
+	}
+	autosave.started = 1;
+
+	return 0;
+}
+
+// Waits for the autosave in progress to finish.
+// Must be called before the game used for the autosave is unloaded.
+void menu_autosave_wait(void)
+{
+	if (autosave.started)
+		autosave_finish();
+}
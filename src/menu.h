@@ -28,8 +28,13 @@ struct files
 int menu_init(void);
 void menu_term(void);
 
+struct bytes *menu_game_file(const unsigned char *restrict filename, size_t filename_size);
+
 struct files *menu_worlds(size_t index);
 void menu_free(struct files *list);
 
 int menu_load(size_t index, const unsigned char *restrict filename, size_t filename_size, struct game *restrict game);
 int menu_save(size_t index, const unsigned char *restrict filename, size_t filename_size, const struct game *restrict game);
+
+int menu_autosave(const struct game *restrict game);
+void menu_autosave_wait(void);
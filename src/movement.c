@@ -246,7 +246,7 @@ static int movement_find_next(const struct game *restrict game, const struct bat
 }
 
 // Calculates the expected position of each pawn at the next step.
-int movement_plan(const struct game *restrict game, struct battle *restrict battle, struct adjacency_list *restrict graph[static PLAYERS_LIMIT], const struct obstacles *restrict obstacles[static PLAYERS_LIMIT])
+int movement_plan(const struct game *restrict game, struct battle *restrict battle, struct adjacency_list *restrict graph[], const struct obstacles *restrict obstacles[])
 {
 	for(size_t i = 0; i < battle->pawns_count; ++i)
 	{
@@ -53,7 +53,7 @@ void battlefield_index_build(struct battle *restrict battle);
 
 struct position movement_position(const struct pawn *restrict pawn);
 
-int movement_plan(const struct game *restrict game, struct battle *restrict battle, struct adjacency_list *restrict graph[static PLAYERS_LIMIT], const struct obstacles *restrict obstacles[static PLAYERS_LIMIT]);
+int movement_plan(const struct game *restrict game, struct battle *restrict battle, struct adjacency_list *restrict graph[], const struct obstacles *restrict obstacles[]);
 int movement_collisions_resolve(const struct game *restrict game, struct battle *restrict battle);
 
 int movement_queue(struct pawn *restrict pawn, struct position target, struct adjacency_list *restrict graph, const struct obstacles *restrict obstacles);
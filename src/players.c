@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include "errors.h"
+#include "bitset.h"
 #include "draw.h"
 #include "game.h"
 #include "map.h"
@@ -156,6 +157,12 @@ static void *computer_main(void *argument)
 			break;
 		}
 
+		// Indicate that the player is ready.
+		// This is done before sending the response because the bitset may be freed once all responses are received.
+		pthread_mutex_lock(&request.generic.game->mutex_input);
+		bitset_set(request.generic.game->input_ready, request.generic.player);
+		pthread_mutex_unlock(&request.generic.game->mutex_input);
+
 		response.player = request.generic.player;
 		status = write(info->out, &response, sizeof(response));
 		if (status < 0)
@@ -164,11 +171,6 @@ static void *computer_main(void *argument)
 			break;
 		}
 		else assert(status == sizeof(response));
-
-		// Indicate that the player is ready.
-		pthread_mutex_lock(&request.generic.game->mutex_input);
-		request.generic.game->input_ready |= (1 << response.player);
-		pthread_mutex_unlock(&request.generic.game->mutex_input);
 	}
 
 	close(info->in);
@@ -210,10 +212,31 @@ static int player_init(struct player *restrict player, void *(*main)(void *))
 	return 0;
 }
 
+static void players_free(struct game *restrict game)
+{
+	free(game->players_local);
+	free(game->input_ready);
+	free(game->input_all);
+	free(game->input_processed);
+}
+
 int players_init(struct game *restrict game)
 {
+	game->players_local = malloc(game->players_count * sizeof(*game->players_local));
+	game->input_ready = bitset_alloc(game->players_count);
+	game->input_all = bitset_alloc(game->players_count);
+	game->input_processed = bitset_alloc(game->players_count);
+	if (!game->players_local || !game->input_ready || !game->input_all || !game->input_processed)
+	{
+		players_free(game);
+		return ERROR_MEMORY;
+	}
+
 	if (pthread_mutex_init(&game->mutex_input, 0))
+	{
+		players_free(game);
 		return ERROR_MEMORY;
+	}
 
 	game->players_local_count = 0;
 	for(size_t player = 0; player < game->players_count; player += 1)
@@ -240,6 +263,7 @@ int players_init(struct game *restrict game)
 						close(game->players[i].control.out);
 						break;
 					}
+				players_free(game);
 				return status;
 			}
 			break;
@@ -261,18 +285,20 @@ int players_term(struct game *restrict game)
 			break;
 		}
 
+	players_free(game);
+
 	return 0;
 }
 
 static int players_wait(struct pollfd *restrict ready, size_t ready_count, struct game *restrict game)
 {
-	uint32_t input_processed;
+	uint64_t *restrict input_processed = game->input_processed;
 
 	pthread_mutex_lock(&game->mutex_input);
-	input_processed = game->input_ready;
+	bitset_copy(input_processed, game->input_ready, game->players_count);
 	pthread_mutex_unlock(&game->mutex_input);
 
-	while (input_processed != game->input_all)
+	while (!bitset_equal(input_processed, game->input_all, game->players_count))
 	{
 		int status = poll(ready, ready_count, -1);
 		assert(status > 0);
@@ -292,7 +318,7 @@ static int players_wait(struct pollfd *restrict ready, size_t ready_count, struc
 			if (response.status)
 				return response.status;
 
-			input_processed |= (1 << response.player);
+			bitset_set(input_processed, response.player);
 		}
 	}
 
@@ -306,8 +332,8 @@ int players_map(struct game *restrict game)
 	size_t player;
 	int status;
 
-	game->input_ready = 0;
-	game->input_all = 0;
+	bitset_zero(game->input_ready, game->players_count);
+	bitset_zero(game->input_all, game->players_count);
 
 	for(player = 0; player < game->players_count; ++player)
 	{
@@ -328,12 +354,12 @@ int players_map(struct game *restrict game)
 
 		case Neutral:
 			pthread_mutex_lock(&game->mutex_input);
-			game->input_ready |= (1 << player);
+			bitset_set(game->input_ready, player);
 			pthread_mutex_unlock(&game->mutex_input);
 			break;
 		}
 
-		game->input_all |= (1 << player);
+		bitset_set(game->input_all, player);
 	}
 
 	for(size_t i = 0; i < game->players_local_count; ++i)
@@ -345,7 +371,7 @@ int players_map(struct game *restrict game)
 			return status;
 
 		pthread_mutex_lock(&game->mutex_input);
-		game->input_ready |= (1 << player);
+		bitset_set(game->input_ready, player);
 		pthread_mutex_unlock(&game->mutex_input);
 	}
 
@@ -356,8 +382,8 @@ int players_invasion(struct game *restrict game, struct region *restrict region)
 {
 	int status;
 
-	game->input_ready = 0;
-	game->input_all = 0;
+	bitset_zero(game->input_ready, game->players_count);
+	bitset_zero(game->input_all, game->players_count);
 
 	switch (game->players[region->garrison.owner].type)
 	{
@@ -367,7 +393,7 @@ int players_invasion(struct game *restrict game, struct region *restrict region)
 			if (!status)
 			{
 				pthread_mutex_lock(&game->mutex_input);
-				game->input_ready |= (1 << region->garrison.owner);
+				bitset_set(game->input_ready, region->garrison.owner);
 				pthread_mutex_unlock(&game->mutex_input);
 			}
 			return status;
@@ -398,8 +424,8 @@ int players_formation(struct game *restrict game, struct battle *restrict battle
 	size_t player;
 	int status;
 
-	game->input_ready = 0;
-	game->input_all = 0;
+	bitset_zero(game->input_ready, game->players_count);
+	bitset_zero(game->input_all, game->players_count);
 
 	for(player = 0; player < game->players_count; ++player)
 	{
@@ -421,7 +447,7 @@ int players_formation(struct game *restrict game, struct battle *restrict battle
 			break;
 		}
 
-		game->input_all |= (1 << player);
+		bitset_set(game->input_all, player);
 	}
 
 	for(size_t i = 0; i < game->players_local_count; ++i)
@@ -435,22 +461,22 @@ int players_formation(struct game *restrict game, struct battle *restrict battle
 			return status;
 
 		pthread_mutex_lock(&game->mutex_input);
-		game->input_ready |= (1 << player);
+		bitset_set(game->input_ready, player);
 		pthread_mutex_unlock(&game->mutex_input);
 	}
 
 	return players_wait(ready, ready_count, game);
 }
 
-int players_battle(struct game *restrict game, struct battle *restrict battle, const struct obstacles *restrict obstacles[static PLAYERS_LIMIT], struct adjacency_list *restrict graph[static PLAYERS_LIMIT])
+int players_battle(struct game *restrict game, struct battle *restrict battle, const struct obstacles *restrict obstacles[], struct adjacency_list *restrict graph[])
 {
 	struct pollfd ready[PLAYERS_LIMIT];
 	size_t ready_count = 0;
 	size_t player;
 	int status;
 
-	game->input_ready = 0;
-	game->input_all = 0;
+	bitset_zero(game->input_ready, game->players_count);
+	bitset_zero(game->input_all, game->players_count);
 
 	for(player = 0; player < game->players_count; ++player)
 	{
@@ -476,7 +502,7 @@ int players_battle(struct game *restrict game, struct battle *restrict battle, c
 			break;
 		}
 
-		game->input_all |= (1 << player);
+		bitset_set(game->input_all, player);
 	}
 
 	for(size_t i = 0; i < game->players_local_count; ++i)
@@ -490,7 +516,7 @@ int players_battle(struct game *restrict game, struct battle *restrict battle, c
 			return status;
 
 		pthread_mutex_lock(&game->mutex_input);
-		game->input_ready |= (1 << player);
+		bitset_set(game->input_ready, player);
 		pthread_mutex_unlock(&game->mutex_input);
 	}
 
@@ -23,4 +23,4 @@ int players_term(struct game *restrict game);
 int players_map(struct game *restrict game);
 int players_invasion(struct game *restrict game, struct region *restrict region);
 int players_formation(struct game *restrict game, struct battle *restrict battle, int hotseat);
-int players_battle(struct game *restrict game, struct battle *restrict battle, const struct obstacles *restrict obstacles[static PLAYERS_LIMIT], struct adjacency_list *restrict graph[static PLAYERS_LIMIT]);
+int players_battle(struct game *restrict game, struct battle *restrict battle, const struct obstacles *restrict obstacles[], struct adjacency_list *restrict graph[]);
@@ -0,0 +1,216 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "errors.h"
+#include "game.h"
+#include "draw.h"
+#include "map.h"
+#include "snapshot.h"
+
+// All the snapshot data is stored in a single memory block.
+#define BLOCK_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+// Creates a snapshot of the dynamic state of the game. Returns 0 on memory error.
+const struct snapshot *snapshot_create(const struct game *restrict game)
+{
+	struct snapshot *snapshot;
+	struct snapshot_player *players;
+	struct snapshot_region *regions;
+	struct snapshot_troop *troops;
+
+	size_t troops_count = 0;
+	size_t offset_players, offset_regions, offset_troops, size;
+	size_t i, j;
+
+	const struct troop *troop;
+
+	for(i = 0; i < game->regions_count; ++i)
+		for(troop = game->regions[i].troops; troop; troop = troop->_next)
+			troops_count += 1;
+
+	offset_players = BLOCK_ALIGN(sizeof(*snapshot));
+	offset_regions = offset_players + BLOCK_ALIGN(game->players_count * sizeof(*players));
+	offset_troops = offset_regions + BLOCK_ALIGN(game->regions_count * sizeof(*regions));
+	size = offset_troops + troops_count * sizeof(*troops);
+
+	snapshot = malloc(size);
+	if (!snapshot) return 0;
+	players = (struct snapshot_player *)((char *)snapshot + offset_players);
+	regions = (struct snapshot_region *)((char *)snapshot + offset_regions);
+	troops = (struct snapshot_troop *)((char *)snapshot + offset_troops);
+
+	snapshot->game = game;
+	snapshot->turn = game->turn;
+
+	for(i = 0; i < game->players_count; ++i)
+	{
+		players[i].type = game->players[i].type;
+		players[i].alliance = game->players[i].alliance;
+		players[i].treasury = game->players[i].treasury;
+	}
+	snapshot->players_count = game->players_count;
+	snapshot->players = players;
+
+	snapshot->troops_count = 0;
+	for(i = 0; i < game->regions_count; ++i)
+	{
+		const struct region *restrict region = game->regions + i;
+		struct snapshot_region *restrict state = regions + i;
+
+		state->owner = region->owner;
+		state->train_progress = region->train_progress;
+		state->build_progress = region->build_progress;
+		state->built = region->built;
+		state->garrison.owner = region->garrison.owner;
+		state->garrison.siege = region->garrison.siege;
+		state->garrison.reinforce = region->garrison.reinforce;
+		for(j = 0; j < TRAIN_QUEUE; ++j)
+			state->train[j] = (region->train[j] ? region->train[j] - UNITS : SNAPSHOT_NONE);
+		state->construct = region->construct;
+		state->population = region->population;
+		state->workers.food = region->workers.food;
+		state->workers.wood = region->workers.wood;
+		state->workers.iron = region->workers.iron;
+		state->workers.stone = region->workers.stone;
+
+		state->troops_offset = snapshot->troops_count;
+		for(troop = region->troops; troop; troop = troop->_next)
+		{
+			struct snapshot_troop *restrict copy = troops + snapshot->troops_count++;
+
+			copy->count = troop->count;
+			copy->unit = troop->unit - UNITS;
+			copy->owner = troop->owner;
+			copy->dismiss = troop->dismiss;
+			copy->location = ((troop->location == LOCATION_GARRISON) ? SNAPSHOT_GARRISON : troop->location->index);
+			copy->move = ((troop->move == LOCATION_GARRISON) ? SNAPSHOT_GARRISON : troop->move->index);
+		}
+		state->troops_count = snapshot->troops_count - state->troops_offset;
+	}
+	snapshot->regions_count = game->regions_count;
+	snapshot->regions = regions;
+	snapshot->troops = troops;
+
+	return snapshot;
+}
+
+static inline struct region *snapshot_location(struct game *restrict game, uint32_t location)
+{
+	return ((location == SNAPSHOT_GARRISON) ? LOCATION_GARRISON : game->regions + location);
+}
+
+// Restores the dynamic state of a game from a snapshot.
+// The game must have the same static data as the game used for creating the snapshot.
+int snapshot_restore(const struct snapshot *restrict snapshot, struct game *restrict game)
+{
+	struct troop *created = 0, **created_tail = &created;
+	struct troop *troop, *next;
+	size_t i, j;
+
+	if ((snapshot->players_count != game->players_count) || (snapshot->regions_count != game->regions_count))
+		return ERROR_INPUT;
+
+	// Allocate all troops before changing the game so that the game is not modified on error.
+	for(i = 0; i < snapshot->troops_count; ++i)
+	{
+		const struct snapshot_troop *restrict copy = snapshot->troops + i;
+
+		troop = malloc(sizeof(*troop));
+		if (!troop)
+		{
+			*created_tail = 0;
+			for(troop = created; troop; troop = next)
+			{
+				next = troop->_next;
+				free(troop);
+			}
+			return ERROR_MEMORY;
+		}
+
+		troop->unit = UNITS + copy->unit;
+		troop->count = copy->count;
+		troop->owner = copy->owner;
+		troop->dismiss = copy->dismiss;
+		troop->location = snapshot_location(game, copy->location);
+		troop->move = snapshot_location(game, copy->move);
+
+		*created_tail = troop;
+		created_tail = &troop->_next;
+	}
+	*created_tail = 0;
+
+	for(i = 0; i < game->players_count; ++i)
+	{
+		game->players[i].type = snapshot->players[i].type;
+		game->players[i].alliance = snapshot->players[i].alliance;
+		game->players[i].treasury = snapshot->players[i].treasury;
+	}
+
+	for(i = 0; i < game->regions_count; ++i)
+	{
+		const struct snapshot_region *restrict state = snapshot->regions + i;
+		struct region *restrict region = game->regions + i;
+		struct troop *last = 0;
+
+		region->owner = state->owner;
+		region->train_progress = state->train_progress;
+		region->build_progress = state->build_progress;
+		region->built = state->built;
+		region->garrison.owner = state->garrison.owner;
+		region->garrison.siege = state->garrison.siege;
+		region->garrison.reinforce = state->garrison.reinforce;
+		for(j = 0; j < TRAIN_QUEUE; ++j)
+			region->train[j] = ((state->train[j] == SNAPSHOT_NONE) ? 0 : UNITS + state->train[j]);
+		region->construct = state->construct;
+		region->population = state->population;
+		region->workers.food = state->workers.food;
+		region->workers.wood = state->workers.wood;
+		region->workers.iron = state->workers.iron;
+		region->workers.stone = state->workers.stone;
+
+		for(troop = region->troops; troop; troop = next)
+		{
+			next = troop->_next;
+			free(troop);
+		}
+
+		// Move the region troops from the created list, keeping their order.
+		region->troops = (state->troops_count ? created : 0);
+		for(j = 0; j < state->troops_count; ++j)
+		{
+			troop = created;
+			created = troop->_next;
+			troop->_prev = last;
+			last = troop;
+		}
+		if (last) last->_next = 0;
+	}
+
+	game->turn = snapshot->turn;
+
+	return 0;
+}
+
+void snapshot_free(const struct snapshot *snapshot)
+{
+	free((void *)snapshot);
+}
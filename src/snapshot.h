@@ -0,0 +1,89 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Immutable copy of the dynamic game state.
+// References between objects are stored as indices. Static data (names, polygons, neighbors) is not copied - it is shared with the game.
+
+#define SNAPSHOT_GARRISON UINT32_MAX /* troop location or move in the garrison */
+#define SNAPSHOT_NONE -1 /* empty train queue slot or no construction */
+
+struct snapshot_player
+{
+	unsigned char type;
+	unsigned char alliance;
+	struct resources treasury;
+};
+
+struct snapshot_region
+{
+	unsigned char owner;
+
+	unsigned char train_progress;
+	unsigned char build_progress;
+	uint32_t built;
+
+	struct
+	{
+		unsigned char owner;
+		unsigned siege;
+		_Bool reinforce;
+	} garrison;
+
+	signed char train[TRAIN_QUEUE]; // indices in UNITS
+	signed char construct; // index in BUILDINGS
+
+	unsigned population;
+	struct
+	{
+		unsigned food;
+		unsigned wood;
+		unsigned iron;
+		unsigned stone;
+	} workers;
+
+	size_t troops_offset, troops_count; // range of the region troops in the troops array
+};
+
+struct snapshot_troop
+{
+	unsigned count;
+	unsigned char unit; // index in UNITS
+	unsigned char owner;
+	unsigned char dismiss;
+	uint32_t location, move; // region indices or SNAPSHOT_GARRISON
+};
+
+struct snapshot
+{
+	const struct game *game; // used for static data
+	unsigned turn;
+
+	size_t players_count;
+	const struct snapshot_player *players;
+
+	size_t regions_count;
+	const struct snapshot_region *regions;
+
+	size_t troops_count;
+	const struct snapshot_troop *troops;
+};
+
+const struct snapshot *snapshot_create(const struct game *restrict game);
+int snapshot_restore(const struct snapshot *restrict snapshot, struct game *restrict game);
+void snapshot_free(const struct snapshot *snapshot);
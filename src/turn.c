@@ -0,0 +1,365 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "game.h"
+#include "draw.h"
+#include "resources.h"
+#include "map.h"
+#include "pathfinding.h"
+#include "movement.h"
+#include "battle.h"
+#include "computer_battle.h"
+#include "turn.h"
+
+// Regions are processed in parallel only if there are enough of them for each worker.
+#define TURN_REGIONS_MIN 32
+
+// The regions are split in contiguous ranges, one for each worker.
+// Outboxes are emptied in the order of the workers so the resulting troop lists don't depend on thread scheduling.
+
+int turn_init(struct turn *restrict turn, struct game *restrict game)
+{
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t count = ((processors > 0) ? processors : 1);
+	size_t start = 0;
+
+	if (count > TURN_WORKERS_LIMIT)
+		count = TURN_WORKERS_LIMIT;
+	if (count > game->regions_count / TURN_REGIONS_MIN)
+		count = game->regions_count / TURN_REGIONS_MIN;
+	if (!count)
+		count = 1;
+
+	turn->game = game;
+	turn->battles = 0;
+	turn->process = 0;
+	turn->workers_count = count;
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		struct turn_worker *restrict worker = turn->workers + i;
+		worker->turn = turn;
+		worker->start = start;
+		start += game->regions_count / count + (i < game->regions_count % count);
+		worker->end = start;
+
+		worker->expenses = malloc(game->players_count * sizeof(*worker->expenses));
+		worker->income = malloc(game->players_count * sizeof(*worker->income));
+		worker->alive = malloc(game->players_count * sizeof(*worker->alive));
+		if (!worker->expenses || !worker->income || !worker->alive)
+		{
+			turn->workers_count = i + 1;
+			turn_term(turn);
+			return ERROR_MEMORY;
+		}
+	}
+
+	return 0;
+}
+
+void turn_term(struct turn *restrict turn)
+{
+	for(size_t i = 0; i < turn->workers_count; ++i)
+	{
+		free(turn->workers[i].expenses);
+		free(turn->workers[i].income);
+		free(turn->workers[i].alive);
+	}
+}
+
+static void *turn_worker_main(void *argument)
+{
+	struct turn_worker *restrict worker = argument;
+	const struct turn *restrict turn = worker->turn;
+
+	for(size_t index = worker->start; index < worker->end; ++index)
+		turn->process(worker, turn->game->regions + index);
+
+	return 0;
+}
+
+static void turn_workers_reset(struct turn *restrict turn, void (*process)(struct turn_worker *restrict, struct region *restrict))
+{
+	turn->process = process;
+	for(size_t i = 0; i < turn->workers_count; ++i)
+	{
+		struct turn_worker *restrict worker = turn->workers + i;
+
+		worker->outbox = 0;
+		worker->outbox_tail = &worker->outbox;
+		memset(worker->expenses, 0, turn->game->players_count * sizeof(*worker->expenses));
+		memset(worker->income, 0, turn->game->players_count * sizeof(*worker->income));
+		memset(worker->alive, 0, turn->game->players_count * sizeof(*worker->alive));
+	}
+}
+
+// Starts a thread for each worker, except for the first skip workers.
+static void turn_workers_start(struct turn *restrict turn, size_t skip)
+{
+	for(size_t i = 0; i < skip; ++i)
+		turn->started[i] = 0;
+	for(size_t i = skip; i < turn->workers_count; ++i)
+		turn->started[i] = !pthread_create(turn->threads + i, 0, turn_worker_main, turn->workers + i);
+}
+
+static void turn_workers_wait(struct turn *restrict turn, size_t skip)
+{
+	for(size_t i = skip; i < turn->workers_count; ++i)
+	{
+		if (turn->started[i]) pthread_join(turn->threads[i], 0);
+		else turn_worker_main(turn->workers + i); // the thread could not be created
+		turn->started[i] = 0;
+	}
+}
+
+static void turn_run(struct turn *restrict turn, void (*process)(struct turn_worker *restrict, struct region *restrict))
+{
+	turn_workers_reset(turn, process);
+
+	// The current thread acts as the first worker.
+	turn_workers_start(turn, 1);
+	turn_worker_main(turn->workers);
+	turn_workers_wait(turn, 1);
+}
+
+static void outbox_send(struct turn_worker *restrict worker, struct region *restrict region, struct troop *restrict troop)
+{
+	troop_detach(&region->troops, troop);
+	troop->_next = 0;
+	*worker->outbox_tail = troop;
+	worker->outbox_tail = &troop->_next;
+}
+
+// Attach each troop from the outboxes to the troops of its destination region.
+static void outbox_deliver(struct turn *restrict turn, int location)
+{
+	for(size_t i = 0; i < turn->workers_count; ++i)
+	{
+		struct troop *troop, *next;
+		for(troop = turn->workers[i].outbox; troop; troop = next)
+		{
+			next = troop->_next;
+			troop_attach(location ? &troop->location->troops : &troop->move->troops, troop);
+		}
+	}
+}
+
+static void region_prepare(struct turn_worker *restrict worker, struct region *restrict region)
+{
+	struct troop *troop, *next;
+	struct resources expense;
+
+	for(troop = region->troops; troop; troop = next)
+	{
+		next = troop->_next;
+		if (troop->dismiss)
+		{
+			troop_detach(&region->troops, troop);
+			free(troop);
+		}
+	}
+
+	// Calculate region expenses.
+	if (region->owner == region->garrison.owner)
+	{
+		// Troops expenses are covered by current region.
+		for(troop = region->troops; troop; troop = troop->_next)
+		{
+			if (troop->move == LOCATION_GARRISON)
+				continue;
+
+			if (troop->move->owner != region->owner)
+				resource_multiply(&expense, &troop->unit->support, 2 * troop->count);
+			else
+				resource_multiply(&expense, &troop->unit->support, troop->count);
+			resource_add(worker->expenses + troop->owner, &expense);
+		}
+	}
+	else
+	{
+		// Troops expenses are covered by another region. Double expenses.
+		for(troop = region->troops; troop; troop = troop->_next)
+		{
+			if ((troop->move == LOCATION_GARRISON) && (troop->owner == region->garrison.owner))
+				continue; // sieged troop
+
+			resource_multiply(&expense, &troop->unit->support, 2 * troop->count);
+			resource_add(worker->expenses + troop->owner, &expense);
+		}
+	}
+	worker->expenses[region->owner].gold -= 10 * sqrt(region->population / 1000.0); // region governing
+	for(size_t i = 0; i < BUILDINGS_COUNT; ++i)
+		if (region->built & (1 << i))
+			resource_add(worker->expenses + region->owner, &BUILDINGS[i].support);
+
+	region_orders_process(region);
+
+	// Move troops in and out of garrison and put them in their target regions.
+	// New troop locations will be set after all battles have concluded.
+	for(troop = region->troops; troop; troop = next)
+	{
+		next = troop->_next;
+		if (troop->move == troop->location) continue;
+
+		if (troop->move == LOCATION_GARRISON)
+		{
+			// Move troop to the garrison unless it prepares for assault.
+			if (troop->owner == region->garrison.owner)
+				troop->location = LOCATION_GARRISON;
+		}
+		else
+		{
+			if (troop->location == LOCATION_GARRISON) troop->location = region;
+
+			// Put the troop in the specified region.
+			if (troop->move != troop->location)
+				outbox_send(worker, region, troop);
+		}
+	}
+}
+
+static void region_battle(struct turn_worker *restrict worker, struct region *restrict region)
+{
+	struct turn_battle *restrict battle = worker->turn->battles + region->index;
+
+	if (battle->type && !battle->manual)
+		battle->winner = calculate_battle(worker->turn->game, region, (battle->type == BATTLE_ASSAULT));
+}
+
+static void region_cleanup(struct turn_worker *restrict worker, struct region *restrict region)
+{
+	const struct game *restrict game = worker->turn->game;
+	const struct turn_battle *restrict battle = worker->turn->battles + region->index;
+	unsigned region_owner_old = region->owner;
+
+	// Each region has a random number generator of its own so that the result does not depend on thread scheduling.
+	unsigned long seed = worker->turn->seed;
+	uint32_t index = region->index;
+	unsigned short random_state[3] = {seed & 0xffff, ((seed >> 16) & 0xffff) ^ (index >> 16), index & 0xffff};
+
+	if (battle->type)
+		region_battle_cleanup(game, region, (battle->type == BATTLE_ASSAULT), battle->winner);
+
+	region_turn_process(game, region, random_state);
+
+	// Cancel all constructions and trainings if region owner changed.
+	if (region->owner != region_owner_old)
+		region_orders_cancel(region);
+
+	// Each player controlling a region or a garrison is alive.
+	worker->alive[region->owner] = 1;
+	worker->alive[region->garrison.owner] = 1;
+}
+
+static void region_settle(struct turn_worker *restrict worker, struct region *restrict region)
+{
+	const struct game *restrict game = worker->turn->game;
+	struct troop *troop, *next;
+
+	for(troop = region->troops; troop; troop = next)
+	{
+		next = troop->_next;
+
+		if (troop->location == LOCATION_GARRISON) continue;
+
+		// Update troop location.
+		// Return retreating troops to their previous location.
+		if (troop->move == region) troop->location = region;
+		else if (allies(game, troop->owner, troop->location->owner))
+			outbox_send(worker, region, troop);
+		else
+			troop_remove(&region->troops, troop); // the troop has no region to return to; kill it
+	}
+
+	// Add region income to the owner's treasury if the garrison is not under siege.
+	if (region->owner == region->garrison.owner)
+		region_production(region, worker->income + region->owner);
+}
+
+static void region_merge(struct turn_worker *restrict worker, struct region *restrict region)
+{
+	region_troops_merge(region);
+}
+
+// Processes orders and expenses of each region and moves troops to their destination regions.
+void turn_regions_prepare(struct turn *restrict turn, struct resources *restrict expenses)
+{
+	turn_run(turn, region_prepare);
+	outbox_deliver(turn, 0);
+
+	for(size_t i = 0; i < turn->workers_count; ++i)
+		for(size_t player = 0; player < turn->game->players_count; ++player)
+			resource_add(expenses + player, turn->workers[i].expenses + player);
+}
+
+// Starts resolving the battles without local players in background threads.
+// The current thread is free to play the battles with local players.
+void turn_battles_start(struct turn *restrict turn, struct turn_battle *restrict battles)
+{
+	size_t index;
+
+	turn->battles = battles;
+	turn_workers_reset(turn, region_battle);
+
+	for(index = 0; index < turn->game->regions_count; ++index)
+		if (battles[index].type && !battles[index].manual)
+			break;
+	turn_workers_start(turn, ((index < turn->game->regions_count) ? 0 : turn->workers_count));
+}
+
+// Waits for all battles started by turn_battles_start() to be resolved.
+void turn_battles_wait(struct turn *restrict turn)
+{
+	turn_workers_wait(turn, 0);
+	turn->battles = 0;
+}
+
+// Performs post-battle cleanup in each region and marks the players still in the game as alive.
+void turn_regions_cleanup(struct turn *restrict turn, struct turn_battle *restrict battles, unsigned char *restrict alive)
+{
+	turn->battles = battles;
+	turn->seed = random();
+	turn_run(turn, region_cleanup);
+	turn->battles = 0;
+
+	for(size_t i = 0; i < turn->workers_count; ++i)
+		for(size_t player = 0; player < turn->game->players_count; ++player)
+			alive[player] |= turn->workers[i].alive[player];
+}
+
+// Returns retreating troops to their previous location, merges troops and collects region income.
+void turn_regions_settle(struct turn *restrict turn)
+{
+	turn_run(turn, region_settle);
+	outbox_deliver(turn, 1);
+
+	for(size_t i = 0; i < turn->workers_count; ++i)
+		for(size_t player = 0; player < turn->game->players_count; ++player)
+			resource_add(&turn->game->players[player].treasury, turn->workers[i].income + player);
+
+	turn_run(turn, region_merge);
+}
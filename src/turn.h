@@ -0,0 +1,65 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define TURN_WORKERS_LIMIT 16
+
+struct turn_battle
+{
+	enum battle_type type;
+	unsigned char winner;
+	_Bool manual; // whether a local player participates in the battle
+};
+
+// Per-thread state of the turn resolver.
+// Troops moving to another region are collected in the outbox and transferred after all workers finish.
+struct turn_worker
+{
+	const struct turn *turn;
+	size_t start, end; // range of regions processed by the worker
+
+	struct troop *outbox, **outbox_tail;
+
+	// Tables indexed by player, allocated by turn_init().
+	struct resources *expenses;
+	struct resources *income;
+	unsigned char *alive;
+};
+
+struct turn
+{
+	struct game *game;
+	struct turn_battle *battles;
+	unsigned long seed; // seed of the random choices made by the workers
+	void (*process)(struct turn_worker *restrict, struct region *restrict);
+
+	size_t workers_count;
+	struct turn_worker workers[TURN_WORKERS_LIMIT];
+	pthread_t threads[TURN_WORKERS_LIMIT];
+	_Bool started[TURN_WORKERS_LIMIT];
+};
+
+int turn_init(struct turn *restrict turn, struct game *restrict game);
+void turn_term(struct turn *restrict turn);
+
+void turn_battles_start(struct turn *restrict turn, struct turn_battle *restrict battles);
+void turn_battles_wait(struct turn *restrict turn);
+
+void turn_regions_prepare(struct turn *restrict turn, struct resources *restrict expenses);
+void turn_regions_cleanup(struct turn *restrict turn, struct turn_battle *restrict battles, unsigned char *restrict alive);
+void turn_regions_settle(struct turn *restrict turn);
@@ -17,8 +17,12 @@
  * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <endian.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -31,6 +35,7 @@
 #include "draw.h"
 #include "game.h"
 #include "map.h"
+#include "snapshot.h"
 #include "world.h"
 
 // WARNING: Player 0 and alliance 0 are hard-coded as neutral.
@@ -39,6 +44,8 @@
 
 #define S(s) (s), sizeof(s) - 1
 
+#define TEMP_SUFFIX ".XXXXXX"
+
 const struct unit UNITS[UNITS_COUNT] =
 {
 	[UnitPeasant] = {
@@ -100,423 +107,1029 @@ const size_t BUILDINGS_COUNT = sizeof(BUILDINGS) / sizeof(*BUILDINGS);
 
 #undef NAME
 
-static int region_build(uint32_t *restrict built, const struct array_json *restrict list)
-{
-	size_t i, j;
-	const union json *entry;
-
-	for(i = 0; i < list->count; ++i)
-	{
-		entry = list->data[i];
-		if (json_type(entry) != JSON_STRING) return -1;
-
-		// TODO maybe use hash table here
-		for(j = 0; j < BUILDINGS_COUNT; ++j)
-			if ((entry->string.size == BUILDINGS[j].name_length) && !memcmp(entry->string.data, BUILDINGS[j].name, BUILDINGS[j].name_length))
-			{
-				*built |= (1 << j);
-				goto next;
-			}
-		return -1;
-next:
-		;
-	}
-
-	return 0;
-}
-
 // TODO maybe use hash table here
-static signed char building_find(const struct string *restrict name)
+static signed char building_find(const char *restrict name, size_t name_size)
 {
 	size_t i;
 	for(i = 0; i < BUILDINGS_COUNT; ++i)
-		if ((name->size == BUILDINGS[i].name_length) && !memcmp(name->data, BUILDINGS[i].name, BUILDINGS[i].name_length))
+		if ((name_size == BUILDINGS[i].name_length) && !memcmp(name, BUILDINGS[i].name, BUILDINGS[i].name_length))
 			return i;
-	LOG_ERROR("building %.*s not found", (int)name->size, name->data);
-	return 0;
+	LOG_ERROR("building %.*s not found", (int)name_size, name);
+	return -1;
 }
 
 // TODO maybe use hash table
-static const struct unit *unit_find(const struct string *restrict name)
+static const struct unit *unit_find(const char *restrict name, size_t name_size)
 {
 	size_t i;
 	for(i = 0; i < UNITS_COUNT; ++i)
-		if ((name->size == UNITS[i].name_length) && !memcmp(name->data, UNITS[i].name, UNITS[i].name_length))
+		if ((name_size == UNITS[i].name_length) && !memcmp(name, UNITS[i].name, UNITS[i].name_length))
 			return UNITS + i;
-	LOG_ERROR("unit %.*s not found", (int)name->size, name->data);
+	LOG_ERROR("unit %.*s not found", (int)name_size, name);
 	return 0;
 }
 
-static inline const char *type_name(enum json_type type)
-{
-	const char *names[] = {
-		[JSON_NULL] = "null",
-		[JSON_BOOLEAN] = "boolean",
-		[JSON_INTEGER] = "integer",
-		[JSON_REAL] = "real",
-		[JSON_STRING] = "string",
-		[JSON_ARRAY] = "array",
-		[JSON_OBJECT] = "object",
-	};
-	return names[type];
-}
+/* < JSON loader */
+
+// The world is filled directly from the tokens reported by the JSON scanner.
+// Memory used during loading is proportional to the size of the world and not to the size of the document.
+// Things that depend on data which may not be loaded yet (neighbors and troops) are recorded and resolved once the document ends.
 
-static inline union json *value_get(const struct hashmap *restrict hashmap, const unsigned char *restrict key, size_t size, enum json_type type)
+// Values the loader expects at a given position in the document.
+enum loader_state
 {
-	union json **entry = hashmap_get(hashmap, key, size);
-	if (!entry)
-		return 0;
-	if (json_type(*entry) != type)
-	{
-		LOG_WARNING("%.*s is of type %s (expected: %s)", (int)size, key, type_name(json_type(*entry)), type_name(type));
-		return 0;
-	}
-	return *entry;
-}
-#define value_get(hashmap, key, type) (value_get)(hashmap, key, sizeof(key) - 1, type)
+	STATE_ROOT,
+	STATE_DOCUMENT,
+	STATE_PLAYERS,
+	STATE_PLAYER,
+	STATE_REGIONS,
+	STATE_REGION,
+	STATE_WORKERS,
+	STATE_GARRISON,
+	STATE_NEIGHBORS,
+	STATE_NEIGHBORS_DIRECTION,
+	STATE_LOCATION,
+	STATE_POINT,
+	STATE_TRAIN,
+	STATE_BUILT,
+	STATE_TROOPS,
+	STATE_TROOP,
+	STATE_SKIP, // value which is not used
+};
 
-static int region_init(struct game *restrict game, struct region *restrict region, const unsigned char *restrict name_data, size_t name_size, const struct hashmap *restrict data)
+enum loader_field
 {
-	size_t j;
+	FIELD_UNKNOWN,
+	FIELD_PLAYERS, FIELD_REGIONS,
+	FIELD_NAME, FIELD_ALLIANCE, FIELD_GOLD, FIELD_FOOD, FIELD_WOOD, FIELD_IRON, FIELD_STONE,
+	FIELD_OWNER, FIELD_POPULATION, FIELD_WORKERS, FIELD_GARRISON, FIELD_SIEGE, FIELD_TROOPS,
+	FIELD_TRAIN, FIELD_TRAIN_PROGRESS, FIELD_BUILT, FIELD_CONSTRUCT, FIELD_BUILD_PROGRESS,
+	FIELD_NEIGHBORS, FIELD_LOCATION, FIELD_LOCATION_GARRISON, FIELD_CENTER,
+	/* dummy */ FIELDS_COUNT
+};
 
-	union json *item, *field, *entry;
-	const union json *name, *count, *owner;
-	const union json *x, *y;
-	struct point *points;
-	const struct unit *restrict unit;
+#define BIT(n) (1u << (n))
 
-	if (name_size > NAME_LIMIT) return -1;
-	memcpy(region->name, name_data, name_size);
-	region->name_length = name_size;
+static const struct
+{
+	const char *name;
+	size_t name_length;
+	uint32_t objects; // states of the objects which have this field
+} loader_fields[] = {
+	[FIELD_PLAYERS] = {S("players"), BIT(STATE_DOCUMENT)},
+	[FIELD_REGIONS] = {S("regions"), BIT(STATE_DOCUMENT)},
+	[FIELD_NAME] = {S("name"), BIT(STATE_PLAYER)},
+	[FIELD_ALLIANCE] = {S("alliance"), BIT(STATE_PLAYER)},
+	[FIELD_GOLD] = {S("gold"), BIT(STATE_PLAYER)},
+	[FIELD_FOOD] = {S("food"), BIT(STATE_PLAYER) | BIT(STATE_WORKERS)},
+	[FIELD_WOOD] = {S("wood"), BIT(STATE_PLAYER) | BIT(STATE_WORKERS)},
+	[FIELD_IRON] = {S("iron"), BIT(STATE_PLAYER) | BIT(STATE_WORKERS)},
+	[FIELD_STONE] = {S("stone"), BIT(STATE_PLAYER) | BIT(STATE_WORKERS)},
+	[FIELD_OWNER] = {S("owner"), BIT(STATE_REGION) | BIT(STATE_GARRISON)},
+	[FIELD_POPULATION] = {S("population"), BIT(STATE_REGION)},
+	[FIELD_WORKERS] = {S("workers"), BIT(STATE_REGION)},
+	[FIELD_GARRISON] = {S("garrison"), BIT(STATE_REGION)},
+	[FIELD_SIEGE] = {S("siege"), BIT(STATE_GARRISON)},
+	[FIELD_TROOPS] = {S("troops"), BIT(STATE_REGION) | BIT(STATE_GARRISON)},
+	[FIELD_TRAIN] = {S("train"), BIT(STATE_REGION)},
+	[FIELD_TRAIN_PROGRESS] = {S("train_progress"), BIT(STATE_REGION)},
+	[FIELD_BUILT] = {S("built"), BIT(STATE_REGION)},
+	[FIELD_CONSTRUCT] = {S("construct"), BIT(STATE_REGION)},
+	[FIELD_BUILD_PROGRESS] = {S("build_progress"), BIT(STATE_REGION)},
+	[FIELD_NEIGHBORS] = {S("neighbors"), BIT(STATE_REGION)},
+	[FIELD_LOCATION] = {S("location"), BIT(STATE_REGION)},
+	[FIELD_LOCATION_GARRISON] = {S("location_garrison"), BIT(STATE_REGION)},
+	[FIELD_CENTER] = {S("center"), BIT(STATE_REGION)},
+};
 
-	item = value_get(data, "owner", JSON_INTEGER);
-	if (!item) return -1;
-	region->owner = item->integer;
+#define PLAYER_FIELDS (BIT(FIELD_NAME) | BIT(FIELD_ALLIANCE) | BIT(FIELD_GOLD) | BIT(FIELD_FOOD) | BIT(FIELD_WOOD) | BIT(FIELD_IRON) | BIT(FIELD_STONE))
+#define WORKERS_FIELDS (BIT(FIELD_FOOD) | BIT(FIELD_WOOD) | BIT(FIELD_IRON) | BIT(FIELD_STONE))
+#define REGION_FIELDS (BIT(FIELD_OWNER) | BIT(FIELD_POPULATION) | BIT(FIELD_NEIGHBORS) | BIT(FIELD_LOCATION) | BIT(FIELD_LOCATION_GARRISON) | BIT(FIELD_CENTER))
 
-	item = value_get(data, "population", JSON_INTEGER);
-	if (!item || (item->integer < 1)) return -1;
-	region->population = item->integer;
+struct loader_frame
+{
+	unsigned char state;
+	unsigned char field; // field of the next value (for objects)
+	uint32_t fields; // fields found so far (for objects)
+	size_t count; // number of items found so far (for arrays)
+};
 
-	if (item = value_get(data, "workers", JSON_OBJECT))
-	{
-		field = value_get(&item->object, "food", JSON_INTEGER);
-		if (!field || (field->integer < 0)) return -1;
-		region->workers.food = field->integer;
+// Neighbor which is resolved after all regions are loaded.
+struct loader_neighbor
+{
+	size_t region;
+	unsigned char direction;
+	unsigned char name_length;
+	char name[NAME_LIMIT];
+};
 
-		field = value_get(&item->object, "wood", JSON_INTEGER);
-		if (!field || (field->integer < 0)) return -1;
-		region->workers.wood = field->integer;
+// Troop which is spawned after all regions are loaded.
+struct loader_troop
+{
+	size_t region;
+	const struct unit *unit;
+	unsigned count;
+	unsigned char owner;
+	_Bool garrison;
+};
 
-		field = value_get(&item->object, "iron", JSON_INTEGER);
-		if (!field || (field->integer < 0)) return -1;
-		region->workers.iron = field->integer;
+struct loader
+{
+	struct game *game;
 
-		field = value_get(&item->object, "strone", JSON_INTEGER);
-		if (!field || (field->integer < 0)) return -1;
-		region->workers.stone = field->integer;
+	struct loader_frame stack[JSON_DEPTH_MAX + 1]; // stack[0] is the root
+	size_t depth;
 
-		if ((region->workers.food + region->workers.wood + region->workers.iron + region->workers.stone) > 100)
-			return -1;
-	}
-	else
-	{
-		region->workers.food = 40;
-		region->workers.wood = 0;
-		region->workers.iron = 0;
-		region->workers.stone = 0;
-	}
+	size_t players_capacity, regions_capacity;
+	int local_initialized;
+	int garrison_owner; // whether the garrison of the region being loaded has an owner
 
-	region->garrison.owner = region->owner;
-	region->garrison.siege = 0;
+	// Name of the next region.
+	char name[NAME_LIMIT];
+	size_t name_length;
 
-	region->troops = 0;
+	struct point *point; // point being loaded
+	struct point *points; // vertices of the region location being loaded
+	size_t points_count, points_capacity;
 
-	if (item = value_get(data, "garrison", JSON_OBJECT))
+	struct loader_troop troop; // troop being loaded
+	struct loader_troop *troops;
+	size_t troops_count, troops_capacity;
+
+	struct loader_neighbor *neighbors;
+	size_t neighbors_count, neighbors_capacity;
+};
+
+// Makes sure there is space for one more item in the array.
+static int loader_expand(void **restrict data, size_t *restrict capacity, size_t count, size_t size)
+{
+	void *buffer;
+	size_t capacity_new;
+
+	if (count < *capacity)
+		return 0;
+
+	capacity_new = (*capacity ? *capacity * 2 : 16);
+	buffer = realloc(*data, capacity_new * size);
+	if (!buffer) return ERROR_MEMORY;
+	*data = buffer;
+	*capacity = capacity_new;
+	return 0;
+}
+
+static inline int integer_range(const JSON_value *restrict value, long long min, long long max)
+{
+	return (value->vu.integer_value >= min) && (value->vu.integer_value <= max);
+}
+
+static int loader_push(struct loader *restrict loader, enum loader_state state)
+{
+	if (loader->depth == JSON_DEPTH_MAX) return 0;
+	loader->depth += 1;
+	loader->stack[loader->depth] = (struct loader_frame){.state = state};
+	return 1;
+}
+
+static int loader_key(struct loader *restrict loader, const JSON_value *restrict value)
+{
+	struct loader_frame *restrict frame = loader->stack + loader->depth;
+	const char *name = value->vu.str.value;
+	size_t name_length = value->vu.str.length;
+	size_t i;
+
+	if (frame->state == STATE_REGIONS)
 	{
-		field = value_get(&item->object, "owner", JSON_INTEGER);
-		if (field) region->garrison.owner = field->integer;
+		if (name_length > NAME_LIMIT) return 0;
+		memcpy(loader->name, name, name_length);
+		loader->name_length = name_length;
+		return 1;
+	}
 
-		if (field = value_get(&item->object, "troops", JSON_ARRAY))
+	frame->field = FIELD_UNKNOWN;
+	for(i = FIELD_UNKNOWN + 1; i < FIELDS_COUNT; ++i)
+		if ((loader_fields[i].objects & BIT(frame->state)) && (name_length == loader_fields[i].name_length) && !memcmp(name, loader_fields[i].name, name_length))
 		{
-			for(j = 0; j < field->array.count; ++j)
+			if (frame->fields & BIT(i))
 			{
-				entry = field->array.data[j];
-				if ((json_type(entry) != JSON_ARRAY) || (entry->array.count != 3)) return -1;
-				name = entry->array.data[0];
-				if (json_type(name) != JSON_STRING) return -1;
-				count = entry->array.data[1];
-				if ((json_type(count) != JSON_INTEGER) || (count->integer <= 0)) return -1;
-				owner = entry->array.data[2];
-				if ((json_type(owner) != JSON_INTEGER) || (owner->integer < 0) || (owner->integer >= game->players_count)) return -1;
-
-				unit = unit_find(&name->string);
-				if (!unit) return -1;
-				if (troop_spawn(LOCATION_GARRISON, &region->troops, unit, count->integer, owner->integer)) return -1;
+				LOG_ERROR("duplicate field %.*s", (int)name_length, name);
+				return 0;
 			}
+			frame->fields |= BIT(i);
+			frame->field = i;
+			break;
 		}
 
-		if (field = value_get(&item->object, "siege", JSON_INTEGER))
-			region->garrison.siege = field->integer;
+	return 1;
+}
+
+static int loader_player(struct loader *restrict loader, unsigned field, int type, const JSON_value *restrict value)
+{
+	struct game *restrict game = loader->game;
+	struct player *restrict player = game->players + game->players_count - 1;
+
+	if (field == FIELD_NAME)
+	{
+		if ((type != JSON_T_STRING) || (value->vu.str.length > NAME_LIMIT)) return 0;
+		memcpy(player->name, value->vu.str.value, value->vu.str.length);
+		player->name_length = value->vu.str.length;
+		return 1;
 	}
 
-	if (item = value_get(data, "troops", JSON_ARRAY))
+	if (type != JSON_T_INTEGER) return 0;
+	switch (field)
 	{
-		for(j = 0; j < item->array.count; ++j)
-		{
-			entry = item->array.data[j];
-			if ((json_type(entry) != JSON_ARRAY) || (entry->array.count != 3)) return -1;
-			name = entry->array.data[0];
-			if (json_type(name) != JSON_STRING) return -1;
-			count = entry->array.data[1];
-			if ((json_type(count) != JSON_INTEGER) || (count->integer <= 0)) return -1;
-			owner = entry->array.data[2];
-			if ((json_type(owner) != JSON_INTEGER) || (owner->integer < 0) || (owner->integer >= game->players_count)) return -1;
-
-			unit = unit_find(&name->string);
-			if (!unit) return -1;
-			if (troop_spawn(region, &region->troops, unit, count->integer, owner->integer)) return -1;
-		}
+	case FIELD_ALLIANCE:
+		if (!integer_range(value, 0, PLAYERS_LIMIT - 1)) return 0;
+		player->alliance = value->vu.integer_value;
+		break;
+	case FIELD_GOLD:
+		player->treasury.gold = value->vu.integer_value;
+		break;
+	case FIELD_FOOD:
+		player->treasury.food = value->vu.integer_value;
+		break;
+	case FIELD_WOOD:
+		player->treasury.wood = value->vu.integer_value;
+		break;
+	case FIELD_IRON:
+		player->treasury.iron = value->vu.integer_value;
+		break;
+	case FIELD_STONE:
+		player->treasury.stone = value->vu.integer_value;
+		break;
 	}
+	return 1;
+}
 
-	size_t train_index = 0;
-	region->train_progress = 0;
-	if (item = value_get(data, "train", JSON_ARRAY))
+static int loader_region(struct loader *restrict loader, unsigned field, int type, const JSON_value *restrict value)
+{
+	struct game *restrict game = loader->game;
+	struct region *restrict region = game->regions + game->regions_count - 1;
+
+	switch (field)
 	{
-		if (item->array.count > TRAIN_QUEUE) return -1;
+	case FIELD_OWNER:
+	case FIELD_POPULATION:
+	case FIELD_TRAIN_PROGRESS:
+	case FIELD_BUILD_PROGRESS:
+		if (type != JSON_T_INTEGER) return 0;
+		break;
+	case FIELD_CONSTRUCT:
+		if (type != JSON_T_STRING) return 0;
+		break;
+	case FIELD_WORKERS:
+	case FIELD_GARRISON:
+		if (type != JSON_T_OBJECT_BEGIN) return 0;
+		break;
+	default:
+		if (type != JSON_T_ARRAY_BEGIN) return 0;
+		break;
+	}
 
-		for(j = 0; j < item->array.count; ++j)
+	switch (field)
+	{
+	case FIELD_OWNER:
+		if (!integer_range(value, 0, PLAYERS_LIMIT - 1)) return 0;
+		region->owner = value->vu.integer_value;
+		return 1;
+	case FIELD_POPULATION:
+		if (!integer_range(value, 1, UINT_MAX)) return 0;
+		region->population = value->vu.integer_value;
+		return 1;
+	case FIELD_TRAIN_PROGRESS:
+		region->train_progress = value->vu.integer_value;
+		return 1;
+	case FIELD_BUILD_PROGRESS:
+		region->build_progress = value->vu.integer_value;
+		return 1;
+	case FIELD_CONSTRUCT:
+		region->construct = building_find(value->vu.str.value, value->vu.str.length);
+		return (region->construct >= 0);
+
+	case FIELD_WORKERS:
+		return loader_push(loader, STATE_WORKERS);
+	case FIELD_GARRISON:
+		return loader_push(loader, STATE_GARRISON);
+	case FIELD_NEIGHBORS:
+		return loader_push(loader, STATE_NEIGHBORS);
+	case FIELD_LOCATION:
+		loader->points_count = 0;
+		return loader_push(loader, STATE_LOCATION);
+	case FIELD_LOCATION_GARRISON:
+		loader->point = &region->location_garrison;
+		return loader_push(loader, STATE_POINT);
+	case FIELD_CENTER:
+		loader->point = &region->center;
+		return loader_push(loader, STATE_POINT);
+	case FIELD_TRAIN:
+		return loader_push(loader, STATE_TRAIN);
+	case FIELD_BUILT:
+		return loader_push(loader, STATE_BUILT);
+	case FIELD_TROOPS:
+		loader->troop.garrison = 0;
+		return loader_push(loader, STATE_TROOPS);
+	}
+
+	return 0; // not reached
+}
+
+// Records a neighbor of the region being loaded.
+static int loader_neighbor(struct loader *restrict loader, int type, const JSON_value *restrict value, unsigned direction)
+{
+	const struct region *restrict region = loader->game->regions + loader->game->regions_count - 1;
+	struct loader_neighbor *restrict neighbor;
+
+	if ((type != JSON_T_STRING) || (value->vu.str.length > NAME_LIMIT)) return 0;
+	if (loader_expand((void **)&loader->neighbors, &loader->neighbors_capacity, loader->neighbors_count, sizeof(*loader->neighbors)) < 0) return 0;
+
+	neighbor = loader->neighbors + loader->neighbors_count++;
+	neighbor->region = region->index;
+	neighbor->direction = direction;
+	neighbor->name_length = value->vu.str.length;
+	memcpy(neighbor->name, value->vu.str.value, value->vu.str.length);
+	return 1;
+}
+
+// Handles a value or the beginning of a value.
+static int loader_value(struct loader *restrict loader, int type, const JSON_value *restrict value)
+{
+	struct game *restrict game = loader->game;
+	struct loader_frame *restrict frame = loader->stack + loader->depth;
+	int container = ((type == JSON_T_ARRAY_BEGIN) || (type == JSON_T_OBJECT_BEGIN));
+	size_t index = frame->count++;
+	struct region *restrict region;
+
+	if ((frame->field == FIELD_UNKNOWN) && ((frame->state == STATE_DOCUMENT) || (frame->state == STATE_PLAYER) || (frame->state == STATE_REGION) || (frame->state == STATE_WORKERS) || (frame->state == STATE_GARRISON)))
+		return (container ? loader_push(loader, STATE_SKIP) : 1);
+
+	switch (frame->state)
+	{
+	case STATE_ROOT:
+		if (type != JSON_T_OBJECT_BEGIN) return 0;
+		return loader_push(loader, STATE_DOCUMENT);
+
+	case STATE_DOCUMENT:
+		if (frame->field == FIELD_PLAYERS)
+		{
+			if (type != JSON_T_ARRAY_BEGIN) return 0;
+			return loader_push(loader, STATE_PLAYERS);
+		}
+		else
+		{
+			if (type != JSON_T_OBJECT_BEGIN) return 0;
+			return loader_push(loader, STATE_REGIONS);
+		}
+
+	case STATE_PLAYERS:
+		if (type != JSON_T_OBJECT_BEGIN) return 0;
+		if (game->players_count == PLAYERS_LIMIT) return 0;
+		if (loader_expand((void **)&game->players, &loader->players_capacity, game->players_count, sizeof(*game->players)) < 0) return 0;
+		game->players_count += 1;
+		return loader_push(loader, STATE_PLAYER);
+
+	case STATE_PLAYER:
+		return loader_player(loader, frame->field, type, value);
+
+	case STATE_REGIONS:
+		if (type != JSON_T_OBJECT_BEGIN) return 0;
+		if (game->regions_count == REGIONS_LIMIT) return 0;
+		if (loader_expand((void **)&game->regions, &loader->regions_capacity, game->regions_count, sizeof(*game->regions)) < 0) return 0;
+		region = game->regions + game->regions_count;
+		*region = (struct region){
+			.index = game->regions_count,
+			.name_length = loader->name_length,
+			.construct = -1,
+			.workers = {.food = 40},
+		};
+		memcpy(region->name, loader->name, loader->name_length);
+		game->regions_count += 1;
+		loader->garrison_owner = 0;
+		return loader_push(loader, STATE_REGION);
+
+	case STATE_REGION:
+		return loader_region(loader, frame->field, type, value);
+
+	case STATE_WORKERS:
+		region = game->regions + game->regions_count - 1;
+		if ((type != JSON_T_INTEGER) || !integer_range(value, 0, 100)) return 0;
+		switch (frame->field)
 		{
-			name = item->array.data[j];
-			if (json_type(name) != JSON_STRING) return -1;
+		case FIELD_FOOD:
+			region->workers.food = value->vu.integer_value;
+			break;
+		case FIELD_WOOD:
+			region->workers.wood = value->vu.integer_value;
+			break;
+		case FIELD_IRON:
+			region->workers.iron = value->vu.integer_value;
+			break;
+		case FIELD_STONE:
+			region->workers.stone = value->vu.integer_value;
+			break;
+		}
+		return 1;
 
-			region->train[train_index] = unit_find(&name->string);
-			if (!region->train[train_index]) return -1;
-			train_index += 1;
+	case STATE_GARRISON:
+		region = game->regions + game->regions_count - 1;
+		switch (frame->field)
+		{
+		case FIELD_OWNER:
+			if ((type != JSON_T_INTEGER) || !integer_range(value, 0, PLAYERS_LIMIT - 1)) return 0;
+			region->garrison.owner = value->vu.integer_value;
+			loader->garrison_owner = 1;
+			return 1;
+		case FIELD_SIEGE:
+			if (type != JSON_T_INTEGER) return 0;
+			region->garrison.siege = value->vu.integer_value;
+			return 1;
+		case FIELD_TROOPS:
+			if (type != JSON_T_ARRAY_BEGIN) return 0;
+			loader->troop.garrison = 1;
+			return loader_push(loader, STATE_TROOPS);
+		}
+		return 0; // not reached
+
+	case STATE_NEIGHBORS:
+		// The position in the array determines the direction. Several neighbors in the same direction are listed in an array.
+		if (index >= DIRECTIONS_COUNT) return 0;
+		if (type == JSON_T_NULL) return 1; // no neighbor in this direction
+		if (type == JSON_T_ARRAY_BEGIN) return loader_push(loader, STATE_NEIGHBORS_DIRECTION);
+		return loader_neighbor(loader, type, value, index);
+
+	case STATE_NEIGHBORS_DIRECTION:
+		return loader_neighbor(loader, type, value, frame[-1].count - 1);
+
+	case STATE_LOCATION:
+		if (type != JSON_T_ARRAY_BEGIN) return 0;
+		if (loader_expand((void **)&loader->points, &loader->points_capacity, loader->points_count, sizeof(*loader->points)) < 0) return 0;
+		loader->point = loader->points + loader->points_count++;
+		return loader_push(loader, STATE_POINT);
+
+	case STATE_POINT:
+		if ((type != JSON_T_INTEGER) || (index >= 2)) return 0;
+		if (index) loader->point->y = value->vu.integer_value;
+		else loader->point->x = value->vu.integer_value;
+		return 1;
+
+	case STATE_TRAIN:
+		region = game->regions + game->regions_count - 1;
+		if ((type != JSON_T_STRING) || (index >= TRAIN_QUEUE)) return 0;
+		region->train[index] = unit_find(value->vu.str.value, value->vu.str.length);
+		return (region->train[index] != 0);
+
+	case STATE_BUILT:
+		region = game->regions + game->regions_count - 1;
+		if (type != JSON_T_STRING) return 0;
+		{
+			signed char building = building_find(value->vu.str.value, value->vu.str.length);
+			if (building < 0) return 0;
+			region->built |= (1 << building);
 		}
+		return 1;
 
-		if (item = value_get(data, "train_progress", JSON_INTEGER))
-			region->train_progress = item->integer;
+	case STATE_TROOPS:
+		if (type != JSON_T_ARRAY_BEGIN) return 0;
+		loader->troop.region = game->regions_count - 1;
+		return loader_push(loader, STATE_TROOP);
+
+	case STATE_TROOP:
+		switch (index)
+		{
+		case 0:
+			if (type != JSON_T_STRING) return 0;
+			loader->troop.unit = unit_find(value->vu.str.value, value->vu.str.length);
+			return (loader->troop.unit != 0);
+		case 1:
+			if ((type != JSON_T_INTEGER) || !integer_range(value, 1, UINT_MAX)) return 0;
+			loader->troop.count = value->vu.integer_value;
+			return 1;
+		case 2:
+			if ((type != JSON_T_INTEGER) || !integer_range(value, 0, PLAYERS_LIMIT - 1)) return 0;
+			loader->troop.owner = value->vu.integer_value;
+			return 1;
+		}
+		return 0;
+
+	case STATE_SKIP:
+		return (container ? loader_push(loader, STATE_SKIP) : 1);
 	}
-	while (train_index < TRAIN_QUEUE)
-		region->train[train_index++] = 0;
 
-	region->built = 0;
-	if (item = value_get(data, "built", JSON_ARRAY))
-		if (region_build(&region->built, &item->array))
-			return -1;
+	return 0; // not reached
+}
 
-	region->build_progress = 0;
-	if (item = value_get(data, "construct", JSON_STRING))
-	{
-		signed char building;
+// Handles the end of a value. Checks whether the value is complete.
+static int loader_end(struct loader *restrict loader)
+{
+	struct game *restrict game = loader->game;
+	struct loader_frame *restrict frame = loader->stack + loader->depth;
+	struct region *restrict region = (game->regions_count ? game->regions + game->regions_count - 1 : 0);
 
-		building = building_find(&item->string);
-		if (building < 0) return -1;
-		region->construct = building;
+	loader->depth -= 1;
 
-		if (item = value_get(data, "build_progress", JSON_INTEGER))
-			region->build_progress = item->integer;
-	}
-	else region->construct = -1;
-
-	item = value_get(data, "location", JSON_ARRAY);
-	if (!item || (item->array.count < 3)) return -1;
-	region->location = malloc(offsetof(struct polygon, points) + item->array.count * sizeof(struct point));
-	if (!region->location) return -1;
-	region->location->vertices_count = item->array.count;
-	points = region->location->points;
-	for(j = 0; j < item->array.count; ++j)
+	switch (frame->state)
 	{
-		entry = item->array.data[j];
-		if ((json_type(entry) != JSON_ARRAY) || (entry->array.count != 2))
+	case STATE_DOCUMENT:
+		return ((frame->fields & BIT(FIELD_PLAYERS)) && (frame->fields & BIT(FIELD_REGIONS)));
+
+	case STATE_PLAYERS:
+		return (game->players_count > 0);
+
+	case STATE_PLAYER:
 		{
-			free(region->location);
-			return -1;
+			struct player *restrict player = game->players + game->players_count - 1;
+			if ((frame->fields & PLAYER_FIELDS) != PLAYER_FIELDS) return 0;
+			if (game->players_count - 1 == PLAYER_NEUTRAL) player->type = Neutral;
+			else if (loader->local_initialized) player->type = Computer;
+			else
+			{
+				player->type = Local;
+				loader->local_initialized = 1;
+			}
 		}
-		x = entry->array.data[0];
-		y = entry->array.data[1];
-		if ((json_type(x) != JSON_INTEGER) || (json_type(y) != JSON_INTEGER))
+		return 1;
+
+	case STATE_REGIONS:
+		return (game->regions_count > 0);
+
+	case STATE_REGION:
+		if ((frame->fields & REGION_FIELDS) != REGION_FIELDS)
 		{
-			free(region->location);
-			return -1;
+			LOG_ERROR("Failed initializing %.*s", (int)region->name_length, region->name);
+			return 0;
 		}
-		points[j] = (struct point){x->integer, y->integer};
+		if (!(frame->fields & BIT(FIELD_TRAIN))) region->train_progress = 0;
+		if (!(frame->fields & BIT(FIELD_CONSTRUCT))) region->build_progress = 0;
+		if (!loader->garrison_owner)
+			region->garrison.owner = region->owner;
+		return 1;
+
+	case STATE_WORKERS:
+		if ((frame->fields & WORKERS_FIELDS) != WORKERS_FIELDS) return 0;
+		return ((region->workers.food + region->workers.wood + region->workers.iron + region->workers.stone) <= 100);
+
+	case STATE_LOCATION:
+		if (loader->points_count < 3) return 0;
+		region->location = malloc(offsetof(struct polygon, points) + loader->points_count * sizeof(struct point));
+		if (!region->location) return 0;
+		region->location->vertices_count = loader->points_count;
+		memcpy(region->location->points, loader->points, loader->points_count * sizeof(struct point));
+		return 1;
+
+	case STATE_POINT:
+		return (frame->count == 2);
+
+	case STATE_TROOP:
+		if (frame->count != 3) return 0;
+		if (loader_expand((void **)&loader->troops, &loader->troops_capacity, loader->troops_count, sizeof(*loader->troops)) < 0) return 0;
+		loader->troops[loader->troops_count++] = loader->troop;
+		return 1;
 	}
 
-	item = value_get(data, "location_garrison", JSON_ARRAY);
-	if (!item || (item->array.count != 2)) return -1;
-	x = item->array.data[0];
-	y = item->array.data[1];
-	if ((json_type(x) != JSON_INTEGER) || (json_type(y) != JSON_INTEGER)) return -1;
-	region->location_garrison = (struct point){x->integer, y->integer};
+	return 1;
+}
 
-	item = value_get(data, "center", JSON_ARRAY);
-	if (!item || (item->array.count != 2)) return -1;
-	x = item->array.data[0];
-	y = item->array.data[1];
-	if ((json_type(x) != JSON_INTEGER) || (json_type(y) != JSON_INTEGER)) return -1;
-	region->center = (struct point){x->integer, y->integer};
+static int loader_token(void *restrict context, int type, const JSON_value *value)
+{
+	struct loader *restrict loader = context;
 
-	return 0;
+	switch (type)
+	{
+	case JSON_T_KEY:
+		return loader_key(loader, value);
+
+	case JSON_T_ARRAY_END:
+	case JSON_T_OBJECT_END:
+		return loader_end(loader);
+
+	default:
+		return loader_value(loader, type, value);
+	}
 }
 
-static int region_neighbors(struct game *restrict game, struct region *restrict region, const struct hashmap *restrict regions, const struct hashmap *restrict data)
+static int region_compare(const void *a, const void *b)
 {
-	size_t i;
+	const struct region *const *left = a, *const *right = b;
+	size_t length = (((*left)->name_length < (*right)->name_length) ? (*left)->name_length : (*right)->name_length);
+	int difference = memcmp((*left)->name, (*right)->name, length);
+	if (difference) return difference;
+	return ((*left)->name_length > (*right)->name_length) - ((*left)->name_length < (*right)->name_length);
+}
 
-	union json *node, *item, *entry;
+// Resolves the references between the loaded objects.
+static int loader_finish(struct loader *restrict loader)
+{
+	struct game *restrict game = loader->game;
+	struct region **sorted;
+	struct region_link *links;
+	size_t i;
+	int pass;
+	int status = ERROR_INPUT;
 
-	size_t index;
+	for(i = 0; i < game->regions_count; ++i)
+		if ((game->regions[i].owner >= game->players_count) || (game->regions[i].garrison.owner >= game->players_count))
+			return ERROR_INPUT;
 
-	item = value_get(data, "neighbors", JSON_ARRAY);
-	if (!item || (item->array.count != NEIGHBORS_LIMIT)) return -1;
-	for(i = 0; i < NEIGHBORS_LIMIT; ++i)
+	// Find neighbors by name in the regions sorted by name.
+	sorted = malloc(game->regions_count * sizeof(*sorted));
+	links = malloc((loader->neighbors_count ? loader->neighbors_count : 1) * sizeof(*links));
+	if (!sorted || !links)
 	{
-		entry = item->array.data[i];
-		switch (json_type(entry))
+		status = ERROR_MEMORY;
+		goto finally;
+	}
+	for(i = 0; i < game->regions_count; ++i)
+		sorted[i] = game->regions + i;
+	qsort(sorted, game->regions_count, sizeof(*sorted), region_compare);
+
+	for(i = 1; i < game->regions_count; ++i)
+		if (!region_compare(sorted + i - 1, sorted + i))
 		{
-		case JSON_NULL:
-			region->neighbors[i] = 0;
-			continue; // no neighbor in this direction
-		default:
-			return -1;
-		case JSON_STRING:
-			break;
+			LOG_ERROR("duplicate region %.*s", (int)sorted[i]->name_length, sorted[i]->name);
+			goto finally;
 		}
 
-		node = (value_get)(regions, entry->string.data, entry->string.size, JSON_OBJECT);
-		if (!node) return -1; // no region with such name
-		index = value_get(&node->object, "location", JSON_ARRAY)->integer; // TODO ugly: type is not changed but the value is integer
-		region->neighbors[i] = game->regions + index;
+	for(i = 0; i < loader->neighbors_count; ++i)
+	{
+		const struct loader_neighbor *restrict neighbor = loader->neighbors + i;
+		struct region key, *key_pointer = &key, **found;
+
+		memcpy(key.name, neighbor->name, neighbor->name_length);
+		key.name_length = neighbor->name_length;
+		found = bsearch(&key_pointer, sorted, game->regions_count, sizeof(*sorted), region_compare);
+		if (!found) goto finally; // no region with such name
+		links[i] = (struct region_link){.region = neighbor->region, .neighbor = (*found)->index, .direction = neighbor->direction};
 	}
+	status = neighbors_init(game, links, loader->neighbors_count);
+	if (status < 0) goto finally;
+	status = ERROR_INPUT;
 
-	return 0;
+	for(i = 0; i < loader->troops_count; ++i)
+		if (loader->troops[i].owner >= game->players_count)
+			goto finally;
+
+	// Spawn garrison troops before the other troops of each region.
+	for(pass = 1; pass >= 0; --pass)
+		for(i = 0; i < loader->troops_count; ++i)
+		{
+			const struct loader_troop *restrict troop = loader->troops + i;
+			struct region *restrict region = game->regions + troop->region;
+
+			if (troop->garrison != pass) continue;
+			if (troop_spawn((troop->garrison ? LOCATION_GARRISON : region), &region->troops, troop->unit, troop->count, troop->owner) < 0)
+			{
+				status = ERROR_MEMORY;
+				goto finally;
+			}
+		}
+
+	status = 0;
+
+finally:
+	free(links);
+	free(sorted);
+	return status;
 }
 
-static int world_populate(const union json *restrict json, struct game *restrict game)
+static int world_load_json(const unsigned char *restrict buffer, size_t size, struct game *restrict game)
 {
-	const union json *item, *node, *field;
-	size_t index;
-	size_t i;
-
-	int local_initialized = 0;
+	struct loader loader = {.game = game};
+	int status;
 
 	game->players_count = 0;
 	game->players = 0;
 	game->regions_count = 0;
 	game->regions = 0;
+	game->neighbors_offsets = 0;
+	game->neighbors = 0;
+	game->neighbors_directions = 0;
 
 	game->turn = 0; // TODO get this from the world file
 
-	if (json_type(json) != JSON_OBJECT) goto error;
-	node = value_get(&json->object, "players", JSON_ARRAY);
-	if (!node || (node->array.count < 1) || (node->array.count > PLAYERS_LIMIT)) goto error;
+	if (!json_scan(buffer, size, loader_token, &loader) || (loader.stack[0].count != 1))
+		status = ERROR_INPUT; // TODO: memory or parse error
+	else
+		status = loader_finish(&loader);
 
-	game->players_count = node->array.count;
-	game->players = malloc(game->players_count * sizeof(struct player));
-	if (!game->players) goto error;
+	free(loader.points);
+	free(loader.troops);
+	free(loader.neighbors);
 
-	for(index = 0; index < game->players_count; ++index)
+	if (status < 0)
 	{
-		item = node->array.data[index];
-		if (json_type(item) != JSON_OBJECT) goto error;
+		for(size_t i = 0; i < game->regions_count; ++i)
+			while (game->regions[i].troops)
+				troop_remove(&game->regions[i].troops, game->regions[i].troops);
+		world_unload(game);
+	}
 
-		field = value_get(&item->object, "name", JSON_STRING);
-		if (!field || (field->string.size > NAME_LIMIT)) goto error;
-		memcpy(game->players[index].name, field->string.data, field->string.size);
-		game->players[index].name_length = field->string.size;
+	// TODO Initialize turn number and month names.
 
-		field = value_get(&item->object, "alliance", JSON_INTEGER);
-		if (!field || (field->integer >= PLAYERS_LIMIT)) goto error;
-		game->players[index].alliance = field->integer;
+	return status;
+}
 
-		field = value_get(&item->object, "gold", JSON_INTEGER);
-		if (!field) goto error;
-		game->players[index].treasury.gold = field->integer;
+/* JSON loader > */
 
-		field = value_get(&item->object, "food", JSON_INTEGER);
-		if (!field) goto error;
-		game->players[index].treasury.food = field->integer;
+/* < Binary format */
 
-		field = value_get(&item->object, "iron", JSON_INTEGER);
-		if (!field) goto error;
-		game->players[index].treasury.iron = field->integer;
+// All numbers are stored in little-endian. Each table is an array of fixed-size records.
+// The tables follow the header in the order: players, regions, neighbors, troops, points, strings.
 
-		field = value_get(&item->object, "wood", JSON_INTEGER);
-		if (!field) goto error;
-		game->players[index].treasury.wood = field->integer;
+#define BINARY_MAGIC "LEVIDON" /* the terminating NUL is part of the magic */
+#define BINARY_VERSION 2
 
-		field = value_get(&item->object, "stone", JSON_INTEGER);
-		if (!field) goto error;
-		game->players[index].treasury.stone = field->integer;
+struct binary_header
+{
+	unsigned char magic[8];
+	uint32_t version;
+	uint32_t turn;
+	uint32_t players_count;
+	uint32_t regions_count;
+	uint32_t troops_count;
+	uint32_t points_count;
+	uint32_t strings_size;
+	uint32_t neighbors_count;
+};
 
-		if (index == PLAYER_NEUTRAL) game->players[index].type = Neutral;
-		else if (local_initialized) game->players[index].type = Computer;
-		else
+struct binary_player
+{
+	uint32_t name_offset, name_length; // in the string table
+	int32_t treasury[5]; // gold, food, wood, iron, stone
+	uint8_t alliance;
+	uint8_t padding[3];
+};
+
+struct binary_region
+{
+	uint32_t name_offset, name_length; // in the string table
+	uint32_t neighbors_offset, neighbors_count; // in the neighbors table
+	uint32_t points_offset, points_count; // in the points table
+	int32_t location_garrison[2], center[2];
+	uint32_t troops_offset, troops_count; // in the troops table
+	uint32_t built;
+	uint32_t population;
+	uint32_t workers[4]; // food, wood, iron, stone
+	uint32_t siege;
+	uint8_t owner, garrison_owner;
+	uint8_t train_progress, build_progress;
+	int8_t construct; // index in BUILDINGS or -1
+	int8_t train[TRAIN_QUEUE]; // indices in UNITS or -1
+	uint8_t padding[3];
+};
+
+struct binary_neighbor
+{
+	uint32_t region;
+	uint8_t direction;
+	uint8_t padding[3];
+};
+
+struct binary_troop
+{
+	uint32_t count;
+	uint8_t unit; // index in UNITS
+	uint8_t owner;
+	uint8_t garrison; // whether the troop is in the garrison
+	uint8_t padding;
+};
+
+struct binary_tables
+{
+	const struct binary_header *header;
+	const struct binary_player *players;
+	const struct binary_region *regions;
+	const struct binary_neighbor *neighbors;
+	const struct binary_troop *troops;
+	const int32_t (*points)[2];
+	const unsigned char *strings;
+};
+
+static inline int binary_range(uint32_t offset, uint32_t count, uint32_t limit)
+{
+	return (offset <= limit) && (count <= limit - offset);
+}
+
+// Finds the location of each table. Returns whether the buffer contains a valid world of the supported version.
+static int binary_tables(const unsigned char *restrict buffer, size_t size, struct binary_tables *restrict tables)
+{
+	const struct binary_header *restrict header = (const struct binary_header *)buffer;
+	size_t players_count, regions_count, neighbors_count, troops_count, points_count, strings_size;
+	size_t offset, neighbors_offset = 0;
+	size_t i, j;
+
+	if (size < sizeof(*header)) return 0;
+	if (memcmp(header->magic, BINARY_MAGIC, sizeof(header->magic))) return 0;
+	if (le32toh(header->version) != BINARY_VERSION) return 0;
+
+	players_count = le32toh(header->players_count);
+	regions_count = le32toh(header->regions_count);
+	neighbors_count = le32toh(header->neighbors_count);
+	troops_count = le32toh(header->troops_count);
+	points_count = le32toh(header->points_count);
+	strings_size = le32toh(header->strings_size);
+
+	if ((players_count < 1) || (players_count > PLAYERS_LIMIT)) return 0;
+	if ((regions_count < 1) || (regions_count > REGIONS_LIMIT) || (regions_count > size / sizeof(struct binary_region))) return 0;
+	if (neighbors_count > size / sizeof(struct binary_neighbor)) return 0;
+	if ((troops_count > size / sizeof(struct binary_troop)) || (points_count > size / sizeof(*tables->points))) return 0;
+
+	offset = sizeof(*header);
+	tables->header = header;
+	tables->players = (const struct binary_player *)(buffer + offset);
+	offset += players_count * sizeof(struct binary_player);
+	tables->regions = (const struct binary_region *)(buffer + offset);
+	offset += regions_count * sizeof(struct binary_region);
+	tables->neighbors = (const struct binary_neighbor *)(buffer + offset);
+	offset += neighbors_count * sizeof(struct binary_neighbor);
+	tables->troops = (const struct binary_troop *)(buffer + offset);
+	offset += troops_count * sizeof(struct binary_troop);
+	tables->points = (const int32_t (*)[2])(buffer + offset);
+	offset += points_count * sizeof(*tables->points);
+	tables->strings = buffer + offset;
+	if ((offset > size) || (strings_size != size - offset)) return 0;
+
+	for(i = 0; i < players_count; ++i)
+	{
+		const struct binary_player *restrict player = tables->players + i;
+		if (le32toh(player->name_length) > NAME_LIMIT) return 0;
+		if (!binary_range(le32toh(player->name_offset), le32toh(player->name_length), strings_size)) return 0;
+		if (player->alliance >= PLAYERS_LIMIT) return 0;
+	}
+
+	for(i = 0; i < regions_count; ++i)
+	{
+		const struct binary_region *restrict region = tables->regions + i;
+		uint32_t troops_offset = le32toh(region->troops_offset), troops_region = le32toh(region->troops_count);
+
+		if (le32toh(region->name_length) > NAME_LIMIT) return 0;
+		if (!binary_range(le32toh(region->name_offset), le32toh(region->name_length), strings_size)) return 0;
+		// The neighbors of the regions are stored in order.
+		if (le32toh(region->neighbors_offset) != neighbors_offset) return 0;
+		if (!binary_range(neighbors_offset, le32toh(region->neighbors_count), neighbors_count)) return 0;
+		neighbors_offset += le32toh(region->neighbors_count);
+		if (le32toh(region->points_count) < 3) return 0;
+		if (!binary_range(le32toh(region->points_offset), le32toh(region->points_count), points_count)) return 0;
+		if (!binary_range(troops_offset, troops_region, troops_count)) return 0;
+
+		if ((region->owner >= players_count) || (region->garrison_owner >= players_count)) return 0;
+		if ((le32toh(region->population) < 1) || (le32toh(region->built) >> BUILDINGS_COUNT)) return 0;
+		if ((uint64_t)le32toh(region->workers[0]) + le32toh(region->workers[1]) + le32toh(region->workers[2]) + le32toh(region->workers[3]) > 100) return 0;
+		if ((region->construct < -1) || (region->construct >= (int)BUILDINGS_COUNT)) return 0;
+		for(j = 0; j < TRAIN_QUEUE; ++j)
+			if ((region->train[j] < -1) || (region->train[j] >= UNITS_COUNT))
+				return 0;
+
+		for(j = 0; j < troops_region; ++j)
 		{
-			game->players[index].type = Local;
-			local_initialized = 1;
+			const struct binary_troop *restrict troop = tables->troops + troops_offset + j;
+			if (!le32toh(troop->count) || (troop->unit >= UNITS_COUNT) || (troop->owner >= players_count)) return 0;
 		}
 	}
 
-	node = value_get(&json->object, "regions", JSON_OBJECT);
-	if (!node || (node->object.count < 1) || (node->object.count > REGIONS_LIMIT)) goto error;
+	if (neighbors_offset != neighbors_count) return 0;
+	for(i = 0; i < neighbors_count; ++i)
+		if ((le32toh(tables->neighbors[i].region) >= regions_count) || (tables->neighbors[i].direction >= DIRECTIONS_COUNT))
+			return 0;
+
+	return 1;
+}
+
+static int world_load_binary(const unsigned char *restrict buffer, size_t size, struct game *restrict game)
+{
+	struct binary_tables tables;
+	struct region_link *links;
+	size_t links_count = 0;
+	size_t i, j;
+
+	int local_initialized = 0;
+
+	if (!binary_tables(buffer, size, &tables))
+		return ERROR_INPUT;
+
+	game->turn = le32toh(tables.header->turn);
+	game->players_count = le32toh(tables.header->players_count);
+	game->regions_count = le32toh(tables.header->regions_count);
 
-	game->regions_count = node->object.count;
-	game->regions = malloc(game->regions_count * sizeof(struct region));
-	if (!game->regions) goto error;
+	game->players = malloc(game->players_count * sizeof(*game->players));
+	if (!game->players) return ERROR_MEMORY;
+	game->regions = malloc(game->regions_count * sizeof(*game->regions));
+	links = malloc((le32toh(tables.header->neighbors_count) ? le32toh(tables.header->neighbors_count) : 1) * sizeof(*links));
+	if (!game->regions || !links)
+	{
+		free(links);
+		free(game->regions);
+		free(game->players);
+		return ERROR_MEMORY;
+	}
+	game->neighbors_offsets = 0;
+	game->neighbors = 0;
+	game->neighbors_directions = 0;
 	for(i = 0; i < game->regions_count; ++i)
+	{
 		game->regions[i].location = 0;
+		game->regions[i].troops = 0;
+	}
 
-	struct hashmap_iterator it;
-	struct hashmap_entry *region;
-	index = 0;
-	for(region = hashmap_first(&node->object, &it); region; region = hashmap_next(&node->object, &it))
+	for(i = 0; i < game->players_count; ++i)
 	{
-		item = region->value;
-		if (json_type(item) != JSON_OBJECT) goto error;
+		const struct binary_player *restrict data = tables.players + i;
+		struct player *restrict player = game->players + i;
+
+		player->name_length = le32toh(data->name_length);
+		memcpy(player->name, tables.strings + le32toh(data->name_offset), player->name_length);
+		player->alliance = data->alliance;
+		player->treasury.gold = (int32_t)le32toh(data->treasury[0]);
+		player->treasury.food = (int32_t)le32toh(data->treasury[1]);
+		player->treasury.wood = (int32_t)le32toh(data->treasury[2]);
+		player->treasury.iron = (int32_t)le32toh(data->treasury[3]);
+		player->treasury.stone = (int32_t)le32toh(data->treasury[4]);
+
+		if (i == PLAYER_NEUTRAL) player->type = Neutral;
+		else if (local_initialized) player->type = Computer;
+		else
+		{
+			player->type = Local;
+			local_initialized = 1;
+		}
+	}
+
+	for(i = 0; i < game->regions_count; ++i)
+	{
+		const struct binary_region *restrict data = tables.regions + i;
+		struct region *restrict region = game->regions + i;
+		size_t points_count = le32toh(data->points_count);
+		size_t troops_offset = le32toh(data->troops_offset);
+
+		region->name_length = le32toh(data->name_length);
+		memcpy(region->name, tables.strings + le32toh(data->name_offset), region->name_length);
+		region->index = i;
 
-		game->regions[index].index = index;
-		if (region_init(game, game->regions + index, region->key_data, region->key_size, &item->object) < 0)
+		for(j = 0; j < le32toh(data->neighbors_count); ++j)
 		{
-			LOG_ERROR("Failed initializing %.*s", (int)region->key_size, region->key_data);
-			goto error;
+			const struct binary_neighbor *restrict neighbor = tables.neighbors + le32toh(data->neighbors_offset) + j;
+			links[links_count++] = (struct region_link){.region = i, .neighbor = le32toh(neighbor->region), .direction = neighbor->direction};
 		}
 
-		// TODO very ugly way to store a hashmap with region indices; fix this
-		union json *field = value_get(&item->object, "location", JSON_ARRAY);
-		for(i = 0; i < field->array.count; ++i)
-			json_free(field->array.data[i]);
-		field->integer = index;
+		region->location = malloc(offsetof(struct polygon, points) + points_count * sizeof(struct point));
+		if (!region->location) goto error;
+		region->location->vertices_count = points_count;
+		for(j = 0; j < points_count; ++j)
+		{
+			const int32_t *restrict point = tables.points[le32toh(data->points_offset) + j];
+			region->location->points[j] = (struct point){(int32_t)le32toh(point[0]), (int32_t)le32toh(point[1])};
+		}
+		region->location_garrison = (struct point){(int32_t)le32toh(data->location_garrison[0]), (int32_t)le32toh(data->location_garrison[1])};
+		region->center = (struct point){(int32_t)le32toh(data->center[0]), (int32_t)le32toh(data->center[1])};
 
-		index += 1;
-	}
+		region->owner = data->owner;
+		region->garrison.owner = data->garrison_owner;
+		region->garrison.siege = le32toh(data->siege);
+		region->garrison.reinforce = 0;
 
-	for(region = hashmap_first(&node->object, &it); region; region = hashmap_next(&node->object, &it))
-	{
-		item = region->value;
-		index = value_get(&item->object, "location", JSON_ARRAY)->integer; // TODO ugly: type is not changed but the value is integer
-		if (region_neighbors(game, game->regions + index, &node->object, &item->object) < 0)
-			goto error;
+		region->train_progress = data->train_progress;
+		for(j = 0; j < TRAIN_QUEUE; ++j)
+			region->train[j] = ((data->train[j] < 0) ? 0 : UNITS + data->train[j]);
+		region->built = le32toh(data->built);
+		region->construct = data->construct;
+		region->build_progress = data->build_progress;
+
+		region->population = le32toh(data->population);
+		region->workers.food = le32toh(data->workers[0]);
+		region->workers.wood = le32toh(data->workers[1]);
+		region->workers.iron = le32toh(data->workers[2]);
+		region->workers.stone = le32toh(data->workers[3]);
+
+		// Troops are attached to the beginning of the list so they are added in reverse order.
+		for(j = le32toh(data->troops_count); j; --j)
+		{
+			const struct binary_troop *restrict troop = tables.troops + troops_offset + j - 1;
+			struct region *location = (troop->garrison ? LOCATION_GARRISON : region);
+			if (troop_spawn(location, &region->troops, UNITS + troop->unit, le32toh(troop->count), troop->owner) < 0)
+				goto error;
+		}
 	}
 
-	// TODO Initialize turn number and month names.
+	if (neighbors_init(game, links, links_count) < 0) goto error;
+	free(links);
 
 	return 0;
 
 error:
-	// TODO segmentation fault on partial initialization (because of non-zeroed pointers)
+	free(links);
+	for(i = 0; i < game->regions_count; ++i)
+		while (game->regions[i].troops)
+			troop_remove(&game->regions[i].troops, game->regions[i].troops);
 	world_unload(game);
-	return ERROR_INPUT;
+	return ERROR_MEMORY;
 }
 
+/* Binary format > */
+
 int world_load(const unsigned char *restrict filepath, struct game *restrict game)
 {
 	int file;
 	struct stat info;
 	unsigned char *buffer;
 	int status;
-	union json *json;
 
 	// Read file content.
 	file = open(filepath, O_RDONLY);
@@ -530,198 +1143,444 @@ int world_load(const unsigned char *restrict filepath, struct game *restrict gam
 	close(file);
 	if (buffer == MAP_FAILED) return ERROR_MEMORY;
 
-	// Parse file content.
-	json = json_parse(buffer, info.st_size);
+	if ((info.st_size >= sizeof(BINARY_MAGIC)) && !memcmp(buffer, BINARY_MAGIC, sizeof(BINARY_MAGIC)))
+		status = world_load_binary(buffer, info.st_size, game);
+	else
+		status = world_load_json(buffer, info.st_size, game);
 	munmap(buffer, info.st_size);
-	if (!json) return ERROR_INPUT;
-
-	// Populate game data.
-	status = world_populate(json, game);
-	json_free(json);
 
 	return status;
 }
 
-static union json *world_save_point(struct point p)
+static void world_save_point(struct json_writer *restrict writer, struct point p)
 {
-	union json *point = json_array();
-	point = json_array_insert(point, json_integer(p.x));
-	point = json_array_insert(point, json_integer(p.y));
-	return point;
+	json_write_array_begin(writer);
+	json_write_integer(writer, p.x);
+	json_write_integer(writer, p.y);
+	json_write_array_end(writer);
 }
 
-static union json *world_save_troops(const struct troop *troop, const struct region *restrict location)
+// The position of each item in the array determines the direction of the neighbors in it.
+// The item is null, the name of the neighbor or an array with the names of several neighbors in the same direction.
+static void world_save_neighbors(struct json_writer *restrict writer, const struct game *restrict game, const struct region *restrict region)
 {
-	union json *troops = json_array();
-	for(; troop; troop = troop->_next)
+	size_t begin = region_neighbors_begin(game, region), end = region_neighbors_end(game, region);
+	size_t counts[DIRECTIONS_COUNT] = {0};
+	size_t i;
+	unsigned direction;
+
+	for(i = begin; i < end; ++i)
+		counts[game->neighbors_directions[i]] += 1;
+
+	json_write_array_begin(writer);
+	for(direction = 0; direction < DIRECTIONS_COUNT; ++direction)
 	{
-		union json *t;
+		if (!counts[direction])
+		{
+			json_write_null(writer);
+			continue;
+		}
+
+		if (counts[direction] > 1)
+			json_write_array_begin(writer);
+		for(i = begin; i < end; ++i)
+		{
+			const struct region *restrict neighbor;
+			if (game->neighbors_directions[i] != direction) continue;
+			neighbor = region_neighbor(game, i);
+			json_write_string(writer, neighbor->name, neighbor->name_length);
+		}
+		if (counts[direction] > 1)
+			json_write_array_end(writer);
+	}
+	json_write_array_end(writer);
+}
 
+static void world_save_troops(struct json_writer *restrict writer, const struct troop *troop, const struct region *restrict location)
+{
+	json_write_array_begin(writer);
+	for(; troop; troop = troop->_next)
+	{
 		if (troop->location != location) continue;
 
-		t = json_array();
-		t = json_array_insert(t, json_string(troop->unit->name, troop->unit->name_length));
-		t = json_array_insert(t, json_integer(troop->count));
-		t = json_array_insert(t, json_integer(troop->owner));
-		troops = json_array_insert(troops, t);
+		json_write_array_begin(writer);
+		json_write_string(writer, troop->unit->name, troop->unit->name_length);
+		json_write_integer(writer, troop->count);
+		json_write_integer(writer, troop->owner);
+		json_write_array_end(writer);
 	}
-	return troops;
+	json_write_array_end(writer);
 }
 
-static union json *world_store(const struct game *restrict game)
+static void world_store(struct json_writer *restrict writer, const struct game *restrict game)
 {
-	union json *json = json_object();
-
 	size_t i, j;
 
-	union json *players = json_array();
+	json_write_object_begin(writer);
+
+	json_write_key(writer, S("players"));
+	json_write_array_begin(writer);
 	for(i = 0; i < game->players_count; ++i)
 	{
-		union json *player = json_object();
-
-		player = json_object_insert(player, S("name"), json_string(game->players[i].name, game->players[i].name_length));
-		player = json_object_insert(player, S("alliance"), json_integer(game->players[i].alliance));
-		player = json_object_insert(player, S("gold"), json_integer(game->players[i].treasury.gold));
-		player = json_object_insert(player, S("food"), json_integer(game->players[i].treasury.food));
-		player = json_object_insert(player, S("wood"), json_integer(game->players[i].treasury.wood));
-		player = json_object_insert(player, S("iron"), json_integer(game->players[i].treasury.iron));
-		player = json_object_insert(player, S("stone"), json_integer(game->players[i].treasury.stone));
-
-		players = json_array_insert(players, player);
+		const struct player *restrict player = game->players + i;
+
+		json_write_object_begin(writer);
+		json_write_key(writer, S("name"));
+		json_write_string(writer, player->name, player->name_length);
+		json_write_key(writer, S("alliance"));
+		json_write_integer(writer, player->alliance);
+		json_write_key(writer, S("gold"));
+		json_write_integer(writer, player->treasury.gold);
+		json_write_key(writer, S("food"));
+		json_write_integer(writer, player->treasury.food);
+		json_write_key(writer, S("wood"));
+		json_write_integer(writer, player->treasury.wood);
+		json_write_key(writer, S("iron"));
+		json_write_integer(writer, player->treasury.iron);
+		json_write_key(writer, S("stone"));
+		json_write_integer(writer, player->treasury.stone);
+		json_write_object_end(writer);
 	}
-	json = json_object_insert(json, S("players"), players);
+	json_write_array_end(writer);
 
-	union json *regions = json_object();
+	json_write_key(writer, S("regions"));
+	json_write_object_begin(writer);
 	for(i = 0; i < game->regions_count; ++i)
 	{
-		union json *region = json_object();
-
-		union json *neighbors = json_array();
-		for(j = 0; j < NEIGHBORS_LIMIT; ++j)
-		{
-			const struct region *restrict neighbor = game->regions[i].neighbors[j];
-			if (neighbor) neighbors = json_array_insert(neighbors, json_string(neighbor->name, neighbor->name_length));
-			else neighbors = json_array_insert(neighbors, json_null());
-		}
-		region = json_object_insert(region, S("neighbors"), neighbors);
-
-		union json *location = json_array();
-		const struct polygon *restrict polygon = game->regions[i].location;
-		for(j = 0; j < polygon->vertices_count; ++j)
-			location = json_array_insert(location, world_save_point(polygon->points[j]));
-		region = json_object_insert(region, S("location"), location);
-
-		region = json_object_insert(region, S("location_garrison"), world_save_point(game->regions[i].location_garrison));
-		region = json_object_insert(region, S("center"), world_save_point(game->regions[i].center));
-
-		region = json_object_insert(region, S("owner"), json_integer(game->regions[i].owner));
-
-		region = json_object_insert(region, S("population"), json_integer(game->regions[i].population));
-		union json *workers = json_object();
-		workers = json_object_insert(workers, S("food"), json_integer(game->regions[i].workers.food));
-		workers = json_object_insert(workers, S("wood"), json_integer(game->regions[i].workers.wood));
-		workers = json_object_insert(workers, S("iron"), json_integer(game->regions[i].workers.iron));
-		workers = json_object_insert(workers, S("stone"), json_integer(game->regions[i].workers.stone));
-		region = json_object_insert(region, S("workers"), workers);
-
-		union json *train = json_array();
+		const struct region *restrict region = game->regions + i;
+
+		json_write_key(writer, region->name, region->name_length);
+		json_write_object_begin(writer);
+
+		json_write_key(writer, S("neighbors"));
+		world_save_neighbors(writer, game, region);
+
+		json_write_key(writer, S("location"));
+		json_write_array_begin(writer);
+		for(j = 0; j < region->location->vertices_count; ++j)
+			world_save_point(writer, region->location->points[j]);
+		json_write_array_end(writer);
+
+		json_write_key(writer, S("location_garrison"));
+		world_save_point(writer, region->location_garrison);
+		json_write_key(writer, S("center"));
+		world_save_point(writer, region->center);
+
+		json_write_key(writer, S("owner"));
+		json_write_integer(writer, region->owner);
+
+		json_write_key(writer, S("population"));
+		json_write_integer(writer, region->population);
+		json_write_key(writer, S("workers"));
+		json_write_object_begin(writer);
+		json_write_key(writer, S("food"));
+		json_write_integer(writer, region->workers.food);
+		json_write_key(writer, S("wood"));
+		json_write_integer(writer, region->workers.wood);
+		json_write_key(writer, S("iron"));
+		json_write_integer(writer, region->workers.iron);
+		json_write_key(writer, S("stone"));
+		json_write_integer(writer, region->workers.stone);
+		json_write_object_end(writer);
+
+		json_write_key(writer, S("train"));
+		json_write_array_begin(writer);
 		for(j = 0; j < TRAIN_QUEUE; ++j)
 		{
-			const struct unit *restrict unit = game->regions[i].train[j];
+			const struct unit *restrict unit = region->train[j];
 			if (!unit) break;
-			train = json_array_insert(train, json_string(unit->name, unit->name_length));
+			json_write_string(writer, unit->name, unit->name_length);
 		}
-		region = json_object_insert(region, S("train"), train);
-		region = json_object_insert(region, S("train_progress"), json_integer(game->regions[i].train_progress));
+		json_write_array_end(writer);
+		json_write_key(writer, S("train_progress"));
+		json_write_integer(writer, region->train_progress);
 
-		union json *built = json_array();
+		json_write_key(writer, S("built"));
+		json_write_array_begin(writer);
 		for(j = 0; j < BUILDINGS_COUNT; ++j)
-			if (game->regions[i].built & (1 << j))
-				built = json_array_insert(built, json_string(BUILDINGS[j].name, BUILDINGS[j].name_length));
-		region = json_object_insert(region, S("built"), built);
-		if (game->regions[i].construct >= 0)
+			if (region_built(region, j))
+				json_write_string(writer, BUILDINGS[j].name, BUILDINGS[j].name_length);
+		json_write_array_end(writer);
+		if (region->construct >= 0)
 		{
-			const struct building *restrict building = &BUILDINGS[game->regions[i].construct];
-			region = json_object_insert(region, S("construct"), json_string(building->name, building->name_length));
-			region = json_object_insert(region, S("build_progress"), json_integer(game->regions[i].build_progress));
+			const struct building *restrict building = &BUILDINGS[region->construct];
+			json_write_key(writer, S("construct"));
+			json_write_string(writer, building->name, building->name_length);
+			json_write_key(writer, S("build_progress"));
+			json_write_integer(writer, region->build_progress);
 		}
 
-		region = json_object_insert(region, S("troops"), world_save_troops(game->regions[i].troops, game->regions + i));
+		json_write_key(writer, S("troops"));
+		world_save_troops(writer, region->troops, region);
 
-		if (garrison_info(game->regions + i))
+		if (region_built(region, BuildingPalisade) || region_built(region, BuildingFortress))
 		{
-			union json *garrison = json_object();
-			garrison = json_object_insert(garrison, S("owner"), json_integer(game->regions[i].garrison.owner));
-			garrison = json_object_insert(garrison, S("troops"), world_save_troops(game->regions[i].troops, LOCATION_GARRISON));
-			garrison = json_object_insert(garrison, S("siege"), json_integer(game->regions[i].garrison.siege));
-			region = json_object_insert(region, S("garrison"), garrison);
+			json_write_key(writer, S("garrison"));
+			json_write_object_begin(writer);
+			json_write_key(writer, S("owner"));
+			json_write_integer(writer, region->garrison.owner);
+			json_write_key(writer, S("troops"));
+			world_save_troops(writer, region->troops, LOCATION_GARRISON);
+			json_write_key(writer, S("siege"));
+			json_write_integer(writer, region->garrison.siege);
+			json_write_object_end(writer);
 		}
 
-		regions = json_object_insert(regions, game->regions[i].name, game->regions[i].name_length, region);
+		json_write_object_end(writer);
 	}
-	json = json_object_insert(json, S("regions"), regions);
+	json_write_object_end(writer);
 
 	// game->turn // TODO write this to the world file
 
-	return json;
+	json_write_object_end(writer);
 }
 
-int world_save(const struct game *restrict game, const unsigned char *restrict filepath)
+// Creates a temporary file in the directory of filepath. On success, returns file descriptor and sets *temp to the name of the file.
+static int file_temp(const unsigned char *restrict filepath, unsigned char **restrict temp)
 {
-	union json *json;
-	size_t size;
-	unsigned char *buffer;
+	size_t filepath_size;
+	int file;
+
+	filepath_size = strlen(filepath);
+	*temp = malloc(filepath_size + sizeof(TEMP_SUFFIX));
+	if (!*temp) return ERROR_MEMORY;
+	memcpy(*temp, filepath, filepath_size);
+	memcpy(*temp + filepath_size, TEMP_SUFFIX, sizeof(TEMP_SUFFIX));
+
+	file = mkstemp(*temp);
+	if (file < 0)
+	{
+		free(*temp);
+		return ERROR_ACCESS; // TODO this could be several different errors
+	}
+	fchmod(file, 0644);
+
+	return file;
+}
+
+// Replaces the file at filepath with the temporary file if it was written successfully (status is 0).
+static int file_commit(int file, unsigned char *restrict temp, const unsigned char *restrict filepath, int status)
+{
+	if (status < 0)
+		goto error;
+
+	// Make sure the data is on the disk before replacing the old file.
+	if (fsync(file) < 0)
+		goto error;
+	close(file);
+	file = -1;
+
+	if (rename(temp, filepath) < 0)
+		goto error;
+
+	free(temp);
+	return 0;
+
+error:
+	if (file >= 0) close(file);
+	unlink(temp);
+	free(temp);
+	return ERROR_WRITE;
+}
+
+// Writes data to a file.
+// The data is written to a temporary file which replaces the target file once it is completely written.
+static int file_replace(const unsigned char *restrict filepath, const unsigned char *restrict buffer, size_t size)
+{
+	unsigned char *temp;
 	int file;
 	size_t progress;
 	ssize_t written;
+	int status = 0;
 
-	json = world_store(game);
-	if (!json) return ERROR_MEMORY;
+	file = file_temp(filepath, &temp);
+	if (file < 0) return file;
 
-	size = json_size(json);
-	buffer = malloc(size);
-	if (!buffer)
+	for(progress = 0; progress < size; progress += written)
 	{
-		json_free(json);
-		return ERROR_MEMORY;
+		written = write(file, buffer + progress, size - progress);
+		if (written < 0)
+		{
+			status = ERROR_WRITE;
+			break;
+		}
 	}
 
-	json_dump(buffer, json);
-	json_free(json);
+	return file_commit(file, temp, filepath, status);
+}
 
-	file = creat(filepath, 0644);
-	if (file < 0)
+// Writes the world to a file in JSON format.
+int world_save(const struct game *restrict game, const unsigned char *restrict filepath)
+{
+	unsigned char *temp;
+	int file;
+	struct json_writer writer;
+	int status;
+
+	file = file_temp(filepath, &temp);
+	if (file < 0) return file;
+
+	json_writer_init(&writer, file);
+	world_store(&writer, game);
+	status = json_writer_flush(&writer);
+	if (!status && (write(file, "\n", 1) != 1))
+		status = ERROR_WRITE;
+
+	return file_commit(file, temp, filepath, status);
+}
+
+// Writes the world from a snapshot to a file in binary format.
+int world_save_binary(const struct snapshot *restrict snapshot, const unsigned char *restrict filepath)
+{
+	const struct game *restrict game = snapshot->game;
+
+	struct binary_header *header;
+	struct binary_player *players;
+	struct binary_region *regions;
+	struct binary_neighbor *neighbors;
+	struct binary_troop *troops;
+	int32_t (*points)[2];
+	unsigned char *strings;
+
+	size_t neighbors_count = game->neighbors_offsets[snapshot->regions_count];
+	size_t points_count = 0, strings_size = 0;
+	size_t troops_count = 0, points_offset = 0, strings_offset = 0;
+	size_t size;
+	unsigned char *buffer;
+	size_t i, j;
+	int status;
+
+	for(i = 0; i < snapshot->players_count; ++i)
+		strings_size += game->players[i].name_length;
+	for(i = 0; i < snapshot->regions_count; ++i)
 	{
-		free(buffer);
-		return ERROR_ACCESS; // TODO this could be several different errors
+		strings_size += game->regions[i].name_length;
+		points_count += game->regions[i].location->vertices_count;
 	}
 
-	// Write the serialized world into the file.
-	for(progress = 0; progress < size; progress += written)
+	size = sizeof(*header) + snapshot->players_count * sizeof(*players) + snapshot->regions_count * sizeof(*regions) + neighbors_count * sizeof(*neighbors) + snapshot->troops_count * sizeof(*troops) + points_count * sizeof(*points) + strings_size;
+	buffer = calloc(1, size);
+	if (!buffer) return ERROR_MEMORY;
+
+	header = (struct binary_header *)buffer;
+	players = (struct binary_player *)(header + 1);
+	regions = (struct binary_region *)(players + snapshot->players_count);
+	neighbors = (struct binary_neighbor *)(regions + snapshot->regions_count);
+	troops = (struct binary_troop *)(neighbors + neighbors_count);
+	points = (int32_t (*)[2])(troops + snapshot->troops_count);
+	strings = (unsigned char *)(points + points_count);
+
+	memcpy(header->magic, BINARY_MAGIC, sizeof(header->magic));
+	header->version = htole32(BINARY_VERSION);
+	header->turn = htole32(snapshot->turn);
+	header->players_count = htole32(snapshot->players_count);
+	header->regions_count = htole32(snapshot->regions_count);
+	header->neighbors_count = htole32(neighbors_count);
+	header->points_count = htole32(points_count);
+	header->strings_size = htole32(strings_size);
+
+	for(i = 0; i < snapshot->players_count; ++i)
 	{
-		written = write(file, buffer + progress, size - progress);
-		if (written < 0)
+		const struct resources *restrict treasury = &snapshot->players[i].treasury;
+
+		players[i].name_offset = htole32(strings_offset);
+		players[i].name_length = htole32(game->players[i].name_length);
+		memcpy(strings + strings_offset, game->players[i].name, game->players[i].name_length);
+		strings_offset += game->players[i].name_length;
+
+		players[i].treasury[0] = htole32(treasury->gold);
+		players[i].treasury[1] = htole32(treasury->food);
+		players[i].treasury[2] = htole32(treasury->wood);
+		players[i].treasury[3] = htole32(treasury->iron);
+		players[i].treasury[4] = htole32(treasury->stone);
+		players[i].alliance = snapshot->players[i].alliance;
+	}
+
+	for(i = 0; i < snapshot->regions_count; ++i)
+	{
+		const struct snapshot_region *restrict state = snapshot->regions + i;
+		const struct region *restrict region = game->regions + i;
+		struct binary_region *restrict data = regions + i;
+
+		data->name_offset = htole32(strings_offset);
+		data->name_length = htole32(region->name_length);
+		memcpy(strings + strings_offset, region->name, region->name_length);
+		strings_offset += region->name_length;
+
+		data->neighbors_offset = htole32(region_neighbors_begin(game, region));
+		data->neighbors_count = htole32(region_neighbors_end(game, region) - region_neighbors_begin(game, region));
+		for(j = region_neighbors_begin(game, region); j < region_neighbors_end(game, region); ++j)
+		{
+			neighbors[j].region = htole32(game->neighbors[j]);
+			neighbors[j].direction = game->neighbors_directions[j];
+		}
+
+		data->points_offset = htole32(points_offset);
+		data->points_count = htole32(region->location->vertices_count);
+		for(j = 0; j < region->location->vertices_count; ++j)
 		{
-			unlink(filepath);
-			close(file);
-			free(buffer);
-			return ERROR_WRITE;
+			points[points_offset + j][0] = htole32(region->location->points[j].x);
+			points[points_offset + j][1] = htole32(region->location->points[j].y);
 		}
+		points_offset += region->location->vertices_count;
+
+		data->location_garrison[0] = htole32(region->location_garrison.x);
+		data->location_garrison[1] = htole32(region->location_garrison.y);
+		data->center[0] = htole32(region->center.x);
+		data->center[1] = htole32(region->center.y);
+
+		// Only troops located in the region or in its garrison are stored.
+		data->troops_offset = htole32(troops_count);
+		for(j = 0; j < state->troops_count; ++j)
+		{
+			const struct snapshot_troop *restrict troop = snapshot->troops + state->troops_offset + j;
+
+			if ((troop->location != i) && (troop->location != SNAPSHOT_GARRISON)) continue;
+
+			troops[troops_count].count = htole32(troop->count);
+			troops[troops_count].unit = troop->unit;
+			troops[troops_count].owner = troop->owner;
+			troops[troops_count].garrison = (troop->location == SNAPSHOT_GARRISON);
+			troops_count += 1;
+		}
+		data->troops_count = htole32(troops_count - le32toh(data->troops_offset));
+
+		data->built = htole32(state->built);
+		data->population = htole32(state->population);
+		data->workers[0] = htole32(state->workers.food);
+		data->workers[1] = htole32(state->workers.wood);
+		data->workers[2] = htole32(state->workers.iron);
+		data->workers[3] = htole32(state->workers.stone);
+		data->siege = htole32(state->garrison.siege);
+		data->owner = state->owner;
+		data->garrison_owner = state->garrison.owner;
+		data->train_progress = state->train_progress;
+		data->build_progress = state->build_progress;
+		data->construct = state->construct;
+		for(j = 0; j < TRAIN_QUEUE; ++j)
+			data->train[j] = state->train[j];
 	}
-	write(file, "\n", 1); // TODO this can fail
 
-	close(file);
+	// Skipped troops leave unused space between the troops and the points tables. Close the gap.
+	if (troops_count < snapshot->troops_count)
+	{
+		size_t gap = (snapshot->troops_count - troops_count) * sizeof(*troops);
+		memmove(troops + troops_count, points, points_count * sizeof(*points) + strings_size);
+		size -= gap;
+	}
+	header->troops_count = htole32(troops_count);
+
+	status = file_replace(filepath, buffer, size);
 	free(buffer);
-	return 0;
+	return status;
 }
 
 void world_unload(struct game *restrict game)
 {
+	neighbors_term(game);
 	if (game->regions)
 		for(size_t i = 0; i < game->regions_count; ++i)
 			free(game->regions[i].location);
 	free(game->regions);
 	free(game->players);
 }
-
-#undef value_get
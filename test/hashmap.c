@@ -0,0 +1,165 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#define hashmap_type size_t
+#include <hashmap.h>
+#include <hashmap.c>
+#include <hashmap_open.h>
+#include <hashmap_open.c>
+
+#define KEYS_COUNT 1000
+
+// Generates keys of various lengths (some are stored inline, some are not).
+static size_t key_generate(char key[static 64], size_t index)
+{
+	return sprintf(key, "%0*u", (int)(1 + index % 40), (unsigned)index);
+}
+
+static void test_hashmap_open_insert(void **state)
+{
+	struct hashmap_open hashmap;
+	char key[64];
+	size_t key_size;
+	size_t i, *value;
+
+	assert_int_equal(hashmap_open_init(&hashmap, 4), 0);
+
+	for(i = 0; i < KEYS_COUNT; ++i)
+	{
+		key_size = key_generate(key, i);
+		value = hashmap_open_insert(&hashmap, key, key_size, i);
+		assert_non_null(value);
+		assert_int_equal(*value, i);
+	}
+	assert_int_equal(hashmap.count, KEYS_COUNT);
+
+	// Inserting an existing key returns the existing value.
+	key_size = key_generate(key, 7);
+	value = hashmap_open_insert(&hashmap, key, key_size, 0);
+	assert_non_null(value);
+	assert_int_equal(*value, 7);
+	assert_int_equal(hashmap.count, KEYS_COUNT);
+
+	for(i = 0; i < KEYS_COUNT; ++i)
+	{
+		key_size = key_generate(key, i);
+		value = hashmap_open_get(&hashmap, key, key_size);
+		assert_non_null(value);
+		assert_int_equal(*value, i);
+	}
+	assert_null(hashmap_open_get(&hashmap, "missing", sizeof("missing") - 1));
+
+	hashmap_open_term(&hashmap);
+}
+
+static void test_hashmap_open_remove(void **state)
+{
+	struct hashmap_open hashmap;
+	char key[64];
+	size_t key_size;
+	size_t i, value, *result;
+
+	assert_int_equal(hashmap_open_init(&hashmap, 16), 0);
+
+	for(i = 0; i < KEYS_COUNT; ++i)
+	{
+		key_size = key_generate(key, i);
+		assert_non_null(hashmap_open_insert(&hashmap, key, key_size, i));
+	}
+
+	// Remove the odd keys.
+	for(i = 1; i < KEYS_COUNT; i += 2)
+	{
+		key_size = key_generate(key, i);
+		assert_int_equal(hashmap_open_remove(&hashmap, key, key_size, &value), 0);
+		assert_int_equal(value, i);
+		assert_int_equal(hashmap_open_remove(&hashmap, key, key_size, 0), ERROR_MISSING);
+	}
+	assert_int_equal(hashmap.count, KEYS_COUNT / 2);
+
+	for(i = 0; i < KEYS_COUNT; ++i)
+	{
+		key_size = key_generate(key, i);
+		result = hashmap_open_get(&hashmap, key, key_size);
+		if (i % 2) assert_null(result);
+		else
+		{
+			assert_non_null(result);
+			assert_int_equal(*result, i);
+		}
+	}
+
+	hashmap_open_term(&hashmap);
+}
+
+static void test_hashmap_open_iterate(void **state)
+{
+	struct hashmap_open hashmap;
+	struct hashmap_open_iterator it;
+	struct hashmap_open_entry *entry;
+	char key[64];
+	size_t key_size;
+	size_t i, count = 0;
+	unsigned char found[KEYS_COUNT] = {0};
+
+	assert_int_equal(hashmap_open_init(&hashmap, 1), 0);
+	assert_null(hashmap_open_first(&hashmap, &it));
+
+	for(i = 0; i < KEYS_COUNT; ++i)
+	{
+		key_size = key_generate(key, i);
+		assert_non_null(hashmap_open_insert(&hashmap, key, key_size, i));
+	}
+
+	for(entry = hashmap_open_first(&hashmap, &it); entry; entry = hashmap_open_next(&hashmap, &it))
+	{
+		assert_true(entry->value < KEYS_COUNT);
+		assert_false(found[entry->value]);
+		found[entry->value] = 1;
+
+		key_size = key_generate(key, entry->value);
+		assert_int_equal(entry->key_size, key_size);
+		assert_memory_equal(hashmap_open_key(entry), key, key_size);
+
+		count += 1;
+	}
+	assert_int_equal(count, KEYS_COUNT);
+
+	hashmap_open_term(&hashmap);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] =
+	{
+		cmocka_unit_test(test_hashmap_open_insert),
+		cmocka_unit_test(test_hashmap_open_remove),
+		cmocka_unit_test(test_hashmap_open_iterate),
+	};
+	return cmocka_run_group_tests(tests, 0, 0);
+}
@@ -0,0 +1,151 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compares the performance of the chained hashmap and the open addressing hashmap.
+// Usage: hashmap_bench [keys_count]
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define hashmap_type size_t
+#include <hashmap.h>
+#include <hashmap.c>
+#include <hashmap_open.h>
+#include <hashmap_open.c>
+
+#define KEYS_COUNT_DEFAULT 200000
+#define REPEAT 5
+
+struct keys
+{
+	size_t count;
+	char (*data)[32];
+	size_t *size;
+};
+
+static double time_elapsed(const struct timespec *restrict start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// Generates keys similar to region names.
+static int keys_init(struct keys *restrict keys, size_t count)
+{
+	keys->count = count;
+	keys->data = malloc(count * sizeof(*keys->data));
+	keys->size = malloc(count * sizeof(*keys->size));
+	if (!keys->data || !keys->size) return -1;
+
+	for(size_t i = 0; i < count; ++i)
+		keys->size[i] = sprintf(keys->data[i], "Region %u of %s", (unsigned)i, ((i % 3) ? "Levidon" : "the great kingdom"));
+
+	return 0;
+}
+
+static void bench_chained(const struct keys *restrict keys, double result[static 4])
+{
+	struct hashmap hashmap;
+	struct hashmap_iterator it;
+	struct hashmap_entry *entry;
+	struct timespec start;
+	size_t i, sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (hashmap_init(&hashmap, HASHMAP_SIZE_DEFAULT) < 0) abort();
+	for(i = 0; i < keys->count; ++i)
+		if (!hashmap_insert(&hashmap, keys->data[i], keys->size[i], i)) abort();
+	result[0] += time_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < keys->count; ++i)
+		sum += *hashmap_get(&hashmap, keys->data[i], keys->size[i]);
+	result[1] += time_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(entry = hashmap_first(&hashmap, &it); entry; entry = hashmap_next(&hashmap, &it))
+		sum -= entry->value;
+	result[2] += time_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	hashmap_term(&hashmap);
+	result[3] += time_elapsed(&start);
+
+	if (sum) abort();
+}
+
+static void bench_open(const struct keys *restrict keys, double result[static 4])
+{
+	struct hashmap_open hashmap;
+	struct hashmap_open_iterator it;
+	struct hashmap_open_entry *entry;
+	struct timespec start;
+	size_t i, sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (hashmap_open_init(&hashmap, HASHMAP_SIZE_DEFAULT) < 0) abort();
+	for(i = 0; i < keys->count; ++i)
+		if (!hashmap_open_insert(&hashmap, keys->data[i], keys->size[i], i)) abort();
+	result[0] += time_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < keys->count; ++i)
+		sum += *hashmap_open_get(&hashmap, keys->data[i], keys->size[i]);
+	result[1] += time_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(entry = hashmap_open_first(&hashmap, &it); entry; entry = hashmap_open_next(&hashmap, &it))
+		sum -= entry->value;
+	result[2] += time_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	hashmap_open_term(&hashmap);
+	result[3] += time_elapsed(&start);
+
+	if (sum) abort();
+}
+
+int main(int argc, char *argv[])
+{
+	struct keys keys;
+	double chained[4] = {0}, open[4] = {0};
+	size_t count = ((argc > 1) ? strtoul(argv[1], 0, 10) : KEYS_COUNT_DEFAULT);
+
+	if (keys_init(&keys, count) < 0) return 1;
+
+	for(size_t i = 0; i < REPEAT; ++i)
+	{
+		bench_chained(&keys, chained);
+		bench_open(&keys, open);
+	}
+
+	printf("%u keys, average of %u runs (ms)\n", (unsigned)count, REPEAT);
+	printf("%-8s %10s %10s %10s %10s\n", "", "insert", "get", "iterate", "term");
+	printf("%-8s %10.2f %10.2f %10.2f %10.2f\n", "chained", chained[0] / REPEAT, chained[1] / REPEAT, chained[2] / REPEAT, chained[3] / REPEAT);
+	printf("%-8s %10.2f %10.2f %10.2f %10.2f\n", "open", open[0] / REPEAT, open[1] / REPEAT, open[2] / REPEAT, open[3] / REPEAT);
+
+	free(keys.data);
+	free(keys.size);
+	return 0;
+}
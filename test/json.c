@@ -73,6 +73,49 @@ static void test_json_parse(void **state)
 	#undef CASE
 }
 
+static void test_json_parse_scan(void **state)
+{
+	union json *json;
+
+	#define PARSE(string) json_parse(string, sizeof(string) - 1)
+
+	// Strings longer than a word with and without escape sequences.
+	json = PARSE("[\"abcdefghijklmnopqrstuvwxyz\", \"abcdefghij\\\"klmnopq\\u00e9\\ud83d\\ude00\"]");
+	assert_non_null(json);
+	assert_int_equal(json->array.count, 2);
+	assert_int_equal(json->array.data[0]->string.size, 26);
+	assert_memory_equal(json->array.data[0]->string.data, "abcdefghijklmnopqrstuvwxyz", 26);
+	assert_int_equal(json->array.data[1]->string.size, 24);
+	assert_memory_equal(json->array.data[1]->string.data, "abcdefghij\"klmnopq\xc3\xa9\xf0\x9f\x98\x80", 24);
+	json_free(json);
+
+	// Numbers and comments.
+	json = PARSE(" /* comment */ [-9223372036854775807, 0, 2.5e1, 1E2] /**/ ");
+	assert_non_null(json);
+	assert_int_equal(json->array.data[0]->integer, -9223372036854775807LL);
+	assert_int_equal(json->array.data[1]->integer, 0);
+	assert_true(json->array.data[2]->real == 25.0);
+	assert_true(json->array.data[3]->real == 100.0);
+	json_free(json);
+
+	assert_null(PARSE("{\"key\":1,\"key\":2}")); // duplicated key
+	assert_null(PARSE("[1,]"));
+	assert_null(PARSE("{\"key\":1,}"));
+	assert_null(PARSE("[01]"));
+	assert_null(PARSE("[\"\t\"]"));
+	assert_null(PARSE("[\"\\udc00\"]"));
+	assert_null(PARSE("[1] 2"));
+	assert_null(PARSE("1"));
+	assert_null(PARSE("[/* unterminated]"));
+
+	json = PARSE("[[[[[[[]]]]]]]");
+	assert_non_null(json);
+	json_free(json);
+	assert_null(PARSE("[[[[[[[[]]]]]]]]")); // too deep
+
+	#undef PARSE
+}
+
 static void test_json_dump(void **state)
 {
 	char canary[SIZE];
@@ -108,6 +151,62 @@ static void test_json_dump(void **state)
 	// TODO unicode
 }
 
+static void test_json_writer(void **state)
+{
+	static const char expected[] = "{\"entries\":[5,-6,19.4,\"a\\\"b\",null,true,{}],\"key\":[]}";
+	char result[sizeof(expected) + JSON_WRITER_BUFFER + 16];
+	char *large;
+	FILE *file;
+	struct json_writer writer;
+
+	file = tmpfile();
+	assert_non_null(file);
+
+	json_writer_init(&writer, fileno(file));
+	json_write_object_begin(&writer);
+	json_write_key(&writer, "entries", sizeof("entries") - 1);
+	json_write_array_begin(&writer);
+	json_write_integer(&writer, 5);
+	json_write_integer(&writer, -6);
+	json_write_real(&writer, 19.4);
+	json_write_string(&writer, "a\"b", 3);
+	json_write_null(&writer);
+	json_write_boolean(&writer, true);
+	json_write_object_begin(&writer);
+	json_write_object_end(&writer);
+	json_write_array_end(&writer);
+	json_write_key(&writer, "key", sizeof("key") - 1);
+	json_write_array_begin(&writer);
+	json_write_array_end(&writer);
+	json_write_object_end(&writer);
+	assert_int_equal(json_writer_flush(&writer), 0);
+
+	rewind(file);
+	assert_int_equal(fread(result, 1, sizeof(result), file), sizeof(expected) - 1);
+	assert_memory_equal(result, expected, sizeof(expected) - 1);
+
+	// A string larger than the buffer.
+	large = malloc(JSON_WRITER_BUFFER + 8);
+	assert_non_null(large);
+	memset(large, 'x', JSON_WRITER_BUFFER + 8);
+
+	rewind(file);
+	json_writer_init(&writer, fileno(file));
+	json_write_array_begin(&writer);
+	json_write_integer(&writer, 1);
+	json_write_string(&writer, large, JSON_WRITER_BUFFER + 8);
+	json_write_array_end(&writer);
+	assert_int_equal(json_writer_flush(&writer), 0);
+
+	rewind(file);
+	assert_int_equal(fread(result, 1, sizeof(result), file), 1 + 1 + 1 + 1 + JSON_WRITER_BUFFER + 8 + 1 + 1);
+	assert_memory_equal(result, "[1,\"x", 5);
+	assert_memory_equal(result + 4 + JSON_WRITER_BUFFER + 7, "x\"]", 3);
+
+	free(large);
+	fclose(file);
+}
+
 #undef OFFSET
 #undef SIZE
 
@@ -116,7 +215,9 @@ int main(void)
 	const struct CMUnitTest tests[] =
 	{
 		cmocka_unit_test(test_json_parse),
+		cmocka_unit_test(test_json_parse_scan),
 		cmocka_unit_test(test_json_dump),
+		cmocka_unit_test(test_json_writer),
 	};
 	return cmocka_run_group_tests(tests, 0, 0);
 }
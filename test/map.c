@@ -29,6 +29,10 @@ struct point
 {
 	int x, y;
 };
+struct bounds
+{
+	int left, right, top, bottom;
+};
 
 #include <game.h>
 #include <map.h>
@@ -47,6 +51,8 @@ static struct player players[] =
 	[ENEMY] = {.alliance = 2},
 };
 
+static unsigned short random_state[3];
+
 static void region_turn_process_empty(void **state)
 {
 	struct game game = {.players = players, .players_count = sizeof(players) / sizeof(*players)};
@@ -58,7 +64,7 @@ static void region_turn_process_empty(void **state)
 	region.troops = 0;
 	region.built = 0;
 
-	region_turn_process(&game, &region);
+	region_turn_process(&game, &region, random_state);
 	assert_int_equal(region.owner, 1);
 	assert_int_equal(region.garrison.owner, 1);
 	assert_int_equal(region.garrison.siege, 0);
@@ -79,7 +85,7 @@ static void region_turn_process_self(void **state)
 	region.troops = troops;
 	region.built = 0;
 
-	region_turn_process(&game, &region);
+	region_turn_process(&game, &region, random_state);
 	assert_int_equal(region.owner, SELF);
 	assert_int_equal(region.garrison.owner, SELF);
 	assert_int_equal(region.garrison.siege, 0);
@@ -100,7 +106,7 @@ static void region_turn_process_ally(void **state)
 	region.troops = troops;
 	region.built = 0;
 
-	region_turn_process(&game, &region);
+	region_turn_process(&game, &region, random_state);
 	assert_int_equal(region.owner, SELF);
 	assert_int_equal(region.garrison.owner, SELF);
 	assert_int_equal(region.garrison.siege, 0);
@@ -121,7 +127,7 @@ static void region_turn_process_enemy(void **state)
 	region.troops = troops;
 	region.built = 0;
 
-	region_turn_process(&game, &region);
+	region_turn_process(&game, &region, random_state);
 	assert_int_equal(region.owner, ENEMY);
 	assert_int_equal(region.garrison.owner, ENEMY);
 	assert_int_equal(region.garrison.siege, 0);
@@ -143,7 +149,7 @@ static void region_turn_process_liberate(void **state)
 	region.troops = troops;
 	region.built = (1 << BuildingPalisade);
 
-	region_turn_process(&game, &region);
+	region_turn_process(&game, &region, random_state);
 	assert_int_equal(region.owner, SELF);
 	assert_int_equal(region.garrison.owner, SELF);
 	assert_int_equal(region.garrison.siege, 0);
@@ -165,7 +171,7 @@ static void region_turn_process_siege(void **state)
 	region.troops = troops;
 	region.built = (1 << BuildingPalisade);
 
-	region_turn_process(&game, &region);
+	region_turn_process(&game, &region, random_state);
 	assert_int_equal(region.owner, ENEMY);
 	assert_int_equal(region.garrison.owner, SELF);
 	assert_int_equal(region.garrison.siege, 1);
@@ -189,7 +195,7 @@ static void region_turn_process_garrison_conquer(void **state)
 
 	expect_value(__wrap_free, ptr, region.troops);
 
-	region_turn_process(&game, &region);
+	region_turn_process(&game, &region, random_state);
 	assert_int_equal(region.owner, ENEMY);
 	assert_int_equal(region.garrison.owner, ENEMY);
 	assert_int_equal(region.garrison.siege, 0);
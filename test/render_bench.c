@@ -0,0 +1,317 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the cost of rendering a scripted sequence of map, battle, animation and report frames.
+// The frames are rendered by the same functions as in the game. OpenGL calls are counted by wrapper functions (see the Makefile).
+// Usage: render_bench world [frames]
+// For reproducible results, run on a virtual display with software rendering:
+// xvfb-run -s "-screen 0 1024x768x24" env LIBGL_ALWAYS_SOFTWARE=1 ./render_bench ../worlds/levidon
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glx.h>
+#include <GL/glext.h>
+
+#include <bitset.h>
+#include <game.h>
+#include <draw.h>
+#include <map.h>
+#include <world.h>
+#include <pathfinding.h>
+#include <movement.h>
+#include <battle.h>
+#include <combat.h>
+#include <interface.h>
+#include <display_common.h>
+#include <display_map.h>
+#include <display_battle.h>
+#include <display_report.h>
+#include <input_map.h>
+#include <input_battle.h>
+
+#define FRAMES_DEFAULT 200
+
+#define BATTLE_PAWNS 12 /* pawns for each side of the battle */
+
+struct gl_calls
+{
+	unsigned long draws; // glBegin() and glDraw*()
+	unsigned long vertices; // vertices specified in immediate mode
+	unsigned long states; // state changes (texture, buffer, capability, color and client array bindings)
+	unsigned long uploads; // texture and buffer data transfers
+};
+
+static struct gl_calls gl_calls;
+
+// Each wrapper counts the call and calls the real function.
+#define GL_WRAP(name, counter, parameters, arguments) \
+	void __real_##name parameters; \
+	void __wrap_##name parameters \
+	{ \
+		gl_calls.counter += 1; \
+		__real_##name arguments; \
+	}
+
+GL_WRAP(glBegin, draws, (GLenum mode), (mode))
+GL_WRAP(glDrawArrays, draws, (GLenum mode, GLint first, GLsizei count), (mode, first, count))
+GL_WRAP(glMultiDrawArrays, draws, (GLenum mode, const GLint *first, const GLsizei *count, GLsizei drawcount), (mode, first, count, drawcount))
+
+GL_WRAP(glVertex2f, vertices, (GLfloat x, GLfloat y), (x, y))
+GL_WRAP(glVertex2i, vertices, (GLint x, GLint y), (x, y))
+
+GL_WRAP(glBindTexture, states, (GLenum target, GLuint texture), (target, texture))
+GL_WRAP(glBindBuffer, states, (GLenum target, GLuint buffer), (target, buffer))
+GL_WRAP(glBindFramebufferEXT, states, (GLenum target, GLuint framebuffer), (target, framebuffer))
+GL_WRAP(glEnable, states, (GLenum capability), (capability))
+GL_WRAP(glDisable, states, (GLenum capability), (capability))
+GL_WRAP(glEnableClientState, states, (GLenum array), (array))
+GL_WRAP(glDisableClientState, states, (GLenum array), (array))
+GL_WRAP(glColor4ubv, states, (const GLubyte *color), (color))
+
+GL_WRAP(glTexImage2D, uploads, (GLenum target, GLint level, GLint format_internal, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *data), (target, level, format_internal, width, height, border, format, type, data))
+GL_WRAP(glBufferData, uploads, (GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage), (target, size, data, usage))
+GL_WRAP(glBufferSubData, uploads, (GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data), (target, offset, size, data))
+
+struct scene
+{
+	const char *name;
+	size_t frames;
+	double cpu, cpu_max; // CPU time of the rendering thread (ms)
+	double wall; // time until the frame is finished (ms)
+	struct gl_calls calls;
+};
+
+static double time_elapsed(const struct timespec *restrict start, clockid_t clock)
+{
+	struct timespec end;
+	clock_gettime(clock, &end);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void frame_start(struct timespec start[static 2])
+{
+	gl_calls = (struct gl_calls){0};
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+	clock_gettime(CLOCK_MONOTONIC, start + 1);
+}
+
+static void frame_end(struct scene *restrict scene, const struct timespec start[static 2])
+{
+	double cpu = time_elapsed(start, CLOCK_THREAD_CPUTIME_ID);
+
+	scene->wall += time_elapsed(start + 1, CLOCK_MONOTONIC);
+	scene->cpu += cpu;
+	if (cpu > scene->cpu_max)
+		scene->cpu_max = cpu;
+	scene->frames += 1;
+
+	scene->calls.draws += gl_calls.draws;
+	scene->calls.vertices += gl_calls.vertices;
+	scene->calls.states += gl_calls.states;
+	scene->calls.uploads += gl_calls.uploads;
+}
+
+static void scene_print(const struct scene *restrict scene)
+{
+	double frames = scene->frames;
+	printf("%-10s %8u %10.3f %10.3f %10.3f %10.1f %10.1f %10.1f %10.1f\n", scene->name, (unsigned)scene->frames,
+		scene->cpu / frames, scene->cpu_max, scene->wall / frames,
+		scene->calls.draws / frames, scene->calls.vertices / frames, scene->calls.states / frames, scene->calls.uploads / frames);
+}
+
+// Selects a different region on each frame.
+static void bench_map(const struct game *restrict game, unsigned char player, size_t frames, struct scene *restrict scene)
+{
+	struct state_map state = {.player = player, .region = REGION_NONE, .hover_object = HOVER_NONE};
+	struct timespec start[2];
+
+	state.regions_visible = bitset_alloc(game->regions_count);
+	if (!state.regions_visible) abort();
+	map_visible(game, player, state.regions_visible);
+
+	for(size_t frame = 0; frame < frames; ++frame)
+	{
+		state.region = ((frame % 2) ? (ssize_t)((frame / 2) % game->regions_count) : REGION_NONE);
+
+		frame_start(start);
+		input_display(if_map, game, &state);
+		frame_end(scene, start);
+	}
+
+	free(state.regions_visible);
+}
+
+// Places the pawns of each player in a block on its side of the battlefield.
+static void battle_formation(struct battle *restrict battle, unsigned char players[static 2])
+{
+	for(size_t side = 0; side < 2; ++side)
+	{
+		for(size_t i = 0; i < battle->players[players[side]].pawns_count; ++i)
+		{
+			struct pawn *restrict pawn = battle->players[players[side]].pawns[i];
+			pawn->position = (struct position){(side ? 18.5 : 4.5) + (i % 3), 6.5 + (i / 3) * 2};
+			battle_field(battle, (struct tile){pawn->position.x, pawn->position.y})->pawn = pawn;
+		}
+	}
+}
+
+// Selects a different pawn on each frame.
+static void bench_battle(const struct game *restrict game, struct battle *restrict battle, unsigned char player, size_t frames, struct scene *restrict scene)
+{
+	struct state_battle state = {.player = player};
+	struct timespec start[2];
+
+	// All the fields are reachable.
+	memset(state.reachable, 0, sizeof(state.reachable));
+
+	for(size_t frame = 0; frame < frames; ++frame)
+	{
+		state.pawn = battle->players[player].pawns[frame % battle->players[player].pawns_count];
+
+		frame_start(start);
+		input_display(if_battle, game, &state);
+		frame_end(scene, start);
+	}
+}
+
+// Moves all the pawns towards the opposite side of the battlefield.
+static void bench_animation(const struct game *restrict game, struct battle *restrict battle, size_t frames, struct scene *restrict scene)
+{
+	struct state_animation state = {.battle = battle};
+	struct timespec start[2];
+
+	state.movements = malloc(battle->pawns_count * sizeof(*state.movements));
+	if (!state.movements) abort();
+	for(size_t i = 0; i < battle->pawns_count; ++i)
+	{
+		struct position position = battle->pawns[i].position;
+		double direction = ((position.x < BATTLEFIELD_WIDTH / 2) ? 1 : -1);
+		for(size_t step = 0; step <= MOVEMENT_STEPS; ++step)
+			state.movements[i][step] = (struct position){position.x + direction * 6.0 * step / MOVEMENT_STEPS, position.y};
+	}
+	memset(state.traversed, 0, sizeof(state.traversed));
+
+	for(size_t frame = 0; frame < frames; ++frame)
+	{
+		// Keep progress below 1 so that the last step is always followed by another one.
+		double progress = (double)frame / frames;
+
+		frame_start(start);
+		input_display_timer(if_animation_move, game, progress, &state);
+		frame_end(scene, start);
+	}
+
+	free(state.movements);
+}
+
+static void bench_report(const struct game *restrict game, size_t frames, struct scene *restrict scene)
+{
+	struct timespec start[2];
+
+	for(size_t frame = 0; frame < frames; ++frame)
+	{
+		frame_start(start);
+		input_display(if_report_map, game, 0);
+		frame_end(scene, start);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct game game;
+	struct battle battle;
+	struct region *region;
+	unsigned char players[2];
+	size_t frames;
+
+	struct scene scenes[] = {
+		{.name = "map"},
+		{.name = "battle"},
+		{.name = "animation"},
+		{.name = "report"},
+	};
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s world [frames]\n", argv[0]);
+		return 1;
+	}
+	frames = ((argc > 2) ? strtoul(argv[2], 0, 10) : FRAMES_DEFAULT);
+
+	if (if_init() < 0)
+	{
+		fprintf(stderr, "Cannot initialize the display\n");
+		return 1;
+	}
+	if (if_load_images(0) < 0) return 1;
+	if_display();
+
+	if (world_load(argv[1], &game) < 0)
+	{
+		fprintf(stderr, "Cannot load world %s\n", argv[1]);
+		return 1;
+	}
+	if (game.players_count < 3)
+	{
+		fprintf(stderr, "The world must have at least 2 players besides the neutral player\n");
+		return 1;
+	}
+	if (if_regions_init(&game) < 0) return 1;
+	if (if_storage_init(&game, MAP_WIDTH, MAP_HEIGHT) < 0) return 1;
+
+	bench_map(&game, 1, frames, scenes + 0);
+
+	// Start an open battle between the first two players in the first region.
+	players[0] = 1;
+	players[1] = 2;
+	region = game.regions;
+	for(size_t side = 0; side < 2; ++side)
+		for(size_t i = 0; i < BATTLE_PAWNS; ++i)
+			if (troop_spawn(region, &region->troops, UNITS + i % UNITS_COUNT, 25, players[side]) < 0)
+				return 1;
+	if (battlefield_init(&game, &battle, region, BATTLE_OPEN) < 0) return 1;
+	battle_formation(&battle, players);
+	if_set(&battle);
+
+	bench_battle(&game, &battle, players[0], frames, scenes + 1);
+	bench_animation(&game, &battle, frames, scenes + 2);
+
+	if_battlefield_term();
+	battlefield_term(&game, &battle);
+
+	bench_report(&game, frames, scenes + 3);
+
+	printf("average per frame; cpu and wall time in ms\n");
+	printf("%-10s %8s %10s %10s %10s %10s %10s %10s %10s\n", "scene", "frames", "cpu", "cpu max", "wall", "draws", "vertices", "states", "uploads");
+	for(size_t i = 0; i < sizeof(scenes) / sizeof(*scenes); ++i)
+		scene_print(scenes + i);
+
+	if_storage_term();
+	if_regions_term();
+	world_unload(&game);
+	if_unload_images();
+	if_term();
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <game.h>
+#include <draw.h>
+#include <map.h>
+#include <snapshot.h>
+
+static struct player players[] =
+{
+	{.type = Neutral, .alliance = 0},
+	{.type = Local, .alliance = 1, .treasury = {.gold = 100}},
+	{.type = Computer, .alliance = 2, .treasury = {.gold = 50, .wood = 20}},
+};
+
+static void game_init(struct game *restrict game, struct region regions[static 2])
+{
+	game->players = players;
+	game->players_count = sizeof(players) / sizeof(*players);
+	game->regions = regions;
+	game->regions_count = 2;
+	game->turn = 3;
+
+	for(size_t i = 0; i < 2; ++i)
+	{
+		regions[i] = (struct region){.index = i, .owner = 1 + i, .construct = -1};
+		regions[i].garrison.owner = 1 + i;
+	}
+	regions[0].train[0] = UNITS + UnitArcher;
+	regions[1].built = (1 << BuildingPalisade);
+
+	troop_spawn(regions + 0, &regions[0].troops, UNITS + UnitPikeman, 20, 1);
+	troop_spawn(regions + 0, &regions[0].troops, UNITS + UnitArcher, 10, 1);
+	regions[0].troops->move = regions + 1;
+	troop_spawn(regions + 1, &regions[1].troops, UNITS + UnitMilitia, 5, 2);
+	regions[1].troops->location = regions[1].troops->move = LOCATION_GARRISON;
+}
+
+static void game_term(struct game *restrict game)
+{
+	for(size_t i = 0; i < game->regions_count; ++i)
+		while (game->regions[i].troops)
+			troop_remove(&game->regions[i].troops, game->regions[i].troops);
+}
+
+static void test_snapshot_state(void **state)
+{
+	struct region regions[2];
+	struct game game;
+	const struct snapshot *snapshot;
+
+	game_init(&game, regions);
+	snapshot = snapshot_create(&game);
+	assert_non_null(snapshot);
+
+	assert_int_equal(snapshot->turn, 3);
+	assert_int_equal(snapshot->players_count, 3);
+	assert_int_equal(snapshot->players[2].treasury.wood, 20);
+	assert_int_equal(snapshot->regions_count, 2);
+	assert_int_equal(snapshot->regions[0].train[0], UnitArcher);
+	assert_int_equal(snapshot->regions[0].train[1], SNAPSHOT_NONE);
+	assert_int_equal(snapshot->regions[1].built, (1 << BuildingPalisade));
+
+	assert_int_equal(snapshot->troops_count, 3);
+	assert_int_equal(snapshot->regions[0].troops_count, 2);
+	assert_int_equal(snapshot->troops[0].unit, UnitArcher);
+	assert_int_equal(snapshot->troops[0].location, 0);
+	assert_int_equal(snapshot->troops[0].move, 1);
+	assert_int_equal(snapshot->troops[1].count, 20);
+	assert_int_equal(snapshot->regions[1].troops_offset, 2);
+	assert_int_equal(snapshot->troops[2].location, SNAPSHOT_GARRISON);
+
+	snapshot_free(snapshot);
+	game_term(&game);
+}
+
+static void test_snapshot_restore(void **state)
+{
+	struct region regions[2];
+	struct game game;
+	const struct snapshot *snapshot;
+	const struct troop *troop;
+
+	game_init(&game, regions);
+	snapshot = snapshot_create(&game);
+	assert_non_null(snapshot);
+
+	// Modify the game after the snapshot is taken.
+	players[1].treasury.gold = 0;
+	regions[0].owner = 2;
+	regions[0].train[0] = 0;
+	troop_remove(&regions[0].troops, regions[0].troops);
+	troop_spawn(regions + 1, &regions[1].troops, UNITS + UnitLongbow, 7, 2);
+	game.turn = 4;
+
+	assert_int_equal(snapshot_restore(snapshot, &game), 0);
+	snapshot_free(snapshot);
+
+	assert_int_equal(game.turn, 3);
+	assert_int_equal(players[1].treasury.gold, 100);
+	assert_int_equal(regions[0].owner, 1);
+	assert_ptr_equal(regions[0].train[0], UNITS + UnitArcher);
+
+	troop = regions[0].troops;
+	assert_non_null(troop);
+	assert_ptr_equal(troop->unit, UNITS + UnitArcher);
+	assert_ptr_equal(troop->move, regions + 1);
+	assert_null(troop->_prev);
+	troop = troop->_next;
+	assert_non_null(troop);
+	assert_ptr_equal(troop->unit, UNITS + UnitPikeman);
+	assert_ptr_equal(troop->_prev, regions[0].troops);
+	assert_null(troop->_next);
+
+	troop = regions[1].troops;
+	assert_non_null(troop);
+	assert_ptr_equal(troop->unit, UNITS + UnitMilitia);
+	assert_ptr_equal(troop->location, LOCATION_GARRISON);
+	assert_null(troop->_next);
+
+	game_term(&game);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] =
+	{
+		cmocka_unit_test(test_snapshot_state),
+		cmocka_unit_test(test_snapshot_restore),
+	};
+	return cmocka_run_group_tests(tests, 0, 0);
+}
@@ -0,0 +1,354 @@
+/*
+ * Conquest of Levidon
+ * Copyright (C) 2016  Martin Kunev <martinkunev@gmail.com>
+ *
+ * This file is part of Conquest of Levidon.
+ *
+ * Conquest of Levidon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 3 of the License.
+ *
+ * Conquest of Levidon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conquest of Levidon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errors.h>
+#include <game.h>
+#include <draw.h>
+#include <map.h>
+#include <snapshot.h>
+#include <world.h>
+
+#define WORLD "../worlds/levidon"
+#define WORLD_BINARY "world_binary.tmp"
+#define WORLD_JSON "world_json.tmp"
+
+static void game_free(struct game *restrict game)
+{
+	for(size_t i = 0; i < game->regions_count; ++i)
+		while (game->regions[i].troops)
+			troop_remove(&game->regions[i].troops, game->regions[i].troops);
+	world_unload(game);
+}
+
+static void save_binary(const struct game *restrict game, const char *restrict filepath)
+{
+	const struct snapshot *snapshot = snapshot_create(game);
+	assert_non_null(snapshot);
+	assert_int_equal(world_save_binary(snapshot, filepath), 0);
+	snapshot_free(snapshot);
+}
+
+static unsigned char *file_read(const char *restrict filepath, size_t *restrict size)
+{
+	FILE *file = fopen(filepath, "rb");
+	unsigned char *buffer;
+
+	assert_non_null(file);
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	buffer = malloc(*size);
+	assert_non_null(buffer);
+	assert_int_equal(fread(buffer, 1, *size, file), *size);
+	fclose(file);
+
+	return buffer;
+}
+
+static void test_binary_state(void **state)
+{
+	struct game game, loaded;
+	size_t i, j;
+
+	assert_int_equal(world_load(WORLD, &game), 0);
+	save_binary(&game, WORLD_BINARY);
+	assert_int_equal(world_load(WORLD_BINARY, &loaded), 0);
+	unlink(WORLD_BINARY);
+
+	assert_int_equal(loaded.players_count, game.players_count);
+	for(i = 0; i < game.players_count; ++i)
+	{
+		assert_int_equal(loaded.players[i].type, game.players[i].type);
+		assert_int_equal(loaded.players[i].alliance, game.players[i].alliance);
+		assert_memory_equal(&loaded.players[i].treasury, &game.players[i].treasury, sizeof(struct resources));
+		assert_int_equal(loaded.players[i].name_length, game.players[i].name_length);
+		assert_memory_equal(loaded.players[i].name, game.players[i].name, game.players[i].name_length);
+	}
+
+	assert_int_equal(loaded.regions_count, game.regions_count);
+	for(i = 0; i < game.regions_count; ++i)
+	{
+		const struct region *a = game.regions + i, *b = loaded.regions + i;
+		const struct troop *ta, *tb;
+
+		assert_int_equal(b->name_length, a->name_length);
+		assert_memory_equal(b->name, a->name, a->name_length);
+		assert_int_equal(region_neighbors_end(&loaded, b) - region_neighbors_begin(&loaded, b), region_neighbors_end(&game, a) - region_neighbors_begin(&game, a));
+		for(j = region_neighbors_begin(&game, a); j < region_neighbors_end(&game, a); ++j)
+			assert_int_equal(region_neighbor_direction(&loaded, b, loaded.regions + game.neighbors[j]), game.neighbors_directions[j]);
+		assert_int_equal(b->location->vertices_count, a->location->vertices_count);
+		assert_memory_equal(b->location->points, a->location->points, a->location->vertices_count * sizeof(struct point));
+		assert_int_equal(b->owner, a->owner);
+		assert_int_equal(b->garrison.owner, a->garrison.owner);
+		assert_int_equal(b->built, a->built);
+		assert_int_equal(b->population, a->population);
+		assert_int_equal(b->construct, a->construct);
+		for(j = 0; j < TRAIN_QUEUE; ++j)
+			assert_ptr_equal(b->train[j], a->train[j]);
+
+		for(ta = a->troops, tb = b->troops; ta && tb; ta = ta->_next, tb = tb->_next)
+		{
+			assert_ptr_equal(tb->unit, ta->unit);
+			assert_int_equal(tb->count, ta->count);
+			assert_int_equal(tb->owner, ta->owner);
+			assert_int_equal(tb->location ? tb->location->index : -1, ta->location ? ta->location->index : -1);
+		}
+		assert_null(ta);
+		assert_null(tb);
+	}
+
+	game_free(&loaded);
+	game_free(&game);
+}
+
+static void test_binary_json(void **state)
+{
+	struct game game;
+	unsigned char *json, *json_binary;
+	size_t json_size, json_binary_size;
+
+	// Convert the world to JSON directly and through the binary format.
+	assert_int_equal(world_load(WORLD, &game), 0);
+	assert_int_equal(world_save(&game, WORLD_JSON), 0);
+	save_binary(&game, WORLD_BINARY);
+	game_free(&game);
+	json = file_read(WORLD_JSON, &json_size);
+
+	assert_int_equal(world_load(WORLD_BINARY, &game), 0);
+	unlink(WORLD_BINARY);
+	assert_int_equal(world_save(&game, WORLD_JSON), 0);
+	game_free(&game);
+	json_binary = file_read(WORLD_JSON, &json_binary_size);
+
+	assert_int_equal(json_binary_size, json_size);
+	assert_memory_equal(json_binary, json, json_size);
+	free(json_binary);
+
+	// Make sure the saved JSON can be loaded.
+	assert_int_equal(world_load(WORLD_JSON, &game), 0);
+	unlink(WORLD_JSON);
+	game_free(&game);
+
+	free(json);
+}
+
+static void test_binary_invalid(void **state)
+{
+	struct game game;
+	unsigned char *buffer;
+	size_t size;
+	FILE *file;
+
+	assert_int_equal(world_load(WORLD, &game), 0);
+	save_binary(&game, WORLD_BINARY);
+	game_free(&game);
+	buffer = file_read(WORLD_BINARY, &size);
+
+	// Truncated file.
+	file = fopen(WORLD_BINARY, "wb");
+	assert_non_null(file);
+	fwrite(buffer, 1, size - 1, file);
+	fclose(file);
+	assert_int_equal(world_load(WORLD_BINARY, &game), ERROR_INPUT);
+
+	unlink(WORLD_BINARY);
+	free(buffer);
+}
+
+static void file_write(const char *restrict filepath, const char *restrict data)
+{
+	FILE *file = fopen(filepath, "wb");
+	assert_non_null(file);
+	assert_int_equal(fwrite(data, 1, strlen(data), file), strlen(data));
+	fclose(file);
+}
+
+#define PLAYERS "\"players\":[{\"name\":\"Neutral\",\"alliance\":0,\"gold\":0,\"food\":0,\"wood\":0,\"iron\":0,\"stone\":0},{\"name\":\"Player\",\"alliance\":1,\"gold\":100,\"food\":20,\"wood\":30,\"iron\":0,\"stone\":5}]"
+#define LOCATION "\"location\":[[0,0],[10,0],[0,10]],\"location_garrison\":[1,1],\"center\":[2,2]"
+
+static void test_json_stream(void **state)
+{
+	struct game game;
+
+	// Neighbors may refer to regions which follow. Unknown fields are ignored.
+	file_write(WORLD_JSON, "{\"version\":[1,{\"a\":[]}]," PLAYERS ",\"regions\":{"
+		"\"a\":{\"neighbors\":[\"b\",null,null,null,null,null,null,null]," LOCATION ",\"owner\":1,\"population\":100,\"troops\":[[\"Peasant\",25,1]],\"garrison\":{\"troops\":[[\"Archer\",10,1]],\"siege\":1},\"unused\":{\"x\":[1,2]}},"
+		"\"b\":{\"owner\":0,\"population\":50,\"workers\":{\"food\":10,\"wood\":20,\"iron\":30,\"stone\":40},\"neighbors\":[null,null,null,null,\"a\",null,null,null]," LOCATION "}"
+		"}}");
+	assert_int_equal(world_load(WORLD_JSON, &game), 0);
+
+	assert_int_equal(game.players_count, 2);
+	assert_int_equal(game.players[0].type, Neutral);
+	assert_int_equal(game.players[1].type, Local);
+	assert_int_equal(game.players[1].treasury.gold, 100);
+
+	assert_int_equal(game.regions_count, 2);
+	assert_int_equal(region_neighbor_direction(&game, game.regions + 0, game.regions + 1), 0);
+	assert_int_equal(region_neighbor_direction(&game, game.regions + 1, game.regions + 0), 4);
+	assert_int_equal(region_neighbors_end(&game, game.regions + 1) - region_neighbors_begin(&game, game.regions + 1), 1);
+	assert_int_equal(game.regions[0].garrison.owner, 1);
+	assert_int_equal(game.regions[0].garrison.siege, 1);
+	assert_int_equal(game.regions[0].workers.food, 40);
+	assert_int_equal(game.regions[0].construct, -1);
+	assert_int_equal(game.regions[1].workers.stone, 40);
+	assert_int_equal(game.regions[0].location->vertices_count, 3);
+	assert_int_equal(game.regions[0].center.x, 2);
+
+	// The troops in the region precede the troops in the garrison.
+	assert_non_null(game.regions[0].troops);
+	assert_ptr_equal(game.regions[0].troops->location, game.regions + 0);
+	assert_int_equal(game.regions[0].troops->count, 25);
+	assert_non_null(game.regions[0].troops->_next);
+	assert_null(game.regions[0].troops->_next->location);
+	assert_null(game.regions[0].troops->_next->_next);
+	assert_null(game.regions[1].troops);
+
+	game_free(&game);
+
+	// More than one neighbor in the same direction. The position in the array determines the direction.
+	file_write(WORLD_JSON, "{" PLAYERS ",\"regions\":{"
+		"\"a\":{\"neighbors\":[\"c\",[\"b\",\"d\"],null,null,null,null,null,null]," LOCATION ",\"owner\":1,\"population\":100},"
+		"\"b\":{\"neighbors\":[\"a\"]," LOCATION ",\"owner\":1,\"population\":100},"
+		"\"c\":{\"neighbors\":[]," LOCATION ",\"owner\":1,\"population\":100},"
+		"\"d\":{\"neighbors\":[]," LOCATION ",\"owner\":1,\"population\":100}"
+		"}}");
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		assert_int_equal(world_load(WORLD_JSON, &game), 0);
+		assert_int_equal(region_neighbors_end(&game, game.regions + 0) - region_neighbors_begin(&game, game.regions + 0), 3);
+		assert_int_equal(region_neighbor_direction(&game, game.regions + 0, game.regions + 1), 1);
+		assert_int_equal(region_neighbor_direction(&game, game.regions + 0, game.regions + 2), 0);
+		assert_int_equal(region_neighbor_direction(&game, game.regions + 0, game.regions + 3), 1);
+		assert_int_equal(region_neighbor_direction(&game, game.regions + 2, game.regions + 0), -1);
+
+		// Make sure the neighbors are preserved when saving.
+		assert_int_equal(world_save(&game, WORLD_JSON), 0);
+		game_free(&game);
+	}
+
+	// More positions than directions.
+	file_write(WORLD_JSON, "{" PLAYERS ",\"regions\":{"
+		"\"a\":{\"neighbors\":[null,\"b\",null,null,null,null,null,null,\"b\"]," LOCATION ",\"owner\":1,\"population\":100},"
+		"\"b\":{\"neighbors\":[null,null,null,null,null,\"a\",null,null]," LOCATION ",\"owner\":1,\"population\":100}"
+		"}}");
+	assert_int_equal(world_load(WORLD_JSON, &game), ERROR_INPUT);
+
+	// Neighbor which does not exist.
+	file_write(WORLD_JSON, "{" PLAYERS ",\"regions\":{\"a\":{\"neighbors\":[\"c\",null,null,null,null,null,null,null]," LOCATION ",\"owner\":1,\"population\":100}}}");
+	assert_int_equal(world_load(WORLD_JSON, &game), ERROR_INPUT);
+
+	// Troop owner which does not exist.
+	file_write(WORLD_JSON, "{\"regions\":{\"a\":{\"neighbors\":[null,null,null,null,null,null,null,null]," LOCATION ",\"owner\":1,\"population\":100,\"troops\":[[\"Peasant\",25,2]]}}," PLAYERS "}");
+	assert_int_equal(world_load(WORLD_JSON, &game), ERROR_INPUT);
+
+	// Missing field.
+	file_write(WORLD_JSON, "{" PLAYERS ",\"regions\":{\"a\":{\"neighbors\":[null,null,null,null,null,null,null,null]," LOCATION ",\"owner\":1}}}");
+	assert_int_equal(world_load(WORLD_JSON, &game), ERROR_INPUT);
+
+	unlink(WORLD_JSON);
+}
+
+static void test_regions_grid(void **state)
+{
+	struct game game;
+	struct regions_grid grid;
+
+	assert_int_equal(world_load(WORLD, &game), 0);
+	assert_int_equal(regions_grid_init(&grid, &game), 0);
+
+	for(size_t i = 0; i < game.regions_count; ++i)
+		assert_int_equal(regions_grid_find(&grid, &game, game.regions[i].center.x, game.regions[i].center.y), i);
+	assert_int_equal(regions_grid_find(&grid, &game, -1, -1), -1);
+	assert_int_equal(regions_grid_find(&grid, &game, 1000000, 1000000), -1);
+
+	regions_grid_term(&grid);
+	game_free(&game);
+}
+
+static void test_regions_grid_query(void **state)
+{
+	struct game game;
+	struct regions_grid grid;
+	uint32_t *result;
+	size_t count;
+
+	const struct bounds views[] = {
+		{0, 383, 0, 383},
+		{200, 599, 300, 499},
+		{-1000, 1000000, -1000, 1000000},
+		{-100, -1, -100, -1},
+		{100, 100, 100, 100},
+	};
+
+	assert_int_equal(world_load(WORLD, &game), 0);
+	assert_int_equal(regions_grid_init(&grid, &game), 0);
+	result = malloc(game.regions_count * sizeof(*result));
+	assert_non_null(result);
+
+	// The result must consist of the regions whose bounding box intersects the view, in increasing order.
+	for(size_t v = 0; v < sizeof(views) / sizeof(*views); ++v)
+	{
+		const struct bounds *restrict view = views + v;
+		size_t expected = 0;
+
+		count = regions_grid_query(&grid, *view, result);
+		for(size_t i = 0; i < game.regions_count; ++i)
+		{
+			const struct bounds *restrict bounds = grid.bounds + i;
+			if ((bounds->right < view->left) || (bounds->left > view->right) || (bounds->bottom < view->top) || (bounds->top > view->bottom))
+				continue;
+			assert_true(expected < count);
+			assert_int_equal(result[expected], i);
+			expected += 1;
+		}
+		assert_int_equal(count, expected);
+	}
+
+	// The view covering the whole world contains all regions.
+	assert_int_equal(regions_grid_query(&grid, views[2], result), game.regions_count);
+
+	free(result);
+	regions_grid_term(&grid);
+	game_free(&game);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] =
+	{
+		cmocka_unit_test(test_binary_state),
+		cmocka_unit_test(test_binary_json),
+		cmocka_unit_test(test_binary_invalid),
+		cmocka_unit_test(test_json_stream),
+		cmocka_unit_test(test_regions_grid),
+		cmocka_unit_test(test_regions_grid_query),
+	};
+	return cmocka_run_group_tests(tests, 0, 0);
+}